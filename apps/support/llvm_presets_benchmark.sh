@@ -0,0 +1,77 @@
+#!/bin/bash
+#
+# Compares how long each app takes to build against how fast it runs,
+# for each of the LLVM optimization presets.
+#
+# Usage: llvm_presets_benchmark.sh [app ...]
+#
+# Apps default to a set that build on any host. Set PRESETS to a
+# space-separated list of targets to compare something else, and
+# HALIDE_DISTRIB_PATH as for building the apps. Set RESULTS to a file
+# name to also append the results there as a Markdown table, in the
+# form recorded in llvm_presets_benchmark.md.
+#
+# Build time covers running the app's Generators and linking the app,
+# but not compiling the Generators themselves, which is done once up
+# front. Runtimes are the times the app reports when run by 'make
+# test'.
+
+set -eu
+
+APPS_DIR=$(cd "$(dirname "$0")/.." && pwd)
+
+if [ $# -gt 0 ]; then
+    APPS="$*"
+else
+    APPS="bilateral_grid camera_pipe harris iir_blur interpolate lens_blur local_laplacian max_filter nl_means stencil_chain unsharp"
+fi
+
+PRESETS=${PRESETS:-"host host-llvm_o2 host-llvm_o1 host-fast_compile"}
+
+BIN=bin_llvm_presets
+TIMEFORMAT=%R
+RESULTS=${RESULTS:-}
+
+if [ -n "${RESULTS}" ]; then
+    RESULTS=$(cd "$(dirname "${RESULTS}")" && pwd)/$(basename "${RESULTS}")
+    LLVM=$( (llvm-config --version || echo unknown) 2> /dev/null)
+    {
+        echo
+        echo "### $(date +%Y-%m-%d), $(uname -sm), $(getconf _NPROCESSORS_ONLN) cores, LLVM ${LLVM}"
+        echo
+        echo "| app | target | build (s) | runtime |"
+        echo "|-----|--------|----------:|---------|"
+    } >> "${RESULTS}"
+fi
+
+printf "%-18s %-22s %12s  %s\n" "app" "target" "build (s)" "runtime"
+
+for APP in ${APPS}; do
+    cd "${APPS_DIR}/${APP}"
+    rm -rf ${BIN}
+
+    # Build the Generators once, so that the timed builds below only
+    # run them.
+    FIRST_PRESET=${PRESETS%% *}
+    if ! make BIN=${BIN} GENERATOR_BIN=${BIN}/generators HL_TARGET=${FIRST_PRESET} build > /dev/null 2>&1; then
+        echo "${APP}: build failed, skipping"
+        continue
+    fi
+
+    for PRESET in ${PRESETS}; do
+        rm -rf ${BIN}/${PRESET}
+        BUILD_TIME=$( { time make BIN=${BIN} GENERATOR_BIN=${BIN}/generators HL_TARGET=${PRESET} build > /dev/null 2>&1; } 2>&1 ) || BUILD_TIME=failed
+        if [ "${BUILD_TIME}" = "failed" ]; then
+            RUNTIME="-"
+        else
+            RUNTIME=$(make BIN=${BIN} GENERATOR_BIN=${BIN}/generators HL_TARGET=${PRESET} test 2>&1 |
+                      grep -iE "time:|^halide \(" | tr "\t" " " | paste -s -d ';' - || true)
+        fi
+        printf "%-18s %-22s %12s  %s\n" "${APP}" "${PRESET}" "${BUILD_TIME}" "${RUNTIME}"
+        if [ -n "${RESULTS}" ]; then
+            echo "| ${APP} | ${PRESET} | ${BUILD_TIME} | ${RUNTIME//|/\\|} |" >> "${RESULTS}"
+        fi
+    done
+
+    rm -rf ${BIN}
+done
@@ -143,6 +143,10 @@ void define_enums(py::module &m) {
         .value("SVE", Target::Feature::SVE)
         .value("SVE2", Target::Feature::SVE2)
         .value("ARMDotProd", Target::Feature::ARMDotProd)
+        .value("ProfileLoops", Target::Feature::ProfileLoops)
+        .value("LLVMO1", Target::Feature::LLVMO1)
+        .value("LLVMO2", Target::Feature::LLVMO2)
+        .value("FastCompile", Target::Feature::FastCompile)
         .value("FeatureEnd", Target::Feature::FeatureEnd);
 
     py::enum_<halide_type_code_t>(m, "TypeCode")
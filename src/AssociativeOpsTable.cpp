@@ -1,6 +1,8 @@
 #include "AssociativeOpsTable.h"
 #include "IRPrinter.h"
 
+#include <mutex>
+
 namespace Halide {
 namespace Internal {
 
@@ -283,6 +285,13 @@ const vector<AssociativePattern> &get_ops_table_helper(const vector<Type> &types
     TableKey gen_key(ValType::All, root, dim);
     TableKey key(convert_halide_types_to_val_types(types), root, dim);
 
+    // Pipelines may be lowered concurrently (see
+    // Pipeline::compile_jit_async), so guard the lazily populated
+    // tables. Entries are never removed, so references to them stay
+    // valid after the lock is released.
+    static std::mutex pattern_tables_lock;
+    std::lock_guard<std::mutex> lock_guard(pattern_tables_lock);
+
     const auto &table_it = pattern_tables.find(key);
     if (table_it == pattern_tables.end()) {  // Populate the table if we haven't done so previously
         vector<AssociativePattern> &table = pattern_tables[key];
@@ -633,6 +633,17 @@ void clone_target_options(const llvm::Module &from, llvm::Module &to) {
     if (get_md_bool(from.getModuleFlag("halide_use_pic"), use_pic)) {
         to.addModuleFlag(llvm::Module::Warning, "halide_use_pic", use_pic ? 1 : 0);
     }
+
+    bool fast_compile = false;
+    if (get_md_bool(from.getModuleFlag("halide_fast_compile"), fast_compile)) {
+        to.addModuleFlag(llvm::Module::Warning, "halide_fast_compile", fast_compile ? 1 : 0);
+    }
+}
+
+int get_codegen_opt_level(const llvm::Module &module) {
+    bool fast_compile = false;
+    get_md_bool(module.getModuleFlag("halide_fast_compile"), fast_compile);
+    return fast_compile ? llvm::CodeGenOpt::Less : llvm::CodeGenOpt::Aggressive;
 }
 
 std::unique_ptr<llvm::TargetMachine> make_target_machine(const llvm::Module &module) {
@@ -663,7 +674,7 @@ std::unique_ptr<llvm::TargetMachine> make_target_machine(const llvm::Module &mod
 #else
                                                 llvm::CodeModel::Small,
 #endif
-                                                llvm::CodeGenOpt::Aggressive);
+                                                (llvm::CodeGenOpt::Level)get_codegen_opt_level(module));
     return std::unique_ptr<llvm::TargetMachine>(tm);
 }
 
@@ -115,6 +115,10 @@ void get_target_options(const llvm::Module &module, llvm::TargetOptions &options
 /** Given two llvm::Modules, clone target options from one to the other */
 void clone_target_options(const llvm::Module &from, llvm::Module &to);
 
+/** Given an llvm::Module, get the optimization level for LLVM's
+ * backend, as an llvm::CodeGenOpt::Level */
+int get_codegen_opt_level(const llvm::Module &module);
+
 /** Given an llvm::Module, get or create an llvm:TargetMachine */
 std::unique_ptr<llvm::TargetMachine> make_target_machine(const llvm::Module &module);
 
@@ -599,6 +599,7 @@ void CodeGen_LLVM::init_codegen(const std::string &name, bool any_strict_float)
     module->addModuleFlag(llvm::Module::Warning, "halide_mattrs", MDString::get(*context, mattrs()));
     module->addModuleFlag(llvm::Module::Warning, "halide_use_pic", use_pic() ? 1 : 0);
     module->addModuleFlag(llvm::Module::Warning, "halide_per_instruction_fast_math_flags", any_strict_float);
+    module->addModuleFlag(llvm::Module::Warning, "halide_fast_compile", target.has_feature(Target::FastCompile) ? 1 : 0);
 
     // Ensure some types we need are defined
     halide_buffer_t_type = module->getTypeByName("struct.halide_buffer_t");
@@ -1227,13 +1228,16 @@ void CodeGen_LLVM::optimize_module() {
     // See https://github.com/halide/Halide/issues/4113 for more info.
     // (Note that setting EnableLLVMLoopOpt always enables loop opt, regardless
     // of the setting of DisableLLVMLoopOpt.)
-    const bool do_loop_opt = !get_target().has_feature(Target::DisableLLVMLoopOpt) ||
+    // FastCompile also turns loop opt off: Halide schedules have usually
+    // vectorized and unrolled everything that matters already.
+    const bool fast_compile = get_target().has_feature(Target::FastCompile);
+    const bool do_loop_opt = !(get_target().has_feature(Target::DisableLLVMLoopOpt) || fast_compile) ||
                              get_target().has_feature(Target::EnableLLVMLoopOpt);
 
     PipelineTuningOptions pto;
     pto.LoopInterleaving = do_loop_opt;
     pto.LoopVectorization = do_loop_opt;
-    pto.SLPVectorization = true;  // Note: SLP vectorization has no analogue in the Halide scheduling model
+    pto.SLPVectorization = !fast_compile;  // Note: SLP vectorization has no analogue in the Halide scheduling model
     pto.LoopUnrolling = do_loop_opt;
     // Clear ScEv info for all loops. Certain Halide applications spend a very
     // long time compiling in forgetLoop, and prefer to forget everything
@@ -1262,7 +1266,21 @@ void CodeGen_LLVM::optimize_module() {
     pb.crossRegisterProxies(lam, fam, cgam, mam);
     ModulePassManager mpm(debug_pass_manager);
 
+    // Lower optimization levels trade the speed of the generated code
+    // for the speed of compilation, e.g. for JIT-heavy workloads.
+    // FastCompile also lowers the backend's optimization level (see
+    // get_codegen_opt_level).
+    user_assert(!get_target().has_feature(Target::LLVMO2) ||
+                !(fast_compile || get_target().has_feature(Target::LLVMO1)))
+        << "Target " << get_target() << " asks for more than one LLVM optimization level. "
+        << "Use at most one of llvm_o1, llvm_o2 and fast_compile, "
+        << "except that llvm_o1 may be combined with fast_compile.\n";
     PassBuilder::OptimizationLevel level = PassBuilder::OptimizationLevel::O3;
+    if (fast_compile || get_target().has_feature(Target::LLVMO1)) {
+        level = PassBuilder::OptimizationLevel::O1;
+    } else if (get_target().has_feature(Target::LLVMO2)) {
+        level = PassBuilder::OptimizationLevel::O2;
+    }
 
     if (get_target().has_feature(Target::ASAN)) {
         pb.registerPipelineStartEPCallback([&](ModulePassManager &mpm) {
@@ -1335,7 +1353,17 @@ void CodeGen_LLVM::optimize_module() {
         }
     }
 
-    mpm = pb.buildPerModuleDefaultPipeline(level, debug_pass_manager);
+    // HL_LLVM_PASSES replaces the whole pipeline, using the syntax of
+    // opt's -passes flag, e.g. "default<O2>" or
+    // "function(sroa,instcombine,simplifycfg)". The sanitizer passes
+    // registered above are only added by the default<...> pipelines.
+    std::string custom_passes = get_env_variable("HL_LLVM_PASSES");
+    if (custom_passes.empty()) {
+        mpm = pb.buildPerModuleDefaultPipeline(level, debug_pass_manager);
+    } else if (llvm::Error err = pb.parsePassPipeline(mpm, custom_passes)) {
+        user_error << "Could not parse HL_LLVM_PASSES=\"" << custom_passes << "\": "
+                   << llvm::toString(std::move(err)) << "\n";
+    }
     mpm.run(*module, mam);
 
     if (llvm::verifyModule(*module, &errs()))
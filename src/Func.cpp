@@ -2575,12 +2575,24 @@ Func &Func::trace_loads() {
     return *this;
 }
 
+Func &Func::trace_loads(const TraceFilter &filter) {
+    invalidate_cache();
+    func.trace_loads(filter);
+    return *this;
+}
+
 Func &Func::trace_stores() {
     invalidate_cache();
     func.trace_stores();
     return *this;
 }
 
+Func &Func::trace_stores(const TraceFilter &filter) {
+    invalidate_cache();
+    func.trace_stores(filter);
+    return *this;
+}
+
 Func &Func::trace_realizations() {
     invalidate_cache();
     func.trace_realizations();
@@ -3196,4 +3208,12 @@ void Func::compile_jit(const Target &target) {
     pipeline().compile_jit(target);
 }
 
+Callable Func::compile_to_callable(const std::vector<Argument> &args, const Target &target) {
+    return pipeline().compile_to_callable(args, target);
+}
+
+std::shared_future<void> Func::compile_jit_async(const Target &target) {
+    return pipeline().compile_jit_async(target);
+}
+
 }  // namespace Halide
@@ -973,6 +973,16 @@ public:
      */
     void compile_jit(const Target &target = get_jit_target_from_environment());
 
+    /** Jit compile the function, and return a Callable for calling it
+     * repeatedly with the given arguments. See
+     * Pipeline::compile_to_callable. */
+    Callable compile_to_callable(const std::vector<Argument> &args,
+                                 const Target &target = get_jit_target_from_environment());
+
+    /** Start jit compiling the function on a background thread. See
+     * Pipeline::compile_jit_async. */
+    std::shared_future<void> compile_jit_async(const Target &target = get_jit_target_from_environment());
+
     /** Set the error handler function that be called in the case of
      * runtime errors during halide pipelines. If you are compiling
      * statically, you can also just define your own function with
@@ -2344,11 +2354,29 @@ public:
      * effect. */
     Func &trace_loads();
 
+    /** Trace the loads from this Func that pass the filter. Loads
+     * that don't are not traced, at the cost of evaluating the
+     * filter. */
+    Func &trace_loads(const TraceFilter &filter);
+
     /** Trace all stores to the buffer backing this Func by emitting
      * calls to halide_trace. If the Func is inlined, this call
      * has no effect. */
     Func &trace_stores();
 
+    /** Trace the stores to this Func that pass the filter. Stores
+     * that don't are not traced, at the cost of evaluating the
+     * filter. For example, to trace one in every hundred stores to
+     * the top-left 64x64 corner of f:
+     \code
+     TraceFilter filter;
+     filter.sample_rate = 100;
+     filter.region = {{0, 64}, {0, 64}};
+     f.trace_stores(filter);
+     \endcode
+     */
+    Func &trace_stores(const TraceFilter &filter);
+
     /** Trace all realizations of this Func by emitting calls to
      * halide_trace. */
     Func &trace_realizations();
@@ -90,6 +90,7 @@ struct FunctionContents {
     Expr extern_proxy_expr;
 
     bool trace_loads = false, trace_stores = false, trace_realizations = false;
+    TraceFilter load_trace_filter, store_trace_filter;
     std::vector<string> trace_tags;
 
     bool frozen = false;
@@ -119,6 +120,13 @@ struct FunctionContents {
             }
         }
 
+        for (const TraceFilter *filter : {&load_trace_filter, &store_trace_filter}) {
+            for (const Range &r : filter->region) {
+                r.min.accept(visitor);
+                r.extent.accept(visitor);
+            }
+        }
+
         for (Parameter i : output_buffers) {
             for (size_t j = 0; j < args.size(); j++) {
                 if (i.min_constraint(j).defined()) {
@@ -153,6 +161,13 @@ struct FunctionContents {
             }
             extern_proxy_expr = mutator->mutate(extern_proxy_expr);
         }
+
+        for (TraceFilter *filter : {&load_trace_filter, &store_trace_filter}) {
+            for (Range &r : filter->region) {
+                r.min = mutator->mutate(r.min);
+                r.extent = mutator->mutate(r.extent);
+            }
+        }
     }
 };
 
@@ -347,6 +362,8 @@ void Function::deep_copy(const FunctionPtr &copy, DeepCopyMap &copied_map) const
     copy->trace_loads = contents->trace_loads;
     copy->trace_stores = contents->trace_stores;
     copy->trace_realizations = contents->trace_realizations;
+    copy->load_trace_filter = contents->load_trace_filter;
+    copy->store_trace_filter = contents->store_trace_filter;
     copy->trace_tags = contents->trace_tags;
     copy->frozen = contents->frozen;
     copy->output_buffers = contents->output_buffers;
@@ -906,11 +923,13 @@ Function::operator ExternFuncArgument() const {
     return ExternFuncArgument(contents);
 }
 
-void Function::trace_loads() {
+void Function::trace_loads(const TraceFilter &filter) {
     contents->trace_loads = true;
+    contents->load_trace_filter = filter;
 }
-void Function::trace_stores() {
+void Function::trace_stores(const TraceFilter &filter) {
     contents->trace_stores = true;
+    contents->store_trace_filter = filter;
 }
 void Function::trace_realizations() {
     contents->trace_realizations = true;
@@ -928,6 +947,12 @@ bool Function::is_tracing_stores() const {
 bool Function::is_tracing_realizations() const {
     return contents->trace_realizations;
 }
+const TraceFilter &Function::load_trace_filter() const {
+    return contents->load_trace_filter;
+}
+const TraceFilter &Function::store_trace_filter() const {
+    return contents->store_trace_filter;
+}
 const std::vector<std::string> &Function::get_trace_tags() const {
     return contents->trace_tags;
 }
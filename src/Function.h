@@ -27,6 +27,38 @@ enum class NameMangling {
     CPlusPlus,  ///< C++ name mangling
 };
 
+/** Selects a subset of the loads from or stores to a Func to trace,
+ * so that pipelines can be traced at sizes where tracing every access
+ * would be too slow or produce too much output. Events that don't
+ * pass the filter are skipped by the generated code, without calling
+ * into the runtime. See Func::trace_loads and Func::trace_stores. */
+struct TraceFilter {
+    /** Trace about one in every sample_rate events. Which events are
+     * traced is decided by a hash of their coordinates, so the same
+     * ones are traced on every run and regardless of which thread
+     * does the access. A vectorized load or store is a single event,
+     * traced if any of its lanes is selected. */
+    int sample_rate = 1;
+
+    /** Trace only events with coordinates inside this box, given as
+     * a (min, extent) per dimension of the Func. A vectorized event
+     * is traced if any of its lanes is inside. Empty means no
+     * restriction. */
+    Region region;
+
+    /** Trace only the events in the first max_realizations
+     * realizations of the Func in each run of the pipeline. Zero
+     * means no restriction. Realizations inside parallel loops are
+     * counted without synchronization, so this is approximate
+     * there. */
+    int max_realizations = 0;
+
+    /** Check if this filter passes every event. */
+    bool passes_all() const {
+        return sample_rate <= 1 && region.empty() && max_realizations <= 0;
+    }
+};
+
 namespace Internal {
 
 struct Call;
@@ -237,13 +269,15 @@ public:
     /** Tracing calls and accessors, passed down from the Func
      * equivalents. */
     // @{
-    void trace_loads();
-    void trace_stores();
+    void trace_loads(const TraceFilter &filter = TraceFilter());
+    void trace_stores(const TraceFilter &filter = TraceFilter());
     void trace_realizations();
     void add_trace_tag(const std::string &trace_tag);
     bool is_tracing_loads() const;
     bool is_tracing_stores() const;
     bool is_tracing_realizations() const;
+    const TraceFilter &load_trace_filter() const;
+    const TraceFilter &store_trace_filter() const;
     const std::vector<std::string> &get_trace_tags() const;
     // @}
 
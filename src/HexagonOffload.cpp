@@ -967,6 +967,7 @@ Stmt inject_hexagon_rpc(Stmt s, const Target &host_target,
     // constitutes valid debug info.
     static const Target::Feature shared_features[] = {
         Target::Profile,
+        Target::ProfileLoops,
         Target::NoAsserts,
         Target::HVX_64,
         Target::HVX_128,
@@ -974,6 +975,9 @@ Stmt inject_hexagon_rpc(Stmt s, const Target &host_target,
         Target::HVX_v65,
         Target::HVX_v66,
         Target::DisableLLVMLoopOpt,
+        Target::LLVMO1,
+        Target::LLVMO2,
+        Target::FastCompile,
     };
     for (Target::Feature i : shared_features) {
         if (host_target.has_feature(i)) {
@@ -1,5 +1,7 @@
+#include <limits>
 #include <mutex>
 #include <set>
+#include <sstream>
 #include <stdint.h>
 #include <string>
 
@@ -16,11 +18,15 @@
 #include "CodeGen_Internal.h"
 #include "CodeGen_LLVM.h"
 #include "Debug.h"
+#include "IRPrinter.h"
+#include "IRVisitor.h"
 #include "JITModule.h"
 #include "LLVM_Headers.h"
 #include "LLVM_Output.h"
 #include "LLVM_Runtime_Linker.h"
+#include "Module.h"
 #include "Pipeline.h"
+#include "Util.h"
 
 namespace Halide {
 namespace Internal {
@@ -171,11 +177,15 @@ void destroy<JITModuleContents>(const JITModuleContents *f) {
 
 namespace {
 
-// Retrieve a function pointer from an llvm module, possibly by compiling it.
-JITModule::Symbol compile_and_get_function(ExecutionEngine &ee, const string &name) {
+// Retrieve a function pointer from an llvm module, possibly by
+// compiling it. Stubs loaded from the JIT cache contain no functions,
+// so for those the symbol comes straight from the cached object.
+JITModule::Symbol compile_and_get_function(ExecutionEngine &ee, const string &name, bool from_cache) {
     debug(2) << "JIT Compiling " << name << "\n";
-    llvm::Function *fn = ee.FindFunctionNamed(name.c_str());
-    internal_assert(fn->getName() == name);
+    if (!from_cache) {
+        llvm::Function *fn = ee.FindFunctionNamed(name.c_str());
+        internal_assert(fn->getName() == name);
+    }
     void *f = (void *)ee.getFunctionAddress(name);
     if (!f) {
         internal_error << "Compiling " << name << " returned nullptr\n";
@@ -241,6 +251,280 @@ public:
     }
 };
 
+// The optional on-disk cache of JIT-compiled code, enabled by
+// pointing HL_JIT_CACHE_DIR at a writable directory. Each entry is a
+// single bitcode file named by a hash of everything that determines
+// the generated code. It holds a stub llvm::Module with no code in
+// it: the target options of the module it replaces, the names to
+// export, the static constructors and destructors to run, and the
+// object code itself as metadata. On a hit the stub is compiled in
+// place of the real module, and MCJIT loads the object through
+// HalideJITObjectCache instead of running codegen.
+
+std::string jit_cache_dir() {
+    return get_env_variable("HL_JIT_CACHE_DIR");
+}
+
+std::string jit_cache_path(const std::string &key) {
+    return jit_cache_dir() + "/" + key + ".bc";
+}
+
+// The build system passes in the version of Halide and the git
+// revision it was built from (see src/CMakeLists.txt and Makefile).
+#ifndef HALIDE_VERSION
+#define HALIDE_VERSION "unknown"
+#endif
+#ifndef HALIDE_GIT_REVISION
+#define HALIDE_GIT_REVISION "unknown"
+#endif
+
+// Hash a description of a compilation into a cache key, mixing in
+// what identifies this build of libHalide and the LLVM version.
+// Returns an empty string if the cache is disabled.
+std::string jit_cache_key(const std::string &description) {
+    if (jit_cache_dir().empty()) {
+        return "";
+    }
+    // The revision covers changes to the compiler itself, and the hash
+    // of the runtime bitcode covers changes to the runtime, even in a
+    // tree with uncommitted changes.
+    std::string text = "halide " HALIDE_VERSION " " HALIDE_GIT_REVISION "\n"
+                       "runtime " +
+                       runtime_bitcode_hash() + "\n" +
+                       "llvm " LLVM_VERSION_STRING "\n"
+                       "HL_LLVM_ARGS " +
+                       get_env_variable("HL_LLVM_ARGS") + "\n" +
+                       "HL_LLVM_PASSES " + get_env_variable("HL_LLVM_PASSES") + "\n" + description;
+    return llvm::toHex(llvm::SHA1::hash(llvm::arrayRefFromStringRef(text)), /* LowerCase */ true);
+}
+
+// The module flags read by get_target_options, for use in a cache key.
+std::string describe_target_options(const llvm::Module &m) {
+    std::string result;
+    llvm::raw_string_ostream stream(result);
+    stream << m.getTargetTriple() << " " << m.getDataLayoutStr();
+    for (const char *flag : {"halide_use_soft_float_abi", "halide_mcpu", "halide_mattrs",
+                             "halide_use_pic", "halide_per_instruction_fast_math_flags", "halide_fast_compile"}) {
+        if (llvm::Metadata *md = m.getModuleFlag(flag)) {
+            stream << " " << flag << "=";
+            md->print(stream);
+        }
+    }
+    return stream.str();
+}
+
+// Codegen uses the alignment of each Load and Store's index, which
+// the IR printer only shows for some vector accesses, so those go in
+// the cache key. When JITting, codegen also uses the host pointers of
+// buffers referenced directly by the pipeline to pick vector load
+// alignments, so their alignment is part of the key too.
+class DescribeAlignments : public IRGraphVisitor {
+    using IRGraphVisitor::visit;
+
+    void visit(const Load *op) override {
+        stream << "load " << op->name << " aligned("
+               << op->alignment.modulus << ", " << op->alignment.remainder << ")\n";
+        if (op->image.defined()) {
+            uintptr_t ptr = (uintptr_t)op->image.data();
+            int alignment_bits = 0;
+            while (alignment_bits < 8 && !(ptr & ((uintptr_t)1 << alignment_bits))) {
+                alignment_bits++;
+            }
+            stream << op->name << " aligned to 2^" << alignment_bits << "\n";
+        }
+        IRGraphVisitor::visit(op);
+    }
+
+    void visit(const Store *op) override {
+        stream << "store " << op->name << " aligned("
+               << op->alignment.modulus << ", " << op->alignment.remainder << ")\n";
+        IRGraphVisitor::visit(op);
+    }
+
+public:
+    std::ostream &stream;
+    DescribeAlignments(std::ostream &stream)
+        : stream(stream) {
+    }
+};
+
+std::string jit_cache_key_for_module(const Module &m) {
+    if (jit_cache_dir().empty()) {
+        return "";
+    }
+
+    std::ostringstream description;
+    // The IR printer writes float constants with the stream's
+    // precision, so make it enough to round-trip a double.
+    description.precision(std::numeric_limits<double>::max_digits10);
+    description << m;
+    for (const LoweredFunc &f : m.functions()) {
+        for (const LoweredArgument &arg : f.args) {
+            description << f.name << " argument " << arg.name
+                        << " kind " << (int)arg.kind
+                        << " type " << arg.type
+                        << " dimensions " << (int)arg.dimensions << "\n";
+        }
+        DescribeAlignments describe(description);
+        f.body.accept(&describe);
+    }
+    for (const Buffer<> &b : m.buffers()) {
+        description << "buffer " << b.name() << " " << b.type();
+        for (int i = 0; i < b.dimensions(); i++) {
+            description << " [" << b.dim(i).min() << ", " << b.dim(i).extent() << "]";
+        }
+        description << "\n";
+        Buffer<> dense = b.copy();
+        description.write((const char *)dense.data(), dense.size_in_bytes());
+    }
+    return jit_cache_key(description.str());
+}
+
+// Make the stub that stands in for a module in the JIT cache, or
+// return nullptr if the module can't be replayed from one.
+std::unique_ptr<llvm::Module> make_jit_cache_stub(const llvm::Module &m, const std::vector<std::string> &exports) {
+    llvm::LLVMContext &context = m.getContext();
+    std::unique_ptr<llvm::Module> stub(new llvm::Module(m.getModuleIdentifier(), context));
+    clone_target_options(m, *stub);
+    if (llvm::Metadata *md = m.getModuleFlag("halide_per_instruction_fast_math_flags")) {
+        stub->addModuleFlag(llvm::Module::Warning, "halide_per_instruction_fast_math_flags", md);
+    }
+    stub->setDataLayout(m.getDataLayout());
+
+    llvm::NamedMDNode *names = stub->getOrInsertNamedMetadata("halide_jit_cache_exports");
+    for (const std::string &name : exports) {
+        names->addOperand(llvm::MDNode::get(context, llvm::MDString::get(context, name)));
+    }
+
+    // MCJIT runs static constructors and destructors by looking their
+    // unmangled names up in the loaded objects, so each becomes a
+    // declaration of its mangled name in the stub. Ones with local
+    // linkage have no symbol to find.
+    for (bool dtors : {false, true}) {
+        const llvm::GlobalVariable *list = m.getNamedGlobal(dtors ? "llvm.global_dtors" : "llvm.global_ctors");
+        if (!list || !list->hasInitializer()) {
+            continue;
+        }
+        const llvm::ConstantArray *entries = llvm::dyn_cast<llvm::ConstantArray>(list->getInitializer());
+        if (!entries) {
+            continue;
+        }
+        for (const llvm::Use &u : entries->operands()) {
+            const llvm::ConstantStruct *entry = llvm::dyn_cast<llvm::ConstantStruct>(u.get());
+            if (!entry || entry->getOperand(1)->isNullValue()) {
+                continue;
+            }
+            const llvm::Function *f = llvm::dyn_cast<llvm::Function>(entry->getOperand(1)->stripPointerCasts());
+            if (!f || f->hasLocalLinkage()) {
+                debug(1) << "Not caching " << m.getModuleIdentifier() << ": it has a static constructor or destructor with local linkage\n";
+                return nullptr;
+            }
+            std::string mangled_name;
+            llvm::raw_string_ostream mangled(mangled_name);
+            llvm::Mangler::getNameWithPrefix(mangled, f->getName(), m.getDataLayout());
+            mangled.flush();
+            llvm::Function *decl = stub->getFunction(mangled_name);
+            if (!decl) {
+                decl = llvm::Function::Create(f->getFunctionType(), llvm::GlobalValue::ExternalLinkage, mangled_name, stub.get());
+            }
+            int priority = (int)llvm::cast<llvm::ConstantInt>(entry->getOperand(0))->getSExtValue();
+            if (dtors) {
+                llvm::appendToGlobalDtors(*stub, decl, priority);
+            } else {
+                llvm::appendToGlobalCtors(*stub, decl, priority);
+            }
+        }
+    }
+    return stub;
+}
+
+void write_jit_cache_entry(const std::string &key, const llvm::Module &stub) {
+    // Write to a unique temporary file and rename it into place, so
+    // that concurrent compilations only ever see complete entries.
+    std::string path = jit_cache_path(key);
+    llvm::SmallString<256> tmp_path;
+    int fd = -1;
+    std::error_code err = llvm::sys::fs::create_directories(jit_cache_dir());
+    if (!err) {
+        err = llvm::sys::fs::createUniqueFile(path + ".%%%%%%%%", fd, tmp_path);
+    }
+    if (!err) {
+        llvm::raw_fd_ostream out(fd, /* shouldClose */ true);
+        llvm::WriteBitcodeToFile(stub, out);
+        out.close();
+        if (out.has_error()) {
+            err = out.error();
+            out.clear_error();
+        } else {
+            err = llvm::sys::fs::rename(tmp_path, path);
+        }
+        if (err) {
+            llvm::sys::fs::remove(tmp_path);
+        }
+    }
+    if (err) {
+        debug(1) << "Could not write JIT cache entry " << path << ": " << err.message() << "\n";
+    } else {
+        debug(1) << "Wrote JIT cache entry " << path << "\n";
+    }
+}
+
+// Returns the stub for a key, or nullptr on a miss.
+std::unique_ptr<llvm::Module> load_jit_cache_entry(const std::string &key, llvm::LLVMContext &context) {
+    if (key.empty()) {
+        return nullptr;
+    }
+    std::string path = jit_cache_path(key);
+    auto buffer = llvm::MemoryBuffer::getFile(path);
+    if (!buffer) {
+        debug(2) << "No JIT cache entry " << path << "\n";
+        return nullptr;
+    }
+    auto stub = llvm::parseBitcodeFile((*buffer)->getMemBufferRef(), context);
+    if (!stub) {
+        llvm::consumeError(stub.takeError());
+        debug(1) << "Ignoring unreadable JIT cache entry " << path << "\n";
+        return nullptr;
+    }
+    if (!(*stub)->getNamedMetadata("halide_jit_cache_object")) {
+        debug(1) << "Ignoring JIT cache entry without object code " << path << "\n";
+        return nullptr;
+    }
+    debug(1) << "Loaded JIT cache entry " << path << "\n";
+    return std::move(*stub);
+}
+
+// Hands MCJIT the object code embedded in a stub, and fills in a new
+// cache entry whenever a real module is compiled.
+class HalideJITObjectCache : public llvm::ObjectCache {
+    std::string key;
+    std::unique_ptr<llvm::Module> stub;
+
+public:
+    HalideJITObjectCache(const std::string &key, std::unique_ptr<llvm::Module> stub)
+        : key(key), stub(std::move(stub)) {
+    }
+
+    void notifyObjectCompiled(const llvm::Module *, llvm::MemoryBufferRef object) override {
+        if (!stub) {
+            return;
+        }
+        llvm::LLVMContext &context = stub->getContext();
+        stub->getOrInsertNamedMetadata("halide_jit_cache_object")->addOperand(llvm::MDNode::get(context, llvm::MDString::get(context, object.getBuffer())));
+        write_jit_cache_entry(key, *stub);
+        stub.reset();
+    }
+
+    std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module *m) override {
+        llvm::NamedMDNode *md = m->getNamedMetadata("halide_jit_cache_object");
+        if (!md || md->getNumOperands() != 1) {
+            return nullptr;
+        }
+        llvm::MDString *object = llvm::cast<llvm::MDString>(md->getOperand(0)->getOperand(0));
+        return llvm::MemoryBuffer::getMemBufferCopy(object->getString(), m->getModuleIdentifier());
+    }
+};
+
 }  // namespace
 
 JITModule::JITModule() {
@@ -250,22 +534,45 @@ JITModule::JITModule() {
 JITModule::JITModule(const Module &m, const LoweredFunc &fn,
                      const std::vector<JITModule> &dependencies) {
     jit_module = new JITModuleContents();
-    std::unique_ptr<llvm::Module> llvm_module(compile_module_to_llvm_module(m, jit_module->context));
+    string cache_key = jit_cache_key_for_module(m);
+    std::unique_ptr<llvm::Module> llvm_module = load_jit_cache_entry(cache_key, jit_module->context);
+    if (!llvm_module) {
+        llvm_module = compile_module_to_llvm_module(m, jit_module->context);
+    }
     std::vector<JITModule> deps_with_runtime = dependencies;
     std::vector<JITModule> shared_runtime = JITSharedRuntime::get(llvm_module.get(), m.target());
     deps_with_runtime.insert(deps_with_runtime.end(), shared_runtime.begin(), shared_runtime.end());
-    compile_module(std::move(llvm_module), fn.name, m.target(), deps_with_runtime);
+    compile_module(std::move(llvm_module), fn.name, m.target(), deps_with_runtime,
+                   std::vector<std::string>(), cache_key);
     // If -time-passes is in HL_LLVM_ARGS, this will print llvm passes time statstics otherwise its no-op.
     llvm::reportAndResetTimings();
 }
 
 void JITModule::compile_module(std::unique_ptr<llvm::Module> m, const string &function_name, const Target &target,
                                const std::vector<JITModule> &dependencies,
-                               const std::vector<std::string> &requested_exports) {
+                               const std::vector<std::string> &requested_exports,
+                               const std::string &cache_key) {
 
     // Ensure that LLVM is initialized
     CodeGen_LLVM::initialize_llvm();
 
+    // A stub loaded from the JIT cache lists its own exports. Anything
+    // else gets a stub made for it now, to be written to the cache
+    // once it has been compiled.
+    std::vector<std::string> exports_to_get = requested_exports;
+    std::unique_ptr<llvm::Module> stub;
+    llvm::NamedMDNode *cached_exports = m->getNamedMetadata("halide_jit_cache_exports");
+    bool from_cache = cached_exports != nullptr;
+    if (from_cache) {
+        exports_to_get.clear();
+        for (llvm::MDNode *node : cached_exports->operands()) {
+            exports_to_get.push_back(llvm::cast<llvm::MDString>(node->getOperand(0))->getString().str());
+        }
+    } else if (!cache_key.empty()) {
+        stub = make_jit_cache_stub(*m, requested_exports);
+    }
+    HalideJITObjectCache object_cache(cache_key, std::move(stub));
+
     // Make the execution engine
     debug(2) << "Creating new execution engine\n";
     debug(2) << "Target triple: " << m->getTargetTriple() << "\n";
@@ -275,6 +582,7 @@ void JITModule::compile_module(std::unique_ptr<llvm::Module> m, const string &fu
     string mattrs;
     llvm::TargetOptions options;
     get_target_options(*m, options, mcpu, mattrs);
+    CodeGenOpt::Level opt_level = (CodeGenOpt::Level)get_codegen_opt_level(*m);
 
     DataLayout initial_module_data_layout = m->getDataLayout();
     string module_name = m->getModuleIdentifier();
@@ -286,7 +594,7 @@ void JITModule::compile_module(std::unique_ptr<llvm::Module> m, const string &fu
     HalideJITMemoryManager *memory_manager = new HalideJITMemoryManager(dependencies);
     engine_builder.setMCJITMemoryManager(std::unique_ptr<RTDyldMemoryManager>(memory_manager));
 
-    engine_builder.setOptLevel(CodeGenOpt::Aggressive);
+    engine_builder.setOptLevel(opt_level);
     if (!mcpu.empty()) {
         engine_builder.setMCPU(mcpu);
     }
@@ -306,6 +614,9 @@ void JITModule::compile_module(std::unique_ptr<llvm::Module> m, const string &fu
 
     if (!ee) std::cerr << error_string << "\n";
     internal_assert(ee) << "Couldn't create execution engine\n";
+    if (from_cache || !cache_key.empty()) {
+        ee->setObjectCache(&object_cache);
+    }
 
     // Do any target-specific initialization
     std::vector<llvm::JITEventListener *> listeners;
@@ -327,21 +638,28 @@ void JITModule::compile_module(std::unique_ptr<llvm::Module> m, const string &fu
 
     std::map<std::string, Symbol> exports;
 
+    if (from_cache) {
+        // Load the cached object, so that its symbols can be found
+        // by name without anything to compile.
+        ee->finalizeObject();
+    }
+
     Symbol entrypoint;
     Symbol argv_entrypoint;
     if (!function_name.empty()) {
-        entrypoint = compile_and_get_function(*ee, function_name);
+        entrypoint = compile_and_get_function(*ee, function_name, from_cache);
         exports[function_name] = entrypoint;
-        argv_entrypoint = compile_and_get_function(*ee, function_name + "_argv");
+        argv_entrypoint = compile_and_get_function(*ee, function_name + "_argv", from_cache);
         exports[function_name + "_argv"] = argv_entrypoint;
     }
 
-    for (size_t i = 0; i < requested_exports.size(); i++) {
-        exports[requested_exports[i]] = compile_and_get_function(*ee, requested_exports[i]);
+    for (size_t i = 0; i < exports_to_get.size(); i++) {
+        exports[exports_to_get[i]] = compile_and_get_function(*ee, exports_to_get[i], from_cache);
     }
 
     debug(2) << "Finalizing object\n";
     ee->finalizeObject();
+    ee->setObjectCache(nullptr);
     // Do any target-specific post-compilation module meddling
     for (size_t i = 0; i < listeners.size(); i++) {
         ee->UnregisterJITEventListener(listeners[i]);
@@ -462,6 +780,28 @@ void JITModule::memoization_cache_set_size(int64_t size) const {
     }
 }
 
+int JITModule::memoization_cache_get_stats(halide_memoization_cache_stats_t *stats,
+                                           halide_memoization_cache_func_stats_t *funcs,
+                                           int max_funcs) const {
+    std::map<std::string, Symbol>::const_iterator f =
+        exports().find("halide_memoization_cache_get_stats");
+    if (f != exports().end()) {
+        return (reinterpret_bits<int (*)(halide_memoization_cache_stats_t *,
+                                         halide_memoization_cache_func_stats_t *,
+                                         int)>(f->second.address))(stats, funcs, max_funcs);
+    }
+    return 0;
+}
+
+int JITModule::memoization_cache_set_eviction_policy(int policy) const {
+    std::map<std::string, Symbol>::const_iterator f =
+        exports().find("halide_memoization_cache_set_eviction_policy");
+    if (f != exports().end()) {
+        return (reinterpret_bits<int (*)(int)>(f->second.address))(policy);
+    }
+    return 0;
+}
+
 void JITModule::reuse_device_allocations(bool b) const {
     std::map<std::string, Symbol>::const_iterator f =
         exports().find("halide_reuse_device_allocations");
@@ -470,6 +810,14 @@ void JITModule::reuse_device_allocations(bool b) const {
     }
 }
 
+void JITModule::reuse_host_allocations(bool b) const {
+    std::map<std::string, Symbol>::const_iterator f =
+        exports().find("halide_reuse_host_allocations");
+    if (f != exports().end()) {
+        (reinterpret_bits<int (*)(void *, bool)>(f->second.address))(nullptr, b);
+    }
+}
+
 bool JITModule::compiled() const {
     return jit_module->execution_engine != nullptr;
 }
@@ -756,30 +1104,38 @@ JITModule &make_module(llvm::Module *for_module, Target target,
             break;
         }
 
-        // This function is protected by a mutex so this is thread safe.
-        auto module =
-            get_initial_module_for_target(one_gpu,
-                                          &runtime.jit_module->context,
-                                          true,
-                                          runtime_kind != MainShared);
-        if (for_module) {
-            clone_target_options(*for_module, *module);
-        }
-        module->setModuleIdentifier(module_name);
+        // A shared runtime depends only on its target and on the
+        // target options it borrows from for_module.
+        string cache_key = jit_cache_key("runtime " + module_name + " " + one_gpu.to_string() +
+                                         (for_module ? " " + describe_target_options(*for_module) : ""));
+        std::unique_ptr<llvm::Module> module = load_jit_cache_entry(cache_key, runtime.jit_module->context);
+        std::vector<std::string> halide_exports;
+        if (!module) {
+            // This function is protected by a mutex so this is thread safe.
+            module =
+                get_initial_module_for_target(one_gpu,
+                                              &runtime.jit_module->context,
+                                              true,
+                                              runtime_kind != MainShared);
+            if (for_module) {
+                clone_target_options(*for_module, *module);
+            }
+            module->setModuleIdentifier(module_name);
 
-        std::set<std::string> halide_exports_unique;
+            std::set<std::string> halide_exports_unique;
 
-        // Enumerate the functions.
-        for (auto &f : *module) {
-            // LLVM_Runtime_Linker has marked everything that should be exported as weak
-            if (f.hasWeakLinkage()) {
-                halide_exports_unique.insert(get_llvm_function_name(f));
+            // Enumerate the functions.
+            for (auto &f : *module) {
+                // LLVM_Runtime_Linker has marked everything that should be exported as weak
+                if (f.hasWeakLinkage()) {
+                    halide_exports_unique.insert(get_llvm_function_name(f));
+                }
             }
-        }
 
-        std::vector<std::string> halide_exports(halide_exports_unique.begin(), halide_exports_unique.end());
+            halide_exports.assign(halide_exports_unique.begin(), halide_exports_unique.end());
+        }
 
-        runtime.compile_module(std::move(module), "", target, deps, halide_exports);
+        runtime.compile_module(std::move(module), "", target, deps, halide_exports, cache_key);
 
         if (runtime_kind == MainShared) {
             runtime_internal_handlers.custom_print =
@@ -949,10 +1305,27 @@ void JITSharedRuntime::memoization_cache_set_size(int64_t size) {
     }
 }
 
+int JITSharedRuntime::memoization_cache_get_stats(halide_memoization_cache_stats_t *stats,
+                                                  halide_memoization_cache_func_stats_t *funcs,
+                                                  int max_funcs) {
+    std::lock_guard<std::mutex> lock(shared_runtimes_mutex);
+    return shared_runtimes(MainShared).memoization_cache_get_stats(stats, funcs, max_funcs);
+}
+
+int JITSharedRuntime::memoization_cache_set_eviction_policy(int policy) {
+    std::lock_guard<std::mutex> lock(shared_runtimes_mutex);
+    return shared_runtimes(MainShared).memoization_cache_set_eviction_policy(policy);
+}
+
 void JITSharedRuntime::reuse_device_allocations(bool b) {
     std::lock_guard<std::mutex> lock(shared_runtimes_mutex);
     shared_runtimes(MainShared).reuse_device_allocations(b);
 }
 
+void JITSharedRuntime::reuse_host_allocations(bool b) {
+    std::lock_guard<std::mutex> lock(shared_runtimes_mutex);
+    shared_runtimes(MainShared).reuse_host_allocations(b);
+}
+
 }  // namespace Internal
 }  // namespace Halide
@@ -118,18 +118,34 @@ struct JITModule {
     Symbol find_symbol_by_name(const std::string &) const;
 
     /** Take an llvm module and compile it. The requested exports will
-        be available via the exports method. */
+        be available via the exports method. If a cache_key is given
+        and HL_JIT_CACHE_DIR names a directory, the object code is
+        also saved there under that key. The module may also be a
+        stub previously loaded from that directory, which carries its
+        own object code and exports. */
     void compile_module(std::unique_ptr<llvm::Module> mod,
                         const std::string &function_name, const Target &target,
                         const std::vector<JITModule> &dependencies = std::vector<JITModule>(),
-                        const std::vector<std::string> &requested_exports = std::vector<std::string>());
+                        const std::vector<std::string> &requested_exports = std::vector<std::string>(),
+                        const std::string &cache_key = std::string());
 
     /** See JITSharedRuntime::memoization_cache_set_size */
     void memoization_cache_set_size(int64_t size) const;
 
+    /** See JITSharedRuntime::memoization_cache_get_stats */
+    int memoization_cache_get_stats(halide_memoization_cache_stats_t *stats,
+                                    halide_memoization_cache_func_stats_t *funcs,
+                                    int max_funcs) const;
+
+    /** See JITSharedRuntime::memoization_cache_set_eviction_policy */
+    int memoization_cache_set_eviction_policy(int policy) const;
+
     /** See JITSharedRuntime::reuse_device_allocations */
     void reuse_device_allocations(bool) const;
 
+    /** See JITSharedRuntime::reuse_host_allocations */
+    void reuse_host_allocations(bool) const;
+
     /** Return true if compile_module has been called on this module. */
     bool compiled() const;
 };
@@ -167,6 +183,22 @@ public:
      */
     static void memoization_cache_set_size(int64_t size);
 
+    /** Get the memoization cache statistics of the shared runtime. See
+     * halide_memoization_cache_get_stats in HalideRuntime.h, which is
+     * what you should call if you are compiling statically. Returns
+     * zero and leaves stats untouched if there is no shared runtime
+     * yet. */
+    static int memoization_cache_get_stats(halide_memoization_cache_stats_t *stats,
+                                           halide_memoization_cache_func_stats_t *funcs = nullptr,
+                                           int max_funcs = 0);
+
+    /** Set the eviction policy of the memoization cache of the shared
+     * runtime. See halide_memoization_cache_set_eviction_policy in
+     * HalideRuntime.h, which is what you should call if you are
+     * compiling statically. Returns the old policy, or zero if there
+     * is no shared runtime yet. */
+    static int memoization_cache_set_eviction_policy(int policy);
+
     /** Set whether or not Halide may hold onto and reuse device
      * allocations to avoid calling expensive device API allocation
      * functions. If you are compiling statically, you should include
@@ -174,6 +206,13 @@ public:
      * instead. */
     static void reuse_device_allocations(bool);
 
+    /** Set whether or not the default host allocator of the shared
+     * runtime pools freed blocks for reuse. Turning it off also
+     * releases the pooled blocks. If you are compiling statically,
+     * include HalideRuntime.h and call halide_reuse_host_allocations
+     * instead. */
+    static void reuse_host_allocations(bool);
+
     static void release_all();
 };
 
@@ -25,8 +25,10 @@
 #include <lld/Common/Driver.h>
 #endif
 
+#include <llvm/Config/llvm-config.h>
 #include <llvm/ExecutionEngine/JITEventListener.h>
 #include <llvm/ExecutionEngine/MCJIT.h>
+#include <llvm/ExecutionEngine/ObjectCache.h>
 #include <llvm/ExecutionEngine/SectionMemoryManager.h>
 
 #include "llvm/Support/ErrorHandling.h"
@@ -43,6 +45,7 @@
 #endif
 #include "llvm/ADT/APFloat.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringExtras.h"
 #include "llvm/ADT/StringRef.h"
 #include <llvm/ADT/StringMap.h>
 #include <llvm/IR/PassTimingInfo.h>
@@ -52,6 +55,7 @@
 #include <llvm/Support/DynamicLibrary.h>
 #include <llvm/Support/FileSystem.h>
 #include <llvm/Support/FormattedStream.h>
+#include <llvm/Support/SHA1.h>
 #include <llvm/Support/TargetRegistry.h>
 #include <llvm/Support/TargetSelect.h>
 #include <llvm/Support/raw_os_ostream.h>
@@ -81,6 +85,7 @@
 #endif
 #endif
 #include <llvm/IR/MDBuilder.h>
+#include <llvm/IR/Mangler.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Value.h>
 
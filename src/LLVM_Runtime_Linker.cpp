@@ -25,6 +25,24 @@ std::unique_ptr<llvm::Module> parse_bitcode_file(llvm::StringRef buf, llvm::LLVM
     return result;
 }
 
+// Every runtime bitcode module built into libHalide, in the order
+// they are declared below, for runtime_bitcode_hash.
+struct InitmodBitcode {
+    const unsigned char *data;
+    const int *length;
+};
+
+std::vector<InitmodBitcode> &all_initmods() {
+    static std::vector<InitmodBitcode> initmods;
+    return initmods;
+}
+
+struct RegisterInitmod {
+    RegisterInitmod(const unsigned char *data, const int *length) {
+        all_initmods().push_back({data, length});
+    }
+};
+
 }  // namespace
 
 #define DECLARE_INITMOD(mod)                                                              \
@@ -34,7 +52,9 @@ std::unique_ptr<llvm::Module> parse_bitcode_file(llvm::StringRef buf, llvm::LLVM
         llvm::StringRef sb = llvm::StringRef((const char *)halide_internal_initmod_##mod, \
                                              halide_internal_initmod_##mod##_length);     \
         return parse_bitcode_file(sb, context, #mod);                                     \
-    }
+    }                                                                                     \
+    static RegisterInitmod register_initmod_##mod(halide_internal_initmod_##mod,          \
+                                                  &halide_internal_initmod_##mod##_length);
 
 #define DECLARE_NO_INITMOD(mod)                                                        \
     std::unique_ptr<llvm::Module> get_initmod_##mod(llvm::LLVMContext *, bool, bool) { \
@@ -92,6 +112,9 @@ DECLARE_NO_INITMOD(d3d12compute)
 DECLARE_CPP_INITMOD(destructors)
 DECLARE_CPP_INITMOD(device_interface)
 DECLARE_CPP_INITMOD(errors)
+DECLARE_CPP_INITMOD(fake_cpu_topology)
+DECLARE_CPP_INITMOD(fake_file_mapping)
+DECLARE_CPP_INITMOD(fake_perf_counters)
 DECLARE_CPP_INITMOD(fake_get_symbol)
 DECLARE_CPP_INITMOD(fake_thread_pool)
 DECLARE_CPP_INITMOD(float16_t)
@@ -103,7 +126,9 @@ DECLARE_CPP_INITMOD(hexagon_dma)
 DECLARE_CPP_INITMOD(hexagon_host)
 DECLARE_CPP_INITMOD(ios_io)
 DECLARE_CPP_INITMOD(linux_clock)
+DECLARE_CPP_INITMOD(linux_cpu_topology)
 DECLARE_CPP_INITMOD(linux_host_cpu_count)
+DECLARE_CPP_INITMOD(linux_perf_counters)
 DECLARE_CPP_INITMOD(linux_yield)
 DECLARE_CPP_INITMOD(matlab)
 DECLARE_CPP_INITMOD(metadata)
@@ -125,6 +150,7 @@ DECLARE_CPP_INITMOD(posix_abort)
 DECLARE_CPP_INITMOD(posix_allocator)
 DECLARE_CPP_INITMOD(posix_clock)
 DECLARE_CPP_INITMOD(posix_error_handler)
+DECLARE_CPP_INITMOD(posix_file_mapping)
 DECLARE_CPP_INITMOD(posix_get_symbol)
 DECLARE_CPP_INITMOD(posix_io)
 DECLARE_CPP_INITMOD(posix_print)
@@ -144,6 +170,7 @@ DECLARE_CPP_INITMOD(qurt_threads)
 DECLARE_CPP_INITMOD(qurt_threads_tsan)
 DECLARE_CPP_INITMOD(qurt_yield)
 DECLARE_CPP_INITMOD(runtime_api)
+DECLARE_CPP_INITMOD(runtime_metrics)
 DECLARE_CPP_INITMOD(ssp)
 DECLARE_CPP_INITMOD(to_string)
 DECLARE_CPP_INITMOD(trace_helper)
@@ -535,6 +562,17 @@ llvm::Triple get_triple_for_target(const Target &target) {
     return triple;
 }
 
+std::string runtime_bitcode_hash() {
+    static std::string hash = []() {
+        llvm::SHA1 sha1;
+        for (const InitmodBitcode &m : all_initmods()) {
+            sha1.update(llvm::ArrayRef<uint8_t>(m.data, *m.length));
+        }
+        return llvm::toHex(sha1.final(), /* LowerCase */ true);
+    }();
+    return hash;
+}
+
 }  // namespace Internal
 
 namespace {
@@ -734,6 +772,8 @@ std::unique_ptr<llvm::Module> link_with_wasm_jit_runtime(llvm::LLVMContext *c, c
     vector<std::unique_ptr<llvm::Module>> modules;
     modules.push_back(std::move(extra_module));
     modules.push_back(get_initmod_fake_thread_pool(c, bits_64, debug));
+    modules.push_back(get_initmod_fake_cpu_topology(c, bits_64, debug));
+    modules.push_back(get_initmod_fake_file_mapping(c, bits_64, debug));
     modules.push_back(get_initmod_posix_allocator(c, bits_64, debug));
     modules.push_back(get_initmod_halide_buffer_t(c, bits_64, debug));
     modules.push_back(get_initmod_destructors(c, bits_64, debug));
@@ -807,6 +847,9 @@ std::unique_ptr<llvm::Module> get_initial_module_for_target(Target t, llvm::LLVM
                 }
                 modules.push_back(get_initmod_posix_io(c, bits_64, debug));
                 modules.push_back(get_initmod_linux_host_cpu_count(c, bits_64, debug));
+                modules.push_back(get_initmod_linux_cpu_topology(c, bits_64, debug));
+                modules.push_back(get_initmod_linux_perf_counters(c, bits_64, debug));
+                modules.push_back(get_initmod_posix_file_mapping(c, bits_64, debug));
                 modules.push_back(get_initmod_linux_yield(c, bits_64, debug));
                 if (tsan) {
                     modules.push_back(get_initmod_posix_threads_tsan(c, bits_64, debug));
@@ -814,6 +857,7 @@ std::unique_ptr<llvm::Module> get_initial_module_for_target(Target t, llvm::LLVM
                     modules.push_back(get_initmod_posix_threads(c, bits_64, debug));
                 }
                 modules.push_back(get_initmod_posix_get_symbol(c, bits_64, debug));
+                modules.push_back(get_initmod_runtime_metrics(c, bits_64, debug));
             } else if (t.os == Target::WebAssemblyRuntime) {
                 modules.push_back(get_initmod_posix_allocator(c, bits_64, debug));
                 modules.push_back(get_initmod_posix_error_handler(c, bits_64, debug));
@@ -821,9 +865,13 @@ std::unique_ptr<llvm::Module> get_initial_module_for_target(Target t, llvm::LLVM
                 modules.push_back(get_initmod_posix_clock(c, bits_64, debug));
                 modules.push_back(get_initmod_posix_io(c, bits_64, debug));
                 modules.push_back(get_initmod_linux_host_cpu_count(c, bits_64, debug));
+                modules.push_back(get_initmod_fake_cpu_topology(c, bits_64, debug));
+                modules.push_back(get_initmod_fake_perf_counters(c, bits_64, debug));
+                modules.push_back(get_initmod_fake_file_mapping(c, bits_64, debug));
                 modules.push_back(get_initmod_linux_yield(c, bits_64, debug));
                 modules.push_back(get_initmod_fake_thread_pool(c, bits_64, debug));
                 modules.push_back(get_initmod_fake_get_symbol(c, bits_64, debug));
+                modules.push_back(get_initmod_runtime_metrics(c, bits_64, debug));
             } else if (t.os == Target::OSX) {
                 modules.push_back(get_initmod_posix_allocator(c, bits_64, debug));
                 modules.push_back(get_initmod_posix_error_handler(c, bits_64, debug));
@@ -831,6 +879,9 @@ std::unique_ptr<llvm::Module> get_initial_module_for_target(Target t, llvm::LLVM
                 modules.push_back(get_initmod_osx_clock(c, bits_64, debug));
                 modules.push_back(get_initmod_posix_io(c, bits_64, debug));
                 modules.push_back(get_initmod_osx_host_cpu_count(c, bits_64, debug));
+                modules.push_back(get_initmod_fake_cpu_topology(c, bits_64, debug));
+                modules.push_back(get_initmod_fake_perf_counters(c, bits_64, debug));
+                modules.push_back(get_initmod_posix_file_mapping(c, bits_64, debug));
                 modules.push_back(get_initmod_osx_yield(c, bits_64, debug));
                 if (tsan) {
                     modules.push_back(get_initmod_posix_threads_tsan(c, bits_64, debug));
@@ -838,6 +889,7 @@ std::unique_ptr<llvm::Module> get_initial_module_for_target(Target t, llvm::LLVM
                     modules.push_back(get_initmod_posix_threads(c, bits_64, debug));
                 }
                 modules.push_back(get_initmod_osx_get_symbol(c, bits_64, debug));
+                modules.push_back(get_initmod_runtime_metrics(c, bits_64, debug));
                 modules.push_back(get_initmod_osx_host_cpu_count(c, bits_64, debug));
             } else if (t.os == Target::Android) {
                 modules.push_back(get_initmod_posix_allocator(c, bits_64, debug));
@@ -850,6 +902,9 @@ std::unique_ptr<llvm::Module> get_initial_module_for_target(Target t, llvm::LLVM
                 }
                 modules.push_back(get_initmod_android_io(c, bits_64, debug));
                 modules.push_back(get_initmod_android_host_cpu_count(c, bits_64, debug));
+                modules.push_back(get_initmod_fake_cpu_topology(c, bits_64, debug));
+                modules.push_back(get_initmod_fake_perf_counters(c, bits_64, debug));
+                modules.push_back(get_initmod_posix_file_mapping(c, bits_64, debug));
                 modules.push_back(get_initmod_linux_yield(c, bits_64, debug));  // TODO: verify
                 if (tsan) {
                     modules.push_back(get_initmod_posix_threads_tsan(c, bits_64, debug));
@@ -857,12 +912,16 @@ std::unique_ptr<llvm::Module> get_initial_module_for_target(Target t, llvm::LLVM
                     modules.push_back(get_initmod_posix_threads(c, bits_64, debug));
                 }
                 modules.push_back(get_initmod_posix_get_symbol(c, bits_64, debug));
+                modules.push_back(get_initmod_runtime_metrics(c, bits_64, debug));
             } else if (t.os == Target::Windows) {
                 modules.push_back(get_initmod_posix_allocator(c, bits_64, debug));
                 modules.push_back(get_initmod_posix_error_handler(c, bits_64, debug));
                 modules.push_back(get_initmod_posix_print(c, bits_64, debug));
                 modules.push_back(get_initmod_windows_clock(c, bits_64, debug));
                 modules.push_back(get_initmod_windows_io(c, bits_64, debug));
+                modules.push_back(get_initmod_fake_cpu_topology(c, bits_64, debug));
+                modules.push_back(get_initmod_fake_perf_counters(c, bits_64, debug));
+                modules.push_back(get_initmod_fake_file_mapping(c, bits_64, debug));
                 modules.push_back(get_initmod_windows_yield(c, bits_64, debug));
                 if (tsan) {
                     modules.push_back(get_initmod_windows_threads_tsan(c, bits_64, debug));
@@ -870,6 +929,7 @@ std::unique_ptr<llvm::Module> get_initial_module_for_target(Target t, llvm::LLVM
                     modules.push_back(get_initmod_windows_threads(c, bits_64, debug));
                 }
                 modules.push_back(get_initmod_windows_get_symbol(c, bits_64, debug));
+                modules.push_back(get_initmod_runtime_metrics(c, bits_64, debug));
             } else if (t.os == Target::IOS) {
                 modules.push_back(get_initmod_posix_allocator(c, bits_64, debug));
                 modules.push_back(get_initmod_posix_error_handler(c, bits_64, debug));
@@ -877,14 +937,21 @@ std::unique_ptr<llvm::Module> get_initial_module_for_target(Target t, llvm::LLVM
                 modules.push_back(get_initmod_posix_clock(c, bits_64, debug));
                 modules.push_back(get_initmod_ios_io(c, bits_64, debug));
                 modules.push_back(get_initmod_osx_host_cpu_count(c, bits_64, debug));
+                modules.push_back(get_initmod_fake_cpu_topology(c, bits_64, debug));
+                modules.push_back(get_initmod_fake_perf_counters(c, bits_64, debug));
+                modules.push_back(get_initmod_fake_file_mapping(c, bits_64, debug));
                 modules.push_back(get_initmod_osx_yield(c, bits_64, debug));
                 if (tsan) {
                     modules.push_back(get_initmod_posix_threads_tsan(c, bits_64, debug));
                 } else {
                     modules.push_back(get_initmod_posix_threads(c, bits_64, debug));
                 }
+                modules.push_back(get_initmod_runtime_metrics(c, bits_64, debug));
             } else if (t.os == Target::QuRT) {
                 modules.push_back(get_initmod_qurt_allocator(c, bits_64, debug));
+                modules.push_back(get_initmod_fake_cpu_topology(c, bits_64, debug));
+                modules.push_back(get_initmod_fake_perf_counters(c, bits_64, debug));
+                modules.push_back(get_initmod_fake_file_mapping(c, bits_64, debug));
                 modules.push_back(get_initmod_qurt_yield(c, bits_64, debug));
                 if (tsan) {
                     modules.push_back(get_initmod_qurt_threads_tsan(c, bits_64, debug));
@@ -892,6 +959,7 @@ std::unique_ptr<llvm::Module> get_initial_module_for_target(Target t, llvm::LLVM
                     modules.push_back(get_initmod_qurt_threads(c, bits_64, debug));
                 }
                 modules.push_back(get_initmod_qurt_init_fini(c, bits_64, debug));
+                modules.push_back(get_initmod_runtime_metrics(c, bits_64, debug));
             } else if (t.os == Target::NoOS) {
                 // The OS-specific symbols provided by the modules
                 // above are expected to be provided by the containing
@@ -902,6 +970,7 @@ std::unique_ptr<llvm::Module> get_initial_module_for_target(Target t, llvm::LLVM
                     modules.push_back(get_initmod_qurt_allocator(c, bits_64, debug));
                 }
                 modules.push_back(get_initmod_fake_thread_pool(c, bits_64, debug));
+                modules.push_back(get_initmod_fake_file_mapping(c, bits_64, debug));
             } else if (t.os == Target::Fuchsia) {
                 modules.push_back(get_initmod_posix_allocator(c, bits_64, debug));
                 modules.push_back(get_initmod_posix_error_handler(c, bits_64, debug));
@@ -909,6 +978,9 @@ std::unique_ptr<llvm::Module> get_initial_module_for_target(Target t, llvm::LLVM
                 modules.push_back(get_initmod_fuchsia_clock(c, bits_64, debug));
                 modules.push_back(get_initmod_posix_io(c, bits_64, debug));
                 modules.push_back(get_initmod_fuchsia_host_cpu_count(c, bits_64, debug));
+                modules.push_back(get_initmod_fake_cpu_topology(c, bits_64, debug));
+                modules.push_back(get_initmod_fake_perf_counters(c, bits_64, debug));
+                modules.push_back(get_initmod_fake_file_mapping(c, bits_64, debug));
                 modules.push_back(get_initmod_fuchsia_yield(c, bits_64, debug));
                 if (tsan) {
                     modules.push_back(get_initmod_posix_threads_tsan(c, bits_64, debug));
@@ -916,6 +988,7 @@ std::unique_ptr<llvm::Module> get_initial_module_for_target(Target t, llvm::LLVM
                     modules.push_back(get_initmod_posix_threads(c, bits_64, debug));
                 }
                 modules.push_back(get_initmod_posix_get_symbol(c, bits_64, debug));
+                modules.push_back(get_initmod_runtime_metrics(c, bits_64, debug));
             }
         }
 
@@ -1040,7 +1113,7 @@ std::unique_ptr<llvm::Module> get_initial_module_for_target(Target t, llvm::LLVM
             if (t.has_feature(Target::AVX2)) {
                 modules.push_back(get_initmod_x86_avx2_ll(c));
             }
-            if (t.has_feature(Target::Profile)) {
+            if (t.has_feature(Target::Profile) || t.has_feature(Target::ProfileLoops)) {
                 user_assert(t.os != Target::WebAssemblyRuntime) << "The profiler cannot be used in a threadless environment.";
                 modules.push_back(get_initmod_profiler_inlined(c, bits_64, debug));
             }
@@ -21,6 +21,9 @@ namespace Internal {
 /** Return the llvm::Triple that corresponds to the given Halide Target */
 llvm::Triple get_triple_for_target(const Target &target);
 
+/** A hash of all the runtime bitcode built into libHalide. */
+std::string runtime_bitcode_hash();
+
 /** Create an llvm module containing the support code for a given target. */
 std::unique_ptr<llvm::Module> get_initial_module_for_target(Target, llvm::LLVMContext *, bool for_shared_jit_runtime = false, bool just_gpu = false);
 
@@ -398,9 +398,9 @@ Module lower(const vector<Function> &output_funcs,
     debug(2) << "Lowering after bounding small allocations:\n"
              << s << "\n\n";
 
-    if (t.has_feature(Target::Profile)) {
+    if (t.has_feature(Target::Profile) || t.has_feature(Target::ProfileLoops)) {
         debug(1) << "Injecting profiling...\n";
-        s = inject_profiling(s, pipeline_name);
+        s = inject_profiling(s, pipeline_name, t.has_feature(Target::ProfileLoops));
         debug(2) << "Lowering after injecting profiling:\n"
                  << s << "\n\n";
     }
@@ -3,12 +3,15 @@
 #include "Function.h"
 #include "IRMutator.h"
 #include "IROperator.h"
+#include "IRPrinter.h"
 #include "Param.h"
 #include "Scope.h"
 #include "Util.h"
 #include "Var.h"
 
 #include <map>
+#include <set>
+#include <sstream>
 
 namespace Halide {
 namespace Internal {
@@ -145,6 +148,130 @@ public:
     std::map<DependencyKey, DependencyInfo> dependency_info;
 };
 
+// Prints the algorithm of a Function and of every Function it calls:
+// the pure arguments, output types, definitions, reduction domains and
+// extern calls. Schedules are left out, as they don't change the
+// results. Used to key persistent memoized results on what computed
+// them, so that changing the definition of a memoized Func doesn't
+// find results stored by the old one.
+class PrintAlgorithm : public IRGraphVisitor {
+    std::set<std::string> functions;
+    std::set<ReductionDomain, ReductionDomain::Compare> rdoms;
+
+    using IRGraphVisitor::visit;
+
+    void visit(const Call *op) override {
+        IRGraphVisitor::visit(op);
+        if (op->func.defined()) {
+            print_function(Function(op->func));
+        }
+    }
+
+    void visit(const Variable *op) override {
+        if (op->reduction_domain.defined() &&
+            rdoms.insert(op->reduction_domain).second) {
+            stream << "rdom";
+            for (const ReductionVariable &rv : op->reduction_domain.domain()) {
+                stream << " " << rv.var << "[" << rv.min << ", " << rv.extent << "]";
+                rv.min.accept(this);
+                rv.extent.accept(this);
+            }
+            Expr pred = op->reduction_domain.predicate();
+            if (pred.defined()) {
+                stream << " where " << pred;
+                pred.accept(this);
+            }
+            stream << "\n";
+        }
+    }
+
+    void print_definition(const Function &f, const Definition &def) {
+        stream << f.name() << "(";
+        for (const Expr &e : def.args()) {
+            stream << e << ", ";
+        }
+        stream << ") = {";
+        for (const Expr &e : def.values()) {
+            stream << e << ", ";
+        }
+        stream << "}";
+        if (def.predicate().defined()) {
+            stream << " if " << def.predicate();
+        }
+        stream << "\n";
+        for (const Expr &e : def.args()) {
+            e.accept(this);
+        }
+        for (const Expr &e : def.values()) {
+            e.accept(this);
+        }
+        if (def.predicate().defined()) {
+            def.predicate().accept(this);
+        }
+    }
+
+public:
+    std::ostringstream stream;
+
+    void print_function(const Function &f) {
+        if (!functions.insert(f.name()).second) {
+            return;
+        }
+        stream << "func " << f.name() << "(";
+        for (const std::string &a : f.args()) {
+            stream << a << ", ";
+        }
+        stream << ") -> {";
+        for (const Type &t : f.output_types()) {
+            stream << t << ", ";
+        }
+        stream << "}\n";
+
+        if (f.has_extern_definition()) {
+            stream << "extern " << f.extern_function_name() << "(";
+            for (const ExternFuncArgument &a : f.extern_arguments()) {
+                if (a.is_func()) {
+                    stream << Function(a.func).name();
+                } else if (a.is_expr()) {
+                    stream << a.expr;
+                } else if (a.is_buffer()) {
+                    stream << a.buffer.name();
+                } else if (a.is_image_param()) {
+                    stream << a.image_param.name();
+                }
+                stream << ", ";
+            }
+            stream << ")\n";
+            for (const ExternFuncArgument &a : f.extern_arguments()) {
+                if (a.is_func()) {
+                    print_function(Function(a.func));
+                } else if (a.is_expr()) {
+                    a.expr.accept(this);
+                }
+            }
+        }
+        if (f.has_pure_definition()) {
+            print_definition(f, f.definition());
+        }
+        for (const Definition &def : f.updates()) {
+            print_definition(f, def);
+        }
+    }
+};
+
+// A 64-bit FNV-1a hash of the algorithm of a Function, as hex.
+std::string algorithm_hash(const Function &function) {
+    PrintAlgorithm printer;
+    printer.print_function(function);
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (char c : printer.stream.str()) {
+        h = (h ^ (uint8_t)c) * 0x100000001b3ULL;
+    }
+    std::ostringstream hex;
+    hex << std::hex << h;
+    return hex.str();
+}
+
 typedef std::pair<FindParameterDependencies::DependencyKey, FindParameterDependencies::DependencyInfo> DependencyKeyInfoPair;
 typedef std::pair<const FindParameterDependencies::DependencyKey, FindParameterDependencies::DependencyInfo> ConstDependencyKeyInfoPair;
 
@@ -153,6 +280,7 @@ class KeyInfo {
     Expr key_size_expr;
     const std::string &top_level_name;
     const std::string &function_name;
+    std::string algorithm;
     int memoize_instance;
 
     size_t parameters_alignment() {
@@ -190,6 +318,7 @@ public:
     KeyInfo(const Function &function, const std::string &name, int memoize_instance)
         : top_level_name(name),
           function_name(function.origin_name()),
+          algorithm(algorithm_hash(function)),
           memoize_instance(memoize_instance) {
         dependencies.visit_function(function);
         size_t size_so_far = 0;
@@ -220,12 +349,16 @@ public:
         Expr index = Expr(0);
 
         // Store a pointer to a string identifying the filter and
-        // function. Assume this will be unique due to CSE. This can
-        // break with loading and unloading of code, though the name
-        // mechanism can also break in those conditions.
+        // function, and a hash of the function's algorithm so that
+        // results kept in a persistent cache file by an older
+        // definition aren't found. Assume this will be unique due to
+        // CSE. This can break with loading and unloading of code,
+        // though the name mechanism can also break in those
+        // conditions.
         writes.push_back(Store::make(key_name,
                                      StringImm::make(std::to_string(top_level_name.size()) + ":" + top_level_name +
-                                                     std::to_string(function_name.size()) + ":" + function_name),
+                                                     std::to_string(function_name.size()) + ":" + function_name +
+                                                     std::to_string(algorithm.size()) + ":" + algorithm),
                                      (index / Handle().bytes()), Parameter(), const_true(), ModulusRemainder()));
         size_t alignment = Handle().bytes();
         index += Handle().bytes();
@@ -61,6 +61,13 @@ std::map<Output, OutputInfo> get_output_info(const Target &target) {
 
 namespace {
 
+// The number of threads to use for LLVM codegen and object emission
+// when compiling several modules at once. Zero means one per core.
+int compile_threads() {
+    std::string n = get_env_variable("HL_COMPILE_THREADS");
+    return n.empty() ? 0 : std::max(1, std::atoi(n.c_str()));
+}
+
 class TemporaryObjectFileDir final {
 public:
     TemporaryObjectFileDir()
@@ -516,6 +523,7 @@ Module Module::resolve_submodules() const {
     for (const auto &ec : external_code()) {
         lowered_module.append(ec);
     }
+    std::vector<Module> copies;
     for (const auto &m : submodules()) {
         Module copy(m.resolve_submodules());
 
@@ -534,7 +542,19 @@ Module Module::resolve_submodules() const {
             }
         }
 
-        auto buf = copy.compile_to_buffer();
+        copies.push_back(copy);
+    }
+
+    // Each submodule is compiled in its own LLVMContext, so they can
+    // be compiled at the same time. The compiler logger is global, so
+    // don't if one is active.
+    std::vector<Buffer<uint8_t>> bufs(copies.size());
+    std::vector<std::function<void()>> tasks;
+    for (size_t i = 0; i < copies.size(); i++) {
+        tasks.emplace_back([&, i]() { bufs[i] = copies[i].compile_to_buffer(); });
+    }
+    run_tasks_in_parallel(std::move(tasks), get_compiler_logger() ? 1 : compile_threads());
+    for (const auto &buf : bufs) {
         lowered_module.append(buf);
     }
     // Copy the autoscheduler results back into the lowered module after resolving the submodules.
@@ -798,6 +818,15 @@ void compile_multitarget(const std::string &fn_name,
     constexpr int kFeaturesWordCount = (Target::FeatureEnd + 63) / (sizeof(uint64_t) * 8);
     uint64_t runtime_features[kFeaturesWordCount] = {(uint64_t)-1LL};
 
+    // Lowering each sub-target isn't thread-safe, but once it's done,
+    // LLVM codegen, optimization and object emission for each
+    // sub-target, the runtime and the wrapper are independent, and
+    // each uses its own LLVMContext. So lower everything first, and
+    // then compile all of it at once. The objects still go into the
+    // library in the same order. The compiler logger is global, so
+    // sub-targets are compiled one at a time if there is one.
+    std::vector<std::function<void()>> compile_tasks;
+
     TemporaryObjectFileDir temp_obj_dir, temp_compiler_log_dir;
     std::vector<Expr> wrapper_args;
     std::vector<LoweredArgument> base_target_args;
@@ -855,7 +884,11 @@ void compile_multitarget(const std::string &fn_name,
                 sub_out[Output::compiler_log] = temp_compiler_log_dir.add_temp_file(output_files.at(Output::static_library), suffix, target);
             }
             debug(1) << "compile_multitarget: compile_sub_target " << sub_out[Output::object] << "\n";
-            sub_module.compile(sub_out);
+            if (compiler_logger_factory) {
+                sub_module.compile(sub_out);
+            } else {
+                compile_tasks.emplace_back([sub_module, sub_out]() { sub_module.compile(sub_out); });
+            }
             auto *r = sub_module.get_auto_scheduler_results();
             auto_scheduler_results.push_back(r ? *r : AutoSchedulerResults());
         }
@@ -908,7 +941,7 @@ void compile_multitarget(const std::string &fn_name,
             {{Output::object,
               temp_obj_dir.add_temp_object_file(output_files.at(Output::static_library), "_runtime", runtime_target)}};
         debug(1) << "compile_multitarget: compile_standalone_runtime " << runtime_out.at(Output::object) << "\n";
-        compile_standalone_runtime(runtime_out, runtime_target);
+        compile_tasks.emplace_back([runtime_out, runtime_target]() { compile_standalone_runtime(runtime_out, runtime_target); });
     }
 
     if (needs_wrapper) {
@@ -941,9 +974,11 @@ void compile_multitarget(const std::string &fn_name,
         std::map<Output, std::string> wrapper_out = {{Output::object,
                                                       temp_obj_dir.add_temp_object_file(output_files.at(Output::static_library), "_wrapper", base_target, /* in_front*/ true)}};
         debug(1) << "compile_multitarget: wrapper " << wrapper_out.at(Output::object) << "\n";
-        wrapper_module.compile(wrapper_out);
+        compile_tasks.emplace_back([wrapper_module, wrapper_out]() { wrapper_module.compile(wrapper_out); });
     }
 
+    run_tasks_in_parallel(std::move(compile_tasks), compile_threads());
+
     if (contains(output_files, Output::c_header)) {
         Module header_module(fn_name, base_target);
         header_module.append(LoweredFunc(fn_name, base_target_args, {}, LinkageType::ExternalPlusMetadata));
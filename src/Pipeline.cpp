@@ -1,5 +1,6 @@
 #include <algorithm>
 #include <atomic>
+#include <thread>
 #include <utility>
 
 #include "Argument.h"
@@ -68,6 +69,19 @@ struct PipelineContents {
     // Cached compiled JavaScript and/or wasm if defined */
     WasmModule wasm_module;
 
+    // A jit compilation started by compile_jit_async, if any
+    std::shared_future<void> pending_jit;
+
+    /** Wait for a jit compilation started by compile_jit_async to
+     * finish, rethrowing any error from it. */
+    void wait_for_pending_jit() {
+        if (pending_jit.valid()) {
+            std::shared_future<void> pending = pending_jit;
+            pending_jit = std::shared_future<void>();
+            pending.get();
+        }
+    }
+
     /** Clear all cached state */
     void invalidate_cache() {
         module = Module("", Target());
@@ -525,7 +539,43 @@ std::string Pipeline::generate_function_name() const {
 
 void Pipeline::compile_jit(const Target &target_arg) {
     user_assert(defined()) << "Pipeline is undefined\n";
+    contents->wait_for_pending_jit();
+    compile_jit_impl(target_arg);
+}
+
+std::shared_future<void> Pipeline::compile_jit_async(const Target &target) {
+    user_assert(defined()) << "Pipeline is undefined\n";
+    contents->wait_for_pending_jit();
+
+    // The compilation runs on a detached thread that holds a
+    // reference to the pipeline until it is done, so that the
+    // pipeline may be dropped while it is being compiled. That
+    // reference may be the last one, which then destroys the
+    // pending future from the compiling thread itself. A future from
+    // std::async would join its thread in its destructor, so use a
+    // plain thread and a promise instead.
+    std::promise<void> promise;
+    contents->pending_jit = promise.get_future().share();
+    Pipeline self = *this;
+    auto compile = [self, target](std::promise<void> promise) mutable {
+#ifdef WITH_EXCEPTIONS
+        try {
+            self.compile_jit_impl(target);
+            promise.set_value();
+        } catch (...) {
+            promise.set_exception(std::current_exception());
+        }
+#else
+        self.compile_jit_impl(target);
+        promise.set_value();
+#endif
+        self = Pipeline();
+    };
+    std::thread(std::move(compile), std::move(promise)).detach();
+    return contents->pending_jit;
+}
 
+void Pipeline::compile_jit_impl(const Target &target_arg) {
     Target target(target_arg);
     target.set_feature(Target::JIT);
     target.set_feature(Target::UserContext);
@@ -623,38 +673,45 @@ void Pipeline::compile_jit(const Target &target_arg) {
 
 void Pipeline::set_error_handler(void (*handler)(void *, const char *)) {
     user_assert(defined()) << "Pipeline is undefined\n";
+    contents->wait_for_pending_jit();
     contents->jit_handlers.custom_error = handler;
 }
 
 void Pipeline::set_custom_allocator(void *(*cust_malloc)(void *, size_t),
                                     void (*cust_free)(void *, void *)) {
     user_assert(defined()) << "Pipeline is undefined\n";
+    contents->wait_for_pending_jit();
     contents->jit_handlers.custom_malloc = cust_malloc;
     contents->jit_handlers.custom_free = cust_free;
 }
 
 void Pipeline::set_custom_do_par_for(int (*cust_do_par_for)(void *, int (*)(void *, int, uint8_t *), int, int, uint8_t *)) {
     user_assert(defined()) << "Pipeline is undefined\n";
+    contents->wait_for_pending_jit();
     contents->jit_handlers.custom_do_par_for = cust_do_par_for;
 }
 
 void Pipeline::set_custom_do_task(int (*cust_do_task)(void *, int (*)(void *, int, uint8_t *), int, uint8_t *)) {
     user_assert(defined()) << "Pipeline is undefined\n";
+    contents->wait_for_pending_jit();
     contents->jit_handlers.custom_do_task = cust_do_task;
 }
 
 void Pipeline::set_custom_trace(int (*trace_fn)(void *, const halide_trace_event_t *)) {
     user_assert(defined()) << "Pipeline is undefined\n";
+    contents->wait_for_pending_jit();
     contents->jit_handlers.custom_trace = trace_fn;
 }
 
 void Pipeline::set_custom_print(void (*cust_print)(void *, const char *)) {
     user_assert(defined()) << "Pipeline is undefined\n";
+    contents->wait_for_pending_jit();
     contents->jit_handlers.custom_print = cust_print;
 }
 
 void Pipeline::set_jit_externs(const std::map<std::string, JITExtern> &externs) {
     user_assert(defined()) << "Pipeline is undefined\n";
+    contents->wait_for_pending_jit();
     contents->jit_externs = externs;
     invalidate_cache();
 }
@@ -666,6 +723,7 @@ const std::map<std::string, JITExtern> &Pipeline::get_jit_externs() {
 
 void Pipeline::add_custom_lowering_pass(IRMutator *pass, std::function<void()> deleter) {
     user_assert(defined()) << "Pipeline is undefined\n";
+    contents->wait_for_pending_jit();
     contents->invalidate_cache();
     CustomLoweringPass p = {pass, std::move(deleter)};
     contents->custom_lowering_passes.push_back(p);
@@ -673,6 +731,7 @@ void Pipeline::add_custom_lowering_pass(IRMutator *pass, std::function<void()> d
 
 void Pipeline::clear_custom_lowering_passes() {
     if (!defined()) return;
+    contents->wait_for_pending_jit();
     contents->clear_custom_lowering_passes();
 }
 
@@ -787,11 +846,13 @@ void Pipeline::add_requirement(const Expr &condition, std::vector<Expr> &error_a
     } checker(condition);
 
     Expr error = Internal::requirement_failed_error(condition, error_args);
+    contents->wait_for_pending_jit();
     contents->requirements.emplace_back(Internal::AssertStmt::make(condition, error));
 }
 
 void Pipeline::trace_pipeline() {
     user_assert(defined()) << "Pipeline is undefined\n";
+    contents->wait_for_pending_jit();
     contents->trace_pipeline = true;
 }
 
@@ -1047,6 +1108,208 @@ int Pipeline::call_jit_code(const Target &target, const JITCallArgs &args) {
     return contents->jit_module.argv_function()(args.store);
 }
 
+namespace Internal {
+
+struct CallableContents {
+    mutable RefCount ref_count;
+
+    // Where each argument of the compiled function comes from.
+    enum class Source {
+        UserContext,  // The JITUserContext made for the call
+        Caller,       // The caller's argument at 'index'
+        Fixed,        // 'address': the value of a Param, or a Buffer used directly
+        BoundBuffer,  // The buffer currently bound to 'param'
+    };
+
+    struct Slot {
+        Source source = Source::Fixed;
+        size_t index = 0;
+        const void *address = nullptr;
+        // Keep whatever 'address' points into alive
+        Parameter param;
+        Buffer<> buffer;
+    };
+
+    // One per argument of the compiled function, in order. The
+    // output buffers follow them.
+    vector<Slot> slots;
+
+    vector<Argument> arguments;
+    int num_outputs = 0;
+
+    Target target;
+    JITModule jit_module;
+    JITModule::argv_wrapper argv_function = nullptr;
+    WasmModule wasm_module;
+    JITHandlers jit_handlers;
+};
+
+template<>
+RefCount &ref_count<CallableContents>(const CallableContents *p) noexcept {
+    return p->ref_count;
+}
+
+template<>
+void destroy<CallableContents>(const CallableContents *p) {
+    delete p;
+}
+
+}  // namespace Internal
+
+Callable::Callable(CallableContents *contents)
+    : contents(contents) {
+}
+
+bool Callable::defined() const {
+    return contents.defined();
+}
+
+const vector<Argument> &Callable::arguments() const {
+    user_assert(defined()) << "Callable is undefined\n";
+    return contents->arguments;
+}
+
+int Callable::num_outputs() const {
+    user_assert(defined()) << "Callable is undefined\n";
+    return contents->num_outputs;
+}
+
+void Callable::check_arg_types(const halide_type_t *types, size_t count) const {
+    user_assert(defined()) << "Can't call an undefined Callable\n";
+    const vector<Argument> &args = contents->arguments;
+    user_assert(count == args.size() + contents->num_outputs)
+        << "Callable takes " << args.size() << " arguments and "
+        << contents->num_outputs << " output buffers, but was called with "
+        << count << " arguments\n";
+    for (size_t i = 0; i < count; i++) {
+        if (i >= args.size()) {
+            user_assert(types[i].bits == 0)
+                << "Argument " << i << " of Callable is output buffer " << i - args.size()
+                << ", but a scalar was passed\n";
+        } else if (args[i].is_buffer()) {
+            user_assert(types[i].bits == 0)
+                << "Argument " << i << " of Callable is buffer " << args[i].name
+                << ", but a scalar was passed\n";
+        } else {
+            user_assert(types[i] == (halide_type_t)args[i].type)
+                << "Argument " << i << " of Callable is scalar " << args[i].name
+                << " of type " << args[i].type << ", but "
+                << (types[i].bits == 0 ? std::string("a buffer") : "a " + type_to_c_type(Type(types[i]), false))
+                << " was passed\n";
+        }
+    }
+}
+
+int Callable::call_argv(const void *const *args) const {
+    user_assert(defined()) << "Can't call an undefined Callable\n";
+    CallableContents &c = *contents;
+
+    // See Pipeline::realize for how the handlers reach the jitted
+    // code through the user context.
+    JITFuncCallContext jit_context(c.jit_handlers);
+    void *user_context_storage = &jit_context.jit_context;
+
+    Pipeline::JITCallArgs call_args(c.slots.size() + c.num_outputs);
+    size_t i = 0;
+    for (const CallableContents::Slot &slot : c.slots) {
+        switch (slot.source) {
+        case CallableContents::Source::UserContext:
+            call_args.store[i] = &user_context_storage;
+            break;
+        case CallableContents::Source::Caller:
+            call_args.store[i] = args[slot.index];
+            break;
+        case CallableContents::Source::Fixed:
+            call_args.store[i] = slot.address;
+            break;
+        case CallableContents::Source::BoundBuffer: {
+            Buffer<> buf = slot.param.buffer();
+            call_args.store[i] = buf.defined() ? buf.raw_buffer() : nullptr;
+            break;
+        }
+        }
+        i++;
+    }
+    for (int j = 0; j < c.num_outputs; j++) {
+        call_args.store[i++] = args[c.arguments.size() + j];
+    }
+
+    int exit_status;
+    if (c.target.arch == Target::WebAssembly) {
+        exit_status = c.wasm_module.run(call_args.store);
+    } else {
+        exit_status = c.argv_function(call_args.store);
+    }
+    jit_context.finalize(exit_status);
+    return exit_status;
+}
+
+Callable Pipeline::compile_to_callable(const vector<Argument> &args, const Target &target) {
+    user_assert(defined()) << "Pipeline is undefined\n";
+    for (const Argument &arg : args) {
+        user_assert(!arg.is_output())
+            << "The arguments to compile_to_callable should not include outputs. "
+            << "Output buffers are passed after the arguments instead.\n";
+    }
+
+    compile_jit(target);
+
+    Callable result(new CallableContents);
+    CallableContents &c = *result.contents;
+    c.arguments = args;
+    c.target = contents->jit_target;
+    c.jit_module = contents->jit_module;
+    c.argv_function = contents->jit_module.argv_function();
+    c.wasm_module = contents->wasm_module;
+    c.jit_handlers = contents->jit_handlers;
+    for (const Function &f : contents->outputs) {
+        c.num_outputs += (int)f.output_types().size();
+    }
+
+    // Work out once where each argument of the compiled function
+    // comes from, so that calls don't have to.
+    vector<bool> used(args.size(), false);
+    for (const InferredArgument &arg : contents->inferred_args) {
+        CallableContents::Slot slot;
+        auto it = std::find_if(args.begin(), args.end(), [&](const Argument &a) {
+            return a.name == arg.arg.name;
+        });
+        if (arg.param.defined() && arg.param.same_as(contents->user_context_arg.param)) {
+            slot.source = CallableContents::Source::UserContext;
+        } else if (it != args.end()) {
+            user_assert(it->is_buffer() == arg.arg.is_buffer() &&
+                        (it->is_buffer() || it->type == arg.arg.type))
+                << "Argument " << it->name << " passed to compile_to_callable doesn't match "
+                << "the pipeline's argument of the same name\n";
+            slot.source = CallableContents::Source::Caller;
+            slot.index = it - args.begin();
+            used[slot.index] = true;
+        } else if (arg.param.defined() && arg.param.is_buffer()) {
+            slot.source = CallableContents::Source::BoundBuffer;
+            slot.param = arg.param;
+        } else if (arg.param.defined()) {
+            slot.source = CallableContents::Source::Fixed;
+            slot.param = arg.param;
+            slot.address = arg.param.scalar_address();
+        } else {
+            internal_assert(arg.buffer.defined());
+            slot.source = CallableContents::Source::Fixed;
+            slot.buffer = arg.buffer;
+            slot.address = arg.buffer.raw_buffer();
+        }
+        c.slots.push_back(slot);
+    }
+
+    for (size_t i = 0; i < args.size(); i++) {
+        if (!used[i]) {
+            user_error << "Argument " << args[i].name << " passed to compile_to_callable "
+                       << "is not used by the pipeline\n";
+        }
+    }
+
+    return result;
+}
+
 void Pipeline::realize(RealizationArg outputs, const Target &t,
                        const ParamMap &param_map) {
     Target target = t;
@@ -1140,7 +1403,7 @@ void Pipeline::realize(RealizationArg outputs, const Target &t,
     debug(2) << "Back from jitted function. Exit status was " << exit_status << "\n";
 
     // If we're profiling, report runtimes and reset profiler stats.
-    if (target.has_feature(Target::Profile)) {
+    if (target.has_feature(Target::Profile) || target.has_feature(Target::ProfileLoops)) {
         JITModule::Symbol report_sym =
             contents->jit_module.find_symbol_by_name("halide_profiler_report");
         JITModule::Symbol reset_sym =
@@ -1287,6 +1550,7 @@ void Pipeline::infer_input_bounds(int x_size, int y_size, int z_size, int w_size
 
 void Pipeline::invalidate_cache() {
     if (defined()) {
+        contents->wait_for_pending_jit();
         contents->invalidate_cache();
     }
 }
@@ -7,7 +7,9 @@
  * pipeline.
  */
 
+#include <future>
 #include <map>
+#include <type_traits>
 #include <vector>
 
 #include "ExternalCode.h"
@@ -90,6 +92,96 @@ struct AutoSchedulerResults {
 
 class Pipeline;
 
+namespace Internal {
+struct CallableContents;
+}  // namespace Internal
+
+/** A pipeline jit-compiled for repeated calls with a fixed argument
+ * signature. Get one from Pipeline::compile_to_callable, and call it
+ * with the arguments in the order given there, followed by the output
+ * buffers. Arguments may be Buffers, Runtime::Buffers, raw
+ * halide_buffer_t pointers, or scalars. A call does none of the work
+ * realize does on every call: no argument inference, no ParamMap
+ * lookups, and no allocation for up to 64 arguments. It checks only
+ * that each argument is of the right kind, and that scalars have the
+ * right type; everything else is left to the checks in the generated
+ * code. */
+class Callable {
+    Internal::IntrusivePtr<Internal::CallableContents> contents;
+
+    friend class Pipeline;
+    explicit Callable(Internal::CallableContents *contents);
+
+    template<typename T>
+    struct IsScalarArg {
+        static constexpr bool value =
+            std::is_arithmetic<T>::value ||
+            (std::is_pointer<T>::value &&
+             !std::is_same<typename std::remove_cv<typename std::remove_pointer<T>::type>::type, halide_buffer_t>::value);
+    };
+
+    static const void *arg_address(const halide_buffer_t *buf) {
+        return buf;
+    }
+
+    template<typename T>
+    static const void *arg_address(const Buffer<T> &buf) {
+        return buf.raw_buffer();
+    }
+
+    template<typename T, int D>
+    static const void *arg_address(const Runtime::Buffer<T, D> &buf) {
+        return buf.raw_buffer();
+    }
+
+    template<typename T, typename std::enable_if<IsScalarArg<T>::value>::type * = nullptr>
+    static const void *arg_address(const T &value) {
+        return &value;
+    }
+
+    // The type of a scalar argument, or a zero-bit type for a buffer.
+    template<typename T, typename std::enable_if<IsScalarArg<T>::value>::type * = nullptr>
+    static halide_type_t arg_type() {
+        return halide_type_of<T>();
+    }
+
+    template<typename T, typename std::enable_if<!IsScalarArg<T>::value>::type * = nullptr>
+    static halide_type_t arg_type() {
+        return halide_type_t();
+    }
+
+    void check_arg_types(const halide_type_t *types, size_t count) const;
+
+public:
+    /** Make an undefined Callable. */
+    Callable() = default;
+
+    bool defined() const;
+
+    /** The arguments that come before the output buffers in a call,
+     * in order. */
+    const std::vector<Argument> &arguments() const;
+
+    /** The number of output buffers that end a call. */
+    int num_outputs() const;
+
+    /** Call the pipeline with one pointer per argument: a
+     * halide_buffer_t * for each buffer, including the outputs, and a
+     * pointer to the value of each scalar. Nothing about the
+     * arguments is checked here. Returns the pipeline's exit status;
+     * errors are reported as they are for realize. */
+    int call_argv(const void *const *args) const;
+
+    /** Call the pipeline with typed arguments. */
+    template<typename... Args>
+    int operator()(const Args &... args) const {
+        const void *argv[] = {arg_address(args)..., nullptr};
+        const halide_type_t types[] = {arg_type<typename std::decay<Args>::type>()..., halide_type_t()};
+        check_arg_types(types, sizeof...(Args));
+        return call_argv(argv);
+    }
+};
+
 using AutoSchedulerFn = std::function<void(const Pipeline &, const Target &, const MachineParams &, AutoSchedulerResults *outputs)>;
 
 /** A class representing a Halide pipeline. Constructed from the Func
@@ -159,6 +251,12 @@ private:
 
     int call_jit_code(const Target &target, const JITCallArgs &args);
 
+    friend class Callable;
+
+    // The body of compile_jit, which doesn't wait for a compilation
+    // started by compile_jit_async.
+    void compile_jit_impl(const Target &target);
+
 public:
     /** Make an undefined Pipeline object. */
     Pipeline();
@@ -328,6 +426,34 @@ public:
      */
     void compile_jit(const Target &target = get_jit_target_from_environment());
 
+    /** Jit compile the pipeline, and return a Callable that calls it
+     * with the given arguments, in order, followed by one buffer per
+     * output. The arguments must include every ImageParam and Param
+     * that should be passed on each call; any others the pipeline
+     * uses take their current bound values on each call, as they do
+     * in realize. The Callable keeps the compiled code alive, and
+     * uses the custom handlers set on this Pipeline when it was
+     * made. */
+    Callable compile_to_callable(const std::vector<Argument> &args,
+                                 const Target &target = get_jit_target_from_environment());
+
+    /** Start jit compiling the pipeline on a background thread, and
+     * return right away. Lowering and LLVM codegen happen on that
+     * thread; realize, infer_input_bounds and compile_jit wait for
+     * it to finish, so calling this early hides some or all of the
+     * compile latency from the first realize. The returned future
+     * becomes ready when compilation is done, and calling get() on
+     * it rethrows any error that stopped it. The pipeline may be
+     * dropped before then, but the program should wait for the future
+     * before it exits. Different Pipelines may be compiled
+     * concurrently this way, but like the rest of its methods, this
+     * one must not be called on a Pipeline (or any Func in it) from
+     * more than one thread at a time. The Pipeline's own setters
+     * (custom handlers, JIT externs, lowering passes, requirements
+     * and tracing) wait for the compilation to finish first, but the
+     * Funcs in it must not be modified until its future is ready. */
+    std::shared_future<void> compile_jit_async(const Target &target = get_jit_target_from_environment());
+
     /** Set the error handler function that be called in the case of
      * runtime errors during halide pipelines. If you are compiling
      * statically, you can also just define your own function with
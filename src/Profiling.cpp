@@ -6,6 +6,7 @@
 #include "CodeGen_Internal.h"
 #include "IRMutator.h"
 #include "IROperator.h"
+#include "IRPrinter.h"
 #include "Profiling.h"
 #include "Scope.h"
 #include "Simplify.h"
@@ -19,18 +20,49 @@ using std::map;
 using std::string;
 using std::vector;
 
+class ContainsLoops : public IRVisitor {
+    using IRVisitor::visit;
+
+    void visit(const For *op) override {
+        result = true;
+    }
+
+public:
+    bool result = false;
+};
+
+bool contains_loops(const Stmt &s) {
+    ContainsLoops c;
+    if (s.defined()) {
+        s.accept(&c);
+    }
+    return c.result;
+}
+
 class InjectProfiling : public IRMutator {
 public:
     map<string, int> indices;  // maps from func name -> index in buffer.
 
-    vector<int> stack;  // What produce nodes are we currently inside of.
+    // What produce nodes (and with profile_loops, loops and
+    // specialization branches) are we currently inside of.
+    vector<int> stack;
 
     string pipeline_name;
 
-    InjectProfiling(const string &pipeline_name)
-        : pipeline_name(pipeline_name) {
+    // Whether to attribute time to loops and specialization branches
+    // as well as to Funcs.
+    bool profile_loops;
+
+    // For loops and branches, the index of the enclosing Func, loop
+    // or branch, and the name to report them by.
+    map<int, int> parents;
+    map<int, string> labels;
+
+    InjectProfiling(const string &pipeline_name, bool profile_loops)
+        : pipeline_name(pipeline_name), profile_loops(profile_loops) {
         indices["overhead"] = 0;
         stack.push_back(0);
+        thread_slot = 0;
     }
 
     map<int, uint64_t> func_stack_current;  // map from func id -> current stack allocation
@@ -48,6 +80,16 @@ private:
 
     bool profiling_memory = true;
 
+    // Whether we're inside code offloaded to a remote processor (the
+    // Hexagon DSP), which reports through its own copy of the global
+    // profiler state rather than the pipeline's instance state.
+    bool remote = false;
+
+    // The slot of the instance state that the current thread reports
+    // its Func through. The thread that calls the pipeline has slot
+    // zero; each parallel task claims one of its own.
+    Expr thread_slot;
+
     // Strip down the tuple name, e.g. f.0 into f
     string normalize_name(const string &name) {
         vector<string> v = split_string(name, ".");
@@ -68,6 +110,52 @@ private:
         return idx;
     }
 
+    int get_region_id(const string &key, const string &label) {
+        map<string, int>::iterator iter = indices.find(key);
+        if (iter != indices.end()) {
+            return iter->second;
+        }
+        int idx = (int)indices.size();
+        indices[key] = idx;
+        parents[idx] = stack.back();
+        labels[idx] = label;
+        return idx;
+    }
+
+    // Name a loop the way print_loop_nest does, trimming the Func
+    // name, stage and any uniqueness suffix from the loop variable.
+    // Loops of update definitions are marked as such.
+    string loop_label(const For *op) {
+        vector<string> parts = split_string(op->name, ".");
+        string var;
+        for (size_t i = 2; i < parts.size(); i++) {
+            if (!var.empty()) {
+                var += ".";
+            }
+            var += parts[i];
+        }
+        var = var.substr(0, var.find('$'));
+
+        std::ostringstream label;
+        label << op->for_type << " " << var;
+        if (parts.size() > 2 && parts[1].size() > 1 && parts[1][0] == 's') {
+            int stage = atoi(parts[1].c_str() + 1);
+            if (stage > 0) {
+                label << " (update " << stage - 1 << ")";
+            }
+        }
+        return label.str();
+    }
+
+    // Attribute the time spent in s to a region of the current Func.
+    Stmt in_region(const string &key, const string &label, const Stmt &s) {
+        int idx = get_region_id(key, label);
+        stack.push_back(idx);
+        Stmt body = mutate(s);
+        stack.pop_back();
+        return Block::make({set_current_func(idx), body, set_current_func(stack.back())});
+    }
+
     Expr compute_allocation_size(const vector<Expr> &extents,
                                  const Expr &condition,
                                  const Type &type,
@@ -201,16 +289,27 @@ private:
             idx = stack.back();
         }
 
-        Expr profiler_token = Variable::make(Int(32), "profiler_token");
-        Expr profiler_state = Variable::make(Handle(), "profiler_state");
+        body = Block::make(set_current_func(idx), body);
 
-        // This call gets inlined and becomes a single store instruction.
-        Expr set_task = Call::make(Int(32), "halide_profiler_set_current_func",
-                                   {profiler_state, profiler_token, idx}, Call::Extern);
+        return ProducerConsumer::make(op->name, op->is_producer, body);
+    }
 
-        body = Block::make(Evaluate::make(set_task), body);
+    Stmt set_current_func(int idx) {
+        // These calls get inlined and become a single store instruction.
+        if (remote) {
+            Expr profiler_token = Variable::make(Int(32), "profiler_token");
+            Expr profiler_state = Variable::make(Handle(), "profiler_state");
+            return Evaluate::make(Call::make(Int(32), "halide_profiler_set_current_func",
+                                             {profiler_state, profiler_token, idx}, Call::Extern));
+        }
+        Expr instance = Variable::make(Handle(), "profiler_instance");
+        return Evaluate::make(Call::make(Int(32), "halide_profiler_set_thread_func",
+                                         {instance, thread_slot, idx}, Call::Extern));
+    }
 
-        return ProducerConsumer::make(op->name, op->is_producer, body);
+    // Mark the current thread as waiting on other threads.
+    Stmt set_waiting() {
+        return set_current_func(halide_profiler_outside_of_halide);
     }
 
     Stmt incr_active_threads() {
@@ -225,38 +324,90 @@ private:
                                          {state}, Call::Extern));
     }
 
+    // Wrap the body of a parallel task so that it claims a thread
+    // slot of its own while it runs.
+    Stmt in_thread_slot(const Stmt &s) {
+        Expr instance = Variable::make(Handle(), "profiler_instance");
+        string slot_name = unique_name("profiler_thread_slot");
+        Expr old_slot = thread_slot;
+        thread_slot = Variable::make(Int(32), slot_name);
+        Stmt body = Block::make({set_current_func(stack.back()),
+                                 mutate(s),
+                                 Evaluate::make(Call::make(Int(32), "halide_profiler_release_thread_slot",
+                                                           {instance, thread_slot}, Call::Extern))});
+        thread_slot = old_slot;
+        Expr acquire = Call::make(Int(32), "halide_profiler_acquire_thread_slot", {instance}, Call::Extern);
+        return LetStmt::make(slot_name, acquire, body);
+    }
+
     Stmt visit_parallel_task(const Stmt &s) {
         if (const Fork *f = s.as<Fork>()) {
             return Fork::make(visit_parallel_task(f->first), visit_parallel_task(f->rest));
         } else if (const Acquire *a = s.as<Acquire>()) {
             return Acquire::make(a->semaphore, a->count, visit_parallel_task(a->body));
-        } else {
+        } else if (remote) {
             return Block::make({incr_active_threads(), mutate(s), decr_active_threads()});
+        } else {
+            return in_thread_slot(s);
+        }
+    }
+
+    // The calling thread waits while parallel tasks run, and then
+    // carries on with the Func it was in.
+    Stmt wait_for_parallel_tasks(const Stmt &s) {
+        if (remote) {
+            return Block::make({decr_active_threads(), s, incr_active_threads()});
+        } else {
+            return Block::make({set_waiting(), s, set_current_func(stack.back())});
+        }
+    }
+
+    Stmt visit(const IfThenElse *op) override {
+        // Branches of a specialization contain loops. Other
+        // conditions aren't worth telling apart.
+        if (!profile_loops ||
+            !(contains_loops(op->then_case) || contains_loops(op->else_case))) {
+            return IRMutator::visit(op);
+        }
+
+        std::ostringstream cond;
+        cond << op->condition;
+        string cond_str = cond.str();
+        if (cond_str.size() > 60) {
+            cond_str = cond_str.substr(0, 57) + "...";
         }
+        string key = std::to_string(stack.back()) + ":" + cond_str;
+        Stmt then_case = in_region(key + ":then", "if " + cond_str, op->then_case);
+        Stmt else_case;
+        if (op->else_case.defined()) {
+            else_case = in_region(key + ":else", "else (not " + cond_str + ")", op->else_case);
+        }
+        return IfThenElse::make(mutate(op->condition), then_case, else_case);
     }
 
     Stmt visit(const Acquire *op) override {
-        Stmt s = visit_parallel_task(op);
-        return Block::make({decr_active_threads(), s, incr_active_threads()});
+        return wait_for_parallel_tasks(visit_parallel_task(op));
     }
 
     Stmt visit(const Fork *op) override {
-        Stmt s = visit_parallel_task(op);
-        return Block::make({decr_active_threads(), s, incr_active_threads()});
+        return wait_for_parallel_tasks(visit_parallel_task(op));
     }
 
     Stmt visit(const For *op) override {
         Stmt body = op->body;
 
         // The for loop indicates a device transition or a
-        // parallel job launch. Decrement the number of active
-        // threads outside the loop, and increment it inside the
-        // body.
-        bool update_active_threads = (op->device_api == DeviceAPI::Hexagon ||
-                                      op->is_unordered_parallel());
-
-        if (update_active_threads) {
-            body = Block::make({incr_active_threads(), body, decr_active_threads()});
+        // parallel job launch.
+        bool on_host = (op->device_api == DeviceAPI::None ||
+                        op->device_api == DeviceAPI::Host);
+        bool parallel = op->is_unordered_parallel() && on_host;
+
+        int region = -1;
+        if (profile_loops && on_host) {
+            // The same loop can appear in several branches of a
+            // specialization, so tell them apart by what encloses them.
+            region = get_region_id(std::to_string(stack.back()) + ":" + op->name, loop_label(op));
+            stack.push_back(region);
         }
 
         // We profile by storing a token to global memory, so don't enter GPU loops
@@ -266,9 +417,12 @@ private:
             // hexagon. We don't support per-func stats remotely,
             // which means we can't do memory accounting.
             bool old_profiling_memory = profiling_memory;
+            bool old_remote = remote;
             profiling_memory = false;
-            body = mutate(body);
+            remote = true;
+            body = Block::make({incr_active_threads(), mutate(body), decr_active_threads()});
             profiling_memory = old_profiling_memory;
+            remote = old_remote;
 
             // Get the profiler state pointer from scratch inside the
             // kernel. There will be a separate copy of the state on
@@ -276,6 +430,9 @@ private:
             Expr get_state = Call::make(Handle(), "halide_profiler_get_state", {}, Call::Extern);
             body = substitute("profiler_state", Variable::make(Handle(), "hvx_profiler_state"), body);
             body = LetStmt::make("hvx_profiler_state", get_state, body);
+        } else if (parallel) {
+            // Each iteration is a task that may run on another thread.
+            body = visit_parallel_task(body);
         } else if (op->device_api == DeviceAPI::None ||
                    op->device_api == DeviceAPI::Host) {
             body = mutate(body);
@@ -283,25 +440,38 @@ private:
             body = op->body;
         }
 
+        if (region >= 0) {
+            stack.pop_back();
+        }
+
         Stmt stmt = For::make(op->name, op->min, op->extent, op->for_type, op->device_api, body);
 
-        if (update_active_threads) {
-            stmt = Block::make({decr_active_threads(), stmt, incr_active_threads()});
+        if (parallel) {
+            stmt = wait_for_parallel_tasks(stmt);
+        } else if (region >= 0) {
+            stmt = Block::make({set_current_func(region), stmt, set_current_func(stack.back())});
         }
         return stmt;
     }
 };
 
-Stmt inject_profiling(Stmt s, const string &pipeline_name) {
-    InjectProfiling profiling(pipeline_name);
+Stmt inject_profiling(Stmt s, const string &pipeline_name, bool profile_loops) {
+    InjectProfiling profiling(pipeline_name, profile_loops);
     s = profiling.mutate(s);
 
     int num_funcs = (int)(profiling.indices.size());
 
     Expr func_names_buf = Variable::make(Handle(), "profiling_func_names");
 
+    Expr instance = Variable::make(Handle(), "profiler_instance");
+
+    Expr func_parents_buf = make_zero(Handle());
+    if (profile_loops) {
+        func_parents_buf = Variable::make(Handle(), "profiling_func_parents");
+    }
+
     Expr start_profiler = Call::make(Int(32), "halide_profiler_pipeline_start",
-                                     {pipeline_name, num_funcs, func_names_buf}, Call::Extern);
+                                     {pipeline_name, num_funcs, func_names_buf, func_parents_buf, instance}, Call::Extern);
 
     Expr get_state = Call::make(Handle(), "halide_profiler_get_state", {}, Call::Extern);
 
@@ -310,7 +480,7 @@ Stmt inject_profiling(Stmt s, const string &pipeline_name) {
     Expr profiler_token = Variable::make(Int(32), "profiler_token");
 
     Expr stop_profiler = Call::make(Handle(), Call::register_destructor,
-                                    {Expr("halide_profiler_pipeline_end"), get_state}, Call::Intrinsic);
+                                    {Expr("halide_profiler_pipeline_end"), instance}, Call::Intrinsic);
 
     bool no_stack_alloc = profiling.func_stack_peak.empty();
     if (!no_stack_alloc) {
@@ -322,15 +492,6 @@ Stmt inject_profiling(Stmt s, const string &pipeline_name) {
         s = Block::make(update_stack, s);
     }
 
-    Expr profiler_state = Variable::make(Handle(), "profiler_state");
-    Stmt incr_active_threads =
-        Evaluate::make(Call::make(Int(32), "halide_profiler_incr_active_threads",
-                                  {profiler_state}, Call::Extern));
-    Stmt decr_active_threads =
-        Evaluate::make(Call::make(Int(32), "halide_profiler_decr_active_threads",
-                                  {profiler_state}, Call::Extern));
-    s = Block::make({incr_active_threads, s, decr_active_threads});
-
     s = LetStmt::make("profiler_pipeline_state", get_pipeline_state, s);
     s = LetStmt::make("profiler_state", get_state, s);
     // If there was a problem starting the profiler, it will call an
@@ -351,8 +512,21 @@ Stmt inject_profiling(Stmt s, const string &pipeline_name) {
                            MemoryType::Auto, {num_funcs}, const_true(), s);
     }
 
+    if (profile_loops) {
+        for (std::pair<string, int> p : profiling.indices) {
+            auto parent = profiling.parents.find(p.second);
+            int parent_idx = parent == profiling.parents.end() ? -1 : parent->second;
+            s = Block::make(Store::make("profiling_func_parents", parent_idx, p.second, Parameter(), const_true(), ModulusRemainder()), s);
+        }
+        s = Block::make(s, Free::make("profiling_func_parents"));
+        s = Allocate::make("profiling_func_parents", Int(32),
+                           MemoryType::Auto, {num_funcs}, const_true(), s);
+    }
+
     for (std::pair<string, int> p : profiling.indices) {
-        s = Block::make(Store::make("profiling_func_names", p.first, p.second, Parameter(), const_true(), ModulusRemainder()), s);
+        auto label = profiling.labels.find(p.second);
+        string name = label == profiling.labels.end() ? p.first : label->second;
+        s = Block::make(Store::make("profiling_func_names", name, p.second, Parameter(), const_true(), ModulusRemainder()), s);
     }
 
     s = Block::make(s, Free::make("profiling_func_names"));
@@ -360,6 +534,11 @@ Stmt inject_profiling(Stmt s, const string &pipeline_name) {
                        MemoryType::Auto, {num_funcs}, const_true(), s);
     s = Block::make(Evaluate::make(stop_profiler), s);
 
+    // The per-call state the profiler samples lives on the stack.
+    const int instance_words = (sizeof(halide_profiler_instance_state) + 7) / 8;
+    s = Allocate::make("profiler_instance", UInt(64),
+                       MemoryType::Stack, {instance_words}, const_true(), s);
+
     return s;
 }
 
@@ -22,6 +22,16 @@
  *   f0:          0.025673ms (42%)
  *   mandelbrot:  0.006444ms (10%)   peak: 505344   num: 104000   avg: 5376
  *   argmin:      0.027715ms (46%)   stack: 20
+ *
+ * With 'host-profile_loops', each Func's time is also broken down by
+ * its loops (including those of update definitions) and the branches
+ * of its specializations. They are listed under the Func, nested and
+ * named as in Func::print_loop_nest, each with the time spent inside
+ * it:
+ *   f:           0.052101ms (87%)
+ *     for y:     0.009220ms (15%)
+ *     for y (update 0): 0.042881ms (71%)
+ *       for x (update 0): 0.040113ms (67%)
  */
 #include <string>
 
@@ -34,10 +44,12 @@ namespace Internal {
  * high-resolution timing into the generated code (via spawning a
  * thread that acts as a sampling profiler); summaries of execution
  * times and counts will be logged at the end. Should be done before
- * storage flattening, but after all bounds inference.
+ * storage flattening, but after all bounds inference. If
+ * profile_loops is true, time is attributed to loops and
+ * specialization branches as well as Funcs.
  *
  */
-Stmt inject_profiling(Stmt, const std::string &);
+Stmt inject_profiling(Stmt, const std::string &, bool profile_loops = false);
 
 }  // namespace Internal
 }  // namespace Halide
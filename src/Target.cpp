@@ -361,6 +361,10 @@ const std::map<std::string, Target::Feature> feature_name_map = {
     {"sve", Target::SVE},
     {"sve2", Target::SVE2},
     {"arm_dot_prod", Target::ARMDotProd},
+    {"profile_loops", Target::ProfileLoops},
+    {"llvm_o1", Target::LLVMO1},
+    {"llvm_o2", Target::LLVMO2},
+    {"fast_compile", Target::FastCompile},
     // NOTE: When adding features to this map, be sure to update PyEnums.cpp as well.
 };
 
@@ -120,6 +120,10 @@ struct Target {
         SVE = halide_target_feature_sve,
         SVE2 = halide_target_feature_sve2,
         ARMDotProd = halide_target_feature_arm_dot_prod,
+        ProfileLoops = halide_target_feature_profile_loops,
+        LLVMO1 = halide_target_feature_llvm_o1,
+        LLVMO2 = halide_target_feature_llvm_o2,
+        FastCompile = halide_target_feature_fast_compile,
         FeatureEnd = halide_target_feature_end
     };
     Target()
@@ -57,6 +57,9 @@ public:
     // The funcs that will have any tracing info emitted (not just trace tags),
     // and the Type(s) of their elements.
     map<string, vector<Type>> funcs_touched;
+    // The funcs whose realizations are counted, to filter their
+    // events to the first few realizations.
+    set<string> realizations_counted;
 
     InjectTracing(const map<string, Function> &e, const Target &t)
         : env(e),
@@ -96,6 +99,52 @@ private:
         }
     }
 
+    // The condition under which an event of the named Func at the
+    // given coordinates passes the filter, or an undefined Expr if
+    // every event does.
+    Expr filter_condition(const string &name, const TraceFilter &filter,
+                          const vector<Expr> &coordinates) {
+        Expr cond;
+        if (filter.max_realizations > 0) {
+            realizations_counted.insert(name);
+            cond = Variable::make(Int(32), name + ".trace_realization") < filter.max_realizations;
+        }
+        if (!filter.region.empty()) {
+            user_assert(filter.region.size() == coordinates.size())
+                << "The region of the trace filter of " << name
+                << " has " << filter.region.size() << " dimensions, but "
+                << name << " has " << coordinates.size() << "\n";
+            for (size_t i = 0; i < coordinates.size(); i++) {
+                const Range &r = filter.region[i];
+                Expr inside = (coordinates[i] >= r.min) && (coordinates[i] < r.min + r.extent);
+                cond = cond.defined() ? (cond && inside) : inside;
+            }
+        }
+        if (filter.sample_rate > 1) {
+            // Mix the coordinates together so that neighboring sites
+            // aren't sampled in a regular pattern.
+            Expr h = make_zero(UInt(32));
+            for (const Expr &c : coordinates) {
+                h = h * make_const(UInt(32), 0x9e3779b1) + cast(UInt(32), c);
+            }
+            Expr shift = make_const(UInt(32), 16);
+            h = (h ^ (h >> shift)) * make_const(UInt(32), 0x45d9f3b);
+            h = h ^ (h >> shift);
+            Expr sampled = (h % make_const(UInt(32), filter.sample_rate)) == make_zero(UInt(32));
+            cond = cond.defined() ? (cond && sampled) : sampled;
+        }
+        return cond;
+    }
+
+    // Only make the trace call if the condition holds.
+    Expr filter_trace(const Expr &cond, const Expr &trace) {
+        if (!cond.defined()) {
+            return trace;
+        }
+        return Call::make(Int(32), Call::if_then_else,
+                          {cond, trace, make_zero(Int(32))}, Call::PureIntrinsic);
+    }
+
     using IRMutator::visit;
 
     Expr visit(const Call *op) override {
@@ -104,6 +153,7 @@ private:
         internal_assert(op);
         bool trace_it = false;
         Expr trace_parent;
+        Expr filter;
         if (op->call_type == Call::Halide) {
             auto it = env.find(op->name);
             internal_assert(it != env.end()) << op->name << " not in environment\n";
@@ -114,6 +164,7 @@ private:
             trace_parent = Variable::make(Int(32), op->name + ".trace_id");
             if (trace_it) {
                 add_trace_tags(op->name, f.get_trace_tags());
+                filter = filter_condition(op->name, f.load_trace_filter(), op->args);
             }
         } else if (op->call_type == Call::Image) {
             trace_it = trace_all_loads;
@@ -151,7 +202,7 @@ private:
             builder.event = halide_trace_load;
             builder.parent_id = trace_parent;
             builder.value_index = op->value_index;
-            Expr trace = builder.build();
+            Expr trace = filter_trace(filter, builder.build());
 
             expr = Let::make(value_var_name, op,
                              Call::make(op->type, Call::return_second,
@@ -176,6 +227,21 @@ private:
             const vector<Expr> &values = op->values;
             vector<Expr> traces(op->values.size());
 
+            // Lift the args out into lets so that the order of
+            // evaluation is right for scatters. Otherwise the store
+            // is traced before any loads in the index.
+            vector<Expr> args = op->args;
+            vector<pair<string, Expr>> lets;
+            for (size_t i = 0; i < args.size(); i++) {
+                if (!args[i].as<Variable>() && !is_const(args[i])) {
+                    string name = unique_name('t');
+                    lets.emplace_back(name, args[i]);
+                    args[i] = Variable::make(args[i].type(), name);
+                }
+            }
+
+            Expr filter = filter_condition(f.name(), f.store_trace_filter(), args);
+
             TraceEventBuilder builder;
             builder.func = f.name();
             builder.coordinates = op->args;
@@ -190,26 +256,13 @@ private:
                 builder.type = t;
                 builder.value_index = (int)i;
                 builder.value = {value_var};
-                Expr trace = builder.build();
+                Expr trace = filter_trace(filter, builder.build());
 
                 traces[i] = Let::make(value_var_name, values[i],
                                       Call::make(t, Call::return_second,
                                                  {trace, value_var}, Call::PureIntrinsic));
             }
 
-            // Lift the args out into lets so that the order of
-            // evaluation is right for scatters. Otherwise the store
-            // is traced before any loads in the index.
-            vector<Expr> args = op->args;
-            vector<pair<string, Expr>> lets;
-            for (size_t i = 0; i < args.size(); i++) {
-                if (!args[i].as<Variable>() && !is_const(args[i])) {
-                    string name = unique_name('t');
-                    lets.emplace_back(name, args[i]);
-                    args[i] = Variable::make(args[i].type(), name);
-                }
-            }
-
             stmt = Provide::make(op->name, traces, args);
             for (const auto &p : lets) {
                 stmt = LetStmt::make(p.first, p.second, stmt);
@@ -226,6 +279,21 @@ private:
         map<string, Function>::const_iterator iter = env.find(op->name);
         if (iter == env.end()) return stmt;
         Function f = iter->second;
+
+        if (realizations_counted.count(op->name)) {
+            // Number the realizations, for the filters of the loads
+            // and stores. The count starts at zero in each run of the
+            // pipeline.
+            string counter = op->name + ".trace_realizations";
+            string index = op->name + ".trace_realization";
+            Expr count = Load::make(Int(32), counter, 0, Buffer<>(), Parameter(), const_true(), ModulusRemainder());
+            Stmt increment = Store::make(counter, Variable::make(Int(32), index) + 1, 0,
+                                         Parameter(), const_true(), ModulusRemainder());
+            Stmt new_body = Block::make(increment, op->body);
+            new_body = LetStmt::make(index, count, new_body);
+            stmt = Realize::make(op->name, op->types, op->memory_type, op->bounds, op->condition, new_body);
+            op = stmt.as<Realize>();
+        }
         if (f.is_tracing_realizations() || trace_all_realizations) {
             add_trace_tags(op->name, f.get_trace_tags());
             for (size_t i = 0; i < op->types.size(); i++) {
@@ -346,6 +414,13 @@ Stmt inject_tracing(Stmt s, const string &pipeline_name, bool trace_pipeline,
     // Strip off the dummy realize blocks
     s = RemoveRealizeOverOutput(outputs).mutate(s);
 
+    // Allocate the realization counters used by trace filters
+    for (const string &name : tracing.realizations_counted) {
+        string counter = name + ".trace_realizations";
+        s = Block::make(Store::make(counter, 0, 0, Parameter(), const_true(), ModulusRemainder()), s);
+        s = Allocate::make(counter, Int(32), MemoryType::Stack, {}, const_true(), s);
+    }
+
     if (!s.same_as(original) || trace_pipeline || t.has_feature(Target::TracePipeline)) {
         // Add pipeline start and end events
         TraceEventBuilder builder;
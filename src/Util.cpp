@@ -2,9 +2,11 @@
 #include "Debug.h"
 #include "Error.h"
 #include "Introspection.h"
+#include "ThreadPool.h"
 #include <atomic>
 #include <chrono>
 #include <fstream>
+#include <future>
 #include <iomanip>
 #include <map>
 #include <mutex>
@@ -113,8 +115,15 @@ const int num_unique_name_counters = (1 << 14);
 // this is a global, which is always zero-initialized.
 std::atomic<int> unique_name_counters[num_unique_name_counters] = {};
 
+// The counters used instead of the ones above by a task run by
+// run_tasks_in_parallel.
+thread_local std::vector<int> *task_unique_name_counters = nullptr;
+
 int unique_count(size_t h) {
     h = h & (num_unique_name_counters - 1);
+    if (task_unique_name_counters) {
+        return (*task_unique_name_counters)[h]++;
+    }
     return unique_name_counters[h]++;
 }
 }  // namespace
@@ -177,6 +186,80 @@ string unique_name(const std::string &prefix) {
     return sanitized + "$" + std::to_string(count);
 }
 
+void run_tasks_in_parallel(std::vector<std::function<void()>> tasks, int num_threads) {
+    // Snapshot the counters of whoever is calling, which may itself
+    // be such a task.
+    std::vector<int> initial_counters(num_unique_name_counters);
+    for (int i = 0; i < num_unique_name_counters; i++) {
+        initial_counters[i] = task_unique_name_counters ? (*task_unique_name_counters)[i] : unique_name_counters[i].load();
+    }
+
+    struct UseCounters {
+        std::vector<int> *old;
+        UseCounters(std::vector<int> *c)
+            : old(task_unique_name_counters) {
+            task_unique_name_counters = c;
+        }
+        ~UseCounters() {
+            task_unique_name_counters = old;
+        }
+    };
+
+    std::vector<std::vector<int>> counters(tasks.size(), initial_counters);
+    std::vector<std::packaged_task<void()>> jobs;
+    std::vector<std::future<void>> results;
+    for (size_t i = 0; i < tasks.size(); i++) {
+        std::vector<int> *c = &counters[i];
+        std::function<void()> task = std::move(tasks[i]);
+        jobs.emplace_back([c, task]() {
+            UseCounters use(c);
+            task();
+        });
+        results.push_back(jobs.back().get_future());
+    }
+
+    if (num_threads <= 0) {
+        num_threads = (int)ThreadPool<void>::num_processors_online();
+    }
+    num_threads = std::min(num_threads, (int)jobs.size());
+    if (num_threads <= 1) {
+        for (auto &job : jobs) {
+            job();
+        }
+    } else {
+        ThreadPool<void> pool(num_threads);
+        for (auto &job : jobs) {
+            std::packaged_task<void()> *j = &job;
+            pool.async([j]() { (*j)(); });
+        }
+        // The pool only finishes the jobs it has already started
+        // when it is destroyed, so wait for them all here.
+        for (auto &r : results) {
+            r.wait();
+        }
+    }
+
+    for (int i = 0; i < num_unique_name_counters; i++) {
+        int c = initial_counters[i];
+        for (const auto &task_counters : counters) {
+            c = std::max(c, task_counters[i]);
+        }
+        if (task_unique_name_counters) {
+            (*task_unique_name_counters)[i] = c;
+        } else {
+            // Other threads may be making names too, so only ever
+            // move the counter forwards.
+            int current = unique_name_counters[i].load();
+            while (current < c && !unique_name_counters[i].compare_exchange_weak(current, c)) {
+            }
+        }
+    }
+
+    for (auto &r : results) {
+        r.get();
+    }
+}
+
 bool starts_with(const string &str, const string &prefix) {
     if (str.size() < prefix.size()) return false;
     for (size_t i = 0; i < prefix.size(); i++) {
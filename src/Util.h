@@ -15,6 +15,7 @@
 
 #include <cstdint>
 #include <cstring>
+#include <functional>
 #include <limits>
 #include <string>
 #include <utility>
@@ -149,6 +150,17 @@ std::string unique_name(char prefix);
 std::string unique_name(const std::string &prefix);
 // @}
 
+/** Run the given tasks, up to num_threads at a time (or one per core
+ * if num_threads is zero), and wait for all of them. Every task sees
+ * unique_name's counters as they were when this was called, and
+ * afterwards they are advanced past every name any task made, so the
+ * names a task makes are the same however the tasks interleave, and
+ * however many threads there are. Names made by different tasks may
+ * coincide, so tasks should only use them in their own outputs. If
+ * any task fails, the error of the first one in the list to fail is
+ * rethrown once they have all finished. */
+void run_tasks_in_parallel(std::vector<std::function<void()>> tasks, int num_threads = 0);
+
 /** Test if the first string starts with the second string */
 bool starts_with(const std::string &str, const std::string &prefix);
 
@@ -673,6 +673,18 @@ class VectorSubs : public IRMutator {
                 }
             }
             return Call::make(op->type, Call::trace, new_args, op->call_type);
+        } else if (op->is_intrinsic(Call::if_then_else) &&
+                   op->args[1].as<Call>() &&
+                   op->args[1].as<Call>()->name == Call::trace) {
+            // A trace call guarded by a trace filter. The trace call
+            // makes a single event for the whole vector, so make it
+            // if the filter passes any of the lanes.
+            Expr cond = new_args[0];
+            if (cond.type().is_vector()) {
+                cond = VectorReduce::make(VectorReduce::Or, cond, 1);
+            }
+            return Call::make(op->type, Call::if_then_else,
+                              {cond, new_args[1], new_args[2]}, Call::PureIntrinsic);
         } else {
             // Widen the args to have the same lanes as the max lanes found
             for (size_t i = 0; i < new_args.size(); i++) {
@@ -158,6 +158,11 @@ extern int halide_do_par_for(void *user_context,
 extern void halide_shutdown_thread_pool();
 //@}
 
+/** Release the threads of just one thread pool. (The call above shuts
+ * down every pool.) The pool keeps its name and settings and starts
+ * up again when it is next used. */
+extern void halide_shutdown_thread_pool_by_id(int pool);
+
 /** Set a custom method for performing a parallel for loop. Returns
  * the old do_par_for handler. */
 typedef int (*halide_do_par_for_t)(void *, halide_task_t, int, int, uint8_t *);
@@ -305,6 +310,29 @@ extern int halide_default_semaphore_release(struct halide_semaphore_t *, int n);
 extern bool halide_default_semaphore_try_acquire(struct halide_semaphore_t *, int n);
 // @}
 
+/** Run a task on Halide's thread pool without waiting for it, and
+ * return straight away. The task is typically a small wrapper that
+ * calls an AOT-compiled pipeline with arguments packed into arg. It
+ * runs on the pool chosen for user_context (see
+ * halide_set_thread_pool), and the parallel loops inside it share
+ * that pool's workers with everything else running there. When it
+ * finishes, done (if not NULL) is released once and then callback (if
+ * not NULL) is called with its return value, both on the worker
+ * thread that ran it. Returns an error code if the task could not be
+ * enqueued. halide_shutdown_thread_pool drains the pool first: every
+ * task already enqueued runs, and gets its callback, before it
+ * returns. Don't enqueue tasks from other threads while it runs. On
+ * platforms without a thread pool the task runs immediately on the
+ * calling thread.
+ */
+// @{
+typedef int (*halide_async_task_t)(void *user_context, void *arg);
+typedef void (*halide_async_callback_t)(void *user_context, void *arg, int result);
+extern int halide_do_async(void *user_context, halide_async_task_t task, void *arg,
+                           halide_async_callback_t callback,
+                           struct halide_semaphore_t *done);
+// @}
+
 struct halide_thread;
 
 /** Spawn a thread. Returns a handle to the thread for the purposes of
@@ -329,6 +357,92 @@ extern void halide_join_thread(struct halide_thread *);
  */
 extern int halide_set_num_threads(int n);
 
+/** Create a named thread pool with its own worker threads, separate
+ * from the default pool, and return its id (a positive number) or a
+ * negative error code. Use halide_set_thread_pool to send a
+ * pipeline's parallel work to it, so that, for example, a big batch
+ * job cannot starve a latency-sensitive one of threads. num_threads
+ * has the same meaning as in halide_set_num_threads. priority is the
+ * nice value its workers run at on Linux (higher is less urgent); it
+ * applies to workers started afterwards, and is ignored on other
+ * platforms. Workers of named pools are never pinned to CPUs. Calling
+ * this again with the same name returns the same pool, after updating
+ * its thread count and priority. At most seven pools can be created.
+ */
+extern int halide_create_thread_pool(const char *name, int num_threads, int priority);
+
+/** Run all the parallel work of pipelines invoked with the given
+ * user_context on the given pool: an id from
+ * halide_create_thread_pool, or 0 for the default pool. Returns the
+ * pool the user_context was bound to before, or a negative error
+ * code. The user_context must not be NULL. */
+extern int halide_set_thread_pool(void *user_context, int pool);
+
+/** As halide_set_num_threads, but for the given pool. */
+extern int halide_set_num_threads_in_pool(int pool, int n);
+
+/** Enable or disable work stealing in Halide's thread pool. When
+ * enabled, the iterations of each halide_do_par_for call are split
+ * into one contiguous range per worker thread. Workers claim
+ * iterations from their own range without taking the thread pool
+ * lock, and steal half of another worker's remaining range when their
+ * own runs dry. The default is read from the HL_WORK_STEALING
+ * environment variable. Returns whether work stealing was previously
+ * enabled. (As with halide_set_num_threads, this only affects the
+ * default implementation of halide_do_par_for.)
+ */
+extern int halide_set_work_stealing(int enable);
+
+/** Enable or disable NUMA awareness in the runtime. When enabled on
+ * Linux, thread pool workers are dealt out round-robin to the NUMA
+ * nodes listed under /sys/devices/system/node and pinned to their
+ * node's CPUs. Each halide_do_par_for loop is split into one
+ * contiguous block of iterations per node. Workers steal from their
+ * own node before stealing from others. halide_default_malloc serves
+ * large allocations from fresh pages, so each page is placed on the
+ * node that first writes to it. The default is read from the HL_NUMA
+ * environment variable. The thread pool reads this setting when it
+ * starts, so change it before running any pipeline or after
+ * halide_shutdown_thread_pool. Returns whether NUMA awareness was
+ * previously enabled. Has no effect on other platforms.
+ */
+extern int halide_set_numa_aware(int enable);
+
+/** Serve host allocations of at least this many bytes made by
+ * halide_default_malloc from mappings aligned to the 2MB huge page
+ * size and marked with madvise(MADV_HUGEPAGE), so that large
+ * intermediate buffers need far fewer TLB entries. Zero or a negative
+ * value turns this off. The default is read from the
+ * HL_HUGE_PAGE_THRESHOLD environment variable, and is off if that is
+ * unset. The number of huge page allocations and their peak size is
+ * reported by halide_profiler_report. Returns the previous threshold,
+ * or zero if it was off. Only supported on Linux; elsewhere this does
+ * nothing and returns zero.
+ */
+extern int64_t halide_set_huge_page_threshold(int64_t bytes);
+
+/** Choose how the thread pool pins its worker threads to CPUs. The
+ * policy is one of:
+ *
+ * "none"   : workers may run anywhere (unless NUMA awareness is on).
+ * "core"   : each worker runs on one physical core (any of its SMT
+ *            siblings), with consecutive workers on different sockets.
+ * "smt"    : each worker runs on one hardware thread. Every core gets
+ *            one worker before any core gets a second.
+ * "socket" : workers are dealt out round-robin to sockets.
+ * a cpulist such as "0-7,16-23" : every worker may run on any of those
+ *            CPUs and no others.
+ *
+ * The default is read from the HL_THREAD_AFFINITY environment
+ * variable. The thread pool reads this setting when it starts, so
+ * change it before running any pipeline or after
+ * halide_shutdown_thread_pool. The resulting placement is reported
+ * through halide_profiler_state. Returns an error code if the policy
+ * is not recognized. Only supported on Linux; elsewhere this does
+ * nothing.
+ */
+extern int halide_set_thread_affinity(const char *policy);
+
 /** Halide calls these functions to allocate and free memory. To
  * replace in AOT code, use the halide_set_custom_malloc and
  * halide_set_custom_free, or (on platforms that support weak
@@ -357,6 +471,21 @@ extern halide_malloc_t halide_set_custom_malloc(halide_malloc_t user_malloc);
 extern halide_free_t halide_set_custom_free(halide_free_t user_free);
 //@}
 
+/** The default host allocator keeps freed blocks of up to 256KB on
+ * free lists, by power-of-two size class, and hands them out again
+ * instead of going back to the system allocator. The free lists are
+ * split between threads, and how much each holds is bounded. This
+ * turns that pooling on or off; turning it off also releases all
+ * unused pooled blocks. The default is on, unless the
+ * HL_HOST_ALLOCATION_POOL environment variable is 0. Has no effect
+ * with a custom allocator, or on platforms with their own default
+ * allocator (such as Hexagon). */
+extern int halide_reuse_host_allocations(void *user_context, bool flag);
+
+/** Return all unused pooled host allocations to the system
+ * allocator, leaving pooling on. */
+extern int halide_release_unused_host_allocations(void *user_context);
+
 /** Halide calls these functions to interact with the underlying
  * system runtime functions. To replace in AOT code on platforms that
  * support weak linking, define these functions yourself, or use
@@ -674,6 +803,26 @@ struct halide_trace_packet_t {
 #endif
 };
 
+/** The marker that starts each block of a compressed binary trace. It
+ * is odd, so it can't be mistaken for the size of a packet. */
+#define HALIDE_TRACE_BLOCK_MAGIC 0x48345a01
+
+/** The header of a block in a compressed binary trace, which is
+ * written when HL_TRACE_COMPRESS=1 is set. Such a trace is a sequence
+ * of blocks, each holding a run of whole packets compressed in the LZ4
+ * block format. The compressed bytes follow the header directly. All
+ * fields are 32-bit. */
+struct halide_trace_block_header_t {
+    /** Always HALIDE_TRACE_BLOCK_MAGIC. */
+    uint32_t magic;
+
+    /** The size of the packets once decompressed. */
+    uint32_t raw_size;
+
+    /** The number of compressed bytes after the header. */
+    uint32_t compressed_size;
+};
+
 /** Set the file descriptor that Halide should write binary trace
  * events to. If called with 0 as the argument, Halide outputs trace
  * information to stdout in a human-readable format. If never called,
@@ -692,7 +841,10 @@ extern void halide_set_trace_file(int fd);
 extern int halide_get_trace_file(void *user_context);
 
 /** If tracing is writing to a file. This call closes that file
- * (flushing the trace). Returns zero on success. */
+ * (flushing the trace). Returns zero on success. Binary traces are
+ * buffered and written out by a background thread, except where the
+ * runtime can't start threads or HL_TRACE_ASYNC=0 is set. They are
+ * flushed at the end of each pipeline. */
 extern int halide_shutdown_trace();
 
 /** All Halide GPU or device backend implementations provide an
@@ -869,6 +1021,82 @@ extern int halide_get_gpu_device(void *user_context);
  */
 extern void halide_memoization_cache_set_size(int64_t size);
 
+/** How the memoization cache chooses what to evict once it is full.
+ * LRU evicts the least recently used results first. Cost-per-byte
+ * evicts the results that took the least time to compute for their
+ * size first, so that a large result that is cheap to recompute
+ * doesn't push out a small expensive one. */
+typedef enum halide_memoization_cache_eviction_policy_t {
+    halide_memoization_cache_evict_lru = 1,
+    halide_memoization_cache_evict_cost_per_byte = 2,
+} halide_memoization_cache_eviction_policy_t;
+
+/** Set the memoization cache eviction policy to one of the above, and
+ * return the old one (or an error code). The default is LRU, unless
+ * the HL_MEMOIZATION_CACHE_POLICY environment variable is "cost". */
+extern int halide_memoization_cache_set_eviction_policy(int policy);
+
+/** Statistics about one memoized Func, identified by its name and the
+ * name of the pipeline that computes it. */
+struct halide_memoization_cache_func_stats_t {
+    const char *pipeline_name;
+    const char *func_name;
+    /** Lookups that found a result, and lookups that didn't. */
+    uint64_t hits, misses;
+    /** Results of this Func evicted to make room. */
+    uint64_t evictions;
+    /** Bytes of this Func's results currently in the cache. */
+    int64_t bytes;
+    /** The sum of the compute times of the results returned by hits,
+     * i.e. roughly the time the cache saved. */
+    int64_t time_saved_ns;
+};
+
+/** The same statistics for the cache as a whole, plus its size limit,
+ * and how many of the hits were served by the persistent file. */
+struct halide_memoization_cache_stats_t {
+    uint64_t hits, misses, evictions;
+    int64_t bytes, max_bytes;
+    int64_t time_saved_ns;
+    uint64_t persistent_hits;
+};
+
+/** Get the memoization cache statistics since it was created or last
+ * reset. Fills in the totals (if stats is not NULL) and the first
+ * max_funcs per-Func entries, in the order the Funcs were first looked
+ * up. Returns the number of Funcs seen, which may be more than
+ * max_funcs. The name strings remain valid until
+ * halide_memoization_cache_cleanup. */
+extern int halide_memoization_cache_get_stats(struct halide_memoization_cache_stats_t *stats,
+                                              struct halide_memoization_cache_func_stats_t *funcs,
+                                              int max_funcs);
+
+/** Zero the hit, miss, eviction and time saved counts. */
+extern void halide_memoization_cache_reset_stats();
+
+/** Use the file at path as a second tier of the memoization cache that
+ * outlives the process. Results that miss in memory are looked up in
+ * the file, and returned without copying straight from where it is
+ * mapped. Newly computed results are appended to it. Processes
+ * sharing the file see each other's results. If the file doesn't
+ * exist it is created max_size bytes long (zero means 64MB); once it
+ * is full, no more results are added. A file written by an
+ * incompatible runtime is replaced. Passing NULL closes the file. If
+ * results from the current file are still in use, it is left open and
+ * an error is returned. If never called, the HL_MEMOIZATION_CACHE_FILE and
+ * HL_MEMOIZATION_CACHE_FILE_SIZE environment variables are used. Only
+ * supported on Linux, Android and OS X; elsewhere this returns an
+ * error. Results that live on a device are not persisted. */
+extern int halide_memoization_cache_set_persistent_file(const char *path, int64_t max_size);
+
+/** Results stored in the persistent file are only found again by
+ * pipelines that have the same name and the same version, and by
+ * memoized Funcs whose algorithm (including the Funcs they call) is
+ * unchanged. Bump the version when results change for another reason,
+ * e.g. an extern stage called by a memoized Func computes something
+ * different. The default version is zero. */
+extern int halide_memoization_cache_set_pipeline_version(const char *pipeline_name, uint64_t version);
+
 /** Given a cache key for a memoized result, currently constructed
  *  from the Func name and top-level Func name plus the arguments of
  *  the computation, determine if the result is in the cache and
@@ -926,8 +1154,9 @@ extern int halide_memoization_cache_store(void *user_context, const uint8_t *cac
   */
 extern void halide_memoization_cache_release(void *user_context, void *host);
 
-/** Free all memory and resources associated with the memoization cache.
- * Must be called at a time when no other threads are accessing the cache.
+/** Free all memory and resources associated with the memoization cache,
+ * and close its persistent file, if any. Must be called at a time when
+ * no other threads are accessing the cache.
  */
 extern void halide_memoization_cache_cleanup();
 
@@ -1315,8 +1544,12 @@ typedef enum halide_target_feature_t {
     halide_target_feature_sve2,                   ///< Enable ARM Scalable Vector Extensions v2
     halide_target_feature_egl,                    ///< Force use of EGL support.
 
-    halide_target_feature_arm_dot_prod,  ///< Enable ARMv8.2-a dotprod extension (i.e. udot and sdot instructions)
-    halide_target_feature_end            ///< A sentinel. Every target is considered to have this feature, and setting this feature does nothing.
+    halide_target_feature_arm_dot_prod,   ///< Enable ARMv8.2-a dotprod extension (i.e. udot and sdot instructions)
+    halide_target_feature_profile_loops,  ///< Like halide_target_feature_profile, but also report the time spent in each loop, update definition and specialization of each Func
+    halide_target_feature_llvm_o1,        ///< Optimize with LLVM's O1 pipeline instead of O3. (Ignored for non-LLVM targets.)
+    halide_target_feature_llvm_o2,        ///< Optimize with LLVM's O2 pipeline instead of O3. Can't be combined with llvm_o1 or fast_compile. (Ignored for non-LLVM targets.)
+    halide_target_feature_fast_compile,   ///< Compile faster at some cost in runtime: LLVM's O1 pipeline without loop optimizations or SLP vectorization, and a less aggressive backend. (Ignored for non-LLVM targets.)
+    halide_target_feature_end             ///< A sentinel. Every target is considered to have this feature, and setting this feature does nothing.
 } halide_target_feature_t;
 
 /** This function is called internally by Halide in some situations to determine
@@ -1666,6 +1899,27 @@ void halide_register_argv_and_metadata(
  * the -profile target flag, which runs a sampling profiler thread
  * alongside the pipeline. */
 
+/** The number of buckets in a halide_profiler_histogram. */
+enum { halide_profiler_histogram_buckets = 256 };
+
+/** A log-scale histogram of durations in nanoseconds. Each power of
+ * two is split into four buckets, so a bucket's bounds are within 25%
+ * of each other. Use halide_profiler_get_latency to read percentiles
+ * from it. */
+struct halide_profiler_histogram {
+    /** The number of durations recorded. */
+    uint64_t count;
+
+    /** The longest duration recorded. */
+    uint64_t max;
+
+    uint64_t buckets[halide_profiler_histogram_buckets];
+};
+
+/** The most events the profiler counts per Func. See
+ * halide_profiler_state::perf_counters. */
+enum { halide_profiler_max_counters = 4 };
+
 /** Per-Func state tracked by the sampling profiler. */
 struct halide_profiler_func_stats {
     /** Total time taken evaluating this Func (in nanoseconds). */
@@ -1691,6 +1945,21 @@ struct halide_profiler_func_stats {
 
     /** The total number of memory allocation of this Func. */
     int num_allocs;
+
+    /** With the profile_loops target feature, a Func's loops and
+     * specialization branches have entries of their own. For those,
+     * this is the index of the enclosing Func, loop or branch; for
+     * Funcs it is -1. */
+    int parent;
+
+    /** The time spent in this Func in each call to the pipeline, or
+     * NULL unless halide_profiler_state::func_histograms is set. */
+    struct halide_profiler_histogram *latency;
+
+    /** The number of each of the events named by
+     * halide_profiler_state::counter_names that occurred while
+     * threads were computing this Func. */
+    uint64_t counters[halide_profiler_max_counters];
 };
 
 /** Per-pipeline state tracked by the sampling profiler. These exist
@@ -1736,6 +2005,65 @@ struct halide_profiler_pipeline_stats {
 
     /** The total number of memory allocation of funcs in this pipeline. */
     int num_allocs;
+
+    /** The wall time of each call to this pipeline. Recorded when
+     * the call returns, so it doesn't depend on sampling. */
+    struct halide_profiler_histogram latency;
+};
+
+/** Where a thread pool worker has been pinned. See
+ * halide_set_thread_affinity. */
+struct halide_thread_placement_t {
+    /** The lowest-numbered CPU the worker may run on, or -1 if it
+     * was not pinned. */
+    int cpu;
+
+    /** The number of CPUs the worker may run on. */
+    int num_cpus;
+
+    /** The physical core and socket of that CPU, numbered densely from
+     * zero, or -1 if the worker was not pinned. */
+    int core, socket;
+};
+
+/** The most threads whose current Func can be told apart within one
+ * running pipeline. Threads beyond this share a single slot. */
+enum { halide_profiler_max_thread_slots = 256 };
+
+/** The state of one call to a pipeline compiled with -profile. It
+ * lives on the pipeline's stack, and is linked into the profiler's
+ * list of instances for the duration of the call, so that concurrent
+ * calls (of the same or different pipelines) are each sampled on
+ * their own. */
+struct halide_profiler_instance_state {
+    /** The pipeline this is a call to. */
+    struct halide_profiler_pipeline_stats *pipeline;
+
+    /** The next running instance. It's a void * because types
+     * in the Halide runtime may not currently be recursive. */
+    void *next;
+
+    /** Which of the slots below are claimed by a thread, one bit per
+     * slot. */
+    uint64_t slots_in_use[halide_profiler_max_thread_slots / 64];
+
+    /** The Func each thread working on this call is currently
+     * computing, as an index into pipeline->funcs, or
+     * halide_profiler_outside_of_halide while it waits on other
+     * threads. Slot zero belongs to the thread that called the
+     * pipeline; each parallel task claims another for as long as it
+     * runs. */
+    int current_func[halide_profiler_max_thread_slots];
+
+    /** When the call started, as given by halide_current_time_ns. */
+    uint64_t start_time;
+
+    /** The time billed to each Func during this call, if per-Func
+     * histograms are being kept, and NULL otherwise. */
+    uint64_t *func_time;
+
+    /** Whether threads count events when they change Func. */
+    int perf_counters;
 };
 
 /** The global state of the profiler. */
@@ -1747,17 +2075,21 @@ struct halide_profiler_state {
     struct halide_mutex lock;
 
     /** The amount of time the profiler thread sleeps between samples
-     * in milliseconds. Defaults to 1 */
+     * in milliseconds. Defaults to 1. Ignored if sleep_time_us is
+     * set. */
     int sleep_time;
 
     /** An internal id used for bookkeeping. */
     int first_free_id;
 
-    /** The id of the current running Func. Set by the pipeline, read
-     * periodically by the profiler thread. */
+    /** The id of the current running Func. Only set by code running
+     * on a remote processor such as the Hexagon DSP (on its own copy
+     * of this state); host code reports through
+     * halide_profiler_instance_state. */
     int current_func;
 
-    /** The number of threads currently doing work. */
+    /** The number of threads currently doing work. As with
+     * current_func, only used by remote code. */
     int active_threads;
 
     /** A linked list of stats gathered for each pipeline. */
@@ -1770,11 +2102,45 @@ struct halide_profiler_state {
 
     /** Sampling thread reference to be joined at shutdown. */
     struct halide_thread *sampling_thread;
+
+    /** Where the thread pool's workers were pinned, indexed by worker,
+     * or NULL if they were not. Refreshed whenever a pipeline starts. */
+    int num_worker_threads;
+    const struct halide_thread_placement_t *worker_placement;
+
+    /** A linked list of the pipeline calls currently running. */
+    struct halide_profiler_instance_state *instances;
+
+    /** If non-zero, the time the profiler thread sleeps between
+     * samples in microseconds. The default is read from the
+     * HL_PROFILER_SAMPLE_INTERVAL_US environment variable when the
+     * profiler thread starts. */
+    int sleep_time_us;
+
+    /** If non-zero, keep a histogram per Func of the time spent in it
+     * in each call, as well as one per pipeline. The default is read
+     * from the HL_PROFILER_FUNC_HISTOGRAMS environment variable when
+     * the profiler thread starts. */
+    int func_histograms;
+
+    /** If non-zero, each thread reads event counters whenever it
+     * changes Func, and bills the events since the last change to the
+     * Func it was in. Hardware events are counted if the kernel
+     * allows it, and software events (such as page faults) if not.
+     * Only supported on Linux. The default is read from the
+     * HL_PROFILER_COUNTERS environment variable when the profiler
+     * thread starts. */
+    int perf_counters;
+
+    /** The events counted per Func, or zero if none are. */
+    int num_counters;
+    const char *counter_names[halide_profiler_max_counters];
 };
 
 /** Profiler func ids with special meanings. */
 enum {
-    /// current_func takes on this value when not inside Halide code
+    /// current_func takes on this value when not inside Halide code,
+    /// and a thread slot while its thread waits for others
     halide_profiler_outside_of_halide = -1,
     /// Set current_func to this value to tell the profiling thread to
     /// halt. It will start up again next time you run a pipeline with
@@ -1809,6 +2175,38 @@ void halide_profiler_shutdown();
  * reset. Also happens at process exit. */
 extern void halide_profiler_report(void *user_context);
 
+/** Percentiles of the durations in a halide_profiler_histogram, in
+ * nanoseconds. Each is the upper bound of the bucket it falls in. */
+struct halide_profiler_latency_t {
+    uint64_t count;
+    uint64_t p50, p90, p99, max;
+};
+
+/** Get percentiles of the wall time of each call to the named
+ * pipeline, or with a func_name, of the time spent in that Func in
+ * each call (which requires halide_profiler_state::func_histograms).
+ * Returns halide_error_code_generic_error if the pipeline or Func has
+ * no histogram. */
+extern int halide_profiler_get_latency(const char *pipeline_name, const char *func_name,
+                                       struct halide_profiler_latency_t *latency);
+
+/** Choose how halide_profiler_report, and the report at process exit,
+ * present their results. The format is one of:
+ * - "text", the default table;
+ * - "json", the pipeline and Func stats, including memory use;
+ * - "csv", the Func stats as one row each;
+ * - "folded", a line per Func with its stack of enclosing Funcs and
+ *   loops and the time spent in it, for flame graph tools;
+ * - "chrome_trace", trace events for chrome://tracing or Perfetto,
+ *   showing what each thread was doing over time. The timeline is
+ *   only recorded while this format is selected.
+ * If filename is non-NULL the report replaces the contents of that
+ * file, otherwise it goes through halide_print. Unless this is called
+ * first, the format and file are read from the HL_PROFILER_FORMAT
+ * and HL_PROFILER_FILE environment variables when the first profiled
+ * pipeline starts. Returns an error code if the format is unknown. */
+extern int halide_profiler_set_output(void *user_context, const char *format, const char *filename);
+
 /// \name "Float16" functions
 /// These functions operate of bits (``uint16_t``) representing a half
 /// precision floating point number (IEEE-754 2008 binary16).
@@ -1864,6 +2262,12 @@ extern bool halide_can_reuse_device_allocations(void *user_context);
 struct halide_device_allocation_pool {
     int (*release_unused)(void *user_context);
     struct halide_device_allocation_pool *next;
+    /** The number of bytes of unused device memory the pool is holding
+     * on to. Maintained by the pool with relaxed atomic adds, and read
+     * by halide_get_runtime_metrics. Pools that don't track it leave
+     * it zero. CUDA's is the only pool built into the runtime; other
+     * device APIs free their allocations straight away. */
+    int64_t cached_bytes;
 };
 
 /** Register a callback to be informed when
@@ -1872,6 +2276,52 @@ struct halide_device_allocation_pool {
  * global lifetime, and its next field will be clobbered. */
 extern void halide_register_device_allocation_pool(struct halide_device_allocation_pool *);
 
+/** A snapshot of the health of the runtime, for monitoring. The thread
+ * pool figures are summed over all thread pools. Host memory is only
+ * counted when it comes from halide_default_malloc, so none is counted
+ * while a custom allocator is in use. */
+struct halide_runtime_metrics_t {
+    /** The number of thread pools, including the default one. */
+    int thread_pools;
+    /** The number of worker threads started. */
+    int threads_created;
+    /** The number of workers and of job owners waiting for work. */
+    int workers_sleeping, owners_sleeping;
+    /** The number of threads committed to jobs that may block. */
+    int threads_reserved;
+    /** The number of jobs enqueued with work no thread has claimed yet. */
+    int queued_jobs;
+
+    /** The bytes handed out by halide_default_malloc and not yet freed,
+     * and the number of allocations they are in. */
+    int64_t host_live_bytes, host_live_allocations;
+    /** The bytes of freed host allocations kept for reuse. */
+    int64_t host_pooled_bytes;
+
+    /** As in halide_memoization_cache_stats_t. */
+    uint64_t cache_hits, cache_misses, cache_evictions;
+    int64_t cache_bytes, cache_max_bytes;
+
+    /** The number of device allocation pools registered, and the bytes
+     * of unused device memory they hold. Of the built-in device APIs,
+     * only CUDA has a pool, so only CUDA memory is counted here. */
+    int device_allocation_pools;
+    int64_t device_pooled_bytes;
+};
+
+/** Fill in a snapshot of the runtime metrics. Cheap enough to call
+ * periodically while pipelines are running: the counters it reads are
+ * maintained with relaxed atomics, and it takes each lock only long
+ * enough to read the fields it protects. Returns zero. */
+extern int halide_get_runtime_metrics(void *user_context, struct halide_runtime_metrics_t *metrics);
+
+/** Format a snapshot of the runtime metrics in the Prometheus text
+ * exposition format, into buf, which holds size bytes. The output is
+ * always null-terminated, and truncated if it doesn't fit. Returns the
+ * number of characters written, not counting the null. */
+extern int halide_format_runtime_metrics(void *user_context, const struct halide_runtime_metrics_t *metrics,
+                                         char *buf, int size);
+
 #ifdef __cplusplus
 }  // End extern "C"
 #endif
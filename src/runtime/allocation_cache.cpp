@@ -1,5 +1,6 @@
 #include "HalideRuntime.h"
 #include "runtime_internal.h"
+#include "runtime_metrics.h"
 #include "scoped_mutex_lock.h"
 
 namespace Halide {
@@ -11,6 +12,16 @@ WEAK bool halide_reuse_device_allocations_flag = true;
 WEAK halide_mutex allocation_pools_lock;
 WEAK halide_device_allocation_pool *device_allocation_pools = NULL;
 
+WEAK void get_device_allocation_metrics(halide_runtime_metrics_t *metrics) {
+    metrics->device_allocation_pools = 0;
+    metrics->device_pooled_bytes = 0;
+    ScopedMutexLock lock(&allocation_pools_lock);
+    for (halide_device_allocation_pool *p = device_allocation_pools; p != NULL; p = p->next) {
+        metrics->device_allocation_pools++;
+        metrics->device_pooled_bytes += __atomic_load_n(&p->cached_bytes, __ATOMIC_RELAXED);
+    }
+}
+
 }  // namespace Internal
 }  // namespace Runtime
 }  // namespace Halide
@@ -1,7 +1,9 @@
 #include "HalideRuntime.h"
 #include "device_buffer_utils.h"
+#include "file_mapping.h"
 #include "printer.h"
 #include "scoped_mutex_lock.h"
+#include "scoped_spin_lock.h"
 
 namespace Halide {
 namespace Runtime {
@@ -80,6 +82,18 @@ struct CacheEntry {
     halide_dimension_t *computed_bounds;
     // The actual stored data.
     halide_buffer_t *buf;
+    // Which entry of func_stats this result belongs to, or -1.
+    int32_t func_index;
+    // How long the result took to compute, and its size. Used by the
+    // cost-per-byte eviction policy and the statistics.
+    int64_t compute_ns;
+    int64_t bytes;
+    // The shard's entries in the order the cost-per-byte policy evicts
+    // them, cheapest first, and when this one was last stored or hit
+    // by the cache_clock, to order entries of equal cost.
+    CacheEntry *cheaper;
+    CacheEntry *costlier;
+    uint32_t last_used;
 
     bool init(const uint8_t *cache_key, size_t cache_key_size,
               uint32_t key_hash,
@@ -92,13 +106,17 @@ struct CacheEntry {
 struct CacheBlockHeader {
     CacheEntry *entry;
     uint32_t hash;
+    int32_t func_index;
+    // When the lookup that missed handed out this block, so the store
+    // can tell how long the result took to compute.
+    int64_t start_ns;
 };
 
 // Each host block has extra space to store a header just before the
 // contents. This block must respect the same alignment as
 // halide_malloc, because it offsets the return value from
-// halide_malloc. The header holds the cache key hash and pointer to
-// the hash entry.
+// halide_malloc. The header holds the cache key hash, pointer to the
+// hash entry, and what the statistics need to know about the miss.
 WEAK __attribute((always_inline)) size_t header_bytes() {
     size_t s = sizeof(CacheBlockHeader);
     size_t mask = halide_malloc_alignment() - 1;
@@ -119,6 +137,12 @@ WEAK bool CacheEntry::init(const uint8_t *cache_key, size_t cache_key_size,
     hash = key_hash;
     in_use_count = 0;
     tuple_count = tuples;
+    func_index = -1;
+    compute_ns = 0;
+    bytes = 0;
+    cheaper = NULL;
+    costlier = NULL;
+    last_used = 0;
     dimensions = computed_bounds_buf->dimensions;
 
     // Allocate all the necessary space (or die)
@@ -184,52 +208,370 @@ WEAK uint32_t djb_hash(const uint8_t *key, size_t key_size) {
     return h;
 }
 
-WEAK halide_mutex memoization_lock = {{0}};
+// Counters for one memoized Func (or for the whole cache). Updated
+// with relaxed atomics, as they're only statistics. Not every 32-bit
+// target has lock-free 64-bit atomics, so there they are updated (and
+// read) under stats_lock instead.
+#ifdef BITS_64
+WEAK void count_stat(uint64_t *counter, uint64_t n = 1) {
+    __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+WEAK void count_stat(int64_t *counter, int64_t n) {
+    __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+#else
+WEAK ScopedSpinLock::AtomicFlag stats_lock = 0;
+
+WEAK void count_stat(uint64_t *counter, uint64_t n = 1) {
+    ScopedSpinLock lock(&stats_lock);
+    *counter += n;
+}
+
+WEAK void count_stat(int64_t *counter, int64_t n) {
+    ScopedSpinLock lock(&stats_lock);
+    *counter += n;
+}
+#endif
+
+#define MAX_MEMOIZED_FUNCS 256
+
+// Per-Func statistics, in the order the Funcs were first seen. Funcs
+// beyond MAX_MEMOIZED_FUNCS are only counted in the totals. The names
+// are owned by the table.
+WEAK halide_memoization_cache_func_stats_t func_stats[MAX_MEMOIZED_FUNCS];
+WEAK int num_func_stats = 0;
+WEAK halide_mutex func_stats_lock = {{0}};
+
+WEAK halide_memoization_cache_stats_t total_stats;
+
+WEAK char *copy_key_string(const char *str, size_t len) {
+    char *result = (char *)malloc(len + 1);
+    if (result) {
+        memcpy(result, str, len);
+        result[len] = 0;
+    }
+    return result;
+}
+
+// Read one "<length>:<chars>" field of the name string of a cache
+// key, as written by KeyInfo::generate_key in src/Memoization.cpp.
+WEAK bool parse_key_string(const char *&pos, const char **str, size_t *len) {
+    size_t n = 0;
+    const char *p = pos;
+    while (*p >= '0' && *p <= '9') {
+        n = n * 10 + (*p - '0');
+        p++;
+    }
+    if (p == pos || *p != ':') {
+        return false;
+    }
+    for (size_t i = 1; i <= n; i++) {
+        if (p[i] == 0) {
+            return false;
+        }
+    }
+    *str = p + 1;
+    *len = n;
+    pos = p + 1 + n;
+    return true;
+}
+
+// The string naming the pipeline and Func a cache key belongs to. The
+// key starts with a pointer to it.
+WEAK const char *key_names(const uint8_t *cache_key, int32_t key_size) {
+    if ((size_t)key_size < sizeof(const char *)) {
+        return NULL;
+    }
+    const char *names;
+    memcpy(&names, cache_key, sizeof(names));
+    return names;
+}
+
+// Maps the name string a cache key points to (see key_names) to its
+// entry of func_stats, so that finding the statistics of a Func on
+// every lookup takes neither func_stats_lock nor a string compare.
+// Open addressed by the address of the string. Slots are only filled
+// in, under func_stats_lock, with the index stored before the name
+// pointer is published, so they can be read without the lock.
+#define FUNC_STATS_INDEX_SLOTS 1024
+
+struct FuncStatsIndexSlot {
+    const char *names;
+    int32_t func_index;
+};
+
+WEAK FuncStatsIndexSlot func_stats_index[FUNC_STATS_INDEX_SLOTS];
+
+WEAK __attribute((always_inline)) uint32_t func_stats_index_start(const char *names) {
+    uintptr_t p = (uintptr_t)names;
+    return (uint32_t)((p >> 3) ^ (p >> 13)) % FUNC_STATS_INDEX_SLOTS;
+}
+
+// Returns false if the names string has no slot yet.
+WEAK bool find_func_stats_index(const char *names, int32_t *func_index) {
+    uint32_t slot = func_stats_index_start(names);
+    for (int i = 0; i < FUNC_STATS_INDEX_SLOTS; i++) {
+        FuncStatsIndexSlot &s = func_stats_index[slot];
+        const char *n = __atomic_load_n(&s.names, __ATOMIC_ACQUIRE);
+        if (n == names) {
+            *func_index = s.func_index;
+            return true;
+        } else if (n == NULL) {
+            return false;
+        }
+        slot = (slot + 1) % FUNC_STATS_INDEX_SLOTS;
+    }
+    return false;
+}
+
+// Must be called with func_stats_lock held. If the index is full, the
+// names string just keeps taking the slow path.
+WEAK void add_func_stats_index(const char *names, int32_t func_index) {
+    uint32_t slot = func_stats_index_start(names);
+    for (int i = 0; i < FUNC_STATS_INDEX_SLOTS; i++) {
+        FuncStatsIndexSlot &s = func_stats_index[slot];
+        if (s.names == names) {
+            return;
+        } else if (s.names == NULL) {
+            s.func_index = func_index;
+            __atomic_store_n(&s.names, names, __ATOMIC_RELEASE);
+            return;
+        }
+        slot = (slot + 1) % FUNC_STATS_INDEX_SLOTS;
+    }
+}
+
+// Find (or add) the statistics entry of the Func named by a cache key
+// name string. Must be called with func_stats_lock held. Returns -1 if
+// the string can't be parsed or the table is full.
+WEAK int32_t find_func_stats_already_locked(const char *names) {
+    const char *pos = names;
+    const char *pipeline, *func;
+    size_t pipeline_len, func_len;
+    if (!parse_key_string(pos, &pipeline, &pipeline_len) ||
+        !parse_key_string(pos, &func, &func_len)) {
+        return -1;
+    }
+
+    for (int i = 0; i < num_func_stats; i++) {
+        const halide_memoization_cache_func_stats_t &f = func_stats[i];
+        if (strncmp(f.pipeline_name, pipeline, pipeline_len) == 0 &&
+            f.pipeline_name[pipeline_len] == 0 &&
+            strncmp(f.func_name, func, func_len) == 0 &&
+            f.func_name[func_len] == 0) {
+            return i;
+        }
+    }
+    if (num_func_stats == MAX_MEMOIZED_FUNCS) {
+        return -1;
+    }
+    halide_memoization_cache_func_stats_t &f = func_stats[num_func_stats];
+    memset(&f, 0, sizeof(f));
+    f.pipeline_name = copy_key_string(pipeline, pipeline_len);
+    f.func_name = copy_key_string(func, func_len);
+    if (!f.pipeline_name || !f.func_name) {
+        free((void *)f.pipeline_name);
+        free((void *)f.func_name);
+        return -1;
+    }
+    return num_func_stats++;
+}
+
+// Find (or add) the statistics entry of the Func a cache key belongs
+// to. Returns -1 if the key can't be parsed or the table is full.
+WEAK int32_t find_func_stats(const uint8_t *cache_key, int32_t key_size) {
+    const char *names = key_names(cache_key, key_size);
+    if (!names) {
+        return -1;
+    }
+    int32_t func_index;
+    if (find_func_stats_index(names, &func_index)) {
+        return func_index;
+    }
+    ScopedMutexLock lock(&func_stats_lock);
+    func_index = find_func_stats_already_locked(names);
+    add_func_stats_index(names, func_index);
+    return func_index;
+}
+
+WEAK halide_memoization_cache_func_stats_t *get_func_stats(int32_t func_index) {
+    return func_index >= 0 ? &func_stats[func_index] : NULL;
+}
+
+WEAK void count_hit(CacheEntry *entry) {
+    count_stat(&total_stats.hits);
+    count_stat(&total_stats.time_saved_ns, entry->compute_ns);
+    if (halide_memoization_cache_func_stats_t *f = get_func_stats(entry->func_index)) {
+        count_stat(&f->hits);
+        count_stat(&f->time_saved_ns, entry->compute_ns);
+    }
+}
 
-const size_t kHashTableSize = 256;
+WEAK void count_miss(int32_t func_index) {
+    count_stat(&total_stats.misses);
+    if (halide_memoization_cache_func_stats_t *f = get_func_stats(func_index)) {
+        count_stat(&f->misses);
+    }
+}
 
-WEAK CacheEntry *cache_entries[kHashTableSize];
+// Account for an entry entering (sign 1) or leaving (sign -1) the
+// cache.
+WEAK void count_entry_bytes(CacheEntry *entry, int64_t sign) {
+    count_stat(&total_stats.bytes, sign * entry->bytes);
+    if (halide_memoization_cache_func_stats_t *f = get_func_stats(entry->func_index)) {
+        count_stat(&f->bytes, sign * entry->bytes);
+    }
+}
+
+WEAK void count_eviction(CacheEntry *entry) {
+    count_stat(&total_stats.evictions);
+    if (halide_memoization_cache_func_stats_t *f = get_func_stats(entry->func_index)) {
+        count_stat(&f->evictions);
+    }
+    count_entry_bytes(entry, -1);
+}
+
+// Zero means not yet decided, in which case HL_MEMOIZATION_CACHE_POLICY
+// is consulted the first time the cache needs to evict.
+WEAK int eviction_policy = 0;
+
+WEAK int get_eviction_policy() {
+    int policy = __atomic_load_n(&eviction_policy, __ATOMIC_RELAXED);
+    if (policy == 0) {
+        policy = halide_memoization_cache_evict_lru;
+        const char *env = getenv("HL_MEMOIZATION_CACHE_POLICY");
+        if (env && strcmp(env, "cost") == 0) {
+            policy = halide_memoization_cache_evict_cost_per_byte;
+        }
+        __atomic_store_n(&eviction_policy, policy, __ATOMIC_RELAXED);
+    }
+    return policy;
+}
+
+// Whether an entry that took a_ns to compute and holds a_bytes is a
+// better candidate for eviction than one that took b_ns and holds
+// b_bytes under the cost-per-byte policy, i.e. it saves less compute
+// time per byte.
+WEAK bool cheaper_per_byte(int64_t a_ns, int64_t a_bytes, int64_t b_ns, int64_t b_bytes) {
+    // Compare a_ns / a_bytes < b_ns / b_bytes without dividing.
+    return (double)a_ns * (double)b_bytes < (double)b_ns * (double)a_bytes;
+}
 
-WEAK CacheEntry *most_recently_used = NULL;
-WEAK CacheEntry *least_recently_used = NULL;
+// Counts stores and hits across all shards, so that when entries were
+// last used can be compared between shards. It wraps around, so stamps
+// are compared by their difference.
+WEAK uint32_t cache_clock = 0;
+
+WEAK __attribute((always_inline)) uint32_t tick_cache_clock() {
+    return __atomic_add_fetch(&cache_clock, 1, __ATOMIC_RELAXED);
+}
+
+// Whether the cost-per-byte policy should evict a before b: a saves
+// less compute time per byte, or the same and was used less recently.
+WEAK bool evict_before(const CacheEntry *a, const CacheEntry *b) {
+    if (cheaper_per_byte(a->compute_ns, a->bytes, b->compute_ns, b->bytes)) {
+        return true;
+    } else if (cheaper_per_byte(b->compute_ns, b->bytes, a->compute_ns, a->bytes)) {
+        return false;
+    }
+    return (int32_t)(a->last_used - b->last_used) < 0;
+}
+
+// The cache is split into shards by key hash, each with its own lock,
+// hash buckets and LRU chain, so that threads looking up unrelated
+// keys don't contend. The size limit applies to the cache as a whole.
+const size_t kCacheShards = 16;
+const size_t kBucketsPerShard = 16;
+
+struct CacheShard {
+    halide_mutex lock;
+    CacheEntry *entries[kBucketsPerShard];
+    CacheEntry *most_recently_used;
+    CacheEntry *least_recently_used;
+    // The head of the chain of entries ordered by evict_before.
+    CacheEntry *cheapest;
+    // Bytes of buffer data held by the entries of this shard.
+    int64_t current_size;
+} __attribute__((aligned(64)));
+
+WEAK CacheShard cache_shards[kCacheShards];
+
+WEAK __attribute((always_inline)) CacheShard &shard_for_hash(uint32_t h) {
+    return cache_shards[h % kCacheShards];
+}
+
+WEAK __attribute((always_inline)) CacheEntry *&bucket_for_hash(CacheShard &shard, uint32_t h) {
+    return shard.entries[(h / kCacheShards) % kBucketsPerShard];
+}
 
 const uint64_t kDefaultCacheSize = 1 << 20;
-WEAK int64_t max_cache_size = kDefaultCacheSize;
-WEAK int64_t current_cache_size = 0;
+// Pointer-sized, so that these are cheap atomics on every target.
+WEAK size_t max_cache_size = kDefaultCacheSize;
+// The sum of the shards' current_size. Updated atomically, as it is
+// changed under different shard locks.
+WEAK size_t current_cache_size = 0;
+
+WEAK __attribute((always_inline)) bool cache_over_budget() {
+    return __atomic_load_n(&current_cache_size, __ATOMIC_RELAXED) >
+           __atomic_load_n(&max_cache_size, __ATOMIC_RELAXED);
+}
+
+WEAK __attribute((always_inline)) void add_to_cache_size(CacheShard &shard, int64_t bytes) {
+    shard.current_size += bytes;
+    __atomic_fetch_add(&current_cache_size, (size_t)bytes, __ATOMIC_RELAXED);
+}
 
 #if CACHE_DEBUGGING
-WEAK void validate_cache() {
-    print(NULL) << "validating cache, "
-                << "current size " << current_cache_size
+WEAK void validate_cache(CacheShard &shard) {
+    print(NULL) << "validating cache shard " << (int)(&shard - cache_shards) << ", "
+                << "current size " << shard.current_size
+                << ", total " << current_cache_size
                 << " of maximum " << max_cache_size << "\n";
     int entries_in_hash_table = 0;
-    for (size_t i = 0; i < kHashTableSize; i++) {
-        CacheEntry *entry = cache_entries[i];
+    for (size_t i = 0; i < kBucketsPerShard; i++) {
+        CacheEntry *entry = shard.entries[i];
         while (entry != NULL) {
             entries_in_hash_table++;
-            if (entry->more_recent == NULL && entry != most_recently_used) {
+            if (entry->more_recent == NULL && entry != shard.most_recently_used) {
                 halide_print(NULL, "cache invalid case 1\n");
                 __builtin_trap();
             }
-            if (entry->less_recent == NULL && entry != least_recently_used) {
+            if (entry->less_recent == NULL && entry != shard.least_recently_used) {
                 halide_print(NULL, "cache invalid case 2\n");
                 __builtin_trap();
             }
+            if (&shard_for_hash(entry->hash) != &shard) {
+                halide_print(NULL, "cache entry in wrong shard\n");
+                __builtin_trap();
+            }
             entry = entry->next;
         }
     }
     int entries_from_mru = 0;
-    CacheEntry *mru_chain = most_recently_used;
+    CacheEntry *mru_chain = shard.most_recently_used;
     while (mru_chain != NULL) {
         entries_from_mru++;
         mru_chain = mru_chain->less_recent;
     }
     int entries_from_lru = 0;
-    CacheEntry *lru_chain = least_recently_used;
+    CacheEntry *lru_chain = shard.least_recently_used;
     while (lru_chain != NULL) {
         entries_from_lru++;
         lru_chain = lru_chain->more_recent;
     }
+    int entries_by_cost = 0;
+    for (CacheEntry *e = shard.cheapest; e != NULL; e = e->costlier) {
+        entries_by_cost++;
+        if (e->costlier != NULL && evict_before(e->costlier, e)) {
+            halide_print(NULL, "cache cost chain out of order\n");
+            __builtin_trap();
+        }
+    }
+    if (entries_in_hash_table != entries_by_cost) {
+        halide_print(NULL, "cache invalid case 5\n");
+        __builtin_trap();
+    }
     print(NULL) << "hash entries " << entries_in_hash_table
                 << ", mru entries " << entries_from_mru
                 << ", lru entries " << entries_from_lru << "\n";
@@ -241,69 +583,643 @@ WEAK void validate_cache() {
         halide_print(NULL, "cache invalid case 4\n");
         __builtin_trap();
     }
-    if (current_cache_size < 0) {
+    if (shard.current_size < 0) {
         halide_print(NULL, "cache size is negative\n");
         __builtin_trap();
     }
 }
 #endif
 
-WEAK void prune_cache() {
+// Link entry into the shard's cost chain just after prev, or at the
+// head if prev is NULL. Must be called with the shard locked.
+WEAK void link_by_cost_after(CacheShard &shard, CacheEntry *entry, CacheEntry *prev) {
+    entry->cheaper = prev;
+    entry->costlier = prev ? prev->costlier : shard.cheapest;
+    if (entry->costlier) {
+        entry->costlier->cheaper = entry;
+    }
+    if (prev) {
+        prev->costlier = entry;
+    } else {
+        shard.cheapest = entry;
+    }
+}
+
+WEAK void unlink_by_cost(CacheShard &shard, CacheEntry *entry) {
+    if (entry->cheaper) {
+        entry->cheaper->costlier = entry->costlier;
+    } else {
+        shard.cheapest = entry->costlier;
+    }
+    if (entry->costlier) {
+        entry->costlier->cheaper = entry->cheaper;
+    }
+    entry->cheaper = entry->costlier = NULL;
+}
+
+// Add a new entry to the shard's cost chain. Must be called with the
+// shard locked.
+WEAK void add_by_cost(CacheShard &shard, CacheEntry *entry) {
+    entry->last_used = tick_cache_clock();
+    CacheEntry *prev = NULL;
+    for (CacheEntry *e = shard.cheapest; e != NULL && evict_before(e, entry); e = e->costlier) {
+        prev = e;
+    }
+    link_by_cost_after(shard, entry, prev);
+}
+
+// Mark an entry as just used. Its cost doesn't change, so it can only
+// move past entries of the same cost. Must be called with the shard
+// locked.
+WEAK void touch_by_cost(CacheShard &shard, CacheEntry *entry) {
+    entry->last_used = tick_cache_clock();
+    CacheEntry *prev = entry;
+    while (prev->costlier && evict_before(prev->costlier, entry)) {
+        prev = prev->costlier;
+    }
+    if (prev != entry) {
+        unlink_by_cost(shard, entry);
+        link_by_cost_after(shard, entry, prev);
+    }
+}
+
+WEAK void evict_cache_entry(CacheShard &shard, CacheEntry *entry) {
+    CacheEntry *more_recent = entry->more_recent;
+
+    // Remove from hash table
+    CacheEntry *&bucket = bucket_for_hash(shard, entry->hash);
+    CacheEntry *prev_hash_entry = bucket;
+    if (prev_hash_entry == entry) {
+        bucket = entry->next;
+    } else {
+        while (prev_hash_entry != NULL && prev_hash_entry->next != entry) {
+            prev_hash_entry = prev_hash_entry->next;
+        }
+        halide_assert(NULL, prev_hash_entry != NULL);
+        prev_hash_entry->next = entry->next;
+    }
+
+    // Remove from less recent chain.
+    if (shard.least_recently_used == entry) {
+        shard.least_recently_used = more_recent;
+    }
+    if (more_recent != NULL) {
+        more_recent->less_recent = entry->less_recent;
+    }
+
+    // Remove from more recent chain.
+    if (shard.most_recently_used == entry) {
+        shard.most_recently_used = entry->less_recent;
+    }
+    if (entry->less_recent != NULL) {
+        entry->less_recent->more_recent = more_recent;
+    }
+
+    unlink_by_cost(shard, entry);
+
+    // Decrease cache used amount.
+    add_to_cache_size(shard, -entry->bytes);
+    count_eviction(entry);
+
+    // Deallocate the entry.
+    entry->destroy();
+    halide_free(NULL, entry);
+}
+
+WEAK bool entry_in_use(CacheEntry *entry) {
+    return __atomic_load_n(&entry->in_use_count, __ATOMIC_ACQUIRE) != 0;
+}
+
+// Evict unused entries of one shard, least recently used first, until
+// the cache as a whole fits. Must be called with the shard locked.
+WEAK void prune_cache_shard(CacheShard &shard) {
 #if CACHE_DEBUGGING
-    validate_cache();
+    validate_cache(shard);
 #endif
-    CacheEntry *prune_candidate = least_recently_used;
-    while (current_cache_size > max_cache_size &&
+    CacheEntry *prune_candidate = shard.least_recently_used;
+    while (cache_over_budget() &&
            prune_candidate != NULL) {
         CacheEntry *more_recent = prune_candidate->more_recent;
+        if (!entry_in_use(prune_candidate)) {
+            evict_cache_entry(shard, prune_candidate);
+        }
+        prune_candidate = more_recent;
+    }
+#if CACHE_DEBUGGING
+    validate_cache(shard);
+#endif
+}
 
-        if (prune_candidate->in_use_count == 0) {
-            uint32_t h = prune_candidate->hash;
-            uint32_t index = h % kHashTableSize;
-
-            // Remove from hash table
-            CacheEntry *prev_hash_entry = cache_entries[index];
-            if (prev_hash_entry == prune_candidate) {
-                cache_entries[index] = prune_candidate->next;
-            } else {
-                while (prev_hash_entry != NULL && prev_hash_entry->next != prune_candidate) {
-                    prev_hash_entry = prev_hash_entry->next;
-                }
-                halide_assert(NULL, prev_hash_entry != NULL);
-                prev_hash_entry->next = prune_candidate->next;
-            }
+// The cheapest unused entry of a shard under the cost-per-byte
+// policy, or NULL. Must be called with the shard locked.
+WEAK CacheEntry *cheapest_unused(CacheShard &shard) {
+    for (CacheEntry *e = shard.cheapest; e != NULL; e = e->costlier) {
+        if (!entry_in_use(e)) {
+            return e;
+        }
+    }
+    return NULL;
+}
 
-            // Remove from less recent chain.
-            if (least_recently_used == prune_candidate) {
-                least_recently_used = more_recent;
-            }
-            if (more_recent != NULL) {
-                more_recent->less_recent = prune_candidate->less_recent;
+// Evict the cheapest entries in the whole cache until it fits. Each
+// shard keeps its entries in cost order, so the cheapest entry overall
+// is the cheapest of the shards' first unused entries. Only one shard
+// is locked at a time, so the choice is made from a snapshot of each
+// shard's candidate, and the chosen shard's candidate is looked up
+// again once it is locked. Must be called with no shard locked.
+WEAK void prune_cache_by_cost() {
+    while (cache_over_budget()) {
+        CacheShard *best_shard = NULL;
+        CacheEntry best;
+        for (size_t i = 0; i < kCacheShards; i++) {
+            CacheShard &shard = cache_shards[i];
+            ScopedMutexLock lock(&shard.lock);
+            CacheEntry *e = cheapest_unused(shard);
+            if (e && (!best_shard || evict_before(e, &best))) {
+                best_shard = &shard;
+                best.compute_ns = e->compute_ns;
+                best.bytes = e->bytes;
+                best.last_used = e->last_used;
             }
+        }
+        if (!best_shard) {
+            return;
+        }
+        ScopedMutexLock lock(&best_shard->lock);
+        CacheEntry *e = cheapest_unused(*best_shard);
+        if (e) {
+            evict_cache_entry(*best_shard, e);
+        }
+#if CACHE_DEBUGGING
+        validate_cache(*best_shard);
+#endif
+    }
+}
 
-            // Remove from more recent chain.
-            if (most_recently_used == prune_candidate) {
-                most_recently_used = prune_candidate->less_recent;
-            }
-            if (prune_candidate->less_recent != NULL) {
-                prune_candidate->less_recent = more_recent;
+// Bring the cache back within its size limit. Under the LRU policy
+// each shard evicts its own least recently used entries, skipping one
+// the caller has already pruned, if any. Under the cost-per-byte
+// policy the cheapest entries of the whole cache go first. Must be
+// called with no shard locked.
+WEAK void prune_cache(CacheShard *skip = NULL) {
+    if (get_eviction_policy() == halide_memoization_cache_evict_cost_per_byte) {
+        prune_cache_by_cost();
+        return;
+    }
+    for (size_t i = 0; i < kCacheShards && cache_over_budget(); i++) {
+        CacheShard &shard = cache_shards[i];
+        if (&shard == skip) {
+            continue;
+        }
+        ScopedMutexLock lock(&shard.lock);
+        prune_cache_shard(shard);
+    }
+}
+
+// The persistent tier: a file, shared by every process that uses it,
+// holding results keyed by a version of the memoization key that
+// doesn't depend on addresses in this process. The file is only ever
+// appended to, so results handed out straight from the mapping stay
+// valid as long as it is mapped. They are handed out from a read-only
+// mapping, so writing to them can't damage the file. Lookups and the results they hand out
+// are counted in persistent_cache.users, and the file is not unmapped
+// while that is non-zero. Appends take the file lock (for other
+// processes) and persistent_cache.lock (for other threads); lookups
+// take no lock, as a record is complete before its index slot is
+// published.
+const uint64_t kPersistentCacheMagic = 0x5a494f4d454d4c48ULL;  // "HLMEMOIZ"
+// Bump this whenever the layout of the file or of its keys changes.
+// Files with another version are replaced.
+const uint32_t kPersistentCacheVersion = 2;
+const uint64_t kDefaultPersistentCacheSize = 64 << 20;
+// Results in the file are aligned to at least this, which is more than
+// any halide_malloc_alignment.
+const uint64_t kPersistentCacheAlignment = 128;
+const size_t kMaxPersistentKeySize = 1024;
+
+#define MAX_PIPELINE_VERSIONS 64
+
+struct PersistentCacheHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t index_slots;
+    // The size of the whole file, and how much of it is in use.
+    uint64_t size;
+    uint64_t used;
+    // Followed by index_slots offsets of records, open addressed by
+    // key hash. Zero marks an empty slot.
+};
+
+struct PersistentCacheRecord {
+    uint64_t record_size;
+    uint32_t hash;
+    uint32_t key_size;
+    int32_t tuple_count;
+    int32_t dimensions;
+    int64_t compute_ns;
+    // Followed by the key, the computed bounds, and a
+    // PersistentCacheTuple for each tuple element.
+};
+
+struct PersistentCacheTuple {
+    halide_type_t type;
+    uint32_t padding;
+    // Where the data starts, relative to the record.
+    uint64_t data_offset;
+    // Followed by the allocated shape.
+};
+
+struct PipelineVersion {
+    char *name;
+    uint64_t version;
+};
+
+struct PersistentCache {
+    halide_mutex lock;
+    // Whether the file to use has been decided, either by
+    // halide_memoization_cache_set_persistent_file or from the
+    // environment.
+    bool initialized;
+    mapped_file_t file;
+    // The start of the read-only mapping of the file once it is open
+    // and valid, or NULL. Writes go through file.writable instead.
+    PersistentCacheHeader *header;
+    // The number of lookups reading the mapping, plus the number of
+    // results handed out from it and not yet released.
+    int32_t users;
+    int num_versions;
+    PipelineVersion versions[MAX_PIPELINE_VERSIONS];
+};
+
+WEAK PersistentCache persistent_cache;
+
+WEAK __attribute((always_inline)) uint64_t align_up(uint64_t x, uint64_t alignment) {
+    return (x + alignment - 1) & ~(alignment - 1);
+}
+
+WEAK __attribute((always_inline)) uint64_t *persistent_index(PersistentCacheHeader *header) {
+    return (uint64_t *)(header + 1);
+}
+
+WEAK __attribute((always_inline)) uint8_t *record_key(PersistentCacheRecord *r) {
+    return (uint8_t *)(r + 1);
+}
+
+WEAK __attribute((always_inline)) halide_dimension_t *record_computed_bounds(PersistentCacheRecord *r) {
+    return (halide_dimension_t *)(record_key(r) + align_up(r->key_size, 8));
+}
+
+WEAK __attribute((always_inline)) size_t persistent_tuple_size(int32_t dimensions) {
+    return sizeof(PersistentCacheTuple) + sizeof(halide_dimension_t) * dimensions;
+}
+
+WEAK __attribute((always_inline)) PersistentCacheTuple *record_tuple(PersistentCacheRecord *r, int32_t i) {
+    uint8_t *first = (uint8_t *)(record_computed_bounds(r) + r->dimensions);
+    return (PersistentCacheTuple *)(first + i * persistent_tuple_size(r->dimensions));
+}
+
+WEAK __attribute((always_inline)) halide_dimension_t *tuple_shape(PersistentCacheTuple *t) {
+    return (halide_dimension_t *)(t + 1);
+}
+
+// Whether the header describes a file this runtime can use.
+WEAK bool persistent_header_valid(const PersistentCacheHeader *header, size_t file_size) {
+    uint64_t index_end = sizeof(PersistentCacheHeader) + header->index_slots * sizeof(uint64_t);
+    return (header->magic == kPersistentCacheMagic &&
+            header->version == kPersistentCacheVersion &&
+            header->size == file_size &&
+            header->index_slots > 0 &&
+            index_end <= header->used &&
+            header->used <= header->size);
+}
+
+// Lay out an empty cache in a freshly created (all zero) file. Must be
+// called with the file locked.
+WEAK void init_persistent_header(PersistentCacheHeader *header, size_t file_size) {
+    // One index slot per 4KB of file, which is about the smallest
+    // result worth persisting.
+    uint64_t slots = file_size / 4096;
+    slots = slots < 64 ? 64 : (slots > (1 << 20) ? (1 << 20) : slots);
+    header->version = kPersistentCacheVersion;
+    header->index_slots = (uint32_t)slots;
+    header->size = file_size;
+    header->used = align_up(sizeof(PersistentCacheHeader) + slots * sizeof(uint64_t), kPersistentCacheAlignment);
+    __atomic_store_n(&header->magic, kPersistentCacheMagic, __ATOMIC_RELEASE);
+}
+
+// Close the file, if any. Returns false, leaving it open, if lookups
+// are reading it or results from it are still in use. Must be called
+// with persistent_cache.lock held.
+WEAK bool close_persistent_file() {
+    if (persistent_cache.file.data) {
+        PersistentCacheHeader *header = persistent_cache.header;
+        // Hide the file from new lookups first. Both this and the
+        // count in lookup_persistent are sequentially consistent, so
+        // either the lookup sees no file or we see the lookup.
+        __atomic_store_n(&persistent_cache.header, (PersistentCacheHeader *)NULL, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&persistent_cache.users, __ATOMIC_SEQ_CST) != 0) {
+            __atomic_store_n(&persistent_cache.header, header, __ATOMIC_RELEASE);
+            return false;
+        }
+        unmap_file(&persistent_cache.file);
+    }
+    return true;
+}
+
+// Open and check the file, replacing it if it was written by another
+// version of the runtime or is damaged. Must be called with
+// persistent_cache.lock held.
+WEAK bool open_persistent_file(void *user_context, const char *path, size_t size) {
+    mapped_file_t &f = persistent_cache.file;
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (!map_file(path, size, &f)) {
+            return false;
+        }
+        PersistentCacheHeader *header = (PersistentCacheHeader *)f.data;
+        bool valid = false;
+        bool ours = false;
+        if (f.size >= sizeof(PersistentCacheHeader) + kPersistentCacheAlignment) {
+            lock_file(&f);
+            if (header->magic == 0 && header->version == 0 && header->size == 0) {
+                init_persistent_header((PersistentCacheHeader *)f.writable, f.size);
             }
+            ours = header->magic == kPersistentCacheMagic;
+            valid = persistent_header_valid(header, f.size);
+            unlock_file(&f);
+        }
+        if (valid) {
+            __atomic_store_n(&persistent_cache.header, header, __ATOMIC_RELEASE);
+            return true;
+        }
+        unmap_file(&f);
+        if (!ours) {
+            // Don't delete something that isn't a cache file.
+            return false;
+        }
+        debug(user_context) << "Replacing out of date memoization cache file " << path << "\n";
+        remove(path);
+    }
+    return false;
+}
 
-            // Decrease cache used amount.
-            for (uint32_t i = 0; i < prune_candidate->tuple_count; i++) {
-                current_cache_size -= prune_candidate->buf[i].size_in_bytes();
+// Parse HL_MEMOIZATION_CACHE_FILE_SIZE. Anything but a positive
+// decimal number of bytes that can be mapped is rejected, rather than
+// read as zero or as a truncated value.
+WEAK bool parse_persistent_file_size(const char *str, int64_t *size) {
+    char *end = NULL;
+    long long value = strtoll(str, &end, 10);
+    // strtoll saturates on overflow.
+    if (end == str || *end != 0 || value <= 0 || value == 0x7fffffffffffffffLL ||
+        (uint64_t)value > (uint64_t)(size_t)-1) {
+        return false;
+    }
+    *size = value;
+    return true;
+}
+
+// The persistent file, or NULL if there isn't one. The first call
+// opens the file named by HL_MEMOIZATION_CACHE_FILE, unless
+// halide_memoization_cache_set_persistent_file got there first.
+WEAK PersistentCacheHeader *get_persistent_cache(void *user_context) {
+    if (!__atomic_load_n(&persistent_cache.initialized, __ATOMIC_ACQUIRE)) {
+        ScopedMutexLock lock(&persistent_cache.lock);
+        if (!persistent_cache.initialized) {
+            const char *path = getenv("HL_MEMOIZATION_CACHE_FILE");
+            if (path && *path) {
+                const char *size_str = getenv("HL_MEMOIZATION_CACHE_FILE_SIZE");
+                int64_t size = kDefaultPersistentCacheSize;
+                if (size_str && *size_str && !parse_persistent_file_size(size_str, &size)) {
+                    error(user_context) << "HL_MEMOIZATION_CACHE_FILE_SIZE must be a positive number of bytes, not "
+                                        << size_str << "\n";
+                } else if (!open_persistent_file(user_context, path, size)) {
+                    debug(user_context) << "Could not open memoization cache file " << path << "\n";
+                }
             }
+            __atomic_store_n(&persistent_cache.initialized, true, __ATOMIC_RELEASE);
+        }
+    }
+    return __atomic_load_n(&persistent_cache.header, __ATOMIC_ACQUIRE);
+}
 
-            // Deallocate the entry.
-            prune_candidate->destroy();
-            halide_free(NULL, prune_candidate);
+// Whether host was handed out from the mapping. The mapping can't
+// change while such a result is in use, so this doesn't need the lock.
+WEAK bool persistent_cache_owns(const void *host) {
+    const uint8_t *data = (const uint8_t *)__atomic_load_n(&persistent_cache.file.data, __ATOMIC_ACQUIRE);
+    size_t size = __atomic_load_n(&persistent_cache.file.size, __ATOMIC_RELAXED);
+    return (data != NULL &&
+            (const uint8_t *)host >= data &&
+            (const uint8_t *)host < data + size);
+}
+
+WEAK uint64_t get_pipeline_version(const char *pipeline, size_t pipeline_len) {
+    ScopedMutexLock lock(&persistent_cache.lock);
+    for (int i = 0; i < persistent_cache.num_versions; i++) {
+        const PipelineVersion &v = persistent_cache.versions[i];
+        if (strncmp(v.name, pipeline, pipeline_len) == 0 && v.name[pipeline_len] == 0) {
+            return v.version;
         }
+    }
+    return 0;
+}
 
-        prune_candidate = more_recent;
+// Build the key used in the persistent file: the pipeline's version,
+// the string that the in-memory key points to (the pipeline and Func
+// names and the hash of the Func's algorithm), and the rest of the
+// in-memory key. Returns zero if the key can't be
+// built or doesn't fit in kMaxPersistentKeySize bytes.
+WEAK size_t make_persistent_key(const uint8_t *cache_key, int32_t key_size, uint8_t *dst) {
+    const char *names = key_names(cache_key, key_size);
+    const char *pos = names, *pipeline;
+    size_t pipeline_len;
+    if (!names || !parse_key_string(pos, &pipeline, &pipeline_len)) {
+        return 0;
     }
-#if CACHE_DEBUGGING
-    validate_cache();
-#endif
+    uint64_t version = get_pipeline_version(pipeline, pipeline_len);
+    size_t names_len = strlen(names);
+    size_t rest = key_size - sizeof(const char *);
+    size_t total = sizeof(version) + names_len + rest;
+    if (total > kMaxPersistentKeySize) {
+        return 0;
+    }
+    memcpy(dst, &version, sizeof(version));
+    memcpy(dst + sizeof(version), names, names_len);
+    memcpy(dst + sizeof(version) + names_len, cache_key + sizeof(const char *), rest);
+    return total;
+}
+
+// Whether a record holds the result for this key with the given
+// shapes. Also checks the record lies within the file, in case it is
+// damaged.
+WEAK bool persistent_record_matches(PersistentCacheHeader *header, uint64_t offset, uint32_t h,
+                                    const uint8_t *key, size_t key_size,
+                                    const halide_buffer_t *computed_bounds,
+                                    int32_t tuple_count, halide_buffer_t **tuple_buffers) {
+    if (offset + sizeof(PersistentCacheRecord) > header->size) {
+        return false;
+    }
+    PersistentCacheRecord *r = (PersistentCacheRecord *)((uint8_t *)header + offset);
+    if (r->hash != h || r->key_size != key_size ||
+        r->tuple_count != tuple_count || r->dimensions != computed_bounds->dimensions ||
+        offset + r->record_size > header->size ||
+        (uint8_t *)record_tuple(r, tuple_count) > (uint8_t *)r + r->record_size ||
+        !keys_equal(record_key(r), key, key_size) ||
+        !buffer_has_shape(computed_bounds, record_computed_bounds(r))) {
+        return false;
+    }
+    for (int32_t i = 0; i < tuple_count; i++) {
+        PersistentCacheTuple *t = record_tuple(r, i);
+        if (t->type != tuple_buffers[i]->type ||
+            !buffer_has_shape(tuple_buffers[i], tuple_shape(t)) ||
+            t->data_offset + tuple_buffers[i]->size_in_bytes() > r->record_size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Find the index slot of the matching record, or of the empty slot
+// where it would go, or -1 if the index is full.
+WEAK int64_t find_persistent_slot(PersistentCacheHeader *header, uint32_t h,
+                                  const uint8_t *key, size_t key_size,
+                                  const halide_buffer_t *computed_bounds,
+                                  int32_t tuple_count, halide_buffer_t **tuple_buffers) {
+    uint64_t *index = persistent_index(header);
+    uint32_t slots = header->index_slots;
+    for (uint32_t i = 0; i < slots; i++) {
+        uint32_t slot = (h + i) % slots;
+        uint64_t offset = __atomic_load_n(&index[slot], __ATOMIC_ACQUIRE);
+        if (offset == 0 ||
+            persistent_record_matches(header, offset, h, key, key_size,
+                                      computed_bounds, tuple_count, tuple_buffers)) {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+// Look for a result in the persistent file, and if it's there point
+// the tuple buffers at it. Each of them counts as a user of the file
+// until it is released.
+WEAK bool lookup_persistent(void *user_context, const uint8_t *cache_key, int32_t size,
+                            const halide_buffer_t *computed_bounds,
+                            int32_t tuple_count, halide_buffer_t **tuple_buffers,
+                            int32_t func_index) {
+    if (!get_persistent_cache(user_context)) {
+        return false;
+    }
+    // Keep the file mapped while reading it. See close_persistent_file.
+    __atomic_fetch_add(&persistent_cache.users, 1, __ATOMIC_SEQ_CST);
+    PersistentCacheHeader *header = __atomic_load_n(&persistent_cache.header, __ATOMIC_SEQ_CST);
+    uint8_t key[kMaxPersistentKeySize];
+    size_t key_size = header ? make_persistent_key(cache_key, size, key) : 0;
+    uint64_t offset = 0;
+    if (key_size != 0) {
+        uint32_t h = djb_hash(key, key_size);
+        int64_t slot = find_persistent_slot(header, h, key, key_size, computed_bounds, tuple_count, tuple_buffers);
+        offset = slot < 0 ? 0 : __atomic_load_n(&persistent_index(header)[slot], __ATOMIC_ACQUIRE);
+    }
+    if (offset == 0) {
+        __atomic_fetch_sub(&persistent_cache.users, 1, __ATOMIC_RELEASE);
+        return false;
+    }
+
+    PersistentCacheRecord *r = (PersistentCacheRecord *)((uint8_t *)header + offset);
+    for (int32_t i = 0; i < tuple_count; i++) {
+        // Like a hit in memory, the result is only on the host.
+        halide_buffer_t *buf = tuple_buffers[i];
+        buf->host = (uint8_t *)r + record_tuple(r, i)->data_offset;
+        buf->device = 0;
+        buf->device_interface = NULL;
+        buf->set_host_dirty(true);
+        buf->set_device_dirty(false);
+    }
+    // Hand the lookup's count on to the buffers.
+    __atomic_fetch_add(&persistent_cache.users, tuple_count - 1, __ATOMIC_RELAXED);
+    count_stat(&total_stats.hits);
+    count_stat(&total_stats.persistent_hits);
+    count_stat(&total_stats.time_saved_ns, r->compute_ns);
+    if (halide_memoization_cache_func_stats_t *f = get_func_stats(func_index)) {
+        count_stat(&f->hits);
+        count_stat(&f->time_saved_ns, r->compute_ns);
+    }
+    return true;
+}
+
+// Append a freshly computed result to the persistent file, unless it
+// is already there or doesn't fit.
+WEAK void store_persistent(void *user_context, const uint8_t *cache_key, int32_t size,
+                           const halide_buffer_t *computed_bounds,
+                           int32_t tuple_count, halide_buffer_t **tuple_buffers,
+                           int64_t compute_ns) {
+    if (!get_persistent_cache(user_context)) {
+        return;
+    }
+    for (int32_t i = 0; i < tuple_count; i++) {
+        if (tuple_buffers[i]->device_dirty()) {
+            return;
+        }
+    }
+    uint8_t key[kMaxPersistentKeySize];
+    size_t key_size = make_persistent_key(cache_key, size, key);
+    if (key_size == 0) {
+        return;
+    }
+    uint32_t h = djb_hash(key, key_size);
+
+    int32_t dimensions = computed_bounds->dimensions;
+    uint64_t record_size = (sizeof(PersistentCacheRecord) + align_up(key_size, 8) +
+                            sizeof(halide_dimension_t) * dimensions +
+                            persistent_tuple_size(dimensions) * tuple_count);
+    uint64_t data_offsets[16];
+    if (tuple_count > 16) {
+        return;
+    }
+    for (int32_t i = 0; i < tuple_count; i++) {
+        record_size = align_up(record_size, kPersistentCacheAlignment);
+        data_offsets[i] = record_size;
+        record_size += tuple_buffers[i]->size_in_bytes();
+    }
+
+    ScopedMutexLock lock(&persistent_cache.lock);
+    PersistentCacheHeader *header = persistent_cache.header;
+    if (!header) {
+        return;
+    }
+    // The mapping lookups read is read-only; write through the other one.
+    PersistentCacheHeader *writable = (PersistentCacheHeader *)persistent_cache.file.writable;
+    lock_file(&persistent_cache.file);
+    int64_t slot = find_persistent_slot(header, h, key, key_size, computed_bounds, tuple_count, tuple_buffers);
+    uint64_t offset = align_up(header->used, kPersistentCacheAlignment);
+    if (slot >= 0 && persistent_index(header)[slot] == 0 &&
+        offset + record_size <= header->size) {
+        PersistentCacheRecord *r = (PersistentCacheRecord *)((uint8_t *)writable + offset);
+        r->record_size = record_size;
+        r->hash = h;
+        r->key_size = key_size;
+        r->tuple_count = tuple_count;
+        r->dimensions = dimensions;
+        r->compute_ns = compute_ns;
+        memcpy(record_key(r), key, key_size);
+        for (int32_t i = 0; i < dimensions; i++) {
+            record_computed_bounds(r)[i] = computed_bounds->dim[i];
+        }
+        for (int32_t i = 0; i < tuple_count; i++) {
+            const halide_buffer_t *buf = tuple_buffers[i];
+            PersistentCacheTuple *t = record_tuple(r, i);
+            t->type = buf->type;
+            t->padding = 0;
+            t->data_offset = data_offsets[i];
+            for (int32_t j = 0; j < dimensions; j++) {
+                tuple_shape(t)[j] = buf->dim[j];
+            }
+            memcpy((uint8_t *)r + data_offsets[i], buf->host, buf->size_in_bytes());
+        }
+        writable->used = offset + record_size;
+        __atomic_store_n(&persistent_index(writable)[slot], offset, __ATOMIC_RELEASE);
+    } else {
+        debug(user_context) << "Memoization cache file is full\n";
+    }
+    unlock_file(&persistent_cache.file);
 }
 
 }  // namespace Internal
@@ -316,19 +1232,20 @@ WEAK void halide_memoization_cache_set_size(int64_t size) {
     if (size == 0) {
         size = kDefaultCacheSize;
     }
+    if (size < 0) {
+        size = 0;
+    } else if ((uint64_t)size > (uint64_t)(size_t)-1) {
+        size = (size_t)-1;
+    }
 
-    ScopedMutexLock lock(&memoization_lock);
-
-    max_cache_size = size;
+    __atomic_store_n(&max_cache_size, (size_t)size, __ATOMIC_RELAXED);
     prune_cache();
 }
 
 WEAK int halide_memoization_cache_lookup(void *user_context, const uint8_t *cache_key, int32_t size,
                                          halide_buffer_t *computed_bounds, int32_t tuple_count, halide_buffer_t **tuple_buffers) {
     uint32_t h = djb_hash(cache_key, size);
-    uint32_t index = h % kHashTableSize;
-
-    ScopedMutexLock lock(&memoization_lock);
+    CacheShard &shard = shard_for_hash(h);
 
 #if CACHE_DEBUGGING
     debug_print_key(user_context, "halide_memoization_cache_lookup", cache_key, size);
@@ -343,52 +1260,68 @@ WEAK int halide_memoization_cache_lookup(void *user_context, const uint8_t *cach
     }
 #endif
 
-    CacheEntry *entry = cache_entries[index];
-    while (entry != NULL) {
-        if (entry->hash == h && entry->key_size == (size_t)size &&
-            keys_equal(entry->key, cache_key, size) &&
-            buffer_has_shape(computed_bounds, entry->computed_bounds) &&
-            entry->tuple_count == (uint32_t)tuple_count) {
-
-            // Check all the tuple buffers have the same bounds (they should).
-            bool all_bounds_equal = true;
-            for (int32_t i = 0; all_bounds_equal && i < tuple_count; i++) {
-                all_bounds_equal = buffer_has_shape(tuple_buffers[i], entry->buf[i].dim);
-            }
+    {
+        ScopedMutexLock lock(&shard.lock);
 
-            if (all_bounds_equal) {
-                if (entry != most_recently_used) {
-                    halide_assert(user_context, entry->more_recent != NULL);
-                    if (entry->less_recent != NULL) {
-                        entry->less_recent->more_recent = entry->more_recent;
-                    } else {
-                        halide_assert(user_context, least_recently_used == entry);
-                        least_recently_used = entry->more_recent;
-                    }
-                    halide_assert(user_context, entry->more_recent != NULL);
-                    entry->more_recent->less_recent = entry->less_recent;
+        CacheEntry *entry = bucket_for_hash(shard, h);
+        while (entry != NULL) {
+            if (entry->hash == h && entry->key_size == (size_t)size &&
+                keys_equal(entry->key, cache_key, size) &&
+                buffer_has_shape(computed_bounds, entry->computed_bounds) &&
+                entry->tuple_count == (uint32_t)tuple_count) {
 
-                    entry->more_recent = NULL;
-                    entry->less_recent = most_recently_used;
-                    if (most_recently_used != NULL) {
-                        most_recently_used->more_recent = entry;
-                    }
-                    most_recently_used = entry;
+                // Check all the tuple buffers have the same bounds (they should).
+                bool all_bounds_equal = true;
+                for (int32_t i = 0; all_bounds_equal && i < tuple_count; i++) {
+                    all_bounds_equal = buffer_has_shape(tuple_buffers[i], entry->buf[i].dim);
                 }
 
-                for (int32_t i = 0; i < tuple_count; i++) {
-                    halide_buffer_t *buf = tuple_buffers[i];
-                    *buf = entry->buf[i];
-                }
+                if (all_bounds_equal) {
+                    if (entry != shard.most_recently_used) {
+                        halide_assert(user_context, entry->more_recent != NULL);
+                        if (entry->less_recent != NULL) {
+                            entry->less_recent->more_recent = entry->more_recent;
+                        } else {
+                            halide_assert(user_context, shard.least_recently_used == entry);
+                            shard.least_recently_used = entry->more_recent;
+                        }
+                        halide_assert(user_context, entry->more_recent != NULL);
+                        entry->more_recent->less_recent = entry->less_recent;
+
+                        entry->more_recent = NULL;
+                        entry->less_recent = shard.most_recently_used;
+                        if (shard.most_recently_used != NULL) {
+                            shard.most_recently_used->more_recent = entry;
+                        }
+                        shard.most_recently_used = entry;
+                    }
+
+                    touch_by_cost(shard, entry);
 
-                entry->in_use_count += tuple_count;
+                    for (int32_t i = 0; i < tuple_count; i++) {
+                        halide_buffer_t *buf = tuple_buffers[i];
+                        *buf = entry->buf[i];
+                    }
 
-                return 0;
+                    __atomic_fetch_add(&entry->in_use_count, tuple_count, __ATOMIC_RELAXED);
+                    count_hit(entry);
+
+                    return 0;
+                }
             }
+            entry = entry->next;
         }
-        entry = entry->next;
     }
 
+    int32_t func_index = find_func_stats(cache_key, size);
+    if (lookup_persistent(user_context, cache_key, size, computed_bounds, tuple_count, tuple_buffers, func_index)) {
+        return 0;
+    }
+
+    // A miss. The caller computes the value into fresh buffers, which
+    // doesn't need the lock.
+    count_miss(func_index);
+    int64_t start_ns = halide_current_time_ns(user_context);
     for (int32_t i = 0; i < tuple_count; i++) {
         halide_buffer_t *buf = tuple_buffers[i];
 
@@ -404,12 +1337,10 @@ WEAK int halide_memoization_cache_lookup(void *user_context, const uint8_t *cach
         CacheBlockHeader *header = get_pointer_to_header(buf->host);
         header->hash = h;
         header->entry = NULL;
+        header->func_index = func_index;
+        header->start_ns = start_ns;
     }
 
-#if CACHE_DEBUGGING
-    validate_cache();
-#endif
-
     return 1;
 }
 
@@ -418,11 +1349,11 @@ WEAK int halide_memoization_cache_store(void *user_context, const uint8_t *cache
                                         int32_t tuple_count, halide_buffer_t **tuple_buffers) {
     debug(user_context) << "halide_memoization_cache_store\n";
 
-    uint32_t h = get_pointer_to_header(tuple_buffers[0]->host)->hash;
-
-    uint32_t index = h % kHashTableSize;
+    CacheBlockHeader *first_header = get_pointer_to_header(tuple_buffers[0]->host);
+    uint32_t h = first_header->hash;
+    int64_t compute_ns = halide_current_time_ns(user_context) - first_header->start_ns;
 
-    ScopedMutexLock lock(&memoization_lock);
+    CacheShard &shard = shard_for_hash(h);
 
 #if CACHE_DEBUGGING
     debug_print_key(user_context, "halide_memoization_cache_store", cache_key, size);
@@ -437,107 +1368,135 @@ WEAK int halide_memoization_cache_store(void *user_context, const uint8_t *cache
     }
 #endif
 
-    CacheEntry *entry = cache_entries[index];
-    while (entry != NULL) {
-        if (entry->hash == h && entry->key_size == (size_t)size &&
-            keys_equal(entry->key, cache_key, size) &&
-            buffer_has_shape(computed_bounds, entry->computed_bounds) &&
-            entry->tuple_count == (uint32_t)tuple_count) {
+    {
+        ScopedMutexLock lock(&shard.lock);
 
-            bool all_bounds_equal = true;
-            bool no_host_pointers_equal = true;
-            {
-                for (int32_t i = 0; all_bounds_equal && i < tuple_count; i++) {
-                    halide_buffer_t *buf = tuple_buffers[i];
-                    all_bounds_equal = buffer_has_shape(tuple_buffers[i], entry->buf[i].dim);
-                    if (entry->buf[i].host == buf->host) {
-                        no_host_pointers_equal = false;
+        CacheEntry *&bucket = bucket_for_hash(shard, h);
+        CacheEntry *entry = bucket;
+        while (entry != NULL) {
+            if (entry->hash == h && entry->key_size == (size_t)size &&
+                keys_equal(entry->key, cache_key, size) &&
+                buffer_has_shape(computed_bounds, entry->computed_bounds) &&
+                entry->tuple_count == (uint32_t)tuple_count) {
+
+                bool all_bounds_equal = true;
+                bool no_host_pointers_equal = true;
+                {
+                    for (int32_t i = 0; all_bounds_equal && i < tuple_count; i++) {
+                        halide_buffer_t *buf = tuple_buffers[i];
+                        all_bounds_equal = buffer_has_shape(tuple_buffers[i], entry->buf[i].dim);
+                        if (entry->buf[i].host == buf->host) {
+                            no_host_pointers_equal = false;
+                        }
                     }
                 }
-            }
-            if (all_bounds_equal) {
-                halide_assert(user_context, no_host_pointers_equal);
-                // This entry is still in use by the caller. Mark it as having no cache entry
-                // so halide_memoization_cache_release can free the buffer.
-                for (int32_t i = 0; i < tuple_count; i++) {
-                    get_pointer_to_header(tuple_buffers[i]->host)->entry = NULL;
+                if (all_bounds_equal) {
+                    halide_assert(user_context, no_host_pointers_equal);
+                    // This entry is still in use by the caller. Mark it as having no cache entry
+                    // so halide_memoization_cache_release can free the buffer.
+                    for (int32_t i = 0; i < tuple_count; i++) {
+                        get_pointer_to_header(tuple_buffers[i]->host)->entry = NULL;
+                    }
+                    return 0;
                 }
-                return 0;
             }
+            entry = entry->next;
         }
-        entry = entry->next;
-    }
 
-    uint64_t added_size = 0;
-    {
-        for (int32_t i = 0; i < tuple_count; i++) {
-            halide_buffer_t *buf = tuple_buffers[i];
-            added_size += buf->size_in_bytes();
+        int64_t added_size = 0;
+        {
+            for (int32_t i = 0; i < tuple_count; i++) {
+                halide_buffer_t *buf = tuple_buffers[i];
+                added_size += buf->size_in_bytes();
+            }
+        }
+        add_to_cache_size(shard, added_size);
+        if (get_eviction_policy() == halide_memoization_cache_evict_lru) {
+            prune_cache_shard(shard);
         }
-    }
-    current_cache_size += added_size;
-    prune_cache();
 
-    CacheEntry *new_entry = (CacheEntry *)halide_malloc(NULL, sizeof(CacheEntry));
-    bool inited = false;
-    if (new_entry) {
-        inited = new_entry->init(cache_key, size, h, computed_bounds, tuple_count, tuple_buffers);
-    }
-    if (!inited) {
-        current_cache_size -= added_size;
+        CacheEntry *new_entry = (CacheEntry *)halide_malloc(NULL, sizeof(CacheEntry));
+        bool inited = false;
+        if (new_entry) {
+            inited = new_entry->init(cache_key, size, h, computed_bounds, tuple_count, tuple_buffers);
+        }
+        if (inited) {
+            new_entry->func_index = first_header->func_index;
+            new_entry->compute_ns = compute_ns;
+            new_entry->bytes = added_size;
+            count_entry_bytes(new_entry, 1);
+        }
+        if (!inited) {
+            add_to_cache_size(shard, -added_size);
 
-        // This entry is still in use by the caller. Mark it as having no cache entry
-        // so halide_memoization_cache_release can free the buffer.
-        for (int32_t i = 0; i < tuple_count; i++) {
-            get_pointer_to_header(tuple_buffers[i]->host)->entry = NULL;
+            // This entry is still in use by the caller. Mark it as having no cache entry
+            // so halide_memoization_cache_release can free the buffer.
+            for (int32_t i = 0; i < tuple_count; i++) {
+                get_pointer_to_header(tuple_buffers[i]->host)->entry = NULL;
+            }
+
+            if (new_entry) {
+                halide_free(user_context, new_entry);
+            }
+            return 0;
         }
 
-        if (new_entry) {
-            halide_free(user_context, new_entry);
+        new_entry->next = bucket;
+        new_entry->less_recent = shard.most_recently_used;
+        if (shard.most_recently_used != NULL) {
+            shard.most_recently_used->more_recent = new_entry;
         }
-        return 0;
-    }
+        shard.most_recently_used = new_entry;
+        if (shard.least_recently_used == NULL) {
+            shard.least_recently_used = new_entry;
+        }
+        add_by_cost(shard, new_entry);
+        bucket = new_entry;
 
-    new_entry->next = cache_entries[index];
-    new_entry->less_recent = most_recently_used;
-    if (most_recently_used != NULL) {
-        most_recently_used->more_recent = new_entry;
-    }
-    most_recently_used = new_entry;
-    if (least_recently_used == NULL) {
-        least_recently_used = new_entry;
+        new_entry->in_use_count = tuple_count;
+
+        for (int32_t i = 0; i < tuple_count; i++) {
+            get_pointer_to_header(tuple_buffers[i]->host)->entry = new_entry;
+        }
+
+#if CACHE_DEBUGGING
+        validate_cache(shard);
+#endif
     }
-    cache_entries[index] = new_entry;
 
-    new_entry->in_use_count = tuple_count;
+    store_persistent(user_context, cache_key, size, computed_bounds, tuple_count, tuple_buffers, compute_ns);
 
-    for (int32_t i = 0; i < tuple_count; i++) {
-        get_pointer_to_header(tuple_buffers[i]->host)->entry = new_entry;
+    // If this shard didn't have enough unused entries to make room,
+    // take it from the others. (Under the cost-per-byte policy all the
+    // pruning happens here.)
+    if (cache_over_budget()) {
+        prune_cache(&shard);
     }
 
-#if CACHE_DEBUGGING
-    validate_cache();
-#endif
     debug(user_context) << "Exiting halide_memoization_cache_store\n";
 
     return 0;
 }
 
 WEAK void halide_memoization_cache_release(void *user_context, void *host) {
-    CacheBlockHeader *header = get_pointer_to_header((uint8_t *)host);
     debug(user_context) << "halide_memoization_cache_release\n";
+    if (persistent_cache_owns(host)) {
+        // Results in the persistent file live as long as the mapping,
+        // which stays until the last of them is released.
+        int32_t old_users = __atomic_fetch_sub(&persistent_cache.users, 1, __ATOMIC_RELEASE);
+        halide_assert(user_context, old_users > 0);
+        return;
+    }
+    CacheBlockHeader *header = get_pointer_to_header((uint8_t *)host);
     CacheEntry *entry = header->entry;
 
     if (entry == NULL) {
         halide_free(user_context, header);
     } else {
-        ScopedMutexLock lock(&memoization_lock);
-
-        halide_assert(user_context, entry->in_use_count > 0);
-        entry->in_use_count--;
-#if CACHE_DEBUGGING
-        validate_cache();
-#endif
+        // No lock needed: the entry can't be evicted while its count
+        // is non-zero, and pruning only frees it once it reads zero.
+        uint32_t old_count = __atomic_fetch_sub(&entry->in_use_count, 1, __ATOMIC_RELEASE);
+        halide_assert(user_context, old_count > 0);
     }
 
     debug(user_context) << "Exited halide_memoization_cache_release.\n";
@@ -545,19 +1504,138 @@ WEAK void halide_memoization_cache_release(void *user_context, void *host) {
 
 WEAK void halide_memoization_cache_cleanup() {
     debug(NULL) << "halide_memoization_cache_cleanup\n";
-    for (size_t i = 0; i < kHashTableSize; i++) {
-        CacheEntry *entry = cache_entries[i];
-        cache_entries[i] = NULL;
-        while (entry != NULL) {
-            CacheEntry *next = entry->next;
-            entry->destroy();
-            halide_free(NULL, entry);
-            entry = next;
+    for (size_t s = 0; s < kCacheShards; s++) {
+        CacheShard &shard = cache_shards[s];
+        ScopedMutexLock lock(&shard.lock);
+        for (size_t i = 0; i < kBucketsPerShard; i++) {
+            CacheEntry *entry = shard.entries[i];
+            shard.entries[i] = NULL;
+            while (entry != NULL) {
+                CacheEntry *next = entry->next;
+                count_entry_bytes(entry, -1);
+                entry->destroy();
+                halide_free(NULL, entry);
+                entry = next;
+            }
+        }
+        add_to_cache_size(shard, -shard.current_size);
+        shard.most_recently_used = NULL;
+        shard.least_recently_used = NULL;
+        shard.cheapest = NULL;
+    }
+
+    {
+        ScopedMutexLock lock(&persistent_cache.lock);
+        for (int i = 0; i < persistent_cache.num_versions; i++) {
+            free(persistent_cache.versions[i].name);
+        }
+        persistent_cache.num_versions = 0;
+        if (close_persistent_file()) {
+            __atomic_store_n(&persistent_cache.initialized, false, __ATOMIC_RELEASE);
+        } else {
+            halide_error(NULL, "halide_memoization_cache_cleanup: results from the persistent file are still in use.");
+        }
+    }
+
+    ScopedMutexLock lock(&func_stats_lock);
+    for (int i = 0; i < num_func_stats; i++) {
+        free((void *)func_stats[i].pipeline_name);
+        free((void *)func_stats[i].func_name);
+    }
+    num_func_stats = 0;
+    memset(func_stats_index, 0, sizeof(func_stats_index));
+    memset(&total_stats, 0, sizeof(total_stats));
+}
+
+WEAK int halide_memoization_cache_set_eviction_policy(int policy) {
+    if (policy != halide_memoization_cache_evict_lru &&
+        policy != halide_memoization_cache_evict_cost_per_byte) {
+        halide_error(NULL, "halide_memoization_cache_set_eviction_policy: unknown policy.");
+        return halide_error_code_generic_error;
+    }
+    int old = get_eviction_policy();
+    __atomic_store_n(&eviction_policy, policy, __ATOMIC_RELAXED);
+    return old;
+}
+
+WEAK int halide_memoization_cache_set_persistent_file(const char *path, int64_t max_size) {
+    ScopedMutexLock lock(&persistent_cache.lock);
+    if (!close_persistent_file()) {
+        halide_error(NULL, "halide_memoization_cache_set_persistent_file: results from the current file are still in use.");
+        return halide_error_code_generic_error;
+    }
+    __atomic_store_n(&persistent_cache.initialized, true, __ATOMIC_RELEASE);
+    if (path == NULL) {
+        return 0;
+    }
+    if (max_size <= 0) {
+        max_size = kDefaultPersistentCacheSize;
+    }
+    if ((uint64_t)max_size > (uint64_t)(size_t)-1) {
+        error(NULL) << "halide_memoization_cache_set_persistent_file: " << max_size << " bytes can't be mapped\n";
+        return halide_error_code_generic_error;
+    }
+    if (!open_persistent_file(NULL, path, max_size)) {
+        error(NULL) << "halide_memoization_cache_set_persistent_file: could not open " << path << "\n";
+        return halide_error_code_generic_error;
+    }
+    return 0;
+}
+
+WEAK int halide_memoization_cache_set_pipeline_version(const char *pipeline_name, uint64_t version) {
+    ScopedMutexLock lock(&persistent_cache.lock);
+    for (int i = 0; i < persistent_cache.num_versions; i++) {
+        PipelineVersion &v = persistent_cache.versions[i];
+        if (strcmp(v.name, pipeline_name) == 0) {
+            v.version = version;
+            return 0;
         }
     }
-    current_cache_size = 0;
-    most_recently_used = NULL;
-    least_recently_used = NULL;
+    char *name = NULL;
+    if (persistent_cache.num_versions < MAX_PIPELINE_VERSIONS) {
+        name = copy_key_string(pipeline_name, strlen(pipeline_name));
+    }
+    if (name == NULL) {
+        halide_error(NULL, "halide_memoization_cache_set_pipeline_version: too many pipelines.");
+        return halide_error_code_out_of_memory;
+    }
+    PipelineVersion &v = persistent_cache.versions[persistent_cache.num_versions++];
+    v.name = name;
+    v.version = version;
+    return 0;
+}
+
+WEAK int halide_memoization_cache_get_stats(halide_memoization_cache_stats_t *stats,
+                                            halide_memoization_cache_func_stats_t *funcs,
+                                            int max_funcs) {
+    ScopedMutexLock lock(&func_stats_lock);
+#ifndef BITS_64
+    ScopedSpinLock counters_lock(&stats_lock);
+#endif
+    if (stats) {
+        *stats = total_stats;
+        stats->max_bytes = (int64_t)__atomic_load_n(&max_cache_size, __ATOMIC_RELAXED);
+    }
+    for (int i = 0; funcs && i < num_func_stats && i < max_funcs; i++) {
+        funcs[i] = func_stats[i];
+    }
+    return num_func_stats;
+}
+
+WEAK void halide_memoization_cache_reset_stats() {
+    ScopedMutexLock lock(&func_stats_lock);
+#ifndef BITS_64
+    ScopedSpinLock counters_lock(&stats_lock);
+#endif
+    // The bytes are the current contents of the cache, not a count,
+    // so they are kept.
+    total_stats.hits = total_stats.misses = total_stats.evictions = 0;
+    total_stats.time_saved_ns = 0;
+    total_stats.persistent_hits = 0;
+    for (int i = 0; i < num_func_stats; i++) {
+        func_stats[i].hits = func_stats[i].misses = func_stats[i].evictions = 0;
+        func_stats[i].time_saved_ns = 0;
+    }
 }
 
 namespace {
@@ -0,0 +1,70 @@
+#ifndef HALIDE_CPU_TOPOLOGY_H
+#define HALIDE_CPU_TOPOLOGY_H
+
+#include "HalideRuntime.h"
+#include "runtime_internal.h"
+
+// Queries about the NUMA and CPU layout of the host, and placement of
+// threads on it, used by the thread pool, the default allocator and
+// the profiler. Each platform provides these in its own runtime
+// module. Platforms without any topology information (and Linux with
+// NUMA awareness turned off) report a single node and never pin.
+
+namespace Halide {
+namespace Runtime {
+namespace Internal {
+
+// The number of NUMA nodes the thread pool should group its workers
+// into. Returns 1 if NUMA awareness is disabled.
+WEAK int numa_node_count();
+
+// The node the calling thread is currently running on, in the range
+// [0, numa_node_count()).
+WEAK int numa_node_of_current_thread();
+
+// Whether thread pool workers need to be pinned, either because of a
+// thread affinity policy (HL_THREAD_AFFINITY) or because NUMA
+// awareness is on.
+WEAK bool should_pin_worker_threads();
+
+// Pin the calling thread as the index'th worker of the thread pool,
+// and record where it ended up.
+WEAK void pin_worker_thread(int index);
+
+// Where each pinned worker ended up, indexed as above. Returns the
+// number of entries.
+WEAK int get_worker_placements(const halide_thread_placement_t **placements);
+
+// Forget the recorded placements when the thread pool shuts down.
+WEAK void clear_worker_placements();
+
+// Set the nice value of the calling thread. Used for the workers of
+// named thread pools. Does nothing where threads have no priority of
+// their own.
+WEAK void set_current_thread_priority(int priority);
+
+// Allocate memory from fresh pages, so that each page ends up on the
+// node of the thread that first writes to it. Allocations at or above
+// the huge page threshold come from huge page aligned mappings marked
+// for transparent huge pages. Returns NULL if neither applies (NUMA
+// awareness is disabled or the allocation is too small to bother), in
+// which case the caller should use its usual allocator.
+WEAK void *page_malloc(size_t x);
+
+// Free memory allocated with page_malloc. Returns false (and does
+// nothing) if the pointer did not come from page_malloc.
+WEAK bool page_free(void *ptr);
+
+// The number of bytes mapped for an allocation made with page_malloc,
+// or zero if the pointer did not come from page_malloc.
+WEAK size_t page_malloc_size(void *ptr);
+
+// How many allocations have been served from huge pages, and how many
+// bytes of them are (and at most were) live at once.
+WEAK void get_huge_page_usage(uint64_t *allocations, uint64_t *bytes, uint64_t *peak_bytes);
+
+}  // namespace Internal
+}  // namespace Runtime
+}  // namespace Halide
+
+#endif
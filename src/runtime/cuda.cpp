@@ -111,6 +111,10 @@ WEAK struct FreeListItem {
 } *free_list = 0;
 WEAK halide_mutex free_list_lock;
 
+// Registered with the runtime so that the free list can be emptied,
+// and counts the bytes on it.
+WEAK halide_device_allocation_pool cuda_allocation_pool;
+
 }  // namespace Cuda
 }  // namespace Internal
 }  // namespace Runtime
@@ -593,6 +597,7 @@ WEAK int halide_cuda_release_unused_device_allocations(void *user_context) {
     while (to_free) {
         debug(user_context) << "    cuMemFree " << (void *)(to_free->ptr) << "\n";
         cuMemFree(to_free->ptr);
+        __atomic_fetch_sub(&cuda_allocation_pool.cached_bytes, to_free->size, __ATOMIC_RELAXED);
         FreeListItem *next = to_free->next;
         free(to_free);
         to_free = next;
@@ -604,8 +609,6 @@ namespace Halide {
 namespace Runtime {
 namespace Internal {
 
-WEAK halide_device_allocation_pool cuda_allocation_pool;
-
 WEAK __attribute__((constructor)) void register_cuda_allocation_pool() {
     cuda_allocation_pool.release_unused = &halide_cuda_release_unused_device_allocations;
     halide_register_device_allocation_pool(&cuda_allocation_pool);
@@ -676,6 +679,9 @@ WEAK int halide_cuda_device_free(void *user_context, halide_buffer_t *buf) {
             ScopedMutexLock lock(&free_list_lock);
             item->next = free_list;
             free_list = item;
+            // Once the lock is dropped another thread may take the
+            // item and free it, so count it while it's still ours.
+            __atomic_fetch_add(&cuda_allocation_pool.cached_bytes, item->size, __ATOMIC_RELAXED);
         }
     } else {
         debug(user_context) << "    cuMemFree " << (void *)(dev_ptr) << "\n";
@@ -861,6 +867,7 @@ WEAK int halide_cuda_device_malloc(void *user_context, halide_buffer_t *buf) {
         if (best) {
             p = best->ptr;
             *best_prev = best->next;
+            __atomic_fetch_sub(&cuda_allocation_pool.cached_bytes, best->size, __ATOMIC_RELAXED);
             free(best);
         }
     }
@@ -868,6 +875,7 @@ WEAK int halide_cuda_device_malloc(void *user_context, halide_buffer_t *buf) {
     while (to_free) {
         FreeListItem *next = to_free->next;
         cuMemFree(to_free->ptr);
+        __atomic_fetch_sub(&cuda_allocation_pool.cached_bytes, to_free->size, __ATOMIC_RELAXED);
         free(to_free);
         to_free = next;
     }
@@ -0,0 +1,73 @@
+#include "HalideRuntime.h"
+#include "cpu_topology.h"
+#include "runtime_internal.h"
+
+// Platforms without NUMA support see a single node and never pin
+// threads.
+
+namespace Halide {
+namespace Runtime {
+namespace Internal {
+
+WEAK int numa_node_count() {
+    return 1;
+}
+
+WEAK int numa_node_of_current_thread() {
+    return 0;
+}
+
+WEAK bool should_pin_worker_threads() {
+    return false;
+}
+
+WEAK void pin_worker_thread(int index) {
+}
+
+WEAK int get_worker_placements(const halide_thread_placement_t **placements) {
+    *placements = NULL;
+    return 0;
+}
+
+WEAK void clear_worker_placements() {
+}
+
+WEAK void set_current_thread_priority(int priority) {
+}
+
+WEAK void *page_malloc(size_t x) {
+    return NULL;
+}
+
+WEAK bool page_free(void *ptr) {
+    return false;
+}
+
+WEAK size_t page_malloc_size(void *ptr) {
+    return 0;
+}
+
+WEAK void get_huge_page_usage(uint64_t *allocations, uint64_t *bytes, uint64_t *peak_bytes) {
+    *allocations = 0;
+    *bytes = 0;
+    *peak_bytes = 0;
+}
+
+}  // namespace Internal
+}  // namespace Runtime
+}  // namespace Halide
+
+extern "C" {
+
+WEAK int halide_set_numa_aware(int enable) {
+    return 0;
+}
+
+WEAK int64_t halide_set_huge_page_threshold(int64_t bytes) {
+    return 0;
+}
+
+WEAK int halide_set_thread_affinity(const char *policy) {
+    return halide_error_code_success;
+}
+}
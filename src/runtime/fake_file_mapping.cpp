@@ -0,0 +1,27 @@
+#include "HalideRuntime.h"
+#include "file_mapping.h"
+#include "runtime_internal.h"
+
+// Platforms without shared file mappings can't open a file, so the
+// persistent tier of the memoization cache stays off.
+
+namespace Halide {
+namespace Runtime {
+namespace Internal {
+
+WEAK bool map_file(const char *path, size_t new_size, mapped_file_t *f) {
+    return false;
+}
+
+WEAK void unmap_file(mapped_file_t *f) {
+}
+
+WEAK void lock_file(mapped_file_t *f) {
+}
+
+WEAK void unlock_file(mapped_file_t *f) {
+}
+
+}  // namespace Internal
+}  // namespace Runtime
+}  // namespace Halide
@@ -0,0 +1,26 @@
+#include "HalideRuntime.h"
+#include "perf_counters.h"
+#include "runtime_internal.h"
+
+// Platforms without a way to count events count none, and the
+// profiler reports only time.
+
+namespace Halide {
+namespace Runtime {
+namespace Internal {
+
+WEAK int get_perf_counter_names(const char **names) {
+    return 0;
+}
+
+WEAK perf_counter_thread_t *current_thread_perf_counters() {
+    return NULL;
+}
+
+WEAK int read_perf_counters(perf_counter_thread_t *t, uint64_t *values) {
+    return 0;
+}
+
+}  // namespace Internal
+}  // namespace Runtime
+}  // namespace Halide
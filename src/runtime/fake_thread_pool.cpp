@@ -1,4 +1,5 @@
 #include "HalideRuntime.h"
+#include "runtime_metrics.h"
 
 extern "C" {
 
@@ -60,6 +61,20 @@ WEAK halide_semaphore_init_t custom_semaphore_init = halide_default_semaphore_in
 WEAK halide_semaphore_try_acquire_t custom_semaphore_try_acquire = halide_default_semaphore_try_acquire;
 WEAK halide_semaphore_release_t custom_semaphore_release = halide_default_semaphore_release;
 
+WEAK bool halide_can_spawn_threads() {
+    return false;
+}
+
+// There are no thread pools, as everything runs on the calling thread.
+WEAK void get_thread_pool_metrics(halide_runtime_metrics_t *metrics) {
+    metrics->thread_pools = 0;
+    metrics->threads_created = 0;
+    metrics->workers_sleeping = 0;
+    metrics->owners_sleeping = 0;
+    metrics->threads_reserved = 0;
+    metrics->queued_jobs = 0;
+}
+
 }  // namespace Internal
 }  // namespace Runtime
 }  // namespace Halide
@@ -114,6 +129,46 @@ WEAK int halide_set_num_threads(int n) {
     return 1;
 }
 
+WEAK int halide_set_work_stealing(int enable) {
+    return 0;
+}
+
+WEAK int halide_do_async(void *user_context, halide_async_task_t task, void *arg,
+                         halide_async_callback_t callback, halide_semaphore_t *done) {
+    int result = task(user_context, arg);
+    if (done) {
+        halide_semaphore_release(done, 1);
+    }
+    if (callback) {
+        callback(user_context, arg, result);
+    }
+    return halide_error_code_success;
+}
+
+WEAK int halide_create_thread_pool(const char *name, int num_threads, int priority) {
+    halide_error(NULL, "halide_create_thread_pool: not supported on this platform.");
+    return halide_error_code_generic_error;
+}
+
+WEAK int halide_set_thread_pool(void *user_context, int pool) {
+    if (pool != 0) {
+        halide_error(user_context, "halide_set_thread_pool: only the default pool exists on this platform.");
+        return halide_error_code_generic_error;
+    }
+    return 0;
+}
+
+WEAK int halide_set_num_threads_in_pool(int pool, int n) {
+    if (pool != 0) {
+        halide_error(NULL, "halide_set_num_threads_in_pool: only the default pool exists on this platform.");
+        return halide_error_code_generic_error;
+    }
+    return halide_set_num_threads(n);
+}
+
+WEAK void halide_shutdown_thread_pool_by_id(int pool) {
+}
+
 WEAK halide_do_task_t halide_set_custom_do_task(halide_do_task_t f) {
     halide_do_task_t result = custom_do_task;
     custom_do_task = f;
@@ -0,0 +1,45 @@
+#ifndef HALIDE_FILE_MAPPING_H
+#define HALIDE_FILE_MAPPING_H
+
+#include "HalideRuntime.h"
+#include "runtime_internal.h"
+
+// Files mapped into memory and shared between processes, used by the
+// persistent tier of the memoization cache. Each platform provides
+// these in its own runtime module. Platforms that can't map files
+// always fail to open one, which leaves the persistent tier disabled.
+
+namespace Halide {
+namespace Runtime {
+namespace Internal {
+
+struct mapped_file_t {
+    // Platform specific handle for the open file.
+    void *file;
+    // The file mapped read-only. Only this mapping is handed out.
+    const uint8_t *data;
+    // The same bytes mapped read/write, for adding to the file.
+    uint8_t *writable;
+    size_t size;
+};
+
+// Open the file at path, creating it if it doesn't exist, and map all
+// of it twice, shared: once read-only and once read/write. An empty
+// file is first grown to new_size bytes of zeros, with disk space
+// allocated for all of them. Returns false on failure.
+WEAK bool map_file(const char *path, size_t new_size, mapped_file_t *f);
+
+// Unmap and close a file opened with map_file.
+WEAK void unmap_file(mapped_file_t *f);
+
+// Take or drop an exclusive lock on the file, shared with all other
+// processes that have it mapped. Threads of the same process are not
+// excluded from each other.
+WEAK void lock_file(mapped_file_t *f);
+WEAK void unlock_file(mapped_file_t *f);
+
+}  // namespace Internal
+}  // namespace Runtime
+}  // namespace Halide
+
+#endif
@@ -0,0 +1,641 @@
+#include "HalideRuntime.h"
+#include "cpu_topology.h"
+#include "printer.h"
+#include "runtime_internal.h"
+#include "scoped_spin_lock.h"
+
+extern "C" {
+
+extern size_t fread(void *, size_t, size_t, void *);
+extern int sched_getcpu();
+extern int sched_setaffinity(int pid, size_t cpusetsize, const void *mask);
+extern void *mmap(void *addr, size_t length, int prot, int flags, int fd, long offset);
+extern int munmap(void *addr, size_t length);
+extern int madvise(void *addr, size_t length, int advice);
+extern int setpriority(int which, int who, int prio);
+
+}  // extern "C"
+
+namespace Halide {
+namespace Runtime {
+namespace Internal {
+
+#define MAX_NUMA_NODES 64
+#define MAX_CPUS 1024
+#define MAX_WORKER_THREADS 256
+
+// Linux values of the mmap constants we need.
+#define PROT_READ 0x1
+#define PROT_WRITE 0x2
+#define MAP_PRIVATE 0x02
+#define MAP_ANONYMOUS 0x20
+#define MAP_FAILED ((void *)-1)
+#define MADV_HUGEPAGE 14
+
+// Allocations at least this big are served from fresh pages when NUMA
+// awareness is on. Smaller ones are not worth a system call each.
+#define NUMA_MMAP_THRESHOLD (1 << 20)
+
+// The x86-64 and AArch64 (with 4K base pages) transparent huge page
+// size. Regions handed to madvise(MADV_HUGEPAGE) are aligned to it, so
+// that the kernel can back all of them with huge pages.
+#define HUGE_PAGE_SIZE (2 << 20)
+
+// Set in the header word of page_malloc allocations (along with the low
+// bit) when the mapping was made for huge pages.
+#define PAGE_MALLOC_HUGE_MARK 2
+
+struct cpu_mask_t {
+    uint64_t bits[MAX_CPUS / 64];
+
+    ALWAYS_INLINE void set(int cpu) {
+        bits[cpu >> 6] |= ((uint64_t)1) << (cpu & 63);
+    }
+
+    ALWAYS_INLINE bool test(int cpu) const {
+        return (bits[cpu >> 6] & (((uint64_t)1) << (cpu & 63))) != 0;
+    }
+};
+
+// Where a CPU sits in the machine. Cores and sockets are renumbered
+// densely in the order they are discovered.
+struct cpu_info_t {
+    int16_t core;
+    int16_t socket;
+    // The index of this CPU among the SMT siblings of its core.
+    int8_t sibling;
+    int8_t node;
+    bool online;
+};
+
+enum {
+    numa_mode_default = 0,
+    numa_mode_disabled = 1,
+    numa_mode_enabled = 2,
+};
+
+enum {
+    affinity_default = 0,
+    affinity_none,
+    affinity_cpu_set,
+    affinity_core,
+    affinity_smt,
+    affinity_socket,
+};
+
+struct cpu_topology_t {
+    // Protects initialization.
+    ScopedSpinLock::AtomicFlag lock;
+
+    bool initialized;
+
+    // Whether the user (or HL_NUMA) turned NUMA awareness on. Zero
+    // means not yet decided.
+    int numa_mode;
+
+    // How workers are pinned (HL_THREAD_AFFINITY). Zero means not yet
+    // decided.
+    int affinity;
+    cpu_mask_t affinity_cpus;
+
+    // Nodes that have at least one CPU, renumbered densely.
+    int num_nodes;
+    cpu_mask_t node_cpus[MAX_NUMA_NODES];
+
+    int num_cpus, num_cores, num_sockets;
+    cpu_info_t cpus[MAX_CPUS];
+
+    // Cores ordered so that consecutive entries are on different
+    // sockets where possible, and online CPUs ordered so that all
+    // cores get a first hardware thread before any gets a second.
+    int16_t core_order[MAX_CPUS];
+    int16_t smt_order[MAX_CPUS];
+
+    // Where each worker thread was pinned.
+    int num_workers;
+    halide_thread_placement_t workers[MAX_WORKER_THREADS];
+};
+
+WEAK cpu_topology_t cpu_topology;
+
+struct huge_page_state_t {
+    // Allocations of at least this many bytes are served from huge
+    // page aligned mappings. Zero means not yet read from
+    // HL_HUGE_PAGE_THRESHOLD, negative means off.
+    int64_t threshold;
+    uint64_t allocations;
+    uint64_t bytes;
+    uint64_t peak_bytes;
+};
+
+WEAK huge_page_state_t huge_page_state;
+
+WEAK int default_numa_mode() {
+    char *numa_str = getenv("HL_NUMA");
+    if (numa_str && atoi(numa_str) != 0) {
+        return numa_mode_enabled;
+    }
+    return numa_mode_disabled;
+}
+
+// Read a small sysfs file into buf as a NUL-terminated string. The
+// root of the sysfs tree can be overridden with HL_SYSFS_ROOT so that
+// a fake topology can be used for testing.
+WEAK bool read_sysfs_file(const char *path, char *buf, size_t size) {
+    char filename[256];
+    char *dst = filename;
+    char *end = filename + sizeof(filename);
+    const char *root = getenv("HL_SYSFS_ROOT");
+    dst = halide_string_to_string(dst, end, root ? root : "/sys");
+    dst = halide_string_to_string(dst, end, path);
+    void *f = fopen(filename, "r");
+    if (!f) {
+        return false;
+    }
+    size_t bytes = fread(buf, 1, size - 1, f);
+    buf[bytes] = 0;
+    fclose(f);
+    return bytes > 0;
+}
+
+// Read a sysfs file under /devices/system/ containing a single
+// integer, with the given CPU or node number spliced into the
+// path. Returns -1 if it can't be read.
+WEAK int read_sysfs_int(const char *prefix, int index, const char *suffix) {
+    char path[128];
+    char *dst = path;
+    char *end = path + sizeof(path);
+    dst = halide_string_to_string(dst, end, "/devices/system/");
+    dst = halide_string_to_string(dst, end, prefix);
+    dst = halide_int64_to_string(dst, end, index, 1);
+    dst = halide_string_to_string(dst, end, suffix);
+    char buf[32];
+    if (!read_sysfs_file(path, buf, sizeof(buf))) {
+        return -1;
+    }
+    return atoi(buf);
+}
+
+// Parse a cpulist such as "0-3,8-11" into a mask. Returns the number
+// of CPUs found, or -1 if the string contains anything else.
+WEAK int parse_cpu_list(const char *str, cpu_mask_t *mask) {
+    int count = 0;
+    while (*str) {
+        if (*str == ',' || *str == ' ' || *str == '\n') {
+            str++;
+            continue;
+        }
+        if (*str < '0' || *str > '9') {
+            return -1;
+        }
+        int first = 0;
+        while (*str >= '0' && *str <= '9') {
+            first = first * 10 + (*str++ - '0');
+        }
+        int last = first;
+        if (*str == '-') {
+            str++;
+            last = 0;
+            while (*str >= '0' && *str <= '9') {
+                last = last * 10 + (*str++ - '0');
+            }
+        }
+        for (int cpu = first; cpu <= last && cpu < MAX_CPUS; cpu++) {
+            mask->set(cpu);
+            count++;
+        }
+    }
+    return count;
+}
+
+// Parse a thread affinity policy: "none", "core", "smt", "socket", or
+// a cpulist. Returns false if it is none of those.
+WEAK bool parse_thread_affinity(const char *str, int *policy, cpu_mask_t *mask) {
+    memset(mask, 0, sizeof(cpu_mask_t));
+    if (!str || !*str || !strcmp(str, "none")) {
+        *policy = affinity_none;
+    } else if (!strcmp(str, "core")) {
+        *policy = affinity_core;
+    } else if (!strcmp(str, "smt")) {
+        *policy = affinity_smt;
+    } else if (!strcmp(str, "socket")) {
+        *policy = affinity_socket;
+    } else if (parse_cpu_list(str, mask) > 0) {
+        *policy = affinity_cpu_set;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+WEAK void load_numa_nodes() {
+    cpu_topology.num_nodes = 0;
+    for (int node = 0; node < MAX_NUMA_NODES; node++) {
+        char path[64];
+        char *dst = path;
+        char *end = path + sizeof(path);
+        dst = halide_string_to_string(dst, end, "/devices/system/node/node");
+        dst = halide_int64_to_string(dst, end, node, 1);
+        dst = halide_string_to_string(dst, end, "/cpulist");
+        char cpulist[1024];
+        if (!read_sysfs_file(path, cpulist, sizeof(cpulist))) {
+            continue;
+        }
+        cpu_mask_t *mask = &cpu_topology.node_cpus[cpu_topology.num_nodes];
+        memset(mask, 0, sizeof(cpu_mask_t));
+        if (parse_cpu_list(cpulist, mask) <= 0) {
+            // Memory-only node.
+            continue;
+        }
+        for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+            if (mask->test(cpu)) {
+                cpu_topology.cpus[cpu].node = (int8_t)cpu_topology.num_nodes;
+            }
+        }
+        cpu_topology.num_nodes++;
+    }
+    if (cpu_topology.num_nodes == 0) {
+        // No sysfs (or no NUMA support in the kernel).
+        cpu_topology.num_nodes = 1;
+        memset(&cpu_topology.node_cpus[0], 0xff, sizeof(cpu_mask_t));
+    }
+}
+
+WEAK void load_cpus() {
+    cpu_mask_t online;
+    memset(&online, 0, sizeof(online));
+    char cpulist[1024];
+    if (!read_sysfs_file("/devices/system/cpu/online", cpulist, sizeof(cpulist)) ||
+        parse_cpu_list(cpulist, &online) <= 0) {
+        int count = halide_host_cpu_count();
+        for (int cpu = 0; cpu < count && cpu < MAX_CPUS; cpu++) {
+            online.set(cpu);
+        }
+    }
+
+    // Core and socket ids from sysfs are only unique within a socket,
+    // and may be sparse, so renumber them.
+    int16_t core_id[MAX_CPUS], socket_id[MAX_CPUS];
+    int16_t core_socket[MAX_CPUS], core_rank[MAX_CPUS], core_siblings[MAX_CPUS];
+    int16_t socket_cores[MAX_CPUS];
+    cpu_topology.num_cpus = 0;
+    cpu_topology.num_cores = 0;
+    cpu_topology.num_sockets = 0;
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        cpu_info_t *info = &cpu_topology.cpus[cpu];
+        if (!online.test(cpu)) {
+            continue;
+        }
+        info->online = true;
+        cpu_topology.num_cpus++;
+
+        int raw_socket = read_sysfs_int("cpu/cpu", cpu, "/topology/physical_package_id");
+        int raw_core = read_sysfs_int("cpu/cpu", cpu, "/topology/core_id");
+        if (raw_core < 0) {
+            // Assume no SMT.
+            raw_core = cpu;
+        }
+
+        int socket = 0;
+        while (socket < cpu_topology.num_sockets && socket_id[socket] != raw_socket) {
+            socket++;
+        }
+        if (socket == cpu_topology.num_sockets) {
+            socket_id[socket] = (int16_t)raw_socket;
+            socket_cores[socket] = 0;
+            cpu_topology.num_sockets++;
+        }
+
+        int core = 0;
+        while (core < cpu_topology.num_cores &&
+               (core_id[core] != raw_core || core_socket[core] != socket)) {
+            core++;
+        }
+        if (core == cpu_topology.num_cores) {
+            core_id[core] = (int16_t)raw_core;
+            core_socket[core] = (int16_t)socket;
+            core_rank[core] = socket_cores[socket]++;
+            core_siblings[core] = 0;
+            cpu_topology.num_cores++;
+        }
+
+        info->socket = (int16_t)socket;
+        info->core = (int16_t)core;
+        info->sibling = (int8_t)core_siblings[core]++;
+    }
+
+    // Deal cores out round-robin across sockets.
+    int n = 0;
+    for (int rank = 0; n < cpu_topology.num_cores; rank++) {
+        for (int socket = 0; socket < cpu_topology.num_sockets; socket++) {
+            for (int core = 0; core < cpu_topology.num_cores; core++) {
+                if (core_socket[core] == socket && core_rank[core] == rank) {
+                    cpu_topology.core_order[n++] = (int16_t)core;
+                }
+            }
+        }
+    }
+
+    // Then hardware threads: the first sibling of every core (in
+    // core order), then the second, and so on.
+    n = 0;
+    for (int sibling = 0; n < cpu_topology.num_cpus; sibling++) {
+        for (int i = 0; i < cpu_topology.num_cores; i++) {
+            for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+                const cpu_info_t &info = cpu_topology.cpus[cpu];
+                if (info.online && info.core == cpu_topology.core_order[i] && info.sibling == sibling) {
+                    cpu_topology.smt_order[n++] = (int16_t)cpu;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+WEAK void load_cpu_topology() {
+    ScopedSpinLock lock(&cpu_topology.lock);
+    if (cpu_topology.initialized) {
+        return;
+    }
+    if (cpu_topology.numa_mode == numa_mode_default) {
+        cpu_topology.numa_mode = default_numa_mode();
+    }
+    if (cpu_topology.affinity == affinity_default) {
+        const char *affinity_str = getenv("HL_THREAD_AFFINITY");
+        if (!parse_thread_affinity(affinity_str, &cpu_topology.affinity, &cpu_topology.affinity_cpus)) {
+            halide_print(NULL, "Ignoring unrecognized HL_THREAD_AFFINITY\n");
+            cpu_topology.affinity = affinity_none;
+        }
+    }
+    memset(cpu_topology.cpus, 0, sizeof(cpu_topology.cpus));
+    load_numa_nodes();
+    load_cpus();
+    cpu_topology.initialized = true;
+}
+
+WEAK int numa_node_count() {
+    load_cpu_topology();
+    return cpu_topology.numa_mode == numa_mode_enabled ? cpu_topology.num_nodes : 1;
+}
+
+WEAK int numa_node_of_current_thread() {
+    if (numa_node_count() == 1) {
+        return 0;
+    }
+    int cpu = sched_getcpu();
+    if (cpu < 0 || cpu >= MAX_CPUS) {
+        return 0;
+    }
+    return cpu_topology.cpus[cpu].node;
+}
+
+WEAK bool should_pin_worker_threads() {
+    load_cpu_topology();
+    return cpu_topology.affinity != affinity_none || numa_node_count() > 1;
+}
+
+WEAK void pin_worker_thread(int index) {
+    load_cpu_topology();
+    if (index < 0 || index >= MAX_WORKER_THREADS || cpu_topology.num_cpus == 0) {
+        return;
+    }
+
+    cpu_mask_t mask;
+    memset(&mask, 0, sizeof(mask));
+    switch (cpu_topology.affinity) {
+    case affinity_cpu_set:
+        mask = cpu_topology.affinity_cpus;
+        break;
+    case affinity_core:
+    case affinity_socket: {
+        bool by_core = cpu_topology.affinity == affinity_core;
+        int target = by_core ?
+                         cpu_topology.core_order[index % cpu_topology.num_cores] :
+                         index % cpu_topology.num_sockets;
+        for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+            const cpu_info_t &info = cpu_topology.cpus[cpu];
+            if (info.online && (by_core ? info.core : info.socket) == target) {
+                mask.set(cpu);
+            }
+        }
+    } break;
+    case affinity_smt:
+        mask.set(cpu_topology.smt_order[index % cpu_topology.num_cpus]);
+        break;
+    default:
+        if (numa_node_count() > 1) {
+            // Deal the workers out to the nodes round-robin.
+            mask = cpu_topology.node_cpus[index % cpu_topology.num_nodes];
+        } else {
+            return;
+        }
+    }
+
+    halide_thread_placement_t placement;
+    placement.cpu = -1;
+    placement.num_cpus = 0;
+    placement.core = -1;
+    placement.socket = -1;
+    if (sched_setaffinity(0, sizeof(mask), &mask) == 0) {
+        for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+            if (mask.test(cpu) && cpu_topology.cpus[cpu].online) {
+                if (placement.cpu < 0) {
+                    placement.cpu = cpu;
+                    placement.core = cpu_topology.cpus[cpu].core;
+                    placement.socket = cpu_topology.cpus[cpu].socket;
+                }
+                placement.num_cpus++;
+            }
+        }
+    }
+
+    ScopedSpinLock lock(&cpu_topology.lock);
+    cpu_topology.workers[index] = placement;
+    if (cpu_topology.num_workers <= index) {
+        for (int i = cpu_topology.num_workers; i < index; i++) {
+            cpu_topology.workers[i].cpu = -1;
+            cpu_topology.workers[i].num_cpus = 0;
+            cpu_topology.workers[i].core = -1;
+            cpu_topology.workers[i].socket = -1;
+        }
+        cpu_topology.num_workers = index + 1;
+    }
+}
+
+WEAK int get_worker_placements(const halide_thread_placement_t **placements) {
+    *placements = cpu_topology.workers;
+    return cpu_topology.num_workers;
+}
+
+WEAK void clear_worker_placements() {
+    ScopedSpinLock lock(&cpu_topology.lock);
+    cpu_topology.num_workers = 0;
+}
+
+WEAK void set_current_thread_priority(int priority) {
+    // On Linux the nice value belongs to the thread, so PRIO_PROCESS
+    // (0) with a who of zero changes only the caller. Failure (e.g.
+    // raising the priority without permission) just leaves it as is.
+    setpriority(0, 0, priority);
+}
+
+WEAK int64_t default_huge_page_threshold() {
+    char *threshold_str = getenv("HL_HUGE_PAGE_THRESHOLD");
+    if (threshold_str && atoi(threshold_str) > 0) {
+        return atoi(threshold_str);
+    }
+    return -1;
+}
+
+WEAK int64_t get_huge_page_threshold() {
+    int64_t threshold = __atomic_load_n(&huge_page_state.threshold, __ATOMIC_RELAXED);
+    if (threshold == 0) {
+        // Racing threads all read the same environment, so it doesn't
+        // matter which of them stores it.
+        threshold = default_huge_page_threshold();
+        int64_t expected = 0;
+        if (!__atomic_compare_exchange_n(&huge_page_state.threshold, &expected, threshold,
+                                         false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            threshold = expected;
+        }
+    }
+    return threshold;
+}
+
+// Map size bytes starting on a huge page boundary, and ask for them to
+// be backed by huge pages. mmap only promises base page alignment, so
+// map an extra huge page and trim the ends.
+WEAK void *map_huge_pages(size_t size) {
+    size_t padded = size + HUGE_PAGE_SIZE;
+    void *orig = mmap(NULL, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (orig == MAP_FAILED) {
+        return MAP_FAILED;
+    }
+    size_t start = ((size_t)orig + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+    size_t head = start - (size_t)orig;
+    if (head) {
+        munmap(orig, head);
+    }
+    if (padded - head > size) {
+        munmap((void *)(start + size), padded - head - size);
+    }
+    // Without THP in the kernel (or with it set to "never") this
+    // fails, and the region is just ordinary pages.
+    madvise((void *)start, size, MADV_HUGEPAGE);
+    return (void *)start;
+}
+
+WEAK void *page_malloc(size_t x) {
+    int64_t huge_threshold = get_huge_page_threshold();
+    bool huge = huge_threshold > 0 && x >= (uint64_t)huge_threshold;
+    if (!huge) {
+        int mode = __atomic_load_n(&cpu_topology.numa_mode, __ATOMIC_RELAXED);
+        if (mode == numa_mode_default) {
+            load_cpu_topology();
+            mode = cpu_topology.numa_mode;
+        }
+        if (mode != numa_mode_enabled || x < NUMA_MMAP_THRESHOLD) {
+            return NULL;
+        }
+    }
+
+    // Fresh anonymous pages are not placed until they are first
+    // written, so a buffer filled by a parallel loop whose workers are
+    // grouped by node ends up spread across the nodes that produce it,
+    // instead of wherever the heap last recycled memory. Huge pages are
+    // placed the same way, a huge page at a time.
+    const size_t alignment = halide_malloc_alignment();
+    const size_t header = (2 * sizeof(void *) + alignment - 1) & ~(alignment - 1);
+    size_t size = x + header;
+    void *orig;
+    if (huge) {
+        size = (size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+        orig = map_huge_pages(size);
+    } else {
+        orig = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if (orig == MAP_FAILED) {
+        return NULL;
+    }
+    void *ptr = (void *)((size_t)orig + header);
+    // As in halide_default_malloc, the original pointer goes just
+    // before the returned one. Its low bit is set to mark the
+    // allocation as ours; malloc never returns odd pointers. The
+    // mapping is page aligned, so the next bit is free to mark huge
+    // page mappings.
+    ((void **)ptr)[-1] = (void *)((size_t)orig | (huge ? PAGE_MALLOC_HUGE_MARK : 0) | 1);
+    ((size_t *)ptr)[-2] = size;
+
+    if (huge) {
+        __atomic_fetch_add(&huge_page_state.allocations, 1, __ATOMIC_RELAXED);
+        uint64_t bytes = __atomic_add_fetch(&huge_page_state.bytes, size, __ATOMIC_RELAXED);
+        uint64_t peak = __atomic_load_n(&huge_page_state.peak_bytes, __ATOMIC_RELAXED);
+        while (bytes > peak &&
+               !__atomic_compare_exchange_n(&huge_page_state.peak_bytes, &peak, bytes,
+                                            true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        }
+    }
+    return ptr;
+}
+
+WEAK bool page_free(void *ptr) {
+    size_t orig = (size_t)(((void **)ptr)[-1]);
+    if (!(orig & 1)) {
+        return false;
+    }
+    size_t size = ((size_t *)ptr)[-2];
+    if (orig & PAGE_MALLOC_HUGE_MARK) {
+        __atomic_fetch_sub(&huge_page_state.bytes, size, __ATOMIC_RELAXED);
+    }
+    munmap((void *)(orig & ~(size_t)(PAGE_MALLOC_HUGE_MARK | 1)), size);
+    return true;
+}
+
+WEAK size_t page_malloc_size(void *ptr) {
+    size_t orig = (size_t)(((void **)ptr)[-1]);
+    return (orig & 1) ? ((size_t *)ptr)[-2] : 0;
+}
+
+WEAK void get_huge_page_usage(uint64_t *allocations, uint64_t *bytes, uint64_t *peak_bytes) {
+    *allocations = __atomic_load_n(&huge_page_state.allocations, __ATOMIC_RELAXED);
+    *bytes = __atomic_load_n(&huge_page_state.bytes, __ATOMIC_RELAXED);
+    *peak_bytes = __atomic_load_n(&huge_page_state.peak_bytes, __ATOMIC_RELAXED);
+}
+
+}  // namespace Internal
+}  // namespace Runtime
+}  // namespace Halide
+
+using namespace Halide::Runtime::Internal;
+
+extern "C" {
+
+WEAK int halide_set_numa_aware(int enable) {
+    load_cpu_topology();
+    int old = cpu_topology.numa_mode;
+    __atomic_store_n(&cpu_topology.numa_mode, enable ? numa_mode_enabled : numa_mode_disabled, __ATOMIC_RELEASE);
+    return old == numa_mode_enabled;
+}
+
+WEAK int64_t halide_set_huge_page_threshold(int64_t bytes) {
+    int64_t old = __atomic_exchange_n(&huge_page_state.threshold, bytes > 0 ? bytes : -1, __ATOMIC_RELAXED);
+    if (old == 0) {
+        old = default_huge_page_threshold();
+    }
+    return old > 0 ? old : 0;
+}
+
+WEAK int halide_set_thread_affinity(const char *policy) {
+    load_cpu_topology();
+    int affinity;
+    cpu_mask_t mask;
+    if (!parse_thread_affinity(policy, &affinity, &mask)) {
+        error(NULL) << "halide_set_thread_affinity: unrecognized policy " << policy << "\n";
+        return halide_error_code_generic_error;
+    }
+    ScopedSpinLock lock(&cpu_topology.lock);
+    cpu_topology.affinity = affinity;
+    cpu_topology.affinity_cpus = mask;
+    return halide_error_code_success;
+}
+}
@@ -0,0 +1,256 @@
+#include "HalideRuntime.h"
+#include "perf_counters.h"
+#include "runtime_internal.h"
+#include "scoped_spin_lock.h"
+
+extern "C" {
+
+extern long syscall(long number, ...);
+extern int uname(void *buf);
+extern ssize_t read(int fd, void *buf, size_t count);
+typedef unsigned int pthread_key_t;
+extern int pthread_key_create(pthread_key_t *key, void (*destructor)(void *));
+extern int pthread_setspecific(pthread_key_t key, const void *value);
+extern void *pthread_getspecific(pthread_key_t key);
+
+}  // extern "C"
+
+namespace Halide {
+namespace Runtime {
+namespace Internal {
+
+// The parts of struct perf_event_attr we use, as it was first defined
+// (PERF_ATTR_SIZE_VER0). Newer kernels accept the older size.
+struct perf_event_attr_t {
+    uint32_t type;
+    uint32_t size;
+    uint64_t config;
+    uint64_t sample_period;
+    uint64_t sample_type;
+    uint64_t read_format;
+    uint64_t flags;
+    uint32_t wakeup_events;
+    uint32_t bp_type;
+    uint64_t config1;
+};
+
+#define PERF_TYPE_HARDWARE 0
+#define PERF_TYPE_SOFTWARE 1
+#define PERF_FORMAT_GROUP (1 << 3)
+#define PERF_ATTR_FLAG_EXCLUDE_KERNEL (1 << 5)
+#define PERF_ATTR_FLAG_EXCLUDE_HV (1 << 6)
+#define PERF_FLAG_FD_CLOEXEC 8
+
+struct perf_event_t {
+    const char *name;
+    uint64_t config;
+};
+
+const perf_event_t hardware_events[halide_profiler_max_counters] = {
+    {"cycles", 0},         // PERF_COUNT_HW_CPU_CYCLES
+    {"instructions", 1},   // PERF_COUNT_HW_INSTRUCTIONS
+    {"cache-misses", 3},   // PERF_COUNT_HW_CACHE_MISSES
+    {"branch-misses", 5},  // PERF_COUNT_HW_BRANCH_MISSES
+};
+
+const perf_event_t software_events[halide_profiler_max_counters] = {
+    {"task-clock", 1},        // PERF_COUNT_SW_TASK_CLOCK
+    {"page-faults", 2},       // PERF_COUNT_SW_PAGE_FAULTS
+    {"context-switches", 3},  // PERF_COUNT_SW_CONTEXT_SWITCHES
+    {"cpu-migrations", 4},    // PERF_COUNT_SW_CPU_MIGRATIONS
+};
+
+enum {
+    perf_events_unknown = 0,
+    perf_events_hardware,
+    perf_events_software,
+    perf_events_unavailable,
+};
+
+struct perf_counter_state_t {
+    ScopedSpinLock::AtomicFlag lock;
+    int events;
+    long syscall_number;
+    // Each thread's counters are found through this key, and closed
+    // when the thread exits.
+    bool key_created;
+    pthread_key_t key;
+};
+
+WEAK perf_counter_state_t perf_counter_state;
+
+// Stored for threads whose counters couldn't be opened, so that they
+// don't try again.
+WEAK perf_counter_thread_t uncounted_thread;
+
+// There's no libc wrapper for perf_event_open, and the runtime isn't
+// compiled per architecture, so look the system call up by the
+// machine the kernel reports.
+WEAK long perf_event_open_syscall_number() {
+    char uts[6 * 65];
+    if (uname(uts) != 0) {
+        return -1;
+    }
+    const char *machine = uts + 4 * 65;
+    bool is_64 = sizeof(void *) == 8;
+    if (!strcmp(machine, "x86_64")) {
+        return is_64 ? 298 : 336;
+    } else if (machine[0] == 'i' && !strcmp(machine + 2, "86")) {
+        return 336;
+    } else if (!strcmp(machine, "aarch64")) {
+        return is_64 ? 241 : 364;
+    } else if (!strncmp(machine, "arm", 3)) {
+        return 364;
+    } else if (!strncmp(machine, "ppc", 3)) {
+        return 319;
+    } else if (!strncmp(machine, "riscv", 5)) {
+        return 241;
+    }
+    return -1;
+}
+
+// Open a group of counters for the calling thread. The first fd is
+// the group leader. Returns false if any of them can't be opened.
+WEAK bool open_perf_events(uint32_t type, const perf_event_t *events, int *fds) {
+    for (int i = 0; i < halide_profiler_max_counters; i++) {
+        perf_event_attr_t attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = type;
+        attr.size = sizeof(attr);
+        attr.config = events[i].config;
+        attr.read_format = PERF_FORMAT_GROUP;
+        // Unprivileged processes may only count their own user code.
+        attr.flags = PERF_ATTR_FLAG_EXCLUDE_KERNEL | PERF_ATTR_FLAG_EXCLUDE_HV;
+        int group = i == 0 ? -1 : fds[0];
+        fds[i] = (int)syscall(perf_counter_state.syscall_number, &attr, 0, -1, group, PERF_FLAG_FD_CLOEXEC);
+        if (fds[i] < 0) {
+            while (i-- > 0) {
+                close(fds[i]);
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+// Open the calling thread's counters, deciding which events to count
+// the first time around.
+WEAK bool open_thread_perf_events(int *fds) {
+    int events = __atomic_load_n(&perf_counter_state.events, __ATOMIC_ACQUIRE);
+    if (events == perf_events_unknown) {
+        ScopedSpinLock lock(&perf_counter_state.lock);
+        events = perf_counter_state.events;
+        if (events == perf_events_unknown) {
+            bool opened = false;
+            perf_counter_state.syscall_number = perf_event_open_syscall_number();
+            if (perf_counter_state.syscall_number >= 0) {
+                events = perf_events_hardware;
+                opened = open_perf_events(PERF_TYPE_HARDWARE, hardware_events, fds);
+                if (!opened) {
+                    events = perf_events_software;
+                    opened = open_perf_events(PERF_TYPE_SOFTWARE, software_events, fds);
+                }
+            }
+            if (!opened) {
+                events = perf_events_unavailable;
+            }
+            __atomic_store_n(&perf_counter_state.events, events, __ATOMIC_RELEASE);
+            return opened;
+        }
+    }
+    if (events == perf_events_hardware) {
+        return open_perf_events(PERF_TYPE_HARDWARE, hardware_events, fds);
+    } else if (events == perf_events_software) {
+        return open_perf_events(PERF_TYPE_SOFTWARE, software_events, fds);
+    }
+    return false;
+}
+
+WEAK int get_perf_counter_names(const char **names) {
+    if (__atomic_load_n(&perf_counter_state.events, __ATOMIC_ACQUIRE) == perf_events_unknown) {
+        // Decide by opening the calling thread's counters.
+        current_thread_perf_counters();
+    }
+    const perf_event_t *events;
+    switch (perf_counter_state.events) {
+    case perf_events_hardware:
+        events = hardware_events;
+        break;
+    case perf_events_software:
+        events = software_events;
+        break;
+    default:
+        return 0;
+    }
+    for (int i = 0; i < halide_profiler_max_counters; i++) {
+        names[i] = events[i].name;
+    }
+    return halide_profiler_max_counters;
+}
+
+WEAK void close_thread_perf_counters(void *arg) {
+    perf_counter_thread_t *t = (perf_counter_thread_t *)arg;
+    if (t != &uncounted_thread) {
+        for (int i = 0; i < halide_profiler_max_counters; i++) {
+            close(t->fds[i]);
+        }
+        free(t);
+    }
+}
+
+WEAK perf_counter_thread_t *current_thread_perf_counters() {
+    if (!__atomic_load_n(&perf_counter_state.key_created, __ATOMIC_ACQUIRE)) {
+        ScopedSpinLock lock(&perf_counter_state.lock);
+        if (!perf_counter_state.key_created) {
+            if (pthread_key_create(&perf_counter_state.key, close_thread_perf_counters) != 0) {
+                return NULL;
+            }
+            __atomic_store_n(&perf_counter_state.key_created, true, __ATOMIC_RELEASE);
+        }
+    }
+
+    perf_counter_thread_t *t = (perf_counter_thread_t *)pthread_getspecific(perf_counter_state.key);
+    if (t) {
+        return t == &uncounted_thread ? NULL : t;
+    }
+
+    int fds[halide_profiler_max_counters];
+    if (open_thread_perf_events(fds)) {
+        t = (perf_counter_thread_t *)malloc(sizeof(perf_counter_thread_t));
+        if (t) {
+            t->pipeline = NULL;
+            t->func = halide_profiler_outside_of_halide;
+            memcpy(t->fds, fds, sizeof(fds));
+            if (!read_perf_counters(t, t->last)) {
+                close_thread_perf_counters(t);
+                t = NULL;
+            }
+        } else {
+            for (int i = 0; i < halide_profiler_max_counters; i++) {
+                close(fds[i]);
+            }
+        }
+    }
+    if (!t) {
+        pthread_setspecific(perf_counter_state.key, &uncounted_thread);
+        return NULL;
+    }
+    pthread_setspecific(perf_counter_state.key, t);
+    return t;
+}
+
+WEAK int read_perf_counters(perf_counter_thread_t *t, uint64_t *values) {
+    // With PERF_FORMAT_GROUP, the count of events, then their values.
+    uint64_t buf[1 + halide_profiler_max_counters];
+    if (read(t->fds[0], buf, sizeof(buf)) != (ssize_t)sizeof(buf)) {
+        return 0;
+    }
+    for (int i = 0; i < halide_profiler_max_counters; i++) {
+        values[i] = buf[i + 1];
+    }
+    return halide_profiler_max_counters;
+}
+
+}  // namespace Internal
+}  // namespace Runtime
+}  // namespace Halide
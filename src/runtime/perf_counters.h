@@ -0,0 +1,46 @@
+#ifndef HALIDE_PERF_COUNTERS_H
+#define HALIDE_PERF_COUNTERS_H
+
+#include "HalideRuntime.h"
+#include "runtime_internal.h"
+
+// Per-thread event counters, read by the profiler whenever a thread
+// changes Func so that the events can be billed to the Func. Hardware
+// events (cycles, instructions, cache and branch misses) are used where
+// the kernel allows it. Where it doesn't, as in many containers and
+// virtual machines, software events are counted instead. Platforms
+// without a way to count events provide none.
+
+namespace Halide {
+namespace Runtime {
+namespace Internal {
+
+struct perf_counter_thread_t {
+    // Where the events counted since the last read are billed, and
+    // the counts at that read. Managed by the profiler.
+    halide_profiler_pipeline_stats *pipeline;
+    int func;
+    uint64_t last[halide_profiler_max_counters];
+
+    // Private to the platform's implementation.
+    int fds[halide_profiler_max_counters];
+};
+
+// The names of the events counted, which are the same on every
+// thread. Returns the number of events, or zero if none can be
+// counted.
+WEAK int get_perf_counter_names(const char **names);
+
+// The counters of the calling thread, opened on first use, or NULL if
+// they can't be.
+WEAK perf_counter_thread_t *current_thread_perf_counters();
+
+// Read the counters of the calling thread into values. Returns the
+// number of values read, or zero on failure.
+WEAK int read_perf_counters(perf_counter_thread_t *t, uint64_t *values);
+
+}  // namespace Internal
+}  // namespace Runtime
+}  // namespace Halide
+
+#endif
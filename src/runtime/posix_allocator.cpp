@@ -1,28 +1,259 @@
 #include "HalideRuntime.h"
+#include "cpu_topology.h"
 #include "runtime_internal.h"
 
 #include "printer.h"
 
+#include "runtime_metrics.h"
+#include "scoped_spin_lock.h"
+
 extern "C" {
 
 extern void *malloc(size_t);
 extern void free(void *);
+}
+
+namespace Halide {
+namespace Runtime {
+namespace Internal {
+
+// Small and medium host allocations are pooled, as pipelines tend to
+// allocate the same sizes over and over, from many threads at once.
+// Freed blocks are kept on free lists by power-of-two size class. The
+// lists are split into arenas, each with its own lock, and a thread
+// uses the arena picked by the address of its stack, so that threads
+// rarely share one. (Real thread-local storage isn't available in all
+// the places the runtime is loaded, such as JIT code.) Each arena
+// holds on to a bounded number of bytes; blocks beyond that are
+// returned to the system.
+#define HOST_POOL_MIN_CLASS_BITS 6   // 64 bytes
+#define HOST_POOL_MAX_CLASS_BITS 18  // 256KB
+#define HOST_POOL_NUM_CLASSES (HOST_POOL_MAX_CLASS_BITS - HOST_POOL_MIN_CLASS_BITS + 1)
+#define HOST_POOL_NUM_ARENAS 8
+#define HOST_POOL_ARENA_BYTES (2 * 1024 * 1024)
+
+// Pooled blocks are marked by this bit in the original pointer stored
+// before them. (page_malloc uses the lowest bit, and checks it first.)
+#define HOST_POOL_MARK 2
+
+struct host_pool_arena_t {
+    ScopedSpinLock::AtomicFlag lock;
+    // Singly linked through the first word of each free block.
+    void *free_blocks[HOST_POOL_NUM_CLASSES];
+    size_t cached_bytes;
+    // The bytes handed out by halide_default_malloc and not yet freed,
+    // and the number of allocations they are in, counted in the arena
+    // of the thread that allocated or freed them. A block freed by
+    // another thread makes one arena's counts wrap below zero, but the
+    // sums over all arenas are right. Only read by
+    // halide_get_runtime_metrics, so relaxed, pointer-sized atomics
+    // suffice, and they stay on the arena's own cache line.
+    size_t live_bytes;
+    size_t live_allocations;
+} __attribute__((aligned(64)));
+
+WEAK host_pool_arena_t host_pool_arenas[HOST_POOL_NUM_ARENAS];
+
+enum {
+    host_pool_default = 0,
+    host_pool_disabled = 1,
+    host_pool_enabled = 2,
+};
+
+// Zero means not yet decided, in which case HL_HOST_ALLOCATION_POOL is
+// consulted on the first allocation.
+WEAK int host_pool_mode = host_pool_default;
+
+WEAK bool host_pool_enabled_now() {
+    int mode = __atomic_load_n(&host_pool_mode, __ATOMIC_RELAXED);
+    if (mode == host_pool_default) {
+        const char *env = getenv("HL_HOST_ALLOCATION_POOL");
+        mode = (env && atoi(env) == 0) ? host_pool_disabled : host_pool_enabled;
+        __atomic_store_n(&host_pool_mode, mode, __ATOMIC_RELAXED);
+    }
+    return mode == host_pool_enabled;
+}
+
+WEAK __attribute__((always_inline)) int host_pool_size_class(size_t x) {
+    int bits = HOST_POOL_MIN_CLASS_BITS;
+    while (((size_t)1 << bits) < x) {
+        bits++;
+    }
+    return bits - HOST_POOL_MIN_CLASS_BITS;
+}
+
+WEAK __attribute__((always_inline)) size_t host_pool_class_bytes(int size_class) {
+    return (size_t)1 << (size_class + HOST_POOL_MIN_CLASS_BITS);
+}
+
+WEAK __attribute__((always_inline)) host_pool_arena_t &current_host_pool_arena() {
+    // Thread stacks are at least a megabyte apart.
+    int marker;
+    size_t stack = (size_t)&marker >> 20;
+    return host_pool_arenas[(stack * 2654435761u >> 8) % HOST_POOL_NUM_ARENAS];
+}
+
+WEAK __attribute__((always_inline)) void count_host_allocation(host_pool_arena_t &arena, size_t bytes) {
+    __atomic_fetch_add(&arena.live_bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&arena.live_allocations, 1, __ATOMIC_RELAXED);
+}
+
+WEAK __attribute__((always_inline)) void count_host_free(host_pool_arena_t &arena, size_t bytes) {
+    __atomic_fetch_sub(&arena.live_bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&arena.live_allocations, 1, __ATOMIC_RELAXED);
+}
+
+WEAK void *host_pool_malloc(size_t x) {
+    if (x > ((size_t)1 << HOST_POOL_MAX_CLASS_BITS) || !host_pool_enabled_now()) {
+        return NULL;
+    }
+    int size_class = host_pool_size_class(x);
+    size_t bytes = host_pool_class_bytes(size_class);
+    host_pool_arena_t &arena = current_host_pool_arena();
+    {
+        ScopedSpinLock lock(&arena.lock);
+        void *ptr = arena.free_blocks[size_class];
+        if (ptr) {
+            arena.free_blocks[size_class] = *(void **)ptr;
+            arena.cached_bytes -= bytes;
+            count_host_allocation(arena, bytes);
+            return ptr;
+        }
+    }
+
+    // As in halide_default_malloc, but with room for the size class
+    // as well as the original pointer.
+    const size_t alignment = halide_malloc_alignment();
+    void *orig = malloc(bytes + alignment + 2 * sizeof(void *));
+    if (orig == NULL) {
+        return NULL;
+    }
+    void *ptr = (void *)(((size_t)orig + alignment + 2 * sizeof(void *) - 1) & ~(alignment - 1));
+    ((void **)ptr)[-1] = (void *)((size_t)orig | HOST_POOL_MARK);
+    ((size_t *)ptr)[-2] = size_class;
+    count_host_allocation(arena, bytes);
+    return ptr;
+}
+
+// Put a block back on a free list. Returns false (and does nothing) if
+// it did not come from host_pool_malloc.
+WEAK bool host_pool_free(void *ptr) {
+    size_t orig = (size_t)(((void **)ptr)[-1]);
+    if (!(orig & HOST_POOL_MARK)) {
+        return false;
+    }
+    int size_class = (int)((size_t *)ptr)[-2];
+    size_t bytes = host_pool_class_bytes(size_class);
+    host_pool_arena_t &arena = current_host_pool_arena();
+    count_host_free(arena, bytes);
+    if (host_pool_enabled_now()) {
+        ScopedSpinLock lock(&arena.lock);
+        if (arena.cached_bytes + bytes <= HOST_POOL_ARENA_BYTES) {
+            *(void **)ptr = arena.free_blocks[size_class];
+            arena.free_blocks[size_class] = ptr;
+            arena.cached_bytes += bytes;
+            return true;
+        }
+    }
+    free((void *)(orig & ~(size_t)HOST_POOL_MARK));
+    return true;
+}
+
+// Return all pooled blocks that aren't in use to the system.
+WEAK void host_pool_release_unused() {
+    for (int a = 0; a < HOST_POOL_NUM_ARENAS; a++) {
+        host_pool_arena_t &arena = host_pool_arenas[a];
+        void *lists[HOST_POOL_NUM_CLASSES];
+        {
+            ScopedSpinLock lock(&arena.lock);
+            for (int c = 0; c < HOST_POOL_NUM_CLASSES; c++) {
+                lists[c] = arena.free_blocks[c];
+                arena.free_blocks[c] = NULL;
+            }
+            arena.cached_bytes = 0;
+        }
+        for (int c = 0; c < HOST_POOL_NUM_CLASSES; c++) {
+            void *ptr = lists[c];
+            while (ptr) {
+                void *next = *(void **)ptr;
+                free((void *)((size_t)(((void **)ptr)[-1]) & ~(size_t)HOST_POOL_MARK));
+                ptr = next;
+            }
+        }
+    }
+}
+
+WEAK __attribute__((destructor)) void halide_host_allocation_pool_cleanup() {
+    host_pool_release_unused();
+}
+
+WEAK void get_host_allocation_metrics(halide_runtime_metrics_t *metrics) {
+    size_t live_bytes = 0, live_allocations = 0;
+    metrics->host_pooled_bytes = 0;
+    for (int a = 0; a < HOST_POOL_NUM_ARENAS; a++) {
+        host_pool_arena_t &arena = host_pool_arenas[a];
+        live_bytes += __atomic_load_n(&arena.live_bytes, __ATOMIC_RELAXED);
+        live_allocations += __atomic_load_n(&arena.live_allocations, __ATOMIC_RELAXED);
+        ScopedSpinLock lock(&arena.lock);
+        metrics->host_pooled_bytes += arena.cached_bytes;
+    }
+    metrics->host_live_bytes = (int64_t)live_bytes;
+    metrics->host_live_allocations = (int64_t)live_allocations;
+}
+
+}  // namespace Internal
+}  // namespace Runtime
+}  // namespace Halide
+
+extern "C" {
 
 WEAK void *halide_default_malloc(void *user_context, size_t x) {
+    // Large allocations in a NUMA-aware process use fresh pages, so
+    // that they are placed by whichever node first touches them, and
+    // those above the huge page threshold use huge pages.
+    void *page_ptr = Halide::Runtime::Internal::page_malloc(x);
+    if (page_ptr) {
+        Halide::Runtime::Internal::count_host_allocation(Halide::Runtime::Internal::current_host_pool_arena(),
+                                                         Halide::Runtime::Internal::page_malloc_size(page_ptr));
+        return page_ptr;
+    }
+
+    // Small allocations are pooled by default. The pool is bypassed
+    // once halide_reuse_host_allocations(user_context, false) has been
+    // called, or if HL_HOST_ALLOCATION_POOL=0 was set at the first
+    // allocation.
+    void *pooled = Halide::Runtime::Internal::host_pool_malloc(x);
+    if (pooled) {
+        return pooled;
+    }
+
     // Allocate enough space for aligning the pointer we return.
     const size_t alignment = halide_malloc_alignment();
-    void *orig = malloc(x + alignment);
+    void *orig = malloc(x + alignment + 2 * sizeof(void *));
     if (orig == NULL) {
         // Will result in a failed assertion and a call to halide_error
         return NULL;
     }
-    // We want to store the original pointer prior to the pointer we return.
-    void *ptr = (void *)(((size_t)orig + alignment + sizeof(void *) - 1) & ~(alignment - 1));
+    // We want to store the original pointer prior to the pointer we
+    // return, and the size before that, so that it can be uncounted.
+    void *ptr = (void *)(((size_t)orig + alignment + 2 * sizeof(void *) - 1) & ~(alignment - 1));
     ((void **)ptr)[-1] = orig;
+    ((size_t *)ptr)[-2] = x;
+    Halide::Runtime::Internal::count_host_allocation(Halide::Runtime::Internal::current_host_pool_arena(), x);
     return ptr;
 }
 
 WEAK void halide_default_free(void *user_context, void *ptr) {
+    size_t page_bytes = Halide::Runtime::Internal::page_malloc_size(ptr);
+    if (page_bytes) {
+        Halide::Runtime::Internal::count_host_free(Halide::Runtime::Internal::current_host_pool_arena(), page_bytes);
+        Halide::Runtime::Internal::page_free(ptr);
+        return;
+    }
+    if (Halide::Runtime::Internal::host_pool_free(ptr)) {
+        return;
+    }
+    Halide::Runtime::Internal::count_host_free(Halide::Runtime::Internal::current_host_pool_arena(), ((size_t *)ptr)[-2]);
     free(((void **)ptr)[-1]);
 }
 }
@@ -59,4 +290,17 @@ WEAK void *halide_malloc(void *user_context, size_t x) {
 WEAK void halide_free(void *user_context, void *ptr) {
     custom_free(user_context, ptr);
 }
+
+WEAK int halide_reuse_host_allocations(void *user_context, bool flag) {
+    __atomic_store_n(&host_pool_mode, flag ? host_pool_enabled : host_pool_disabled, __ATOMIC_RELAXED);
+    if (!flag) {
+        host_pool_release_unused();
+    }
+    return 0;
+}
+
+WEAK int halide_release_unused_host_allocations(void *user_context) {
+    host_pool_release_unused();
+    return 0;
+}
 }
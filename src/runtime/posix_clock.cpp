@@ -52,4 +52,8 @@ extern int usleep(int);
 WEAK void halide_sleep_ms(void *user_context, int ms) {
     usleep(ms * 1000);
 }
+
+WEAK void halide_sleep_us(void *user_context, int us) {
+    usleep(us);
+}
 }
@@ -0,0 +1,124 @@
+#include "HalideRuntime.h"
+#include "file_mapping.h"
+#include "runtime_internal.h"
+
+extern "C" {
+
+extern int fseek(void *stream, long offset, int whence);
+extern long ftell(void *stream);
+extern int ftruncate(int fd, long length);
+extern int flock(int fd, int operation);
+extern void *mmap(void *addr, size_t length, int prot, int flags, int fd, long offset);
+extern int munmap(void *addr, size_t length);
+
+}  // extern "C"
+
+namespace Halide {
+namespace Runtime {
+namespace Internal {
+
+// These have the same values on Linux, Android and OS X.
+#define PROT_READ 0x1
+#define PROT_WRITE 0x2
+#define MAP_SHARED 0x01
+#define MAP_FAILED ((void *)-1)
+#define LOCK_EX 2
+#define LOCK_UN 8
+#define SEEK_END 2
+
+// Grow an empty file to size bytes of zeros by writing them, rather
+// than with ftruncate, which leaves a sparse file: if the disk filled
+// up later, touching an unbacked page of the mapping would raise
+// SIGBUS instead of failing here.
+WEAK bool fill_file(int fd, size_t size) {
+    const size_t chunk = 64 * 1024;
+    uint8_t *zeros = (uint8_t *)malloc(chunk);
+    if (!zeros) {
+        return false;
+    }
+    memset(zeros, 0, chunk);
+    size_t done = 0;
+    while (done < size) {
+        size_t n = size - done < chunk ? size - done : chunk;
+        ssize_t written = write(fd, zeros, n);
+        if (written <= 0) {
+            break;
+        }
+        done += written;
+    }
+    free(zeros);
+    if (done < size) {
+        // Leave the file empty, so that the next process tries again.
+        ftruncate(fd, 0);
+        return false;
+    }
+    return true;
+}
+
+WEAK bool map_file(const char *path, size_t new_size, mapped_file_t *f) {
+    // "a+" creates the file if needed but never truncates it, as
+    // another process may be using it.
+    void *file = fopen(path, "a+b");
+    if (!file) {
+        return false;
+    }
+    int fd = fileno(file);
+
+    // Check and grow the size under the lock, so that processes
+    // creating the file at the same time agree on how big it is.
+    flock(fd, LOCK_EX);
+    long size = -1;
+    if (fseek(file, 0, SEEK_END) == 0) {
+        size = ftell(file);
+    }
+    if (size == 0 && fill_file(fd, new_size)) {
+        size = (long)new_size;
+    }
+    flock(fd, LOCK_UN);
+
+    // Results are handed out to pipelines from a read-only mapping,
+    // so that nothing can write to the file through them. The cache
+    // adds results through a second, writable mapping of the same
+    // pages.
+    void *data = MAP_FAILED, *writable = MAP_FAILED;
+    if (size > 0) {
+        data = mmap(NULL, (size_t)size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    if (data != MAP_FAILED) {
+        writable = mmap(NULL, (size_t)size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (writable == MAP_FAILED) {
+            munmap(data, (size_t)size);
+        }
+    }
+    if (writable == MAP_FAILED) {
+        fclose(file);
+        return false;
+    }
+    f->file = file;
+    f->data = (const uint8_t *)data;
+    f->writable = (uint8_t *)writable;
+    f->size = (size_t)size;
+    return true;
+}
+
+WEAK void unmap_file(mapped_file_t *f) {
+    munmap((void *)f->data, f->size);
+    munmap(f->writable, f->size);
+    fclose(f->file);
+    f->file = NULL;
+    f->data = NULL;
+    f->writable = NULL;
+    f->size = 0;
+}
+
+WEAK void lock_file(mapped_file_t *f) {
+    flock(fileno(f->file), LOCK_EX);
+}
+
+WEAK void unlock_file(mapped_file_t *f) {
+    flock(fileno(f->file), LOCK_UN);
+}
+
+}  // namespace Internal
+}  // namespace Runtime
+}  // namespace Halide
@@ -1,4 +1,6 @@
 #include "HalideRuntime.h"
+#include "cpu_topology.h"
+#include "perf_counters.h"
 #include "printer.h"
 #include "scoped_mutex_lock.h"
 
@@ -9,7 +11,7 @@
 extern "C" {
 // Returns the address of the global halide_profiler state
 WEAK halide_profiler_state *halide_profiler_get_state() {
-    static halide_profiler_state s = {{{0}}, 1, 0, 0, 0, 0, NULL, NULL};
+    static halide_profiler_state s = {{{0}}, 1, 0, 0, 0, 0, NULL, NULL, 0, NULL, NULL, 0, 0, 0, 0, {NULL}};
     return &s;
 }
 }
@@ -18,7 +20,8 @@ namespace Halide {
 namespace Runtime {
 namespace Internal {
 
-WEAK halide_profiler_pipeline_stats *find_or_create_pipeline(const char *pipeline_name, int num_funcs, const uint64_t *func_names) {
+WEAK halide_profiler_pipeline_stats *find_or_create_pipeline(const char *pipeline_name, int num_funcs,
+                                                            const uint64_t *func_names, const int *func_parents) {
     halide_profiler_state *s = halide_profiler_get_state();
 
     for (halide_profiler_pipeline_stats *p = s->pipelines; p;
@@ -47,6 +50,7 @@ WEAK halide_profiler_pipeline_stats *find_or_create_pipeline(const char *pipelin
     p->num_allocs = 0;
     p->active_threads_numerator = 0;
     p->active_threads_denominator = 0;
+    memset(&p->latency, 0, sizeof(p->latency));
     p->funcs = (halide_profiler_func_stats *)malloc(num_funcs * sizeof(halide_profiler_func_stats));
     if (!p->funcs) {
         free(p);
@@ -62,6 +66,9 @@ WEAK halide_profiler_pipeline_stats *find_or_create_pipeline(const char *pipelin
         p->funcs[i].stack_peak = 0;
         p->funcs[i].active_threads_numerator = 0;
         p->funcs[i].active_threads_denominator = 0;
+        p->funcs[i].parent = func_parents ? func_parents[i] : -1;
+        p->funcs[i].latency = NULL;
+        memset(p->funcs[i].counters, 0, sizeof(p->funcs[i].counters));
     }
     s->first_free_id += num_funcs;
     s->pipelines = p;
@@ -94,6 +101,298 @@ WEAK void bill_func(halide_profiler_state *s, int func_id, uint64_t time, int ac
     // Someone must have called reset_state while a kernel was running. Do nothing.
 }
 
+// Find the threads working on a running pipeline and the Func each
+// is in. Returns the number found.
+WEAK int get_active_slots(halide_profiler_instance_state *instance, int *slots, int *funcs) {
+    halide_profiler_pipeline_stats *p = instance->pipeline;
+    int active_threads = 0;
+    for (int w = 0; w < halide_profiler_max_thread_slots / 64; w++) {
+        uint64_t used = __atomic_load_n(&(instance->slots_in_use[w]), __ATOMIC_ACQUIRE);
+        while (used) {
+            int slot = w * 64 + __builtin_ctzll(used);
+            used &= used - 1;
+            int func = ((volatile int *)(instance->current_func))[slot];
+            if (func >= 0 && func < p->num_funcs) {
+                slots[active_threads] = slot;
+                funcs[active_threads] = func;
+                active_threads++;
+            }
+        }
+    }
+    return active_threads;
+}
+
+// Split the time since the last sample evenly between the threads
+// working on a running pipeline, billing each to the Func it is in.
+WEAK void bill_instance(halide_profiler_instance_state *instance, uint64_t time) {
+    halide_profiler_pipeline_stats *p = instance->pipeline;
+    int slots[halide_profiler_max_thread_slots];
+    int funcs[halide_profiler_max_thread_slots];
+    int active_threads = get_active_slots(instance, slots, funcs);
+
+    if (active_threads == 0) {
+        // Every thread is between tasks.
+        p->funcs[0].time += time;
+        p->funcs[0].active_threads_denominator += 1;
+    }
+    for (int i = 0; i < active_threads; i++) {
+        halide_profiler_func_stats *f = p->funcs + funcs[i];
+        f->time += time / active_threads;
+        f->active_threads_numerator += active_threads;
+        f->active_threads_denominator += 1;
+        if (instance->func_time) {
+            instance->func_time[funcs[i]] += time / active_threads;
+        }
+    }
+    p->time += time;
+    p->samples++;
+    p->active_threads_numerator += active_threads;
+    p->active_threads_denominator += 1;
+}
+
+// Durations below four nanoseconds get a bucket each. Above that, each
+// power of two is split into four.
+WEAK int histogram_bucket(uint64_t t) {
+    if (t < 4) {
+        return (int)t;
+    }
+    int msb = 63 - __builtin_clzll(t);
+    return 4 * (msb - 1) + (int)((t >> (msb - 2)) & 3);
+}
+
+WEAK uint64_t histogram_bucket_upper_bound(int bucket) {
+    if (bucket < 4) {
+        return bucket;
+    }
+    int shift = bucket / 4 - 1;
+    uint64_t lower = (uint64_t)(4 + bucket % 4) << shift;
+    return lower + (((uint64_t)1 << shift) - 1);
+}
+
+WEAK void histogram_add(halide_profiler_histogram *h, uint64_t t) {
+    h->count++;
+    h->buckets[histogram_bucket(t)]++;
+    if (t > h->max) {
+        h->max = t;
+    }
+}
+
+WEAK uint64_t histogram_percentile(const halide_profiler_histogram *h, int percent) {
+    uint64_t rank = (h->count * percent + 99) / 100;
+    uint64_t seen = 0;
+    for (int b = 0; b < halide_profiler_histogram_buckets; b++) {
+        seen += h->buckets[b];
+        if (seen >= rank && seen > 0) {
+            uint64_t t = histogram_bucket_upper_bound(b);
+            return t < h->max ? t : h->max;
+        }
+    }
+    return h->max;
+}
+
+WEAK void get_latency(const halide_profiler_histogram *h, halide_profiler_latency_t *latency) {
+    latency->count = h->count;
+    latency->p50 = histogram_percentile(h, 50);
+    latency->p90 = histogram_percentile(h, 90);
+    latency->p99 = histogram_percentile(h, 99);
+    latency->max = h->max;
+}
+
+WEAK void clear_pipeline_stats(halide_profiler_pipeline_stats *p) {
+    p->runs = 0;
+    p->time = 0;
+    p->samples = 0;
+    p->memory_peak = p->memory_current;
+    p->memory_total = 0;
+    p->num_allocs = 0;
+    p->active_threads_numerator = 0;
+    p->active_threads_denominator = 0;
+    memset(&p->latency, 0, sizeof(p->latency));
+    for (int i = 0; i < p->num_funcs; i++) {
+        halide_profiler_func_stats *f = p->funcs + i;
+        if (f->latency) {
+            memset(f->latency, 0, sizeof(halide_profiler_histogram));
+        }
+        f->time = 0;
+        f->memory_peak = f->memory_current;
+        f->memory_total = 0;
+        f->num_allocs = 0;
+        f->stack_peak = 0;
+        f->active_threads_numerator = 0;
+        f->active_threads_denominator = 0;
+        memset(f->counters, 0, sizeof(f->counters));
+    }
+}
+
+// The ways a report can be written out. See halide_profiler_set_output.
+enum ProfilerOutputFormat {
+    TextOutput,
+    JSONOutput,
+    CSVOutput,
+    FoldedOutput,
+    ChromeTraceOutput,
+};
+
+// A stretch of time a thread spent in one Func, for the chrome_trace
+// format. Lanes number the threads of the pipelines running at once.
+struct TimelineEvent {
+    uint64_t start, end;
+    halide_profiler_pipeline_stats *pipeline;
+    int func;
+    int lane;
+};
+
+// The event each thread seen in the last sample is extending.
+struct OpenTimelineEvent {
+    halide_profiler_instance_state *instance;
+    int slot;
+    int event;
+    int lane;
+    bool seen;
+};
+
+#define MAX_OPEN_TIMELINE_EVENTS 1024
+#define MAX_TIMELINE_EVENTS (1 << 20)
+
+struct ProfilerOutput {
+    // Set once the format has been chosen, by halide_profiler_set_output
+    // or from the environment.
+    bool configured;
+    int format;
+    char filename[1024];
+
+    TimelineEvent *events;
+    int num_events, max_events;
+    bool truncated;
+    OpenTimelineEvent open[MAX_OPEN_TIMELINE_EVENTS];
+    int num_open;
+};
+
+// Guarded by the profiler state's lock.
+WEAK ProfilerOutput profiler_output;
+
+WEAK int parse_output_format(const char *name) {
+    if (name == NULL || *name == 0 || !strcmp(name, "text")) {
+        return TextOutput;
+    } else if (!strcmp(name, "json")) {
+        return JSONOutput;
+    } else if (!strcmp(name, "csv")) {
+        return CSVOutput;
+    } else if (!strcmp(name, "folded")) {
+        return FoldedOutput;
+    } else if (!strcmp(name, "chrome_trace")) {
+        return ChromeTraceOutput;
+    }
+    return -1;
+}
+
+WEAK void set_output_filename(const char *filename) {
+    char *dst = profiler_output.filename;
+    char *end = dst + sizeof(profiler_output.filename) - 1;
+    *dst = 0;
+    if (filename) {
+        halide_string_to_string(dst, end, filename);
+    }
+}
+
+WEAK void clear_timeline() {
+    profiler_output.num_events = 0;
+    profiler_output.num_open = 0;
+    profiler_output.truncated = false;
+}
+
+WEAK void extend_timeline(halide_profiler_instance_state *instance, int slot, int func,
+                          uint64_t t, uint64_t t_now) {
+    ProfilerOutput &o = profiler_output;
+    OpenTimelineEvent *open = NULL;
+    for (int i = 0; i < o.num_open; i++) {
+        if (o.open[i].instance == instance && o.open[i].slot == slot) {
+            open = o.open + i;
+            break;
+        }
+    }
+    if (open) {
+        open->seen = true;
+        TimelineEvent *e = o.events + open->event;
+        if (e->pipeline == instance->pipeline && e->func == func && e->end == t) {
+            e->end = t_now;
+            return;
+        }
+    } else {
+        if (o.num_open == MAX_OPEN_TIMELINE_EVENTS) {
+            return;
+        }
+        // Take the lowest lane no other thread is using.
+        int lane = 0;
+        for (int i = 0; i < o.num_open; i++) {
+            if (o.open[i].lane == lane) {
+                lane++;
+                i = -1;
+            }
+        }
+        open = o.open + o.num_open++;
+        open->instance = instance;
+        open->slot = slot;
+        open->lane = lane;
+        open->seen = true;
+    }
+
+    if (o.num_events == o.max_events) {
+        int new_max = o.max_events ? o.max_events * 2 : 1024;
+        TimelineEvent *new_events = NULL;
+        if (new_max <= MAX_TIMELINE_EVENTS) {
+            new_events = (TimelineEvent *)malloc(new_max * sizeof(TimelineEvent));
+        }
+        if (!new_events) {
+            // Stop recording, and say so in the report.
+            o.truncated = true;
+            return;
+        }
+        if (o.events) {
+            memcpy(new_events, o.events, o.num_events * sizeof(TimelineEvent));
+            free(o.events);
+        }
+        o.events = new_events;
+        o.max_events = new_max;
+    }
+    TimelineEvent *e = o.events + o.num_events;
+    e->start = t;
+    e->end = t_now;
+    e->pipeline = instance->pipeline;
+    e->func = func;
+    e->lane = open->lane;
+    open->event = o.num_events++;
+}
+
+// Record what every thread of every running pipeline was doing since
+// the last sample.
+WEAK void record_timeline(halide_profiler_state *s, uint64_t t, uint64_t t_now) {
+    ProfilerOutput &o = profiler_output;
+    if (o.truncated) {
+        return;
+    }
+    for (int i = 0; i < o.num_open; i++) {
+        o.open[i].seen = false;
+    }
+    int slots[halide_profiler_max_thread_slots];
+    int funcs[halide_profiler_max_thread_slots];
+    for (halide_profiler_instance_state *i = s->instances; i;
+         i = (halide_profiler_instance_state *)(i->next)) {
+        int active_threads = get_active_slots(i, slots, funcs);
+        for (int j = 0; j < active_threads; j++) {
+            extend_timeline(i, slots[j], funcs[j], t, t_now);
+        }
+    }
+    // Threads that have stopped working end their events.
+    int num_open = 0;
+    for (int i = 0; i < o.num_open; i++) {
+        if (o.open[i].seen) {
+            o.open[num_open++] = o.open[i];
+        }
+    }
+    o.num_open = num_open;
+}
+
 WEAK void sampling_profiler_thread(void *) {
     halide_profiler_state *s = halide_profiler_get_state();
 
@@ -102,32 +401,41 @@ WEAK void sampling_profiler_thread(void *) {
 
     while (s->current_func != halide_profiler_please_stop) {
 
-        uint64_t t1 = halide_current_time_ns(NULL);
-        uint64_t t = t1;
+        uint64_t t = halide_current_time_ns(NULL);
         while (1) {
-            int func, active_threads;
-            if (s->get_remote_profiler_state) {
+            uint64_t t_now = halide_current_time_ns(NULL);
+            if (s->current_func == halide_profiler_please_stop) {
+                break;
+            } else if (s->get_remote_profiler_state) {
                 // Execution has disappeared into remote code running
                 // on an accelerator (e.g. Hexagon DSP)
+                int func, active_threads;
                 s->get_remote_profiler_state(&func, &active_threads);
+                if (func >= 0) {
+                    // Assume all time since I was last awake is due to
+                    // the currently running func.
+                    bill_func(s, func, t_now - t, active_threads);
+                }
             } else {
-                func = s->current_func;
-                active_threads = s->active_threads;
-            }
-            uint64_t t_now = halide_current_time_ns(NULL);
-            if (func == halide_profiler_please_stop) {
-                break;
-            } else if (func >= 0) {
-                // Assume all time since I was last awake is due to
-                // the currently running func.
-                bill_func(s, func, t_now - t, active_threads);
+                for (halide_profiler_instance_state *i = s->instances; i;
+                     i = (halide_profiler_instance_state *)(i->next)) {
+                    bill_instance(i, t_now - t);
+                }
+                if (profiler_output.format == ChromeTraceOutput) {
+                    record_timeline(s, t, t_now);
+                }
             }
             t = t_now;
 
             // Release the lock, sleep, reacquire.
             int sleep_ms = s->sleep_time;
+            int sleep_us = s->sleep_time_us;
             halide_mutex_unlock(&s->lock);
-            halide_sleep_ms(NULL, sleep_ms);
+            if (sleep_us > 0) {
+                halide_sleep_us(NULL, sleep_us);
+            } else {
+                halide_sleep_ms(NULL, sleep_ms);
+            }
             halide_mutex_lock(&s->lock);
         }
     }
@@ -173,28 +481,99 @@ WEAK halide_profiler_pipeline_stats *halide_profiler_get_pipeline_state(const ch
     return NULL;
 }
 
-// Returns a token identifying this pipeline instance.
+// Registers a call to a pipeline, whose state lives in instance, and
+// returns a token identifying the pipeline's funcs.
 WEAK int halide_profiler_pipeline_start(void *user_context,
                                         const char *pipeline_name,
                                         int num_funcs,
-                                        const uint64_t *func_names) {
+                                        const uint64_t *func_names,
+                                        const int *func_parents,
+                                        halide_profiler_instance_state *instance) {
     halide_profiler_state *s = halide_profiler_get_state();
 
+    // Read by halide_profiler_pipeline_end even if starting fails.
+    instance->perf_counters = 0;
+
     ScopedMutexLock lock(&s->lock);
 
+    if (!profiler_output.configured) {
+        profiler_output.configured = true;
+        const char *format_str = getenv("HL_PROFILER_FORMAT");
+        int format = parse_output_format(format_str);
+        if (format < 0) {
+            halide_print(user_context, "Ignoring unknown HL_PROFILER_FORMAT; using text\n");
+            format = TextOutput;
+        }
+        profiler_output.format = format;
+        set_output_filename(getenv("HL_PROFILER_FILE"));
+    }
+
     if (!s->sampling_thread) {
+        if (!s->sleep_time_us) {
+            const char *interval_str = getenv("HL_PROFILER_SAMPLE_INTERVAL_US");
+            if (interval_str) {
+                s->sleep_time_us = atoi(interval_str);
+            }
+        }
+        if (!s->func_histograms) {
+            const char *histograms_str = getenv("HL_PROFILER_FUNC_HISTOGRAMS");
+            if (histograms_str) {
+                s->func_histograms = atoi(histograms_str);
+            }
+        }
+        if (!s->perf_counters) {
+            const char *counters_str = getenv("HL_PROFILER_COUNTERS");
+            if (counters_str) {
+                s->perf_counters = atoi(counters_str);
+            }
+        }
         halide_start_clock(user_context);
         s->sampling_thread = halide_spawn_thread(sampling_profiler_thread, NULL);
     }
 
+    s->num_worker_threads = get_worker_placements(&s->worker_placement);
+    if (!s->num_worker_threads) {
+        s->worker_placement = NULL;
+    }
+
     halide_profiler_pipeline_stats *p =
-        find_or_create_pipeline(pipeline_name, num_funcs, func_names);
+        find_or_create_pipeline(pipeline_name, num_funcs, func_names, func_parents);
     if (!p) {
         // Allocating space to track the statistics failed.
         return halide_error_out_of_memory(user_context);
     }
     p->runs++;
 
+    // The calling thread takes slot zero, and the last slot is
+    // reserved for tasks that find no other free.
+    instance->pipeline = p;
+    for (int i = 0; i < halide_profiler_max_thread_slots / 64; i++) {
+        instance->slots_in_use[i] = 0;
+    }
+    for (int i = 0; i < halide_profiler_max_thread_slots; i++) {
+        instance->current_func[i] = halide_profiler_outside_of_halide;
+    }
+    instance->slots_in_use[0] = 1;
+    instance->slots_in_use[halide_profiler_max_thread_slots / 64 - 1] |= (uint64_t)1 << 63;
+    instance->current_func[0] = 0;
+    instance->func_time = NULL;
+    if (s->func_histograms) {
+        instance->func_time = (uint64_t *)malloc(num_funcs * sizeof(uint64_t));
+        if (instance->func_time) {
+            memset(instance->func_time, 0, num_funcs * sizeof(uint64_t));
+        }
+    }
+    if (s->perf_counters) {
+        s->num_counters = get_perf_counter_names(s->counter_names);
+        instance->perf_counters = s->num_counters > 0;
+    }
+    instance->next = s->instances;
+    s->instances = instance;
+    if (instance->perf_counters) {
+        halide_profiler_count_thread_events(instance, 0);
+    }
+    instance->start_time = halide_current_time_ns(user_context);
+
     return p->first_func_id;
 }
 
@@ -284,10 +663,116 @@ WEAK void halide_profiler_memory_free(void *user_context,
     __sync_sub_and_fetch(&f_stats->memory_current, decr);
 }
 
-WEAK void halide_profiler_report_unlocked(void *user_context, halide_profiler_state *s) {
+}
+
+namespace Halide {
+namespace Runtime {
+namespace Internal {
+
+// Where a report goes: to a file if one was given, and through
+// halide_print otherwise.
+struct ReportOutput {
+    void *user_context;
+    void *file;
+
+    void write(const char *str) {
+        if (file) {
+            fwrite(str, 1, strlen(str), file);
+        } else {
+            halide_print(user_context, str);
+        }
+    }
+};
+
+// Print the loops and specialization branches directly inside a Func
+// (or another loop or branch), indented under it, and then theirs.
+WEAK void print_loop_times(ReportOutput &out, halide_profiler_pipeline_stats *p,
+                           const uint64_t *inclusive, int parent, int depth) {
+    char line_buf[1024];
+    Printer<StringStreamPrinter, sizeof(line_buf)> sstr(out.user_context, line_buf);
+    for (int i = parent + 1; i < p->num_funcs; i++) {
+        halide_profiler_func_stats *fs = p->funcs + i;
+        if (fs->parent != parent || inclusive[i] == 0) continue;
+
+        sstr.clear();
+        for (int d = 0; d < depth; d++) {
+            sstr << "  ";
+        }
+        sstr << fs->name << ": ";
+        size_t cursor = sstr.size() < 25 ? 25 : sstr.size();
+        while (sstr.size() < cursor) {
+            sstr << " ";
+        }
+
+        float ft = inclusive[i] / (p->runs * 1000000.0f);
+        sstr << ft;
+        sstr.erase(3);
+        sstr << "ms";
+        cursor += 10;
+        while (sstr.size() < cursor) {
+            sstr << " ";
+        }
+
+        int percent = 0;
+        if (p->time != 0) {
+            percent = (100 * inclusive[i]) / p->time;
+        }
+        sstr << "(" << percent << "%)\n";
+        out.write(sstr.str());
+
+        print_loop_times(out, p, inclusive, i, depth + 1);
+    }
+}
+
+// Add percentiles of a histogram, in milliseconds, to a line of the
+// text report.
+template<typename P>
+void append_latency(P &sstr, const halide_profiler_histogram *h) {
+    halide_profiler_latency_t l;
+    get_latency(h, &l);
+    sstr << "p50: " << l.p50 / 1000000.0f << " ms"
+         << "  p90: " << l.p90 / 1000000.0f << " ms"
+         << "  p99: " << l.p99 / 1000000.0f << " ms"
+         << "  max: " << l.max / 1000000.0f << " ms\n";
+}
 
+WEAK void write_text_report(ReportOutput &out, halide_profiler_state *s) {
     char line_buf[1024];
-    Printer<StringStreamPrinter, sizeof(line_buf)> sstr(user_context, line_buf);
+    Printer<StringStreamPrinter, sizeof(line_buf)> sstr(out.user_context, line_buf);
+
+    if (s->worker_placement) {
+        out.write("worker placement (worker: cpu/core/socket):\n");
+        sstr.clear();
+        for (int i = 0; i < s->num_worker_threads; i++) {
+            const halide_thread_placement_t *w = s->worker_placement + i;
+            if (sstr.size() > 72) {
+                sstr << "\n";
+                out.write(sstr.str());
+                sstr.clear();
+            }
+            sstr << " " << i << ": ";
+            if (w->cpu < 0) {
+                sstr << "unpinned";
+            } else {
+                sstr << w->cpu << "/" << w->core << "/" << w->socket;
+                if (w->num_cpus > 1) {
+                    sstr << " (+" << w->num_cpus - 1 << " cpus)";
+                }
+            }
+        }
+        sstr << "\n";
+        out.write(sstr.str());
+    }
+
+    uint64_t huge_allocs, huge_bytes, huge_peak;
+    get_huge_page_usage(&huge_allocs, &huge_bytes, &huge_peak);
+    if (huge_allocs) {
+        sstr.clear();
+        sstr << "huge pages: " << huge_allocs << " allocations"
+             << ", peak " << huge_peak << " bytes"
+             << ", " << huge_bytes << " bytes in use\n";
+        out.write(sstr.str());
+    }
 
     for (halide_profiler_pipeline_stats *p = s->pipelines; p;
          p = (halide_profiler_pipeline_stats *)(p->next)) {
@@ -310,7 +795,11 @@ WEAK void halide_profiler_report_unlocked(void *user_context, halide_profiler_st
         }
         sstr << " heap allocations: " << p->num_allocs
              << "  peak heap usage: " << p->memory_peak << " bytes\n";
-        halide_print(user_context, sstr.str());
+        if (p->latency.count) {
+            sstr << " latency ";
+            append_latency(sstr, &p->latency);
+        }
+        out.write(sstr.str());
 
         bool print_f_states = p->time || p->memory_total;
         if (!print_f_states) {
@@ -324,14 +813,40 @@ WEAK void halide_profiler_report_unlocked(void *user_context, halide_profiler_st
         }
 
         if (print_f_states) {
+            // With profile_loops, the time of a Func includes that of
+            // its loops, which are listed under it. Entries always
+            // come after the one that encloses them.
+            uint64_t *inclusive = NULL;
+            for (int i = 0; i < p->num_funcs; i++) {
+                if (p->funcs[i].parent >= 0) {
+                    inclusive = (uint64_t *)malloc(p->num_funcs * sizeof(uint64_t));
+                    break;
+                }
+            }
+            if (inclusive) {
+                for (int i = 0; i < p->num_funcs; i++) {
+                    inclusive[i] = p->funcs[i].time;
+                }
+                for (int i = p->num_funcs - 1; i > 0; i--) {
+                    if (p->funcs[i].parent >= 0) {
+                        inclusive[p->funcs[i].parent] += inclusive[i];
+                    }
+                }
+            }
+
             for (int i = 0; i < p->num_funcs; i++) {
                 size_t cursor = 0;
                 sstr.clear();
                 halide_profiler_func_stats *fs = p->funcs + i;
 
+                // Loops are listed under their Func.
+                if (fs->parent >= 0) continue;
+
+                uint64_t time = inclusive ? inclusive[i] : fs->time;
+
                 // The first func is always a catch-all overhead
                 // slot. Only report overhead time if it's non-zero
-                if (i == 0 && fs->time == 0) continue;
+                if (i == 0 && time == 0) continue;
 
                 sstr << "  " << fs->name << ": ";
                 cursor += 25;
@@ -339,7 +854,7 @@ WEAK void halide_profiler_report_unlocked(void *user_context, halide_profiler_st
                     sstr << " ";
                 }
 
-                float ft = fs->time / (p->runs * 1000000.0f);
+                float ft = time / (p->runs * 1000000.0f);
                 sstr << ft;
                 // We don't need 6 sig. figs.
                 sstr.erase(3);
@@ -351,7 +866,7 @@ WEAK void halide_profiler_report_unlocked(void *user_context, halide_profiler_st
 
                 int percent = 0;
                 if (p->time != 0) {
-                    percent = (100 * fs->time) / p->time;
+                    percent = (100 * time) / p->time;
                 }
                 sstr << "(" << percent << "%)";
                 cursor += 8;
@@ -359,7 +874,7 @@ WEAK void halide_profiler_report_unlocked(void *user_context, halide_profiler_st
                     sstr << " ";
                 }
 
-                if (!serial) {
+                if (!serial && fs->active_threads_denominator) {
                     float threads = fs->active_threads_numerator / (fs->active_threads_denominator + 1e-10);
                     sstr << "threads: " << threads;
                     sstr.erase(3);
@@ -391,13 +906,299 @@ WEAK void halide_profiler_report_unlocked(void *user_context, halide_profiler_st
                     sstr << " stack: " << fs->stack_peak;
                 }
                 sstr << "\n";
+                if (fs->latency && fs->latency->count) {
+                    sstr << "    per call ";
+                    append_latency(sstr, fs->latency);
+                }
+                if (s->num_counters && (fs->counters[0] || fs->counters[1])) {
+                    sstr << "   ";
+                    for (int c = 0; c < s->num_counters; c++) {
+                        sstr << " " << s->counter_names[c] << ": " << fs->counters[c];
+                    }
+                    sstr << "\n";
+                }
+
+                out.write(sstr.str());
+
+                if (inclusive) {
+                    print_loop_times(out, p, inclusive, i, 2);
+                }
+            }
+            free(inclusive);
+        }
+    }
+}
+
+// Add a name to a line of a report, quoted and escaped as the format
+// needs.
+template<typename P>
+void append_name(P &sstr, const char *name, int format) {
+    bool quoted = format != FoldedOutput;
+    if (quoted) {
+        sstr << "\"";
+    }
+    char c[2] = {0, 0};
+    for (const char *n = name; *n; n++) {
+        c[0] = *n;
+        if ((unsigned char)c[0] < 0x20) {
+            c[0] = ' ';
+        } else if (c[0] == '"' && quoted) {
+            sstr << (format == CSVOutput ? "\"" : "\\");
+        } else if (c[0] == '\\' && (format == JSONOutput || format == ChromeTraceOutput)) {
+            sstr << "\\";
+        } else if (c[0] == ';' && format == FoldedOutput) {
+            // Semicolons separate the frames of a stack.
+            c[0] = ',';
+        }
+        sstr << c;
+    }
+    if (quoted) {
+        sstr << "\"";
+    }
+}
+
+template<typename P>
+void append_json_latency(P &sstr, const halide_profiler_histogram *h) {
+    halide_profiler_latency_t l;
+    get_latency(h, &l);
+    sstr << ", \"latency\": {\"count\": " << l.count
+         << ", \"p50_ns\": " << l.p50
+         << ", \"p90_ns\": " << l.p90
+         << ", \"p99_ns\": " << l.p99
+         << ", \"max_ns\": " << l.max << "}";
+}
+
+WEAK void write_json_report(ReportOutput &out, halide_profiler_state *s) {
+    char line_buf[1024];
+    Printer<StringStreamPrinter, sizeof(line_buf)> sstr(out.user_context, line_buf);
+
+    out.write("{\"pipelines\": [");
+    bool first = true;
+    for (halide_profiler_pipeline_stats *p = s->pipelines; p;
+         p = (halide_profiler_pipeline_stats *)(p->next)) {
+        if (!p->runs) continue;
+        float threads = p->active_threads_numerator / (p->active_threads_denominator + 1e-10);
+        sstr.clear();
+        sstr << (first ? "\n" : ",\n") << " {\"name\": ";
+        append_name(sstr, p->name, JSONOutput);
+        sstr << ", \"runs\": " << p->runs
+             << ", \"time_ns\": " << p->time
+             << ", \"samples\": " << p->samples
+             << ", \"average_threads\": " << threads
+             << ", \"num_allocs\": " << p->num_allocs
+             << ", \"memory_peak\": " << p->memory_peak
+             << ", \"memory_total\": " << p->memory_total;
+        append_json_latency(sstr, &p->latency);
+        sstr << ",\n  \"funcs\": [";
+        out.write(sstr.str());
+        first = false;
+
+        for (int i = 0; i < p->num_funcs; i++) {
+            halide_profiler_func_stats *fs = p->funcs + i;
+            float threads = fs->active_threads_numerator / (fs->active_threads_denominator + 1e-10);
+            sstr.clear();
+            sstr << (i ? ",\n" : "\n") << "   {\"id\": " << i << ", \"name\": ";
+            append_name(sstr, fs->name, JSONOutput);
+            sstr << ", \"parent\": " << fs->parent
+                 << ", \"time_ns\": " << fs->time
+                 << ", \"average_threads\": " << threads
+                 << ", \"num_allocs\": " << fs->num_allocs
+                 << ", \"memory_peak\": " << fs->memory_peak
+                 << ", \"memory_total\": " << fs->memory_total
+                 << ", \"stack_peak\": " << fs->stack_peak;
+            if (fs->latency) {
+                append_json_latency(sstr, fs->latency);
+            }
+            if (s->num_counters) {
+                sstr << ", \"counters\": {";
+                for (int c = 0; c < s->num_counters; c++) {
+                    sstr << (c ? ", " : "");
+                    append_name(sstr, s->counter_names[c], JSONOutput);
+                    sstr << ": " << fs->counters[c];
+                }
+                sstr << "}";
+            }
+            sstr << "}";
+            out.write(sstr.str());
+        }
+        out.write("]}");
+    }
+    out.write("\n]}\n");
+}
 
-                halide_print(user_context, sstr.str());
+WEAK void write_csv_report(ReportOutput &out, halide_profiler_state *s) {
+    char line_buf[1024];
+    Printer<StringStreamPrinter, sizeof(line_buf)> sstr(out.user_context, line_buf);
+
+    sstr << "pipeline,runs,id,func,parent,time_ns,average_threads,"
+         << "num_allocs,memory_peak,memory_total,stack_peak,p50_ns,p90_ns,p99_ns,max_ns";
+    for (int c = 0; c < s->num_counters; c++) {
+        sstr << "," << s->counter_names[c];
+    }
+    sstr << "\n";
+    out.write(sstr.str());
+    for (halide_profiler_pipeline_stats *p = s->pipelines; p;
+         p = (halide_profiler_pipeline_stats *)(p->next)) {
+        if (!p->runs) continue;
+        for (int i = 0; i < p->num_funcs; i++) {
+            halide_profiler_func_stats *fs = p->funcs + i;
+            float threads = fs->active_threads_numerator / (fs->active_threads_denominator + 1e-10);
+            sstr.clear();
+            append_name(sstr, p->name, CSVOutput);
+            sstr << "," << p->runs << "," << i << ",";
+            append_name(sstr, fs->name, CSVOutput);
+            sstr << "," << fs->parent
+                 << "," << fs->time
+                 << "," << threads
+                 << "," << fs->num_allocs
+                 << "," << fs->memory_peak
+                 << "," << fs->memory_total
+                 << "," << fs->stack_peak;
+            halide_profiler_latency_t l = {0, 0, 0, 0, 0};
+            if (fs->latency) {
+                get_latency(fs->latency, &l);
             }
+            sstr << "," << l.p50 << "," << l.p90 << "," << l.p99 << "," << l.max;
+            for (int c = 0; c < s->num_counters; c++) {
+                sstr << "," << fs->counters[c];
+            }
+            sstr << "\n";
+            out.write(sstr.str());
         }
     }
 }
 
+// One line per Func, loop or branch, with the stack of names leading
+// to it and the time spent in it, in nanoseconds. This is the input
+// flamegraph.pl and speedscope take.
+WEAK void write_folded_report(ReportOutput &out, halide_profiler_state *s) {
+    char line_buf[1024];
+    Printer<StringStreamPrinter, sizeof(line_buf)> sstr(out.user_context, line_buf);
+
+    const int max_depth = 64;
+    int stack[max_depth];
+    for (halide_profiler_pipeline_stats *p = s->pipelines; p;
+         p = (halide_profiler_pipeline_stats *)(p->next)) {
+        if (!p->runs) continue;
+        for (int i = 0; i < p->num_funcs; i++) {
+            halide_profiler_func_stats *fs = p->funcs + i;
+            if (fs->time == 0) continue;
+            int depth = 0;
+            for (int j = i; j >= 0 && depth < max_depth; j = p->funcs[j].parent) {
+                stack[depth++] = j;
+            }
+            sstr.clear();
+            append_name(sstr, p->name, FoldedOutput);
+            while (depth > 0) {
+                sstr << ";";
+                append_name(sstr, p->funcs[stack[--depth]].name, FoldedOutput);
+            }
+            sstr << " " << fs->time << "\n";
+            out.write(sstr.str());
+        }
+    }
+}
+
+// The trace event format read by chrome://tracing and Perfetto. Each
+// event is a stretch of time a thread spent in one Func.
+WEAK void write_chrome_trace_report(ReportOutput &out, halide_profiler_state *s) {
+    char line_buf[1024];
+    Printer<StringStreamPrinter, sizeof(line_buf)> sstr(out.user_context, line_buf);
+    const ProfilerOutput &o = profiler_output;
+
+    out.write("{\"traceEvents\": [");
+    for (int i = 0; i < o.num_events; i++) {
+        const TimelineEvent *e = o.events + i;
+        sstr.clear();
+        sstr << (i ? ",\n" : "\n") << " {\"name\": ";
+        append_name(sstr, e->pipeline->funcs[e->func].name, ChromeTraceOutput);
+        sstr << ", \"cat\": ";
+        append_name(sstr, e->pipeline->name, ChromeTraceOutput);
+        sstr << ", \"ph\": \"X\", \"pid\": 0, \"tid\": " << e->lane
+             << ", \"ts\": " << e->start / 1000
+             << ", \"dur\": " << (e->end - e->start) / 1000 << "}";
+        out.write(sstr.str());
+    }
+    out.write("\n],\n\"displayTimeUnit\": \"ms\"");
+    if (o.truncated) {
+        out.write(",\n\"otherData\": {\"truncated\": \"true\"}");
+    }
+    out.write("}\n");
+}
+
+}  // namespace Internal
+}  // namespace Runtime
+}  // namespace Halide
+
+extern "C" {
+
+WEAK void halide_profiler_report_unlocked(void *user_context, halide_profiler_state *s) {
+    ReportOutput out = {user_context, NULL};
+    if (profiler_output.filename[0]) {
+        out.file = fopen(profiler_output.filename, "w");
+        if (!out.file) {
+            print(user_context) << "Could not open " << profiler_output.filename
+                                << " for the profiler report\n";
+        }
+    }
+
+    switch (profiler_output.format) {
+    case JSONOutput:
+        write_json_report(out, s);
+        break;
+    case CSVOutput:
+        write_csv_report(out, s);
+        break;
+    case FoldedOutput:
+        write_folded_report(out, s);
+        break;
+    case ChromeTraceOutput:
+        write_chrome_trace_report(out, s);
+        break;
+    default:
+        write_text_report(out, s);
+    }
+
+    if (out.file) {
+        fclose(out.file);
+    }
+}
+
+WEAK int halide_profiler_get_latency(const char *pipeline_name, const char *func_name,
+                                     halide_profiler_latency_t *latency) {
+    halide_profiler_state *s = halide_profiler_get_state();
+    ScopedMutexLock lock(&s->lock);
+    for (halide_profiler_pipeline_stats *p = s->pipelines; p;
+         p = (halide_profiler_pipeline_stats *)(p->next)) {
+        if (strcmp(p->name, pipeline_name)) continue;
+        if (!func_name) {
+            get_latency(&p->latency, latency);
+            return 0;
+        }
+        for (int i = 0; i < p->num_funcs; i++) {
+            if (p->funcs[i].latency && !strcmp(p->funcs[i].name, func_name)) {
+                get_latency(p->funcs[i].latency, latency);
+                return 0;
+            }
+        }
+    }
+    return halide_error_code_generic_error;
+}
+
+WEAK int halide_profiler_set_output(void *user_context, const char *format, const char *filename) {
+    int f = parse_output_format(format);
+    if (f < 0) {
+        error(user_context) << "Unknown profiler output format " << format << "\n";
+        return halide_error_code_generic_error;
+    }
+    halide_profiler_state *s = halide_profiler_get_state();
+    ScopedMutexLock lock(&s->lock);
+    profiler_output.configured = true;
+    profiler_output.format = f;
+    set_output_filename(filename);
+    return 0;
+}
+
 WEAK void halide_profiler_report(void *user_context) {
     halide_profiler_state *s = halide_profiler_get_state();
     ScopedMutexLock lock(&s->lock);
@@ -405,9 +1206,26 @@ WEAK void halide_profiler_report(void *user_context) {
 }
 
 WEAK void halide_profiler_reset_unlocked(halide_profiler_state *s) {
+    if (s->instances) {
+        // Running pipelines still point at their stats, so clear them
+        // in place instead of freeing them.
+        for (halide_profiler_pipeline_stats *p = s->pipelines; p;
+             p = (halide_profiler_pipeline_stats *)(p->next)) {
+            clear_pipeline_stats(p);
+        }
+        clear_timeline();
+        return;
+    }
+    clear_timeline();
+    free(profiler_output.events);
+    profiler_output.events = NULL;
+    profiler_output.max_events = 0;
     while (s->pipelines) {
         halide_profiler_pipeline_stats *p = s->pipelines;
         s->pipelines = (halide_profiler_pipeline_stats *)(p->next);
+        for (int i = 0; i < p->num_funcs; i++) {
+            free(p->funcs[i].latency);
+        }
         free(p->funcs);
         free(p);
     }
@@ -468,8 +1286,65 @@ WEAK void halide_windows_profiler_shutdown() {
 #endif
 }  // namespace
 
-WEAK void halide_profiler_pipeline_end(void *user_context, void *state) {
-    ((halide_profiler_state *)state)->current_func = halide_profiler_outside_of_halide;
+// Bill the events counted on the calling thread since it last changed
+// Func to the Func it was in, and start counting for func.
+WEAK int halide_profiler_count_thread_events(halide_profiler_instance_state *instance, int func) {
+    perf_counter_thread_t *t = current_thread_perf_counters();
+    if (!t) {
+        return 0;
+    }
+    uint64_t values[halide_profiler_max_counters];
+    int n = read_perf_counters(t, values);
+    if (!n) {
+        return 0;
+    }
+    if (t->pipeline && t->func >= 0) {
+        halide_profiler_func_stats *fs = t->pipeline->funcs + t->func;
+        for (int i = 0; i < n; i++) {
+            __sync_add_and_fetch(&fs->counters[i], values[i] - t->last[i]);
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        t->last[i] = values[i];
+    }
+    t->pipeline = func >= 0 ? instance->pipeline : NULL;
+    t->func = func;
+    return 0;
+}
+
+WEAK void halide_profiler_pipeline_end(void *user_context, void *instance) {
+    halide_profiler_state *s = halide_profiler_get_state();
+    if (((halide_profiler_instance_state *)instance)->perf_counters) {
+        halide_profiler_count_thread_events((halide_profiler_instance_state *)instance,
+                                            halide_profiler_outside_of_halide);
+    }
+    ScopedMutexLock lock(&s->lock);
+    // The instance isn't in the list if starting the profiler failed.
+    void **prev = (void **)&(s->instances);
+    while (*prev && *prev != instance) {
+        prev = &(((halide_profiler_instance_state *)(*prev))->next);
+    }
+    if (!*prev) {
+        return;
+    }
+    halide_profiler_instance_state *i = (halide_profiler_instance_state *)instance;
+    *prev = i->next;
+
+    halide_profiler_pipeline_stats *p = i->pipeline;
+    histogram_add(&p->latency, halide_current_time_ns(user_context) - i->start_time);
+    if (i->func_time) {
+        for (int f = 0; f < p->num_funcs; f++) {
+            halide_profiler_func_stats *fs = p->funcs + f;
+            if (!i->func_time[f]) continue;
+            if (!fs->latency) {
+                fs->latency = (halide_profiler_histogram *)malloc(sizeof(halide_profiler_histogram));
+                if (!fs->latency) continue;
+                memset(fs->latency, 0, sizeof(halide_profiler_histogram));
+            }
+            histogram_add(fs->latency, i->func_time[f]);
+        }
+        free(i->func_time);
+    }
 }
 
 }  // extern "C"
@@ -33,4 +33,42 @@ WEAK_INLINE int halide_profiler_decr_active_threads(halide_profiler_state *state
     // clang-format on
     return ret;
 }
+
+WEAK_INLINE int halide_profiler_set_thread_func(halide_profiler_instance_state *instance, int slot, int func) {
+    if (instance->perf_counters) {
+        halide_profiler_count_thread_events(instance, func);
+    }
+    volatile int *ptr = &(instance->current_func[slot]);
+    // clang-format off
+    asm volatile ("":::);
+    *ptr = func;
+    asm volatile ("":::);
+    // clang-format on
+    return 0;
+}
+
+// Claim a thread slot for a parallel task. The last slot is never
+// claimed; if all the others are taken, tasks share it.
+WEAK_INLINE int halide_profiler_acquire_thread_slot(halide_profiler_instance_state *instance) {
+    const int words = halide_profiler_max_thread_slots / 64;
+    for (int w = 0; w < words; w++) {
+        uint64_t *word = &(instance->slots_in_use[w]);
+        uint64_t used = __atomic_load_n(word, __ATOMIC_RELAXED);
+        while (~used) {
+            uint64_t bit = ~used & (used + 1);
+            if (__atomic_compare_exchange_n(word, &used, used | bit, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                return w * 64 + __builtin_ctzll(bit);
+            }
+        }
+    }
+    return halide_profiler_max_thread_slots - 1;
+}
+
+WEAK_INLINE int halide_profiler_release_thread_slot(halide_profiler_instance_state *instance, int slot) {
+    halide_profiler_set_thread_func(instance, slot, halide_profiler_outside_of_halide);
+    if (slot != halide_profiler_max_thread_slots - 1) {
+        __atomic_fetch_and(&(instance->slots_in_use[slot / 64]), ~((uint64_t)1 << (slot % 64)), __ATOMIC_RELEASE);
+    }
+    return 0;
+}
 }
@@ -1,4 +1,5 @@
 #include "HalideRuntime.h"
+#include "runtime_metrics.h"
 
 extern "C" {
 
@@ -15,17 +16,23 @@ WEAK void *aligned_malloc(size_t alignment, size_t size) {
     size = (size + alignment - 1) & ~(alignment - 1);
 
     // Allocate enough space for aligning the pointer we return.
-    void *orig = malloc(size + alignment);
+    void *orig = malloc(size + alignment + 2 * sizeof(void *));
     if (orig == NULL) {
         // Will result in a failed assertion and a call to halide_error
         return NULL;
     }
-    // We want to store the original pointer prior to the pointer we return.
-    void *ptr = (void *)(((size_t)orig + alignment + sizeof(void *) - 1) & ~(alignment - 1));
+    // We want to store the original pointer prior to the pointer we
+    // return, and the size before that.
+    void *ptr = (void *)(((size_t)orig + alignment + 2 * sizeof(void *) - 1) & ~(alignment - 1));
     ((void **)ptr)[-1] = orig;
+    ((size_t *)ptr)[-2] = size;
     return ptr;
 }
 
+WEAK size_t aligned_size(void *ptr) {
+    return ((size_t *)ptr)[-2];
+}
+
 WEAK void aligned_free(void *ptr) {
     if (ptr) {
         free(((void **)ptr)[-1]);
@@ -54,6 +61,38 @@ WEAK __attribute__((destructor)) void halide_allocator_cleanup() {
     }
 }
 
+// The bytes handed out by halide_default_malloc and not yet freed, and
+// the number of allocations they are in. Only read by
+// halide_get_runtime_metrics, so relaxed atomics suffice. They are
+// pointer-sized, as Hexagon has no cheap 64-bit atomics.
+struct host_allocation_counters_t {
+    size_t live_bytes;
+    size_t live_allocations;
+};
+
+WEAK host_allocation_counters_t host_allocation_counters;
+
+WEAK __attribute__((always_inline)) void count_host_allocation(size_t bytes) {
+    __atomic_fetch_add(&host_allocation_counters.live_bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&host_allocation_counters.live_allocations, 1, __ATOMIC_RELAXED);
+}
+
+WEAK __attribute__((always_inline)) void count_host_free(size_t bytes) {
+    __atomic_fetch_sub(&host_allocation_counters.live_bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&host_allocation_counters.live_allocations, 1, __ATOMIC_RELAXED);
+}
+
+WEAK void get_host_allocation_metrics(halide_runtime_metrics_t *metrics) {
+    metrics->host_live_bytes = (int64_t)__atomic_load_n(&host_allocation_counters.live_bytes, __ATOMIC_RELAXED);
+    metrics->host_live_allocations = (int64_t)__atomic_load_n(&host_allocation_counters.live_allocations, __ATOMIC_RELAXED);
+    metrics->host_pooled_bytes = 0;
+    for (int i = 0; i < num_buffers; ++i) {
+        if (mem_buf[i] != NULL && __atomic_load_n(buf_is_used + i, __ATOMIC_RELAXED) == 0) {
+            metrics->host_pooled_bytes += buffer_size;
+        }
+    }
+}
+
 }  // namespace Internal
 }  // namespace Runtime
 }  // namespace Halide
@@ -68,22 +107,35 @@ WEAK void *halide_default_malloc(void *user_context, size_t x) {
                 if (mem_buf[i] == NULL) {
                     mem_buf[i] = aligned_malloc(alignment, buffer_size);
                 }
+                if (mem_buf[i] != NULL) {
+                    count_host_allocation(buffer_size);
+                }
                 return mem_buf[i];
             }
         }
     }
 
-    return aligned_malloc(alignment, x);
+    void *ptr = aligned_malloc(alignment, x);
+    if (ptr) {
+        count_host_allocation(aligned_size(ptr));
+    }
+    return ptr;
 }
 
 WEAK void halide_default_free(void *user_context, void *ptr) {
     for (int i = 0; i < num_buffers; ++i) {
         if (mem_buf[i] == ptr) {
+            if (ptr != NULL) {
+                count_host_free(buffer_size);
+            }
             buf_is_used[i] = 0;
             return;
         }
     }
 
+    if (ptr) {
+        count_host_free(aligned_size(ptr));
+    }
     aligned_free(ptr);
 }
 
@@ -89,6 +89,7 @@ void free(void *);
 void *malloc(size_t);
 const char *strstr(const char *, const char *);
 int atoi(const char *);
+long long strtoll(const char *, char **, int);
 int strcmp(const char *s, const char *t);
 int strncmp(const char *s, const char *t, size_t n);
 size_t strlen(const char *s);
@@ -136,6 +137,7 @@ WEAK void *halide_get_library_symbol(void *lib, const char *name);
 WEAK int halide_start_clock(void *user_context);
 WEAK int64_t halide_current_time_ns(void *user_context);
 WEAK void halide_sleep_ms(void *user_context, int ms);
+WEAK void halide_sleep_us(void *user_context, int us);
 WEAK void halide_device_free_as_destructor(void *user_context, void *obj);
 WEAK void halide_device_and_host_free_as_destructor(void *user_context, void *obj);
 WEAK void halide_device_host_nop_free(void *user_context, void *obj);
@@ -153,10 +155,14 @@ WEAK void halide_profiler_memory_free(void *user_context,
                                       void *pipeline_state,
                                       int func_id,
                                       uint64_t decr);
+struct halide_profiler_instance_state;
 WEAK int halide_profiler_pipeline_start(void *user_context,
                                         const char *pipeline_name,
                                         int num_funcs,
-                                        const uint64_t *func_names);
+                                        const uint64_t *func_names,
+                                        const int *func_parents,
+                                        struct halide_profiler_instance_state *instance);
+WEAK int halide_profiler_count_thread_events(struct halide_profiler_instance_state *instance, int func);
 WEAK int halide_host_cpu_count();
 
 WEAK int halide_device_and_host_malloc(void *user_context, struct halide_buffer_t *buf,
@@ -223,6 +229,11 @@ extern WEAK_INLINE void halide_abort();
 
 void halide_thread_yield();
 
+// Whether halide_spawn_thread can start threads. False where the
+// thread pool is a fake one that runs everything on the calling
+// thread.
+WEAK bool halide_can_spawn_threads();
+
 }  // namespace Internal
 }  // namespace Runtime
 }  // namespace Halide
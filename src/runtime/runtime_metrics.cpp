@@ -0,0 +1,93 @@
+#include "HalideRuntime.h"
+#include "runtime_internal.h"
+#include "runtime_metrics.h"
+
+namespace Halide {
+namespace Runtime {
+namespace Internal {
+
+// Append one metric, with its help and type lines, in the Prometheus
+// text exposition format.
+WEAK char *append_metric(char *dst, char *end, const char *name, const char *type,
+                         const char *help, int64_t value) {
+    dst = halide_string_to_string(dst, end, "# HELP ");
+    dst = halide_string_to_string(dst, end, name);
+    dst = halide_string_to_string(dst, end, " ");
+    dst = halide_string_to_string(dst, end, help);
+    dst = halide_string_to_string(dst, end, "\n# TYPE ");
+    dst = halide_string_to_string(dst, end, name);
+    dst = halide_string_to_string(dst, end, " ");
+    dst = halide_string_to_string(dst, end, type);
+    dst = halide_string_to_string(dst, end, "\n");
+    dst = halide_string_to_string(dst, end, name);
+    dst = halide_string_to_string(dst, end, " ");
+    dst = halide_int64_to_string(dst, end, value, 1);
+    dst = halide_string_to_string(dst, end, "\n");
+    return dst;
+}
+
+}  // namespace Internal
+}  // namespace Runtime
+}  // namespace Halide
+
+extern "C" {
+
+WEAK int halide_get_runtime_metrics(void *user_context, halide_runtime_metrics_t *metrics) {
+    get_thread_pool_metrics(metrics);
+    get_host_allocation_metrics(metrics);
+    get_device_allocation_metrics(metrics);
+
+    halide_memoization_cache_stats_t cache;
+    halide_memoization_cache_get_stats(&cache, NULL, 0);
+    metrics->cache_hits = cache.hits;
+    metrics->cache_misses = cache.misses;
+    metrics->cache_evictions = cache.evictions;
+    metrics->cache_bytes = cache.bytes;
+    metrics->cache_max_bytes = cache.max_bytes;
+    return 0;
+}
+
+WEAK int halide_format_runtime_metrics(void *user_context, const halide_runtime_metrics_t *metrics,
+                                       char *buf, int size) {
+    if (size <= 0) {
+        return 0;
+    }
+    char *dst = buf, *end = buf + size - 1;
+    *dst = 0;
+    dst = append_metric(dst, end, "halide_thread_pools", "gauge",
+                        "Thread pools, including the default one.", metrics->thread_pools);
+    dst = append_metric(dst, end, "halide_thread_pool_threads", "gauge",
+                        "Worker threads started.", metrics->threads_created);
+    dst = append_metric(dst, end, "halide_thread_pool_workers_sleeping", "gauge",
+                        "Worker threads waiting for work.", metrics->workers_sleeping);
+    dst = append_metric(dst, end, "halide_thread_pool_owners_sleeping", "gauge",
+                        "Threads waiting for the jobs they own to finish.", metrics->owners_sleeping);
+    dst = append_metric(dst, end, "halide_thread_pool_threads_reserved", "gauge",
+                        "Threads committed to jobs that may block.", metrics->threads_reserved);
+    dst = append_metric(dst, end, "halide_thread_pool_queued_jobs", "gauge",
+                        "Jobs with work no thread has claimed yet.", metrics->queued_jobs);
+    dst = append_metric(dst, end, "halide_host_live_bytes", "gauge",
+                        "Bytes allocated by halide_default_malloc and not yet freed.", metrics->host_live_bytes);
+    dst = append_metric(dst, end, "halide_host_live_allocations", "gauge",
+                        "Allocations made by halide_default_malloc and not yet freed.", metrics->host_live_allocations);
+    dst = append_metric(dst, end, "halide_host_pooled_bytes", "gauge",
+                        "Bytes of freed host allocations kept for reuse.", metrics->host_pooled_bytes);
+    dst = append_metric(dst, end, "halide_memoization_cache_hits_total", "counter",
+                        "Memoization cache lookups that found a result.", metrics->cache_hits);
+    dst = append_metric(dst, end, "halide_memoization_cache_misses_total", "counter",
+                        "Memoization cache lookups that did not find a result.", metrics->cache_misses);
+    dst = append_metric(dst, end, "halide_memoization_cache_evictions_total", "counter",
+                        "Results evicted from the memoization cache.", metrics->cache_evictions);
+    dst = append_metric(dst, end, "halide_memoization_cache_bytes", "gauge",
+                        "Bytes of results in the memoization cache.", metrics->cache_bytes);
+    dst = append_metric(dst, end, "halide_memoization_cache_max_bytes", "gauge",
+                        "The size limit of the memoization cache.", metrics->cache_max_bytes);
+    dst = append_metric(dst, end, "halide_device_allocation_pools", "gauge",
+                        "Device allocation pools registered.", metrics->device_allocation_pools);
+    dst = append_metric(dst, end, "halide_device_pooled_bytes", "gauge",
+                        "Bytes of unused device memory kept for reuse.", metrics->device_pooled_bytes);
+    // When the output is truncated, dst isn't where the null went.
+    return (int)strlen(buf);
+}
+
+}  // extern "C"
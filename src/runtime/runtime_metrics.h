@@ -0,0 +1,27 @@
+#ifndef HALIDE_RUNTIME_METRICS_H
+#define HALIDE_RUNTIME_METRICS_H
+
+#include "HalideRuntime.h"
+#include "runtime_internal.h"
+
+// The parts of halide_runtime_metrics_t each subsystem fills in. Each
+// is defined by the module that owns the state it reads.
+
+namespace Halide {
+namespace Runtime {
+namespace Internal {
+
+// The thread pool fields. Defined by the thread pool.
+WEAK void get_thread_pool_metrics(halide_runtime_metrics_t *metrics);
+
+// The host memory fields. Defined by the allocator.
+WEAK void get_host_allocation_metrics(halide_runtime_metrics_t *metrics);
+
+// The device allocation pool fields. Defined in allocation_cache.cpp.
+WEAK void get_device_allocation_metrics(halide_runtime_metrics_t *metrics);
+
+}  // namespace Internal
+}  // namespace Runtime
+}  // namespace Halide
+
+#endif
@@ -160,6 +160,20 @@ ALWAYS_INLINE void atomic_thread_fence_acquire() {
     __sync_synchronize();
 }
 
+ALWAYS_INLINE void atomic_thread_fence_sequentially_consistent() {
+    __sync_synchronize();
+}
+
+template<typename T>
+ALWAYS_INLINE T atomic_fetch_or_acquire_release(T *addr, T val) {
+    return __sync_fetch_and_or(addr, val);
+}
+
+template<typename T>
+ALWAYS_INLINE T atomic_fetch_and_acquire_release(T *addr, T val) {
+    return __sync_fetch_and_and(addr, val);
+}
+
 #else
 
 ALWAYS_INLINE uintptr_t atomic_and_fetch_release(uintptr_t *addr, uintptr_t val) {
@@ -223,6 +237,20 @@ ALWAYS_INLINE void atomic_thread_fence_acquire() {
     __atomic_thread_fence(__ATOMIC_ACQUIRE);
 }
 
+ALWAYS_INLINE void atomic_thread_fence_sequentially_consistent() {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+template<typename T>
+ALWAYS_INLINE T atomic_fetch_or_acquire_release(T *addr, T val) {
+    return __atomic_fetch_or(addr, val, __ATOMIC_ACQ_REL);
+}
+
+template<typename T>
+ALWAYS_INLINE T atomic_fetch_and_acquire_release(T *addr, T val) {
+    return __atomic_fetch_and(addr, val, __ATOMIC_ACQ_REL);
+}
+
 #endif
 
 }  // namespace
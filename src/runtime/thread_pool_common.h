@@ -1,3 +1,6 @@
+#include "cpu_topology.h"
+#include "runtime_metrics.h"
+
 #define EXTENDED_DEBUG 0
 
 #if EXTENDED_DEBUG
@@ -23,6 +26,66 @@ namespace Halide {
 namespace Runtime {
 namespace Internal {
 
+// A contiguous range of loop iterations owned by one worker of a
+// work-stealing job. Both ends are packed into a single word, relative
+// to the job's min, so that the owner popping from the front and a
+// thief taking the back half are each a single compare-and-swap. The
+// padding keeps each worker's range on its own cache line.
+struct work_range {
+    uint64_t bounds;
+    // Whether a worker has taken this as its home range. Only read
+    // and written with the work queue lock held.
+    bool claimed;
+    char padding[64 - sizeof(uint64_t) - sizeof(bool)];
+};
+
+ALWAYS_INLINE uint64_t pack_work_range(uint32_t begin, uint32_t end) {
+    return ((uint64_t)end << 32) | begin;
+}
+
+// The state of a halide_semaphore_t. Each bit of waiting_pools marks
+// a thread pool with a job that found the count too low and is
+// waiting for a release. Both are 32 bits, so that 32-bit targets
+// without 64-bit atomics can use them.
+struct halide_semaphore_impl_t {
+    int count;
+    uint32_t waiting_pools;
+};
+
+// Try to take n from the semaphore. On failure, add waiting_pools to
+// the pools the next release wakes.
+WEAK bool semaphore_try_acquire(halide_semaphore_t *s, int n, uint32_t waiting_pools) {
+    if (n == 0) {
+        return true;
+    }
+    halide_semaphore_impl_t *sem = (halide_semaphore_impl_t *)s;
+    int expected;
+    int desired;
+    Synchronization::atomic_load_acquire(&sem->count, &expected);
+    while (true) {
+        while (expected >= n) {
+            desired = expected - n;
+            if (Synchronization::atomic_cas_weak_relacq_relaxed(&sem->count, &expected, &desired)) {
+                return true;
+            }
+        }
+        if (waiting_pools == 0) {
+            return false;
+        }
+        // Mark the pools as waiting, then look at the count again. A
+        // release adds to the count before it reads the marks, so
+        // either it sees our mark and wakes us, or we see its count.
+        Synchronization::atomic_fetch_or_acquire_release(&sem->waiting_pools, waiting_pools);
+        Synchronization::atomic_thread_fence_sequentially_consistent();
+        Synchronization::atomic_load_acquire(&sem->count, &expected);
+        if (expected < n) {
+            return false;
+        }
+    }
+}
+
+struct work_queue_t;
+
 struct work {
     halide_parallel_task_t task;
 
@@ -43,10 +106,35 @@ struct work {
     // which condition variable is the owner sleeping on. NULL if it isn't sleeping.
     bool owner_is_sleeping;
 
-    ALWAYS_INLINE bool make_runnable() {
+    // Per-worker iteration ranges for work-stealing jobs, or NULL if
+    // the iterations are claimed one at a time under the work queue
+    // lock. Only do_par_for jobs are ever split this way.
+    work_range *ranges;
+    int num_ranges;
+    // The number of workers that have joined this job so far. Each
+    // has its own home range, so no more than num_ranges may join.
+    int workers_joined;
+    // If non-zero, the ranges are divided contiguously into this many
+    // groups, one per NUMA node, and workers start on and prefer to
+    // steal from the group of their own node.
+    int num_nodes;
+
+    // The thread pool this job was enqueued on. Jobs nested inside it
+    // go on the same pool.
+    work_queue_t *queue;
+
+    // Whether this job came from halide_do_async. Such jobs have no
+    // owner waiting on them, so the worker that finishes one reports
+    // completion and frees it.
+    bool async;
+
+    // waiter_bit marks the calling worker's pool as waiting on any
+    // semaphore that can't be acquired yet.
+    ALWAYS_INLINE bool make_runnable(uint32_t waiter_bit) {
         for (; next_semaphore < task.num_semaphores; next_semaphore++) {
-            if (!halide_default_semaphore_try_acquire(task.semaphores[next_semaphore].semaphore,
-                                                      task.semaphores[next_semaphore].count)) {
+            if (!semaphore_try_acquire(task.semaphores[next_semaphore].semaphore,
+                                       task.semaphores[next_semaphore].count,
+                                       waiter_bit)) {
                 // Note that we don't release the semaphores already
                 // acquired. We never have two consumers contending
                 // over the same semaphore, so it's not helpful to do
@@ -66,6 +154,28 @@ struct work {
 
 #define MAX_THREADS 256
 
+// The default thread pool plus the named pools made by
+// halide_create_thread_pool.
+#define MAX_THREAD_POOLS 8
+#define MAX_THREAD_POOL_BINDINGS 64
+#define MAX_THREAD_POOL_NAME 32
+
+enum {
+    work_stealing_default = 0,
+    work_stealing_disabled = 1,
+    work_stealing_enabled = 2,
+};
+
+// A job enqueued by halide_do_async, along with what to do when it
+// finishes. Heap allocated, as the caller doesn't wait for it.
+struct async_work {
+    work job;
+    halide_async_task_t fn;
+    void *arg;
+    halide_async_callback_t callback;
+    halide_semaphore_t *done;
+};
+
 WEAK int clamp_num_threads(int threads) {
     if (threads > MAX_THREADS) {
         threads = MAX_THREADS;
@@ -90,7 +200,17 @@ WEAK int default_desired_num_threads() {
     return desired_num_threads;
 }
 
-// The work queue and thread pool is weak, so one big work queue is shared by all halide functions
+WEAK int default_work_stealing_mode() {
+    char *stealing_str = getenv("HL_WORK_STEALING");
+    if (stealing_str && atoi(stealing_str) != 0) {
+        return work_stealing_enabled;
+    }
+    return work_stealing_disabled;
+}
+
+// The work queues and thread pools are weak, so they are shared by all
+// halide functions. Pipelines use the default pool unless their
+// user_context has been bound to a named pool.
 struct work_queue_t {
     // all fields are protected by this mutex.
     halide_mutex mutex;
@@ -98,6 +218,19 @@ struct work_queue_t {
     // The desired number threads doing work (HL_NUM_THREADS).
     int desired_threads_working;
 
+    // Whether do_par_for jobs use per-worker work-stealing ranges
+    // (HL_WORK_STEALING). Zero means not yet decided, in which case
+    // the environment is consulted when the queue is initialized.
+    int work_stealing_mode;
+
+    // The nice value the workers of this pool run at. Zero leaves
+    // them at the priority of the thread that spawned them.
+    int priority;
+
+    // The name given to halide_create_thread_pool. Empty for the
+    // default pool and for slots not handed out yet.
+    char name[MAX_THREAD_POOL_NAME];
+
     // All fields after this must be zero in the initial state. See assert_zeroed
     // Field serves both to mark the offset in struct and as layout padding.
     int zero_marker;
@@ -105,6 +238,10 @@ struct work_queue_t {
     // Singly linked list for job stack
     work *jobs;
 
+    // The number of halide_do_async jobs enqueued and not yet
+    // finished. Workers stay on through a shutdown until it is zero.
+    int async_jobs;
+
     // The number threads created
     int threads_created;
 
@@ -132,6 +269,14 @@ struct work_queue_t {
     // whether the thread pool has been initialized.
     bool shutdown, initialized;
 
+    // The number of NUMA nodes workers are spread over (HL_NUMA), or 1
+    // if the pool is not NUMA-aware.
+    int num_numa_nodes;
+
+    // Whether workers pin themselves when they start (HL_NUMA or
+    // HL_THREAD_AFFINITY).
+    bool pin_workers;
+
     // The number of threads that are currently commited to possibly block
     // via outstanding jobs queued or being actively worked on. Used to limit
     // the number of iterations of parallel for loops that are invoked so as
@@ -163,7 +308,91 @@ struct work_queue_t {
     }
 };
 
-WEAK work_queue_t work_queue = {};
+WEAK work_queue_t work_queues[MAX_THREAD_POOLS] = {};
+
+// The bit that marks a pool as waiting on a semaphore.
+ALWAYS_INLINE uint32_t semaphore_waiter_bit(const work_queue_t *q) {
+    return (uint32_t)1 << (q - work_queues);
+}
+
+// The number of slots of work_queues in use, including the default
+// pool. Slots are handed out in order and never given back.
+WEAK int num_thread_pools = 1;
+
+// Which pool each bound user_context runs its parallel work on. Slots
+// are written only under thread_pool_registry_lock, but read without
+// it, so every field is accessed atomically. Unbinding a user_context
+// just sets its pool back to zero, and the slot is later reused for
+// another user_context.
+struct thread_pool_binding {
+    void *user_context;
+    int pool;
+};
+
+// Protects the pool names, num_thread_pools and the bindings.
+WEAK halide_mutex thread_pool_registry_lock = {{0}};
+WEAK thread_pool_binding thread_pool_bindings[MAX_THREAD_POOL_BINDINGS];
+// The number of slots of thread_pool_bindings ever used. Never
+// decreases.
+WEAK int num_thread_pool_bindings = 0;
+
+WEAK work_queue_t *work_queue_for_user_context(void *user_context) {
+    int bindings;
+    Synchronization::atomic_load_acquire(&num_thread_pool_bindings, &bindings);
+    if (bindings == 0 || user_context == NULL) {
+        return &work_queues[0];
+    }
+    for (int i = 0; i < bindings; i++) {
+        thread_pool_binding *b = &thread_pool_bindings[i];
+        void *bound;
+        Synchronization::atomic_load_acquire(&b->user_context, &bound);
+        if (bound == user_context) {
+            int pool;
+            Synchronization::atomic_load_acquire(&b->pool, &pool);
+            // When a slot is reused, its user_context is cleared
+            // before its pool changes, so if it still holds ours,
+            // the pool we read was ours too.
+            Synchronization::atomic_load_acquire(&b->user_context, &bound);
+            if (bound == user_context) {
+                return &work_queues[pool];
+            }
+        }
+    }
+    return &work_queues[0];
+}
+
+WEAK bool valid_thread_pool(int pool) {
+    int pools;
+    Synchronization::atomic_load_acquire(&num_thread_pools, &pools);
+    return pool >= 0 && pool < pools;
+}
+
+WEAK bool halide_can_spawn_threads() {
+    return true;
+}
+
+WEAK void get_thread_pool_metrics(halide_runtime_metrics_t *metrics) {
+    int pools;
+    Synchronization::atomic_load_acquire(&num_thread_pools, &pools);
+    metrics->thread_pools = pools;
+    metrics->threads_created = 0;
+    metrics->workers_sleeping = 0;
+    metrics->owners_sleeping = 0;
+    metrics->threads_reserved = 0;
+    metrics->queued_jobs = 0;
+    for (int i = 0; i < pools; i++) {
+        work_queue_t *q = &work_queues[i];
+        halide_mutex_lock(&q->mutex);
+        metrics->threads_created += q->threads_created;
+        metrics->workers_sleeping += q->workers_sleeping;
+        metrics->owners_sleeping += q->owners_sleeping;
+        metrics->threads_reserved += q->threads_reserved;
+        for (work *job = q->jobs; job != NULL; job = job->next_job) {
+            metrics->queued_jobs++;
+        }
+        halide_mutex_unlock(&q->mutex);
+    }
+}
 
 #if EXTENDED_DEBUG
 WEAK void print_job(work *job, const char *indent, const char *prefix = NULL) {
@@ -178,9 +407,9 @@ WEAK void print_job(work *job, const char *indent, const char *prefix = NULL) {
     }
 }
 
-WEAK void dump_job_state() {
+WEAK void dump_job_state(work_queue_t *q) {
     log_message("Dumping job state, jobs in queue:");
-    work *job = work_queue.jobs;
+    work *job = q->jobs;
     while (job != NULL) {
         print_job(job, "    ");
         job = job->next_job;
@@ -189,15 +418,178 @@ WEAK void dump_job_state() {
 }
 #else
 #define print_job(job, indent, prefix)
-#define dump_job_state()
+#define dump_job_state(q)
 #endif
 
-WEAK void worker_thread(void *);
+// Claim the next iteration from the front of a range. Returns false
+// if the range is empty.
+WEAK bool pop_work_range(work_range *range, uint32_t *idx) {
+    uint64_t expected;
+    uint64_t desired;
+    Synchronization::atomic_load_acquire(&range->bounds, &expected);
+    do {
+        uint32_t begin = (uint32_t)expected;
+        uint32_t end = (uint32_t)(expected >> 32);
+        if (begin >= end) {
+            return false;
+        }
+        *idx = begin;
+        desired = pack_work_range(begin + 1, end);
+    } while (!Synchronization::atomic_cas_weak_relacq_relaxed(&range->bounds, &expected, &desired));
+    return true;
+}
+
+// Move the back half of a victim's range into the thief's own (empty)
+// range. Returns false if the victim had nothing left.
+WEAK bool steal_work_range(work_range *victim, work_range *thief) {
+    uint64_t expected;
+    uint64_t desired;
+    uint32_t mid, end;
+    Synchronization::atomic_load_acquire(&victim->bounds, &expected);
+    do {
+        uint32_t begin = (uint32_t)expected;
+        end = (uint32_t)(expected >> 32);
+        if (begin >= end) {
+            return false;
+        }
+        mid = begin + (end - begin) / 2;
+        desired = pack_work_range(begin, mid);
+    } while (!Synchronization::atomic_cas_weak_relacq_relaxed(&victim->bounds, &expected, &desired));
+    // The thief is the only worker whose home range this is (see
+    // choose_work_range), and nobody else modifies a range while it is
+    // empty, so a plain store suffices.
+    uint64_t stolen = pack_work_range(mid, end);
+    Synchronization::atomic_store_release(&thief->bounds, &stolen);
+    return true;
+}
+
+// The first range belonging to a NUMA node's group in a job.
+ALWAYS_INLINE int first_range_of_node(const work *job, int node) {
+    return (node * job->num_ranges + job->num_nodes - 1) / job->num_nodes;
+}
+
+// Whether another worker can join a job. A work-stealing job can take
+// at most one worker per range.
+ALWAYS_INLINE bool job_has_free_range(const work *job) {
+    return !job->ranges || job->workers_joined < job->num_ranges;
+}
 
-WEAK void worker_thread_already_locked(work *owned_job) {
-    while (owned_job ? owned_job->running() : !work_queue.shutdown) {
-        work *job = work_queue.jobs;
-        work **prev_ptr = &work_queue.jobs;
+// Pick an unclaimed home range for a worker joining a work-stealing
+// job, preferring one in the group of the worker's NUMA node. A range
+// is never shared, because stolen work is published into the thief's
+// home range with a plain store. The job must have a free range (see
+// job_has_free_range). Must be called with the work queue lock held.
+WEAK int choose_work_range(work *job) {
+    int first = 0, last = 0;
+    if (job->num_nodes) {
+        int node = numa_node_of_current_thread();
+        first = first_range_of_node(job, node);
+        last = first_range_of_node(job, node + 1);
+    }
+    int slot = -1;
+    for (int i = first; i < last && slot < 0; i++) {
+        if (!job->ranges[i].claimed) {
+            slot = i;
+        }
+    }
+    for (int i = 0; i < job->num_ranges && slot < 0; i++) {
+        if (!job->ranges[i].claimed) {
+            slot = i;
+        }
+    }
+    halide_assert(job->user_context, slot >= 0);
+    job->ranges[slot].claimed = true;
+    job->workers_joined++;
+    return slot;
+}
+
+// Claim an iteration of a work-stealing job, first from the worker's
+// own range and then by stealing from randomly chosen victims,
+// preferring victims on the same NUMA node. Returns false once every
+// range has been observed empty. Iterations still held by a thief
+// that has not yet published them are run by that thief, so this
+// never drops work.
+WEAK bool claim_work_iteration(work *job, int slot, uint32_t *rng_state, uint32_t *idx) {
+    work_range *mine = job->ranges + slot;
+    if (pop_work_range(mine, idx)) {
+        return true;
+    }
+    int n = job->num_ranges;
+    if (n > 1) {
+        int local_first = 0, local_size = 0;
+        if (job->num_nodes) {
+            int node = (int)(((int64_t)slot * job->num_nodes) / n);
+            local_first = first_range_of_node(job, node);
+            local_size = first_range_of_node(job, node + 1) - local_first;
+        }
+        // A few random probes, first within this node and then
+        // anywhere, then a sweep to make sure everything is gone.
+        for (int attempt = 0; attempt < local_size + 2 * n; attempt++) {
+            uint32_t x = *rng_state;
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            *rng_state = x;
+            int victim;
+            if (attempt < local_size) {
+                victim = local_first + (int)(x % (uint32_t)local_size);
+            } else if (attempt < local_size + n) {
+                victim = (int)(x % (uint32_t)n);
+            } else {
+                victim = (slot + attempt) % n;
+            }
+            if (victim != slot && steal_work_range(job->ranges + victim, mine)) {
+                if (pop_work_range(mine, idx)) {
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+// Run iterations of a work-stealing job until none are left or one
+// fails. Called without the work queue lock held.
+WEAK int run_work_stealing_job(work *job, int slot) {
+    uint32_t rng_state = (uint32_t)(slot + 1) * 2654435761U;
+    uint32_t idx;
+    int result = 0;
+    while (claim_work_iteration(job, slot, &rng_state, &idx)) {
+        result = halide_do_task(job->user_context, job->task_fn,
+                                job->task.min + (int)idx, job->task.closure);
+        if (result != 0) {
+            break;
+        }
+        int exit_status;
+        Synchronization::atomic_load_relaxed(&job->exit_status, &exit_status);
+        if (exit_status != 0) {
+            break;
+        }
+    }
+    return result;
+}
+
+// The task function of halide_do_async jobs.
+WEAK int run_async_work(void *user_context, int idx, uint8_t *closure) {
+    async_work *w = (async_work *)closure;
+    return w->fn(user_context, w->arg);
+}
+
+WEAK void finish_async_work(async_work *w) {
+    int result = w->job.exit_status;
+    if (w->done) {
+        halide_semaphore_release(w->done, 1);
+    }
+    if (w->callback) {
+        w->callback(w->job.user_context, w->arg, result);
+    }
+    free(w);
+}
+
+WEAK void worker_thread_already_locked(work_queue_t *q, work *owned_job) {
+    while (owned_job ? owned_job->running() : (!q->shutdown || q->async_jobs)) {
+        work *job = q->jobs;
+        work **prev_ptr = &q->jobs;
 
         if (owned_job) {
             if (owned_job->exit_status != 0) {
@@ -215,12 +607,12 @@ WEAK void worker_thread_already_locked(work *owned_job) {
                 // The wakeup can likely be only done under certain conditions, but it is only happening
                 // in when an error has already occured and it seems more important to ensure reliable
                 // termination than to optimize this path.
-                halide_cond_broadcast(&work_queue.wake_owners);
+                halide_cond_broadcast(&q->wake_owners);
                 continue;
             }
         }
 
-        dump_job_state();
+        dump_job_state(q);
 
         // Find a job to run, prefering things near the top of the stack.
         while (job) {
@@ -235,8 +627,8 @@ WEAK void worker_thread_already_locked(work *owned_job) {
 
             int threads_available;
             if (parent_job == NULL) {
-                // The + 1 is because work_queue.threads_created does not include the main thread.
-                threads_available = (work_queue.threads_created + 1) - work_queue.threads_reserved;
+                // The + 1 is because q->threads_created does not include the main thread.
+                threads_available = (q->threads_created + 1) - q->threads_reserved;
             } else {
                 if (parent_job->active_workers == 0) {
                     threads_available = parent_job->task.min_threads - parent_job->threads_reserved;
@@ -254,13 +646,13 @@ WEAK void worker_thread_already_locked(work *owned_job) {
             if (!can_use_this_thread_stack) {
                 log_message("Cannot run job " << job->task.name << " on this thread.");
             }
-            bool can_add_worker = (!job->task.serial || (job->active_workers == 0));
+            bool can_add_worker = (!job->task.serial || (job->active_workers == 0)) && job_has_free_range(job);
             if (!can_add_worker) {
                 log_message("Cannot add worker to job " << job->task.name);
             }
 
             if (enough_threads && can_use_this_thread_stack && can_add_worker) {
-                if (job->make_runnable()) {
+                if (job->make_runnable(semaphore_waiter_bit(q))) {
                     break;
                 } else {
                     log_message("Cannot acquire semaphores for " << job->task.name);
@@ -273,22 +665,22 @@ WEAK void worker_thread_already_locked(work *owned_job) {
         if (!job) {
             // There is no runnable job. Go to sleep.
             if (owned_job) {
-                work_queue.owners_sleeping++;
+                q->owners_sleeping++;
                 owned_job->owner_is_sleeping = true;
-                halide_cond_wait(&work_queue.wake_owners, &work_queue.mutex);
+                halide_cond_wait(&q->wake_owners, &q->mutex);
                 owned_job->owner_is_sleeping = false;
-                work_queue.owners_sleeping--;
+                q->owners_sleeping--;
             } else {
-                work_queue.workers_sleeping++;
-                if (work_queue.a_team_size > work_queue.target_a_team_size) {
+                q->workers_sleeping++;
+                if (q->a_team_size > q->target_a_team_size) {
                     // Transition to B team
-                    work_queue.a_team_size--;
-                    halide_cond_wait(&work_queue.wake_b_team, &work_queue.mutex);
-                    work_queue.a_team_size++;
+                    q->a_team_size--;
+                    halide_cond_wait(&q->wake_b_team, &q->mutex);
+                    q->a_team_size++;
                 } else {
-                    halide_cond_wait(&work_queue.wake_a_team, &work_queue.mutex);
+                    halide_cond_wait(&q->wake_a_team, &q->mutex);
                 }
-                work_queue.workers_sleeping--;
+                q->workers_sleeping--;
             }
             continue;
         }
@@ -301,8 +693,8 @@ WEAK void worker_thread_already_locked(work *owned_job) {
         job->active_workers++;
 
         if (job->parent_job == NULL) {
-            work_queue.threads_reserved += job->task.min_threads;
-            log_message("Reserved " << job->task.min_threads << " on work queue for " << job->task.name << " giving " << work_queue.threads_reserved << " of " << work_queue.threads_created + 1);
+            q->threads_reserved += job->task.min_threads;
+            log_message("Reserved " << job->task.min_threads << " on work queue for " << job->task.name << " giving " << q->threads_reserved << " of " << q->threads_created + 1);
         } else {
             job->parent_job->threads_reserved += job->task.min_threads;
             log_message("Reserved " << job->task.min_threads << " on " << job->parent_job->task.name << " for " << job->task.name << " giving " << job->parent_job->threads_reserved << " of " << job->parent_job->task.min_threads);
@@ -310,18 +702,39 @@ WEAK void worker_thread_already_locked(work *owned_job) {
 
         int result = 0;
 
-        if (job->task.serial) {
+        if (job->ranges) {
+            // Work-stealing job. Iterations are claimed from per-worker
+            // ranges without holding the lock.
+            int slot = choose_work_range(job);
+            halide_mutex_unlock(&q->mutex);
+            result = run_work_stealing_job(job, slot);
+            halide_mutex_lock(&q->mutex);
+
+            // This worker found nothing left to claim (or failed), so
+            // there is no point in anyone else picking the job up
+            // again. Take it off the stack if nobody beat us to it.
+            if (job->task.extent != 0) {
+                work **ptr = &q->jobs;
+                while (*ptr && *ptr != job) {
+                    ptr = &((*ptr)->next_job);
+                }
+                if (*ptr) {
+                    *ptr = job->next_job;
+                }
+                job->task.extent = 0;
+            }
+        } else if (job->task.serial) {
             // Remove it from the stack while we work on it
             *prev_ptr = job->next_job;
 
             // Release the lock and do the task.
-            halide_mutex_unlock(&work_queue.mutex);
+            halide_mutex_unlock(&q->mutex);
             int total_iters = 0;
             int iters = 1;
             while (result == 0) {
                 // Claim as many iterations as possible
                 while ((job->task.extent - total_iters) > iters &&
-                       job->make_runnable()) {
+                       job->make_runnable(semaphore_waiter_bit(q))) {
                     iters++;
                 }
                 if (iters == 0) break;
@@ -333,7 +746,7 @@ WEAK void worker_thread_already_locked(work *owned_job) {
                 total_iters += iters;
                 iters = 0;
             }
-            halide_mutex_lock(&work_queue.mutex);
+            halide_mutex_lock(&q->mutex);
 
             job->task.min += total_iters;
             job->task.extent -= total_iters;
@@ -342,8 +755,8 @@ WEAK void worker_thread_already_locked(work *owned_job) {
             if (result != 0) {
                 job->task.extent = 0;  // Force job to be finished.
             } else if (job->task.extent > 0) {
-                job->next_job = work_queue.jobs;
-                work_queue.jobs = job;
+                job->next_job = q->jobs;
+                q->jobs = job;
             }
         } else {
             // Claim a task from it.
@@ -358,7 +771,7 @@ WEAK void worker_thread_already_locked(work *owned_job) {
             }
 
             // Release the lock and do the task.
-            halide_mutex_unlock(&work_queue.mutex);
+            halide_mutex_unlock(&q->mutex);
             if (myjob.task_fn) {
                 result = halide_do_task(myjob.user_context, myjob.task_fn,
                                         myjob.task.min, myjob.task.closure);
@@ -367,7 +780,7 @@ WEAK void worker_thread_already_locked(work *owned_job) {
                                              myjob.task.min, 1,
                                              myjob.task.closure, job);
             }
-            halide_mutex_lock(&work_queue.mutex);
+            halide_mutex_lock(&q->mutex);
         }
 
         if (result != 0) {
@@ -378,7 +791,7 @@ WEAK void worker_thread_already_locked(work *owned_job) {
 
         // If this task failed, set the exit status on the job.
         if (result != 0) {
-            job->exit_status = result;
+            Synchronization::atomic_store_release(&job->exit_status, &result);
             // Mark all siblings as also failed.
             for (int i = 0; i < job->sibling_count; i++) {
                 log_message("Marking " << job->sibling_count << " siblings ");
@@ -391,8 +804,8 @@ WEAK void worker_thread_already_locked(work *owned_job) {
         }
 
         if (job->parent_job == NULL) {
-            work_queue.threads_reserved -= job->task.min_threads;
-            log_message("Returned " << job->task.min_threads << " to work queue for " << job->task.name << " giving " << work_queue.threads_reserved << " of " << work_queue.threads_created + 1);
+            q->threads_reserved -= job->task.min_threads;
+            log_message("Returned " << job->task.min_threads << " to work queue for " << job->task.name << " giving " << q->threads_reserved << " of " << q->threads_created + 1);
         } else {
             job->parent_job->threads_reserved -= job->task.min_threads;
             log_message("Returned " << job->task.min_threads << " to " << job->parent_job->task.name << " for " << job->task.name << " giving " << job->parent_job->threads_reserved << " of " << job->parent_job->task.min_threads);
@@ -406,30 +819,68 @@ WEAK void worker_thread_already_locked(work *owned_job) {
         if (wake_owners ||
             (job->active_workers == 0 && (job->task.extent == 0 || job->exit_status != 0) && job->owner_is_sleeping)) {
             // The job is done or some owned job failed via sibling linkage. Wake up the owner.
-            halide_cond_broadcast(&work_queue.wake_owners);
+            halide_cond_broadcast(&q->wake_owners);
+        }
+
+        if (job->async && job->active_workers == 0 && job->task.extent == 0) {
+            // Nothing else refers to the job now, so tell whoever
+            // asked for it and clean up without holding the lock.
+            halide_mutex_unlock(&q->mutex);
+            finish_async_work((async_work *)job);
+            halide_mutex_lock(&q->mutex);
+            q->async_jobs--;
+            if (q->shutdown && q->async_jobs == 0) {
+                // That was the last thing keeping a shutdown waiting,
+                // so let the other workers leave.
+                halide_cond_broadcast(&q->wake_a_team);
+                halide_cond_broadcast(&q->wake_b_team);
+            }
         }
     }
 }
 
+// The entry point for worker threads. The argument encodes the pool
+// and the index of the worker within it, as pool * MAX_THREADS + index.
 WEAK void worker_thread(void *arg) {
-    halide_mutex_lock(&work_queue.mutex);
-    worker_thread_already_locked((work *)arg);
-    halide_mutex_unlock(&work_queue.mutex);
+    int pool = (int)((intptr_t)arg / MAX_THREADS);
+    int index = (int)((intptr_t)arg % MAX_THREADS);
+    work_queue_t *q = &work_queues[pool];
+    // These are only changed while the pool has no workers.
+    if (q->pin_workers) {
+        pin_worker_thread(index);
+    }
+    if (q->priority) {
+        set_current_thread_priority(q->priority);
+    }
+    halide_mutex_lock(&q->mutex);
+    worker_thread_already_locked(q, NULL);
+    halide_mutex_unlock(&q->mutex);
 }
 
-WEAK void enqueue_work_already_locked(int num_jobs, work *jobs, work *task_parent) {
-    if (!work_queue.initialized) {
-        work_queue.assert_zeroed();
+WEAK void initialize_work_queue_already_locked(work_queue_t *q) {
+    if (!q->initialized) {
+        q->assert_zeroed();
 
         // Compute the desired number of threads to use. Other code
         // can also mess with this value, but only when the work queue
         // is locked.
-        if (!work_queue.desired_threads_working) {
-            work_queue.desired_threads_working = default_desired_num_threads();
+        if (!q->desired_threads_working) {
+            q->desired_threads_working = default_desired_num_threads();
+        }
+        q->desired_threads_working = clamp_num_threads(q->desired_threads_working);
+        if (q->work_stealing_mode == work_stealing_default) {
+            q->work_stealing_mode = default_work_stealing_mode();
         }
-        work_queue.desired_threads_working = clamp_num_threads(work_queue.desired_threads_working);
-        work_queue.initialized = true;
+        q->num_numa_nodes = numa_node_count();
+        // Only the default pool is pinned. Named pools are meant to
+        // share the machine with it, so they float.
+        q->pin_workers = (q == &work_queues[0]) && should_pin_worker_threads();
+        q->initialized = true;
     }
+}
+
+WEAK void enqueue_work_already_locked(work_queue_t *q, int num_jobs, work *jobs, work *task_parent) {
+    initialize_work_queue_already_locked(q);
 
     // Gather some information about the work.
 
@@ -438,8 +889,9 @@ WEAK void enqueue_work_already_locked(int num_jobs, work *jobs, work *task_paren
     int min_threads = 0;
 
     // Count how many workers to wake. Start at -1 because this thread
-    // will contribute.
-    int workers_to_wake = -1;
+    // will contribute, unless the caller of halide_do_async is going
+    // away.
+    int workers_to_wake = jobs[0].async ? 0 : -1;
 
     // Could stalled owners of other tasks conceivably help with one
     // of these jobs.
@@ -481,18 +933,19 @@ WEAK void enqueue_work_already_locked(int num_jobs, work *jobs, work *task_paren
         }
 
         // Spawn more threads if necessary.
-        while (work_queue.threads_created < MAX_THREADS &&
-               ((work_queue.threads_created < work_queue.desired_threads_working - 1) ||
-                (work_queue.threads_created + 1) - work_queue.threads_reserved < min_threads)) {
-            // We might need to make some new threads, if work_queue.desired_threads_working has
+        while (q->threads_created < MAX_THREADS &&
+               ((q->threads_created < q->desired_threads_working - 1) ||
+                (q->threads_created + 1) - q->threads_reserved < min_threads)) {
+            // We might need to make some new threads, if q->desired_threads_working has
             // increased, or if there aren't enough threads to complete this new task.
-            work_queue.a_team_size++;
-            work_queue.threads[work_queue.threads_created++] =
-                halide_spawn_thread(worker_thread, NULL);
+            q->a_team_size++;
+            intptr_t arg = (q - work_queues) * MAX_THREADS + q->threads_created;
+            q->threads[q->threads_created++] =
+                halide_spawn_thread(worker_thread, (void *)arg);
         }
-        log_message("enqueue_work_already_locked top level job " << jobs[0].task.name << " with min_threads " << min_threads << " work_queue.threads_created " << work_queue.threads_created << " work_queue.threads_reserved " << work_queue.threads_reserved);
+        log_message("enqueue_work_already_locked top level job " << jobs[0].task.name << " with min_threads " << min_threads << " q->threads_created " << q->threads_created << " q->threads_reserved " << q->threads_reserved);
         if (job_has_acquires || job_may_block) {
-            work_queue.threads_reserved++;
+            q->threads_reserved++;
         }
     } else {
         log_message("enqueue_work_already_locked job " << jobs[0].task.name << " with min_threads " << min_threads << " task_parent " << task_parent->task.name << " task_parent->task.min_threads " << task_parent->task.min_threads << " task_parent->threads_reserved " << task_parent->threads_reserved);
@@ -508,31 +961,31 @@ WEAK void enqueue_work_already_locked(int num_jobs, work *jobs, work *task_paren
     for (int i = num_jobs - 1; i >= 0; i--) {
         // We could bubble it downwards based on some heuristics, but
         // it's not strictly necessary to do so.
-        jobs[i].next_job = work_queue.jobs;
+        jobs[i].next_job = q->jobs;
         jobs[i].siblings = &jobs[0];
         jobs[i].sibling_count = num_jobs;
         jobs[i].threads_reserved = 0;
-        work_queue.jobs = jobs + i;
+        q->jobs = jobs + i;
     }
 
     bool nested_parallelism =
-        work_queue.owners_sleeping ||
-        (work_queue.workers_sleeping < work_queue.threads_created);
+        q->owners_sleeping ||
+        (q->workers_sleeping < q->threads_created);
 
     // Wake up an appropriate number of threads
-    if (nested_parallelism || workers_to_wake > work_queue.workers_sleeping) {
+    if (nested_parallelism || workers_to_wake > q->workers_sleeping) {
         // If there's nested parallelism going on, we just wake up
         // everyone. TODO: make this more precise.
-        work_queue.target_a_team_size = work_queue.threads_created;
+        q->target_a_team_size = q->threads_created;
     } else {
-        work_queue.target_a_team_size = workers_to_wake;
+        q->target_a_team_size = workers_to_wake;
     }
 
-    halide_cond_broadcast(&work_queue.wake_a_team);
-    if (work_queue.target_a_team_size > work_queue.a_team_size) {
-        halide_cond_broadcast(&work_queue.wake_b_team);
+    halide_cond_broadcast(&q->wake_a_team);
+    if (q->target_a_team_size > q->a_team_size) {
+        halide_cond_broadcast(&q->wake_b_team);
         if (stealable_jobs) {
-            halide_cond_broadcast(&work_queue.wake_owners);
+            halide_cond_broadcast(&q->wake_owners);
         }
     }
 
@@ -540,7 +993,7 @@ WEAK void enqueue_work_already_locked(int num_jobs, work *jobs, work *task_paren
         if (task_parent != NULL) {
             task_parent->threads_reserved--;
         } else {
-            work_queue.threads_reserved--;
+            q->threads_reserved--;
         }
     }
 }
@@ -603,10 +1056,48 @@ WEAK int halide_default_do_par_for(void *user_context, halide_task_t f,
     job.siblings = &job;  // guarantees no other job points to the same siblings.
     job.sibling_count = 0;
     job.parent_job = NULL;
-    halide_mutex_lock(&work_queue.mutex);
-    enqueue_work_already_locked(1, &job, NULL);
-    worker_thread_already_locked(&job);
-    halide_mutex_unlock(&work_queue.mutex);
+    job.ranges = NULL;
+    job.num_ranges = 0;
+    job.workers_joined = 0;
+    job.num_nodes = 0;
+    job.async = false;
+    work_queue_t *q = work_queue_for_user_context(user_context);
+    job.queue = q;
+    halide_mutex_lock(&q->mutex);
+    initialize_work_queue_already_locked(q);
+    // The packed ranges need 64-bit atomics, so 32-bit targets always
+    // claim iterations under the lock. NUMA-aware pools always use
+    // ranges so that each node works on a contiguous block.
+    bool numa = q->num_numa_nodes > 1;
+    if (sizeof(void *) == 8 &&
+        (numa || q->work_stealing_mode == work_stealing_enabled) && size > 1) {
+        // Split the iterations contiguously over one range per thread
+        // that could work on them. Workers that never show up have
+        // their ranges stolen. In a NUMA-aware pool consecutive ranges
+        // are grouped by node, so each node works on one contiguous
+        // block of the loop.
+        int n = q->threads_created + 1;
+        if (n < q->desired_threads_working) {
+            n = q->desired_threads_working;
+        }
+        if (n > size) {
+            n = size;
+        }
+        job.ranges = (work_range *)__builtin_alloca(sizeof(work_range) * n);
+        job.num_ranges = n;
+        for (int i = 0; i < n; i++) {
+            uint32_t begin = (uint32_t)(((int64_t)size * i) / n);
+            uint32_t end = (uint32_t)(((int64_t)size * (i + 1)) / n);
+            job.ranges[i].bounds = pack_work_range(begin, end);
+            job.ranges[i].claimed = false;
+        }
+        if (numa && n >= q->num_numa_nodes) {
+            job.num_nodes = q->num_numa_nodes;
+        }
+    }
+    enqueue_work_already_locked(q, 1, &job, NULL);
+    worker_thread_already_locked(q, &job);
+    halide_mutex_unlock(&q->mutex);
     return job.exit_status;
 }
 
@@ -614,6 +1105,7 @@ WEAK int halide_default_do_parallel_tasks(void *user_context, int num_tasks,
                                           struct halide_parallel_task_t *tasks,
                                           void *task_parent) {
     work *jobs = (work *)__builtin_alloca(sizeof(work) * num_tasks);
+    work_queue_t *q = task_parent ? ((work *)task_parent)->queue : work_queue_for_user_context(user_context);
 
     for (int i = 0; i < num_tasks; i++) {
         if (tasks->extent <= 0) {
@@ -629,104 +1121,284 @@ WEAK int halide_default_do_parallel_tasks(void *user_context, int num_tasks,
         jobs[i].next_semaphore = 0;
         jobs[i].owner_is_sleeping = false;
         jobs[i].parent_job = (work *)task_parent;
+        jobs[i].ranges = NULL;
+        jobs[i].num_ranges = 0;
+        jobs[i].workers_joined = 0;
+        jobs[i].num_nodes = 0;
+        jobs[i].queue = q;
+        jobs[i].async = false;
     }
 
     if (num_tasks == 0) {
         return 0;
     }
 
-    halide_mutex_lock(&work_queue.mutex);
-    enqueue_work_already_locked(num_tasks, jobs, (work *)task_parent);
+    halide_mutex_lock(&q->mutex);
+    enqueue_work_already_locked(q, num_tasks, jobs, (work *)task_parent);
     int exit_status = 0;
     for (int i = 0; i < num_tasks; i++) {
         // It doesn't matter what order we join the tasks in, because
         // we'll happily assist with siblings too.
-        worker_thread_already_locked(jobs + i);
+        worker_thread_already_locked(q, jobs + i);
         if (jobs[i].exit_status != 0) {
             exit_status = jobs[i].exit_status;
         }
     }
-    halide_mutex_unlock(&work_queue.mutex);
+    halide_mutex_unlock(&q->mutex);
     return exit_status;
 }
 
+WEAK int halide_do_async(void *user_context, halide_async_task_t task, void *arg,
+                         halide_async_callback_t callback, halide_semaphore_t *done) {
+    async_work *w = (async_work *)malloc(sizeof(async_work));
+    if (!w) {
+        return halide_error_code_out_of_memory;
+    }
+    w->fn = task;
+    w->arg = arg;
+    w->callback = callback;
+    w->done = done;
+
+    work &job = w->job;
+    job.task.fn = NULL;
+    job.task.min = 0;
+    job.task.extent = 1;
+    job.task.serial = false;
+    job.task.semaphores = NULL;
+    job.task.num_semaphores = 0;
+    job.task.closure = (uint8_t *)w;
+    // The worker that runs the job is tied up until it finishes, just
+    // like the thread that calls a pipeline synchronously, so it is
+    // reserved. That also keeps workers that are blocked inside some
+    // other job from picking it up.
+    job.task.min_threads = 1;
+    job.task.name = "halide_do_async";
+    job.task_fn = run_async_work;
+    job.user_context = user_context;
+    job.exit_status = 0;
+    job.active_workers = 0;
+    job.next_semaphore = 0;
+    job.owner_is_sleeping = false;
+    job.parent_job = NULL;
+    job.ranges = NULL;
+    job.num_ranges = 0;
+    job.workers_joined = 0;
+    job.num_nodes = 0;
+    job.async = true;
+    work_queue_t *q = work_queue_for_user_context(user_context);
+    job.queue = q;
+
+    halide_mutex_lock(&q->mutex);
+    q->async_jobs++;
+    enqueue_work_already_locked(q, 1, &job, NULL);
+    halide_mutex_unlock(&q->mutex);
+    return halide_error_code_success;
+}
+
 WEAK int halide_set_num_threads(int n) {
+    return halide_set_num_threads_in_pool(0, n);
+}
+
+WEAK int halide_set_num_threads_in_pool(int pool, int n) {
     if (n < 0) {
         halide_error(NULL, "halide_set_num_threads: must be >= 0.");
     }
+    if (!valid_thread_pool(pool)) {
+        halide_error(NULL, "halide_set_num_threads_in_pool: no such thread pool.");
+        return halide_error_code_generic_error;
+    }
+    work_queue_t *q = &work_queues[pool];
     // Don't make this an atomic swap - we don't want to be changing
     // the desired number of threads while another thread is in the
     // middle of a sequence of non-atomic operations.
-    halide_mutex_lock(&work_queue.mutex);
+    halide_mutex_lock(&q->mutex);
     if (n == 0) {
         n = default_desired_num_threads();
     }
-    int old = work_queue.desired_threads_working;
-    work_queue.desired_threads_working = clamp_num_threads(n);
-    halide_mutex_unlock(&work_queue.mutex);
+    int old = q->desired_threads_working;
+    q->desired_threads_working = clamp_num_threads(n);
+    halide_mutex_unlock(&q->mutex);
     return old;
 }
 
-WEAK void halide_shutdown_thread_pool() {
-    if (work_queue.initialized) {
+WEAK int halide_set_work_stealing(int enable) {
+    int old = work_stealing_default;
+    // Unused slots are set too, so pools created later pick it up.
+    for (int i = 0; i < MAX_THREAD_POOLS; i++) {
+        work_queue_t *q = &work_queues[i];
+        halide_mutex_lock(&q->mutex);
+        if (i == 0) {
+            old = q->work_stealing_mode;
+        }
+        q->work_stealing_mode = enable ? work_stealing_enabled : work_stealing_disabled;
+        halide_mutex_unlock(&q->mutex);
+    }
+    if (old == work_stealing_default) {
+        old = default_work_stealing_mode();
+    }
+    return old == work_stealing_enabled;
+}
+
+WEAK int halide_create_thread_pool(const char *name, int num_threads, int priority) {
+    if (name == NULL || name[0] == 0) {
+        halide_error(NULL, "halide_create_thread_pool: pools must have a name.");
+        return halide_error_code_generic_error;
+    }
+    if (num_threads < 0) {
+        halide_error(NULL, "halide_create_thread_pool: num_threads must be >= 0.");
+        return halide_error_code_generic_error;
+    }
+    halide_mutex_lock(&thread_pool_registry_lock);
+    int pool = 1;
+    while (pool < num_thread_pools &&
+           strncmp(work_queues[pool].name, name, MAX_THREAD_POOL_NAME - 1) != 0) {
+        pool++;
+    }
+    if (pool == MAX_THREAD_POOLS) {
+        halide_mutex_unlock(&thread_pool_registry_lock);
+        halide_error(NULL, "halide_create_thread_pool: too many thread pools.");
+        return halide_error_code_generic_error;
+    }
+    work_queue_t *q = &work_queues[pool];
+    halide_mutex_lock(&q->mutex);
+    if (pool == num_thread_pools) {
+        strncpy(q->name, name, MAX_THREAD_POOL_NAME - 1);
+    }
+    q->desired_threads_working = clamp_num_threads(num_threads ? num_threads : default_desired_num_threads());
+    q->priority = priority;
+    halide_mutex_unlock(&q->mutex);
+    if (pool == num_thread_pools) {
+        int pools = num_thread_pools + 1;
+        Synchronization::atomic_store_release(&num_thread_pools, &pools);
+    }
+    halide_mutex_unlock(&thread_pool_registry_lock);
+    return pool;
+}
+
+WEAK int halide_set_thread_pool(void *user_context, int pool) {
+    if (user_context == NULL) {
+        halide_error(NULL, "halide_set_thread_pool: user_context must not be NULL.");
+        return halide_error_code_generic_error;
+    }
+    if (!valid_thread_pool(pool)) {
+        halide_error(user_context, "halide_set_thread_pool: no such thread pool.");
+        return halide_error_code_generic_error;
+    }
+    halide_mutex_lock(&thread_pool_registry_lock);
+    int i = 0;
+    while (i < num_thread_pool_bindings &&
+           thread_pool_bindings[i].user_context != user_context) {
+        i++;
+    }
+    int result = (i < num_thread_pool_bindings) ? thread_pool_bindings[i].pool : 0;
+    if (i == num_thread_pool_bindings && pool != 0) {
+        // Reuse the slot of a user_context that has been unbound, or
+        // failing that take a new one.
+        i = 0;
+        while (i < num_thread_pool_bindings && thread_pool_bindings[i].pool != 0) {
+            i++;
+        }
+        if (i == MAX_THREAD_POOL_BINDINGS) {
+            result = halide_error_code_generic_error;
+        } else {
+            thread_pool_binding *b = &thread_pool_bindings[i];
+            void *none = NULL;
+            Synchronization::atomic_store_release(&b->user_context, &none);
+            Synchronization::atomic_store_release(&b->pool, &pool);
+            Synchronization::atomic_store_release(&b->user_context, &user_context);
+            if (i == num_thread_pool_bindings) {
+                int bindings = i + 1;
+                Synchronization::atomic_store_release(&num_thread_pool_bindings, &bindings);
+            }
+        }
+    } else if (i < num_thread_pool_bindings) {
+        // Binding to the default pool is the same as not being bound,
+        // and frees the slot for reuse.
+        Synchronization::atomic_store_release(&thread_pool_bindings[i].pool, &pool);
+    }
+    halide_mutex_unlock(&thread_pool_registry_lock);
+    if (result < 0) {
+        halide_error(user_context, "halide_set_thread_pool: too many user_contexts bound to thread pools.");
+    }
+    return result;
+}
+
+WEAK void halide_shutdown_thread_pool_by_id(int pool) {
+    if (!valid_thread_pool(pool)) {
+        return;
+    }
+    work_queue_t *q = &work_queues[pool];
+    if (q->initialized) {
         // Wake everyone up and tell them the party's over and it's time
-        // to go home
-        halide_mutex_lock(&work_queue.mutex);
+        // to go home. They finish any halide_do_async jobs still queued
+        // first, so that every one of them gets its callback.
+        halide_mutex_lock(&q->mutex);
 
-        work_queue.shutdown = true;
-        halide_cond_broadcast(&work_queue.wake_owners);
-        halide_cond_broadcast(&work_queue.wake_a_team);
-        halide_cond_broadcast(&work_queue.wake_b_team);
-        halide_mutex_unlock(&work_queue.mutex);
+        q->shutdown = true;
+        halide_cond_broadcast(&q->wake_owners);
+        halide_cond_broadcast(&q->wake_a_team);
+        halide_cond_broadcast(&q->wake_b_team);
+        halide_mutex_unlock(&q->mutex);
 
         // Wait until they leave
-        for (int i = 0; i < work_queue.threads_created; i++) {
-            halide_join_thread(work_queue.threads[i]);
+        for (int i = 0; i < q->threads_created; i++) {
+            halide_join_thread(q->threads[i]);
         }
 
         // Tidy up
-        work_queue.reset();
+        q->reset();
+        if (pool == 0) {
+            clear_worker_placements();
+        }
     }
 }
 
-struct halide_semaphore_impl_t {
-    int value;
-};
+WEAK void halide_shutdown_thread_pool() {
+    for (int i = 0; i < MAX_THREAD_POOLS; i++) {
+        halide_shutdown_thread_pool_by_id(i);
+    }
+}
 
 WEAK int halide_default_semaphore_init(halide_semaphore_t *s, int n) {
     halide_semaphore_impl_t *sem = (halide_semaphore_impl_t *)s;
-    Halide::Runtime::Internal::Synchronization::atomic_store_release(&sem->value, &n);
+    uint32_t none = 0;
+    Halide::Runtime::Internal::Synchronization::atomic_store_release(&sem->waiting_pools, &none);
+    Halide::Runtime::Internal::Synchronization::atomic_store_release(&sem->count, &n);
     return n;
 }
 
 WEAK int halide_default_semaphore_release(halide_semaphore_t *s, int n) {
     halide_semaphore_impl_t *sem = (halide_semaphore_impl_t *)s;
-    int old_val = Halide::Runtime::Internal::Synchronization::atomic_fetch_add_acquire_release(&sem->value, n);
-    // TODO(abadams|zvookin): Is this correct if an acquire can be for say count of 2 and the releases are 1 each?
-    if (old_val == 0 && n != 0) {  // Don't wake if nothing released.
-        // We may have just made a job runnable
-        halide_mutex_lock(&work_queue.mutex);
-        halide_cond_broadcast(&work_queue.wake_a_team);
-        halide_cond_broadcast(&work_queue.wake_owners);
-        halide_mutex_unlock(&work_queue.mutex);
+    if (n == 0) {  // Don't wake if nothing released.
+        int count;
+        Halide::Runtime::Internal::Synchronization::atomic_load_acquire(&sem->count, &count);
+        return count;
     }
-    return old_val + n;
+    int old_count = Halide::Runtime::Internal::Synchronization::atomic_fetch_add_acquire_release(&sem->count, n);
+    // We may have just made a job runnable. Now that the count is
+    // up, take the set of pools that had a job waiting, and wake them
+    // (see semaphore_try_acquire). Any that still can't run will mark
+    // their pool as waiting again.
+    Halide::Runtime::Internal::Synchronization::atomic_thread_fence_sequentially_consistent();
+    uint32_t waiting_pools;
+    Halide::Runtime::Internal::Synchronization::atomic_load_acquire(&sem->waiting_pools, &waiting_pools);
+    if (waiting_pools) {
+        waiting_pools = Halide::Runtime::Internal::Synchronization::atomic_fetch_and_acquire_release(&sem->waiting_pools, (uint32_t)0);
+    }
+    for (int i = 0; waiting_pools; i++, waiting_pools >>= 1) {
+        if (waiting_pools & 1) {
+            work_queue_t *q = &work_queues[i];
+            halide_mutex_lock(&q->mutex);
+            halide_cond_broadcast(&q->wake_a_team);
+            halide_cond_broadcast(&q->wake_owners);
+            halide_mutex_unlock(&q->mutex);
+        }
+    }
+    return old_count + n;
 }
 
 WEAK bool halide_default_semaphore_try_acquire(halide_semaphore_t *s, int n) {
-    if (n == 0) {
-        return true;
-    }
-    halide_semaphore_impl_t *sem = (halide_semaphore_impl_t *)s;
-    // Decrement and get new value
-    int expected;
-    int desired;
-    Halide::Runtime::Internal::Synchronization::atomic_load_acquire(&sem->value, &expected);
-    do {
-        desired = expected - n;
-    } while (desired >= 0 &&
-             !Halide::Runtime::Internal::Synchronization::atomic_cas_weak_relacq_relaxed(&sem->value, &expected, &desired));
-    return desired >= 0;
+    return semaphore_try_acquire(s, n, 0);
 }
 
 WEAK halide_do_task_t halide_set_custom_do_task(halide_do_task_t f) {
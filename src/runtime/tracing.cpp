@@ -5,156 +5,392 @@
 extern "C" {
 
 typedef int32_t (*trace_fn)(void *, const halide_trace_event_t *);
+typedef int *(*errno_location_fn)();
 }
 
 namespace Halide {
 namespace Runtime {
 namespace Internal {
 
-// A spinlock that allows for shared and exclusive access. It's
-// equivalent to a reader-writer lock, but in my case the "readers"
-// will actually be writing simultaneously to the trace buffer, so
-// that's a bad name. We use the __sync primitives used elsewhere in
-// the runtime for atomic work. They are well supported by clang.
-class SharedExclusiveSpinLock {
-    volatile uint32_t lock;
-
-    // Covers a single bit indicating one owner has exclusive
-    // access. The waiting bit can be set while the exclusive bit is
-    // set, but the bits masked by shared_mask must be zero while this
-    // bit is set.
-    const static uint32_t exclusive_held_mask = 0x80000000;
-
-    // Set to indicate a thread needs to acquire exclusive
-    // access. Other fields of the lock may be set, but no shared
-    // access request will proceed while this bit is set.
-    const static uint32_t exclusive_waiting_mask = 0x40000000;
-
-    // Count of threads currently holding shared access. Must be zero
-    // if the exclusive bit is set. Cannot increase if the waiting bit
-    // is set.
-    const static uint32_t shared_mask = 0x3fffffff;
+const static uint32_t buffer_size = 1024 * 1024;
+
+// The same on every platform we write trace files on.
+#define HALIDE_EINTR 4
+
+// The C library's accessor for the calling thread's errno. The
+// runtime doesn't know which C library it is linked against, and
+// glibc and musl, OS X, Android and Windows each name it differently.
+// Returns NULL if the process has none of them.
+WEAK errno_location_fn find_errno_location() {
+    const char *names[] = {"__errno_location", "__error", "__errno", "_errno"};
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        errno_location_fn f = (errno_location_fn)halide_get_symbol(names[i]);
+        if (f) {
+            return f;
+        }
+    }
+    return NULL;
+}
 
-public:
-    ALWAYS_INLINE void acquire_shared() {
-        while (1) {
-            uint32_t x = lock & shared_mask;
-            if (__sync_bool_compare_and_swap(&lock, x, x + 1)) {
-                return;
-            }
+// Binary trace packets are written into one of two buffers. Threads
+// reserve space for a packet in the active buffer with an atomic add
+// to its cursor, without taking any lock. The thread whose
+// reservation first runs off the end seals that buffer and makes the
+// other one active, and a background thread writes the sealed buffer
+// out while packets go into the other. If the background thread falls
+// behind, threads block until it has written out the other buffer.
+// Where threads can't be spawned (or HL_TRACE_ASYNC=0), the sealing
+// thread writes the buffer out itself.
+struct TraceBuffer {
+    // The bytes reserved so far. More than buffer_size once sealed.
+    uint32_t cursor;
+    // The number of threads that have reserved space and not finished
+    // writing their packet yet.
+    uint32_t writers;
+    // The bytes of packets in the buffer. Set when it is sealed.
+    uint32_t end;
+    // Set when sealed and cleared once written out. Protected by the
+    // writer's mutex, as is the generation.
+    bool pending;
+    // The number of times this buffer has been written out.
+    uint32_t generation;
+    uint8_t buf[buffer_size];
+};
+
+// LZ4 block compression, for HL_TRACE_COMPRESS=1. This is a greedy
+// single-probe matcher: traces compress well even so, as packets
+// repeat their Func names and much of their headers.
+#define LZ4_HASH_BITS 12
+#define LZ4_MIN_MATCH 4
+// The last match must start at least this many bytes before the end,
+// and the last this many bytes must be literals.
+#define LZ4_MATCH_LIMIT 12
+#define LZ4_LAST_LITERALS 5
+
+ALWAYS_INLINE uint32_t lz4_compress_bound(uint32_t size) {
+    return size + size / 255 + 16;
+}
+
+ALWAYS_INLINE uint32_t lz4_read32(const uint8_t *p) {
+    uint32_t x;
+    memcpy(&x, p, sizeof(x));
+    return x;
+}
+
+ALWAYS_INLINE uint8_t *lz4_write_length(uint8_t *op, uint32_t length) {
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (uint8_t)length;
+    return op;
+}
+
+// Write the literals from anchor up to ip, followed by a match of the
+// given offset and length, or no match if length is zero.
+ALWAYS_INLINE uint8_t *lz4_write_sequence(uint8_t *op, const uint8_t *anchor, const uint8_t *ip,
+                                          uint32_t offset, uint32_t length) {
+    uint32_t literals = (uint32_t)(ip - anchor);
+    uint8_t *token = op++;
+    *token = (uint8_t)(min(literals, (uint32_t)15) << 4);
+    if (literals >= 15) {
+        op = lz4_write_length(op, literals - 15);
+    }
+    memcpy(op, anchor, literals);
+    op += literals;
+    if (length) {
+        *op++ = (uint8_t)offset;
+        *op++ = (uint8_t)(offset >> 8);
+        length -= LZ4_MIN_MATCH;
+        *token |= (uint8_t)min(length, (uint32_t)15);
+        if (length >= 15) {
+            op = lz4_write_length(op, length - 15);
         }
     }
+    return op;
+}
 
-    ALWAYS_INLINE void release_shared() {
-        __sync_fetch_and_sub(&lock, 1);
+// Compress size bytes from src into dst, which must hold
+// lz4_compress_bound(size) bytes. table holds 1 << LZ4_HASH_BITS
+// entries. Returns the compressed size.
+WEAK uint32_t lz4_compress(const uint8_t *src, uint32_t size, uint8_t *dst, uint32_t *table) {
+    const uint8_t *ip = src, *anchor = src, *end = src + size;
+    uint8_t *op = dst;
+    if (size > LZ4_MATCH_LIMIT) {
+        memset(table, 0, sizeof(uint32_t) << LZ4_HASH_BITS);
+        const uint8_t *match_limit = end - LZ4_MATCH_LIMIT;
+        const uint8_t *match_end_limit = end - LZ4_LAST_LITERALS;
+        while (ip < match_limit) {
+            uint32_t seq = lz4_read32(ip);
+            uint32_t h = (seq * 2654435761u) >> (32 - LZ4_HASH_BITS);
+            const uint8_t *ref = src + table[h];
+            table[h] = (uint32_t)(ip - src);
+            if (ref >= ip || ip - ref > 65535 || lz4_read32(ref) != seq) {
+                ip++;
+                continue;
+            }
+            const uint8_t *match_end = ip + LZ4_MIN_MATCH;
+            ref += LZ4_MIN_MATCH;
+            while (match_end < match_end_limit && *match_end == *ref) {
+                match_end++;
+                ref++;
+            }
+            ref -= match_end - ip;
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            op = lz4_write_sequence(op, anchor, ip, (uint32_t)(ip - ref), (uint32_t)(match_end - ip));
+            ip = anchor = match_end;
+        }
     }
+    return (uint32_t)(lz4_write_sequence(op, anchor, end, 0, 0) - dst);
+}
 
-    ALWAYS_INLINE void acquire_exclusive() {
-        while (1) {
-            // If multiple threads are trying to acquire exclusive
-            // ownership, we may need to rerequest exclusive waiting
-            // while we spin, as it gets unset whenever a thread
-            // acquires exclusive ownership.
-            __sync_fetch_and_or(&lock, exclusive_waiting_mask);
-            if (__sync_bool_compare_and_swap(&lock, exclusive_waiting_mask, exclusive_held_mask)) {
-                return;
+class TraceWriter {
+    TraceBuffer buffers[2];
+    // The index of the buffer packets are going into.
+    uint32_t active;
+    // The index of the buffer to write out next. Buffers are sealed
+    // alternately, so they are written in the order they were filled.
+    uint32_t next_to_write;
+
+    halide_mutex mutex;
+    // The background thread waits on wake_writer for a buffer to be
+    // sealed. Threads waiting for a buffer to be activated or written
+    // out wait on wake_waiters.
+    halide_cond wake_writer, wake_waiters;
+    halide_thread *thread;
+    bool shutdown;
+
+    int fd;
+    // Where a buffer is compressed to before it is written, and the
+    // compressor's hash table, if compression is enabled. Only used by
+    // whichever thread is writing out a buffer, and buffers are
+    // written one at a time.
+    uint8_t *compressed;
+    uint32_t *hash_table;
+    // Looked up once in init, so that nothing runs between a failed
+    // write and reading its errno. NULL if unknown, in which case
+    // every failed write is taken to be a real error.
+    errno_location_fn errno_location;
+
+    ALWAYS_INLINE void write_or_die(void *user_context, const uint8_t *data, uint32_t size) {
+        while (size) {
+            ssize_t written = write(fd, data, size);
+            if (written < 0 && errno_location && *errno_location() == HALIDE_EINTR) {
+                // Interrupted by a signal before writing anything.
+                continue;
             }
+            halide_assert(user_context, written > 0 && "Could not write to trace file");
+            data += written;
+            size -= (uint32_t)written;
         }
     }
 
-    ALWAYS_INLINE void release_exclusive() {
-        __sync_fetch_and_and(&lock, ~exclusive_held_mask);
+    // Write out a sealed buffer, once every thread writing a packet
+    // into it has finished.
+    void write_buffer(void *user_context, uint32_t idx) {
+        TraceBuffer &b = buffers[idx];
+        while (__atomic_load_n(&b.writers, __ATOMIC_SEQ_CST)) {
+            halide_thread_yield();
+        }
+        if (b.end) {
+            if (compressed) {
+                halide_trace_block_header_t *header = (halide_trace_block_header_t *)compressed;
+                header->magic = HALIDE_TRACE_BLOCK_MAGIC;
+                header->raw_size = b.end;
+                header->compressed_size = lz4_compress(b.buf, b.end, (uint8_t *)(header + 1), hash_table);
+                write_or_die(user_context, compressed, sizeof(*header) + header->compressed_size);
+            } else {
+                write_or_die(user_context, b.buf, b.end);
+            }
+        }
+        halide_mutex_lock(&mutex);
+        b.pending = false;
+        b.generation++;
+        halide_cond_broadcast(&wake_waiters);
+        halide_mutex_unlock(&mutex);
     }
 
-    ALWAYS_INLINE void init() {
-        lock = 0;
+    // Called by the one thread whose reservation ran off the end of
+    // the active buffer, at the given offset.
+    void seal(void *user_context, uint32_t idx, uint32_t end) {
+        TraceBuffer &b = buffers[idx];
+        TraceBuffer &other = buffers[idx ^ 1];
+        b.end = end;
+        halide_mutex_lock(&mutex);
+        b.pending = true;
+        if (thread) {
+            halide_cond_signal(&wake_writer);
+            while (other.pending) {
+                halide_cond_wait(&wake_waiters, &mutex);
+            }
+        } else {
+            halide_mutex_unlock(&mutex);
+            write_buffer(user_context, idx);
+            halide_mutex_lock(&mutex);
+        }
+        __atomic_store_n(&other.cursor, 0, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&active, idx ^ 1, __ATOMIC_RELEASE);
+        halide_cond_broadcast(&wake_waiters);
+        halide_mutex_unlock(&mutex);
     }
 
-    SharedExclusiveSpinLock()
-        : lock(0) {
+public:
+    // Reserve space for a packet. It must be released before it can
+    // be written out.
+    ALWAYS_INLINE halide_trace_packet_t *acquire_packet(void *user_context, uint32_t size) {
+        halide_assert(user_context, size <= buffer_size);
+        while (1) {
+            uint32_t idx = __atomic_load_n(&active, __ATOMIC_ACQUIRE);
+            TraceBuffer &b = buffers[idx];
+            if (__atomic_load_n(&b.cursor, __ATOMIC_RELAXED) <= buffer_size) {
+                __atomic_fetch_add(&b.writers, 1, __ATOMIC_SEQ_CST);
+                uint32_t my_cursor = __atomic_fetch_add(&b.cursor, size, __ATOMIC_SEQ_CST);
+                if (my_cursor + size <= buffer_size) {
+                    return (halide_trace_packet_t *)(b.buf + my_cursor);
+                }
+                __atomic_fetch_sub(&b.writers, 1, __ATOMIC_SEQ_CST);
+                if (my_cursor <= buffer_size) {
+                    seal(user_context, idx, my_cursor);
+                    continue;
+                }
+            }
+            // Someone else is sealing this buffer. Wait for them to
+            // activate the other one.
+            halide_mutex_lock(&mutex);
+            while (__atomic_load_n(&active, __ATOMIC_ACQUIRE) == idx &&
+                   __atomic_load_n(&b.cursor, __ATOMIC_RELAXED) > buffer_size) {
+                halide_cond_wait(&wake_waiters, &mutex);
+            }
+            halide_mutex_unlock(&mutex);
+        }
     }
-};
 
-const static int buffer_size = 1024 * 1024;
+    // Release a packet, allowing it to be written out.
+    ALWAYS_INLINE void release_packet(halide_trace_packet_t *packet) {
+        TraceBuffer &b = buffers[((uint8_t *)packet >= buffers[1].buf) ? 1 : 0];
+        __atomic_fetch_sub(&b.writers, 1, __ATOMIC_SEQ_CST);
+    }
 
-class TraceBuffer {
-    SharedExclusiveSpinLock lock;
-    uint32_t cursor, overage;
-    uint8_t buf[buffer_size];
+    // Write out every packet released before the call, and wait for
+    // them to reach the file.
+    void flush(void *user_context) {
+        halide_mutex_lock(&mutex);
+        uint32_t idx = __atomic_load_n(&active, __ATOMIC_ACQUIRE);
+        TraceBuffer &b = buffers[idx], &other = buffers[idx ^ 1];
+        uint32_t generation = b.generation, other_generation = other.generation;
+        bool other_pending = other.pending;
+        halide_mutex_unlock(&mutex);
+
+        if (__atomic_load_n(&b.cursor, __ATOMIC_RELAXED) == 0) {
+            // Nothing in the active buffer. Just wait for the other to
+            // be written out, if it hasn't been.
+            halide_mutex_lock(&mutex);
+            while (other_pending && other.generation == other_generation) {
+                halide_cond_wait(&wake_waiters, &mutex);
+            }
+            halide_mutex_unlock(&mutex);
+            return;
+        }
 
-    // Attempt to atomically acquire space in the buffer to write a
-    // packet. Returns NULL if the buffer was full.
-    ALWAYS_INLINE halide_trace_packet_t *try_acquire_packet(void *user_context, uint32_t size) {
-        lock.acquire_shared();
-        halide_assert(user_context, size <= buffer_size);
-        uint32_t my_cursor = __sync_fetch_and_add(&cursor, size);
-        if (my_cursor + size > sizeof(buf)) {
-            // Don't try to back it out: instead, just allow this request to fail
-            // (along with all subsequent requests) and record the 'overage'
-            // that was added and should be ignored; then, in the next flush,
-            // remove the overage.
-            __sync_fetch_and_add(&overage, size);
-            lock.release_shared();
-            return NULL;
-        } else {
-            return (halide_trace_packet_t *)(buf + my_cursor);
+        // Seal the active buffer, unless someone beat us to it, and
+        // wait for it to be written out, which also means everything
+        // before it has been.
+        uint32_t my_cursor = __atomic_fetch_add(&b.cursor, buffer_size + 1, __ATOMIC_SEQ_CST);
+        if (my_cursor <= buffer_size) {
+            seal(user_context, idx, my_cursor);
+        }
+        halide_mutex_lock(&mutex);
+        while (b.generation == generation) {
+            halide_cond_wait(&wake_waiters, &mutex);
         }
+        halide_mutex_unlock(&mutex);
     }
 
-public:
-    // Wait for all writers to finish with their packets, stall any
-    // new writers, and flush the buffer to the fd.
-    ALWAYS_INLINE void flush(void *user_context, int fd) {
-        lock.acquire_exclusive();
-        bool success = true;
-        if (cursor) {
-            cursor -= overage;
-            success = (cursor == (uint32_t)write(fd, buf, cursor));
-            cursor = 0;
-            overage = 0;
+    // The body of the background thread.
+    void run() {
+        halide_mutex_lock(&mutex);
+        while (1) {
+            if (buffers[next_to_write].pending) {
+                uint32_t idx = next_to_write;
+                next_to_write ^= 1;
+                halide_mutex_unlock(&mutex);
+                write_buffer(NULL, idx);
+                halide_mutex_lock(&mutex);
+            } else if (shutdown) {
+                break;
+            } else {
+                halide_cond_wait(&wake_writer, &mutex);
+            }
         }
-        lock.release_exclusive();
-        halide_assert(user_context, success && "Could not write to trace file");
+        halide_mutex_unlock(&mutex);
     }
 
-    // Acquire and return a packet's worth of space in the trace
-    // buffer, flushing the trace buffer to the given fd to make space
-    // if necessary. The region acquired is protected from other
-    // threads writing or reading to it, so it must be released before
-    // a flush can occur.
-    ALWAYS_INLINE halide_trace_packet_t *acquire_packet(void *user_context, int fd, uint32_t size) {
-        halide_trace_packet_t *packet = NULL;
-        while (!(packet = try_acquire_packet(user_context, size))) {
-            // Couldn't acquire space to write a packet. Flush and try again.
-            flush(user_context, fd);
+    void init(void *user_context, int fd, void (*thread_fn)(void *)) {
+        memset(this, 0, sizeof(*this));
+        this->fd = fd;
+        buffers[1].cursor = buffer_size + 1;
+        errno_location = find_errno_location();
+
+        const char *compress = getenv("HL_TRACE_COMPRESS");
+        if (compress && atoi(compress)) {
+            compressed = (uint8_t *)malloc(sizeof(halide_trace_block_header_t) + lz4_compress_bound(buffer_size));
+            hash_table = (uint32_t *)malloc(sizeof(uint32_t) << LZ4_HASH_BITS);
+            halide_assert(user_context, compressed && hash_table);
         }
-        return packet;
-    }
 
-    // Release a packet, allowing it to be written out with flush
-    ALWAYS_INLINE void release_packet(halide_trace_packet_t *) {
-        // Need a memory barrier to guarantee all the writes are done.
-        __sync_synchronize();
-        lock.release_shared();
+        const char *async = getenv("HL_TRACE_ASYNC");
+        if (halide_can_spawn_threads() && !(async && atoi(async) == 0)) {
+            thread = halide_spawn_thread(thread_fn, this);
+        }
     }
 
-    ALWAYS_INLINE void init() {
-        cursor = 0;
-        overage = 0;
-        lock.init();
+    // Flush, and stop the background thread.
+    void destroy(void *user_context) {
+        flush(user_context);
+        if (thread) {
+            halide_mutex_lock(&mutex);
+            shutdown = true;
+            halide_cond_signal(&wake_writer);
+            halide_mutex_unlock(&mutex);
+            halide_join_thread(thread);
+        }
+        free(compressed);
+        free(hash_table);
     }
 
-    TraceBuffer()
-        : cursor(0), overage(0) {
+    // Point the writer at another file, once everything for the old
+    // one is written.
+    void set_fd(void *user_context, int new_fd) {
+        flush(user_context);
+        fd = new_fd;
     }
 };
 
-WEAK TraceBuffer *halide_trace_buffer = NULL;
+WEAK void trace_writer_thread(void *arg) {
+    ((TraceWriter *)arg)->run();
+}
+
+WEAK TraceWriter *halide_trace_writer = NULL;
 WEAK int halide_trace_file = -1;  // -1 indicates uninitialized
 WEAK ScopedSpinLock::AtomicFlag halide_trace_file_lock = 0;
 WEAK bool halide_trace_file_initialized = false;
 WEAK void *halide_trace_file_internally_opened = NULL;
 
+// The writer for the given trace file, created on first use. Must be
+// called with halide_trace_file_lock held.
+WEAK TraceWriter *get_trace_writer(void *user_context, int fd) {
+    if (!halide_trace_writer) {
+        TraceWriter *w = (TraceWriter *)malloc(sizeof(TraceWriter));
+        halide_assert(user_context, w && "Could not allocate trace buffers");
+        w->init(user_context, fd, trace_writer_thread);
+        __atomic_store_n(&halide_trace_writer, w, __ATOMIC_RELEASE);
+    }
+    return halide_trace_writer;
+}
+
 }  // namespace Internal
 }  // namespace Runtime
 }  // namespace Halide
@@ -178,8 +414,14 @@ WEAK int32_t halide_default_trace(void *user_context, const halide_trace_event_t
         uint32_t total_size_without_padding = header_bytes + value_bytes + coords_bytes + name_bytes + trace_tag_bytes;
         uint32_t total_size = (total_size_without_padding + 3) & ~3;
 
+        TraceWriter *writer = __atomic_load_n(&halide_trace_writer, __ATOMIC_ACQUIRE);
+        if (!writer) {
+            ScopedSpinLock lock(&halide_trace_file_lock);
+            writer = get_trace_writer(user_context, fd);
+        }
+
         // Claim some space to write to in the trace buffer
-        halide_trace_packet_t *packet = halide_trace_buffer->acquire_packet(user_context, fd, total_size);
+        halide_trace_packet_t *packet = writer->acquire_packet(user_context, total_size);
 
         if (total_size > 4096) {
             print(NULL) << total_size << "\n";
@@ -203,12 +445,12 @@ WEAK int32_t halide_default_trace(void *user_context, const halide_trace_event_t
         memcpy((void *)packet->trace_tag(), e->trace_tag ? e->trace_tag : "", trace_tag_bytes);
 
         // Release it
-        halide_trace_buffer->release_packet(packet);
+        writer->release_packet(packet);
 
         // We should also flush the trace buffer if we hit an event
         // that might be the end of the trace.
         if (e->event == halide_trace_end_pipeline) {
-            halide_trace_buffer->flush(user_context, fd);
+            writer->flush(user_context);
         }
 
     } else {
@@ -343,26 +585,28 @@ WEAK trace_fn halide_set_custom_trace(trace_fn t) {
 }
 
 WEAK void halide_set_trace_file(int fd) {
-    halide_trace_file = fd;
+    ScopedSpinLock lock(&halide_trace_file_lock);
+    if (halide_trace_writer) {
+        halide_trace_writer->set_fd(NULL, fd);
+    }
+    __atomic_store_n(&halide_trace_file, fd, __ATOMIC_RELEASE);
 }
 
-extern int errno;
-
 WEAK int halide_get_trace_file(void *user_context) {
+    int fd = __atomic_load_n(&halide_trace_file, __ATOMIC_ACQUIRE);
+    if (fd >= 0) {
+        return fd;
+    }
     ScopedSpinLock lock(&halide_trace_file_lock);
     if (halide_trace_file < 0) {
         const char *trace_file_name = getenv("HL_TRACE_FILE");
         if (trace_file_name) {
             void *file = fopen(trace_file_name, "ab");
             halide_assert(user_context, file && "Failed to open trace file\n");
-            halide_set_trace_file(fileno(file));
             halide_trace_file_internally_opened = file;
-            if (!halide_trace_buffer) {
-                halide_trace_buffer = (TraceBuffer *)malloc(sizeof(TraceBuffer));
-                halide_trace_buffer->init();
-            }
+            __atomic_store_n(&halide_trace_file, fileno(file), __ATOMIC_RELEASE);
         } else {
-            halide_set_trace_file(0);
+            __atomic_store_n(&halide_trace_file, 0, __ATOMIC_RELEASE);
         }
     }
     return halide_trace_file;
@@ -373,14 +617,17 @@ WEAK int32_t halide_trace(void *user_context, const halide_trace_event_t *e) {
 }
 
 WEAK int halide_shutdown_trace() {
+    ScopedSpinLock lock(&halide_trace_file_lock);
+    if (halide_trace_writer) {
+        halide_trace_writer->destroy(NULL);
+        free(halide_trace_writer);
+        halide_trace_writer = NULL;
+    }
     if (halide_trace_file_internally_opened) {
         int ret = fclose(halide_trace_file_internally_opened);
         halide_trace_file = 0;
         halide_trace_file_initialized = false;
         halide_trace_file_internally_opened = NULL;
-        if (halide_trace_buffer) {
-            free(halide_trace_buffer);
-        }
         return ret;
     } else {
         return 0;
@@ -37,4 +37,9 @@ WEAK int64_t halide_current_time_ns(void *user_context) {
 WEAK void halide_sleep_ms(void *user_context, int ms) {
     Sleep(ms);
 }
+
+// Sleep only has millisecond resolution, so this rounds up.
+WEAK void halide_sleep_us(void *user_context, int us) {
+    Sleep((us + 999) / 1000);
+}
 }
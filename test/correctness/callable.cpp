@@ -0,0 +1,107 @@
+#include "Halide.h"
+#include <stdio.h>
+
+using namespace Halide;
+
+int main(int argc, char **argv) {
+    ImageParam input(Float(32), 2, "input");
+    Param<float> scale("scale");
+    Param<int> offset("offset");
+    Param<float> bias("bias");
+    ImageParam weights(Float(32), 1, "weights");
+    Var x("x"), y("y");
+
+    Func f("f"), g("g");
+    f(x, y) = input(x, y) * scale + offset + bias + weights(x);
+    g(x, y) = cast<int>(f(x, y));
+
+    // bias and weights are not passed to the Callable, so it uses
+    // whatever they are bound to at the time of each call.
+    Pipeline p({f, g});
+    Callable c = p.compile_to_callable({input, scale, offset});
+
+    if (c.arguments().size() != 3 || c.num_outputs() != 2) {
+        printf("Callable has %d arguments and %d outputs\n",
+               (int)c.arguments().size(), c.num_outputs());
+        return -1;
+    }
+
+    Buffer<float> in(10, 10), w(10);
+    in.for_each_element([&](int x, int y) { in(x, y) = x + y * 10; });
+    w.fill(0.0f);
+    bias.set(0.0f);
+    weights.set(w);
+
+    Buffer<float> f_out(10, 10);
+    Buffer<int> g_out(10, 10);
+
+    auto check = [&](float s, int o, float b, float wt) {
+        for (int y = 0; y < 10; y++) {
+            for (int x = 0; x < 10; x++) {
+                float correct = in(x, y) * s + o + b + wt;
+                if (f_out(x, y) != correct || g_out(x, y) != (int)correct) {
+                    printf("f(%d, %d) = %f and g(%d, %d) = %d instead of %f\n",
+                           x, y, f_out(x, y), x, y, g_out(x, y), correct);
+                    return false;
+                }
+            }
+        }
+        return true;
+    };
+
+    // Typed arguments
+    for (int i = 0; i < 3; i++) {
+        int result = c(in, 2.0f + i, i, f_out, g_out);
+        if (result != 0 || !check(2.0f + i, i, 0.0f, 0.0f)) {
+            return -1;
+        }
+    }
+
+    // Changing the unlisted params is seen by the next call
+    bias.set(0.5f);
+    Buffer<float> w2(10);
+    w2.fill(3.0f);
+    weights.set(w2);
+    if (c(in, 1.0f, 0, f_out, g_out) != 0 || !check(1.0f, 0, 0.5f, 3.0f)) {
+        return -1;
+    }
+
+    // Raw halide_buffer_t pointers
+    if (c(in.raw_buffer(), 1.0f, 1, f_out.raw_buffer(), g_out.raw_buffer()) != 0 ||
+        !check(1.0f, 1, 0.5f, 3.0f)) {
+        return -1;
+    }
+
+    // The argv form
+    float scale_value = 4.0f;
+    int offset_value = 7;
+    const void *args[] = {in.raw_buffer(), &scale_value, &offset_value,
+                          f_out.raw_buffer(), g_out.raw_buffer()};
+    if (c.call_argv(args) != 0 || !check(4.0f, 7, 0.5f, 3.0f)) {
+        return -1;
+    }
+
+    // The Callable keeps the compiled code alive after the Func it
+    // came from is gone.
+    {
+        Var x;
+        Func h;
+        Param<int> n;
+        h(x) = x + n;
+        Callable hc = h.compile_to_callable({n});
+        h = Func();
+        Buffer<int> out(8);
+        if (hc(3, out) != 0) {
+            return -1;
+        }
+        for (int i = 0; i < 8; i++) {
+            if (out(i) != i + 3) {
+                printf("out(%d) = %d instead of %d\n", i, out(i), i + 3);
+                return -1;
+            }
+        }
+    }
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,88 @@
+#include "Halide.h"
+#include <chrono>
+#include <stdio.h>
+
+using namespace Halide;
+
+const int num_pipelines = 8;
+
+int main(int argc, char **argv) {
+    Target t = get_jit_target_from_environment();
+    if (t.arch == Target::WebAssembly) {
+        printf("[SKIP] WebAssembly JIT does not support compile_jit_async().\n");
+        return 0;
+    }
+
+    // Compile a batch of pipelines concurrently.
+    std::vector<Func> funcs;
+    std::vector<std::shared_future<void>> futures;
+    for (int i = 0; i < num_pipelines; i++) {
+        Var x, y, u;
+        Func f;
+        if (i % 2 == 0) {
+            f(x, y) = x * y + i;
+            f.vectorize(x, 8).parallel(y);
+        } else {
+            RDom r(0, 100);
+            f(x, y) = 0;
+            f(x, y) += (r + x) * (y + i);
+            f.update().rfactor(r, u);
+        }
+        futures.push_back(f.compile_jit_async());
+        funcs.push_back(f);
+    }
+
+    // Wait on half of the futures explicitly, and let realize wait on
+    // the other half.
+    for (int i = 0; i < num_pipelines; i += 2) {
+        futures[i].get();
+    }
+
+    for (int i = 0; i < num_pipelines; i++) {
+        Buffer<int> result = funcs[i].realize({16, 16});
+        if (futures[i].wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            printf("Pipeline %d was realized before its compilation finished\n", i);
+            return -1;
+        }
+        for (int y = 0; y < 16; y++) {
+            for (int x = 0; x < 16; x++) {
+                int correct = (i % 2 == 0) ? x * y + i : (99 * 100 / 2 + 100 * x) * (y + i);
+                if (result(x, y) != correct) {
+                    printf("pipeline %d: result(%d, %d) = %d instead of %d\n",
+                           i, x, y, result(x, y), correct);
+                    return -1;
+                }
+            }
+        }
+    }
+
+    // Asking again for the same target reuses the compiled code.
+    Func g;
+    Var x;
+    g(x) = x * 2;
+    g.compile_jit_async().get();
+    g.compile_jit_async().get();
+    Buffer<int> result = g.realize(10);
+    for (int i = 0; i < 10; i++) {
+        if (result(i) != i * 2) {
+            printf("result(%d) = %d instead of %d\n", i, result(i), i * 2);
+            return -1;
+        }
+    }
+
+    // Dropping a pipeline while it is being compiled leaves the
+    // compiling thread with the last reference to it.
+    std::vector<std::shared_future<void>> dropped;
+    for (int i = 0; i < num_pipelines; i++) {
+        Func h;
+        h(x) = x * i;
+        h.vectorize(x, 8);
+        dropped.push_back(h.compile_jit_async());
+    }
+    for (auto &f : dropped) {
+        f.get();
+    }
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,111 @@
+#include "Halide.h"
+#include <cstdio>
+#include <cstdlib>
+
+using namespace Halide;
+
+// Check that compiling several modules at once gives the same output
+// as compiling them one at a time. Lowering assigns names from
+// process-wide counters, so two compilations in one process would
+// differ anyway; the test reruns itself in a child process for each
+// compilation. File names end up inside the outputs (e.g. as archive
+// member names), so both children use the same names, each in its own
+// temporary directory.
+
+std::string library_name(const std::string &dir) {
+#ifdef _MSC_VER
+    return dir + "/compile_threads_multitarget.lib";
+#else
+    return dir + "/compile_threads_multitarget.a";
+#endif
+}
+
+std::string header_name(const std::string &dir) {
+    return dir + "/compile_threads_multitarget.h";
+}
+
+std::string object_name(const std::string &dir) {
+    return dir + "/compile_threads_submodules.o";
+}
+
+int run_child(const std::string &dir) {
+    Param<float> factor("factor");
+    ImageParam input(Float(32), 2, "input");
+    Func f("f"), g("g"), h("h");
+    Var x("x"), y("y");
+    f(x, y) = input(x, y) * factor + input(x + 1, y);
+    g(x, y) = f(x, y - 1) + f(x, y + 1);
+    h(x, y) = sqrt(g(x, y)) * factor;
+    f.compute_root().vectorize(x, 8);
+    g.compute_at(h, y).vectorize(x, 8);
+    h.parallel(y).vectorize(x, 8);
+
+    std::vector<Target> targets = {
+        Target("host-no_bounds_query"),
+        Target("host"),
+    };
+    h.compile_to_multitarget_static_library(dir + "/compile_threads_multitarget", {input, factor}, targets);
+
+    // Submodules are compiled at once too.
+    Target host = get_host_target();
+    Module m = h.compile_to_module({input, factor}, "whole", host);
+    m.append(g.compile_to_module({input, factor}, "inner", host));
+    m.append(f.compile_to_module({input, factor}, "innermost", host));
+    m.compile({{Output::object, object_name(dir)}});
+    return 0;
+}
+
+bool run_compile(const std::string &program, const std::string &dir, const char *threads) {
+    if (threads) {
+        setenv("HL_COMPILE_THREADS", threads, 1);
+    } else {
+        unsetenv("HL_COMPILE_THREADS");
+    }
+    std::string command = "\"" + program + "\" -child \"" + dir + "\"";
+    return system(command.c_str()) == 0;
+}
+
+void remove_outputs(const std::string &dir) {
+    Internal::ensure_no_file_exists(library_name(dir));
+    Internal::ensure_no_file_exists(header_name(dir));
+    Internal::ensure_no_file_exists(object_name(dir));
+    Internal::dir_rmdir(dir);
+}
+
+bool same_file(const std::string &a, const std::string &b) {
+    if (Internal::read_entire_file(a) != Internal::read_entire_file(b)) {
+        printf("%s and %s differ\n", a.c_str(), b.c_str());
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+#ifdef _WIN32
+    printf("[SKIP] Windows does not have a working setenv\n");
+#else
+    if (argc == 3 && std::string(argv[1]) == "-child") {
+        return run_child(argv[2]);
+    }
+
+    std::string serial = Internal::dir_make_temp();
+    std::string parallel = Internal::dir_make_temp();
+    bool ok = (run_compile(argv[0], serial, "1") &&
+               run_compile(argv[0], parallel, nullptr));
+    if (!ok) {
+        printf("A child process failed\n");
+    } else {
+        ok = (same_file(library_name(serial), library_name(parallel)) &&
+              same_file(header_name(serial), header_name(parallel)) &&
+              same_file(object_name(serial), object_name(parallel)));
+    }
+    remove_outputs(serial);
+    remove_outputs(parallel);
+    if (!ok) {
+        return -1;
+    }
+
+    printf("Success!\n");
+#endif
+    return 0;
+}
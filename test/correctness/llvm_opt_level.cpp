@@ -0,0 +1,131 @@
+#include "Halide.h"
+#include "halide_test_dirs.h"
+
+#include <cstdlib>
+#include <stdio.h>
+
+using namespace Halide;
+
+Func make_pipeline() {
+    Var x, y;
+    Func in, f1, f2;
+    in(x, y) = x * 3 + y;
+    f1(x, y) = in(x - 1, y) + 2 * in(x, y) + in(x + 1, y);
+    RDom r(0, 10);
+    f2(x, y) = 0;
+    f2(x, y) += f1(x, y + r) / (r + 1);
+
+    f1.compute_root().vectorize(x, 8);
+    f2.update().vectorize(x, 8);
+
+    // A scalar loop with a constant trip count, for LLVM's loop
+    // passes to work on.
+    Func table, out;
+    table(x) = sqrt(cast<float>(x * x + 1));
+    table.compute_root().bound(x, 0, 64);
+    out(x, y) = f2(x, y) + cast<int>(table(x & 63));
+    return out;
+}
+
+// Compile the pipeline to assembly in a fresh process. Lowering
+// names things from process-wide counters, so only compilations in
+// separate runs of the same program can be compared.
+int run_child(const char *target, const char *output) {
+    Func out = make_pipeline();
+    // Linkage without metadata keeps the target string out of the
+    // assembly.
+    Module m = Pipeline(out).compile_to_module({}, "llvm_opt_level", Target(target), LinkageType::External);
+    m.compile({{Output::assembly, output}});
+    return 0;
+}
+
+// The assembly for the pipeline with the given target features and
+// custom LLVM pass pipeline, if any.
+std::vector<char> compile_to_assembly(const std::string &program, const Target &target,
+                                      const char *passes) {
+    std::string output = Internal::get_test_tmp_dir() + "llvm_opt_level.s";
+    Internal::ensure_no_file_exists(output);
+    if (passes) {
+        setenv("HL_LLVM_PASSES", passes, 1);
+    } else {
+        unsetenv("HL_LLVM_PASSES");
+    }
+    std::string command = "\"" + program + "\" -child " + target.to_string() + " \"" + output + "\"";
+    if (system(command.c_str()) != 0) {
+        printf("Compiling for %s failed\n", target.to_string().c_str());
+        exit(-1);
+    }
+    return Internal::read_entire_file(output);
+}
+
+int main(int argc, char **argv) {
+#ifdef _WIN32
+    printf("[SKIP] Windows does not have a working setenv\n");
+#else
+    if (argc == 4 && std::string(argv[1]) == "-child") {
+        return run_child(argv[2], argv[3]);
+    }
+
+    Target t = get_jit_target_from_environment();
+
+    // Every optimization level should compute the same thing.
+    Buffer<int> reference;
+    for (Target target : {t, t.with_feature(Target::LLVMO1), t.with_feature(Target::LLVMO2),
+                          t.with_feature(Target::FastCompile)}) {
+        Buffer<int> result = make_pipeline().realize({64, 32}, target);
+        if (!reference.defined()) {
+            reference = result;
+            continue;
+        }
+        for (int y = 0; y < 32; y++) {
+            for (int x = 0; x < 64; x++) {
+                if (result(x, y) != reference(x, y)) {
+                    printf("With target %s, result(%d, %d) = %d instead of %d\n",
+                           target.to_string().c_str(), x, y, result(x, y), reference(x, y));
+                    return -1;
+                }
+            }
+        }
+    }
+
+    if (t.arch == Target::WebAssembly) {
+        printf("[SKIP] Not comparing assembly for WebAssembly.\n");
+        return 0;
+    }
+
+    // Only O3 fully unrolls loops with these thresholds, so the code
+    // for the scalar loop differs between O3 and the other levels.
+    setenv("HL_LLVM_ARGS", "-unroll-threshold-aggressive=100000 -unroll-threshold-default=0", 1);
+
+    // Each level should make the same code as asking LLVM for that
+    // level's pipeline directly, and not the same as O3.
+    Target host = get_host_target();
+    std::vector<char> o3 = compile_to_assembly(argv[0], host, nullptr);
+    std::vector<char> o2 = compile_to_assembly(argv[0], host.with_feature(Target::LLVMO2), nullptr);
+    std::vector<char> o1 = compile_to_assembly(argv[0], host.with_feature(Target::LLVMO1), nullptr);
+    std::vector<char> fast = compile_to_assembly(argv[0], host.with_feature(Target::FastCompile), nullptr);
+    if (o3.empty() || o3 != compile_to_assembly(argv[0], host, "default<O3>")) {
+        printf("The default target doesn't optimize with LLVM's O3 pipeline\n");
+        return -1;
+    }
+    if (o2 != compile_to_assembly(argv[0], host, "default<O2>") || o2 == o3) {
+        printf("llvm_o2 doesn't optimize with LLVM's O2 pipeline\n");
+        return -1;
+    }
+    if (o1 != compile_to_assembly(argv[0], host, "default<O1>") || o1 == o3) {
+        printf("llvm_o1 doesn't optimize with LLVM's O1 pipeline\n");
+        return -1;
+    }
+    // fast_compile also turns off loop and SLP vectorization, and
+    // lowers the backend's optimization level.
+    if (fast == o1) {
+        printf("fast_compile makes the same code as llvm_o1\n");
+        return -1;
+    }
+    unsetenv("HL_LLVM_ARGS");
+    unsetenv("HL_LLVM_PASSES");
+
+    printf("Success!\n");
+#endif
+    return 0;
+}
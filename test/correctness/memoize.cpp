@@ -1,8 +1,11 @@
 #include "Halide.h"
 #include "HalideRuntime.h"
 #include <assert.h>
+#include <chrono>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <thread>
 
 using namespace Halide;
 
@@ -60,6 +63,17 @@ extern "C" DLLEXPORT int count_calls_staged(int32_t stage, uint8_t val, halide_b
     return 0;
 }
 
+int call_count_slowly = 0;
+
+extern "C" DLLEXPORT int count_calls_slowly(halide_buffer_t *out) {
+    if (!out->is_bounds_query()) {
+        call_count_slowly++;
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        Halide::Runtime::Buffer<uint8_t>(*out).fill(17);
+    }
+    return 0;
+}
+
 void simple_free(void *user_context, void *ptr) {
     free(ptr);
 }
@@ -610,6 +624,81 @@ int main(int argc, char **argv) {
         printf("In 100 attempts with flakey malloc, %d errors and %d full completions occured.\n", total_errors, completed);
     }
 
+    {
+        // Check the cache statistics record the hit and the miss against the Func.
+        Internal::JITSharedRuntime::memoization_cache_set_size(0);
+        call_count = 0;
+        Func count_calls;
+        count_calls.define_extern("count_calls", {}, UInt(8), 2);
+
+        Func f, stats_memoized("stats_memoized");
+        Var x, y;
+        stats_memoized(x, y) = count_calls(x, y);
+        stats_memoized.compute_root().memoize();
+        f(x, y) = stats_memoized(x, y);
+
+        f.realize(32, 32);
+        halide_memoization_cache_stats_t before;
+        Internal::JITSharedRuntime::memoization_cache_get_stats(&before);
+        f.realize(32, 32);
+        assert(call_count == 1);
+
+        halide_memoization_cache_stats_t stats;
+        halide_memoization_cache_func_stats_t funcs[16];
+        int num_funcs = Internal::JITSharedRuntime::memoization_cache_get_stats(&stats, funcs, 16);
+        assert(stats.hits == before.hits + 1);
+        assert(stats.misses >= 1);
+        assert(stats.bytes >= 32 * 32);
+
+        bool found = false;
+        for (int i = 0; i < num_funcs && i < 16; i++) {
+            if (funcs[i].func_name && strstr(funcs[i].func_name, "stats_memoized")) {
+                assert(funcs[i].hits == 1);
+                assert(funcs[i].misses == 1);
+                assert(funcs[i].bytes >= 32 * 32);
+                found = true;
+            }
+        }
+        assert(found);
+    }
+
+    {
+        // Under the cost-per-byte policy, a large result that was
+        // quick to compute is evicted before a small one that was
+        // slow, even though the small one is less recently used.
+        Internal::JITSharedRuntime::memoization_cache_set_size(1);
+        Internal::JITSharedRuntime::memoization_cache_set_size(1000000);
+        Internal::JITSharedRuntime::memoization_cache_set_eviction_policy(halide_memoization_cache_evict_cost_per_byte);
+        call_count = 0;
+        call_count_slowly = 0;
+
+        Func slow_small("slow_small"), cheap_large("cheap_large");
+        slow_small.define_extern("count_calls_slowly", {}, UInt(8), 2);
+        slow_small.compute_root().memoize();
+        cheap_large.define_extern("count_calls", {}, UInt(8), 2);
+        cheap_large.compute_root().memoize();
+
+        Func f, g;
+        Var x, y;
+        f(x, y) = slow_small(x, y);
+        g(x, y) = cheap_large(x, y);
+
+        f.realize(16, 16);
+        g.realize(256, 256);
+        assert(call_count_slowly == 1 && call_count == 1);
+
+        // Room for either result, but not both.
+        Internal::JITSharedRuntime::memoization_cache_set_size(256 * 256 + 16 * 16 - 1);
+
+        f.realize(16, 16);
+        assert(call_count_slowly == 1);
+        g.realize(256, 256);
+        assert(call_count == 2);
+
+        Internal::JITSharedRuntime::memoization_cache_set_eviction_policy(halide_memoization_cache_evict_lru);
+        Internal::JITSharedRuntime::memoization_cache_set_size(0);
+    }
+
     printf("Success!\n");
     return 0;
 }
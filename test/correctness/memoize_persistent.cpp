@@ -0,0 +1,160 @@
+#include "Halide.h"
+#include "HalideRuntime.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+using namespace Halide;
+
+#ifdef _WIN32
+#define DLLEXPORT __declspec(dllexport)
+#else
+#define DLLEXPORT
+#include <unistd.h>
+#endif
+
+int call_count = 0;
+
+extern "C" DLLEXPORT int count_calls_persistent(halide_buffer_t *out) {
+    if (!out->is_bounds_query()) {
+        call_count++;
+        Halide::Runtime::Buffer<int32_t> buf(*out);
+        buf.for_each_element([&](int x, int y) { buf(x, y) = x * 100 + y; });
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+#ifdef _WIN32
+    printf("[SKIP] The persistent memoization cache needs mmap.\n");
+    return 0;
+#else
+    Target t = get_jit_target_from_environment();
+    if (t.os != Target::Linux && t.os != Target::OSX) {
+        printf("[SKIP] The persistent memoization cache is only supported on Linux and OS X.\n");
+        return 0;
+    }
+
+    // The file is picked up from the environment on the first lookup.
+    std::string path = "/tmp/halide_memoize_persistent_" + std::to_string(getpid()) + ".bin";
+    remove(path.c_str());
+    setenv("HL_MEMOIZATION_CACHE_FILE", path.c_str(), 1);
+
+    Func count_calls;
+    count_calls.define_extern("count_calls_persistent", {}, Int(32), 2);
+
+    Func lut("lut"), f("f");
+    Var x, y;
+    lut(x, y) = count_calls(x, y);
+    lut.compute_root().memoize();
+    f(x, y) = lut(x, y) + 1;
+    Pipeline p(f);
+
+    Buffer<int32_t> out1 = p.realize(64, 64);
+    if (call_count != 1) {
+        printf("Expected one call, got %d\n", call_count);
+        return -1;
+    }
+
+    // Empty the in-memory tier, so the next lookup has to go to the file.
+    Internal::JITSharedRuntime::memoization_cache_set_size(1);
+    Internal::JITSharedRuntime::memoization_cache_set_size(0);
+
+    Buffer<int32_t> out2 = p.realize(64, 64);
+    if (call_count != 1) {
+        printf("Result was recomputed instead of read from %s\n", path.c_str());
+        return -1;
+    }
+
+    halide_memoization_cache_stats_t stats;
+    Internal::JITSharedRuntime::memoization_cache_get_stats(&stats);
+    if (stats.persistent_hits != 1) {
+        printf("Expected one hit in the file, got %d\n", (int)stats.persistent_hits);
+        return -1;
+    }
+
+    // A fresh runtime, as in another process, opens the file again
+    // and finds the result there.
+    p.invalidate_cache();
+    Internal::JITSharedRuntime::release_all();
+    Buffer<int32_t> out3 = p.realize(64, 64);
+    if (call_count != 1) {
+        printf("Result was recomputed instead of read from %s after reopening it\n", path.c_str());
+        return -1;
+    }
+    Internal::JITSharedRuntime::memoization_cache_get_stats(&stats);
+    if (stats.persistent_hits != 1) {
+        printf("Expected one hit in the reopened file, got %d\n", (int)stats.persistent_hits);
+        return -1;
+    }
+
+    // A file written by another version of the runtime is replaced
+    // with an empty one.
+    p.invalidate_cache();
+    Internal::JITSharedRuntime::release_all();
+    {
+        FILE *file = fopen(path.c_str(), "r+b");
+        if (!file) {
+            printf("Could not open %s\n", path.c_str());
+            return -1;
+        }
+        // The version follows the 8 byte magic number.
+        uint32_t version = 0xffffffff;
+        fseek(file, 8, SEEK_SET);
+        fwrite(&version, sizeof(version), 1, file);
+        fclose(file);
+    }
+    Buffer<int32_t> out4 = p.realize(64, 64);
+    if (call_count != 2) {
+        printf("Result was read from an out of date file\n");
+        return -1;
+    }
+    Internal::JITSharedRuntime::memoization_cache_set_size(1);
+    Internal::JITSharedRuntime::memoization_cache_set_size(0);
+    Buffer<int32_t> out5 = p.realize(64, 64);
+    if (call_count != 2) {
+        printf("Result was recomputed instead of read from the replaced file\n");
+        return -1;
+    }
+
+    for (int y = 0; y < 64; y++) {
+        for (int x = 0; x < 64; x++) {
+            int correct = x * 100 + y + 1;
+            for (Buffer<int32_t> *out : {&out1, &out2, &out3, &out4, &out5}) {
+                if ((*out)(x, y) != correct) {
+                    printf("out(%d, %d) = %d instead of %d\n", x, y, (*out)(x, y), correct);
+                    return -1;
+                }
+            }
+        }
+    }
+
+    // A new definition of the memoized Func, with the same names,
+    // doesn't find the results of the old one.
+    Func lut2("lut"), f2("f");
+    lut2(x, y) = count_calls(x, y) * 2;
+    lut2.compute_root().memoize();
+    f2(x, y) = lut2(x, y) + 1;
+    Internal::JITSharedRuntime::memoization_cache_set_size(1);
+    Internal::JITSharedRuntime::memoization_cache_set_size(0);
+    Buffer<int32_t> out6 = f2.realize(64, 64);
+    if (call_count != 3) {
+        printf("Result of the old definition was read from the file\n");
+        return -1;
+    }
+    for (int y = 0; y < 64; y++) {
+        for (int x = 0; x < 64; x++) {
+            int correct = (x * 100 + y) * 2 + 1;
+            if (out6(x, y) != correct) {
+                printf("out6(%d, %d) = %d instead of %d\n", x, y, out6(x, y), correct);
+                return -1;
+            }
+        }
+    }
+
+    remove(path.c_str());
+
+    printf("Success!\n");
+    return 0;
+#endif
+}
@@ -0,0 +1,71 @@
+#include "Halide.h"
+#include "halide_test_dirs.h"
+
+#include <cstdio>
+#include <fstream>
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+using namespace Halide;
+
+#ifdef __linux__
+// Write a fake sysfs tree describing the given number of NUMA nodes,
+// each of which claims CPU 0, and return its root.
+std::string make_fake_sysfs(int nodes) {
+    std::string root = Internal::get_test_tmp_dir() + "numa_thread_pool_sysfs_" + std::to_string(nodes);
+    std::string dir = root;
+    for (const char *d : {"/devices", "/system", "/node"}) {
+        dir += d;
+        mkdir(dir.c_str(), 0755);
+    }
+    for (int i = 0; i < nodes; i++) {
+        std::string node_dir = dir + "/node" + std::to_string(i * 2);
+        mkdir(node_dir.c_str(), 0755);
+        std::ofstream cpulist(node_dir + "/cpulist");
+        cpulist << "0\n";
+    }
+    return root;
+}
+#endif
+
+int main(int argc, char **argv) {
+#ifndef __linux__
+    printf("[SKIP] NUMA awareness is only implemented on Linux\n");
+#else
+    Func f, g;
+    Var x, y;
+    f(x, y) = x * 3 + y;
+    g(x, y) = f(x, y) + f(x + 1, y);
+    // f is big enough to be served from fresh pages.
+    f.compute_root().parallel(y);
+    g.parallel(y, 7);
+    Pipeline p(g);
+
+    for (int nodes = 1; nodes <= 3; nodes++) {
+        for (int threads : {1, 3, 8}) {
+            setenv("HL_SYSFS_ROOT", make_fake_sysfs(nodes).c_str(), 1);
+            setenv("HL_NUMA", "1", 1);
+            setenv("HL_NUM_THREADS", std::to_string(threads).c_str(), 1);
+            p.invalidate_cache();
+            Internal::JITSharedRuntime::release_all();
+            p.compile_jit();
+
+            Buffer<int> out = p.realize(1024, 1037);
+            for (int y = 0; y < out.height(); y++) {
+                for (int x = 0; x < out.width(); x++) {
+                    int correct = x * 6 + 3 + 2 * y;
+                    if (out(x, y) != correct) {
+                        printf("out(%d, %d) = %d instead of %d with %d nodes and %d threads\n",
+                               x, y, out(x, y), correct, nodes, threads);
+                        return -1;
+                    }
+                }
+            }
+        }
+    }
+
+    printf("Success!\n");
+#endif
+    return 0;
+}
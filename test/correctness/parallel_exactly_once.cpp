@@ -0,0 +1,128 @@
+#include "Halide.h"
+
+#include "halide_test_dirs.h"
+
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+using namespace Halide;
+
+#ifdef _WIN32
+#define DLLEXPORT __declspec(dllexport)
+#else
+#define DLLEXPORT
+#endif
+
+const int max_extent = 100003;
+std::atomic<int> counts[max_extent];
+
+extern "C" DLLEXPORT int count_iteration(int x) {
+    counts[x]++;
+    return x;
+}
+HalideExtern_1(int, count_iteration, int);
+
+// Check that every iteration of a parallel loop runs exactly once, for
+// loops both much bigger and smaller than the thread pool, so that
+// work gets stolen and some workers find nothing to do.
+bool check_exactly_once(Pipeline p, const char *mode, int threads) {
+    for (int extent : {1, 2, 3, 5, 7, 64, 1000, max_extent}) {
+        for (int i = 0; i < max_extent; i++) {
+            counts[i] = 0;
+        }
+        for (int rep = 0; rep < 3; rep++) {
+            Buffer<int> out = p.realize(extent);
+            for (int i = 0; i < extent; i++) {
+                if (out(i) != i) {
+                    printf("%s, %d threads: out(%d) = %d\n", mode, threads, i, out(i));
+                    return false;
+                }
+            }
+        }
+        for (int i = 0; i < extent; i++) {
+            if (counts[i] != 3) {
+                printf("%s, %d threads, extent %d: iteration %d ran %d times in 3 realizations\n",
+                       mode, threads, extent, i, counts[i].load());
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+#ifdef __linux__
+// Write a fake sysfs tree describing the given number of NUMA nodes,
+// each of which claims CPU 0, and return its root. See
+// numa_thread_pool.cpp.
+std::string make_fake_sysfs(int nodes) {
+    std::string root = Internal::get_test_tmp_dir() + "parallel_exactly_once_sysfs_" + std::to_string(nodes);
+    std::string dir = root;
+    for (const char *d : {"/devices", "/system", "/node"}) {
+        dir += d;
+        mkdir(dir.c_str(), 0755);
+    }
+    for (int i = 0; i < nodes; i++) {
+        std::string node_dir = dir + "/node" + std::to_string(i);
+        mkdir(node_dir.c_str(), 0755);
+        std::ofstream cpulist(node_dir + "/cpulist");
+        cpulist << "0\n";
+    }
+    return root;
+}
+#endif
+
+int main(int argc, char **argv) {
+#ifdef _WIN32
+    printf("[SKIP] Windows does not have a working setenv\n");
+#else
+    Target t = get_jit_target_from_environment();
+    if (t.arch == Target::WebAssembly) {
+        printf("[SKIP] WebAssembly does not support threads.\n");
+        return 0;
+    }
+
+    Func f;
+    Var x;
+    f(x) = count_iteration(x);
+    f.parallel(x);
+    Pipeline p(f);
+
+    setenv("HL_WORK_STEALING", "1", 1);
+    for (int threads : {1, 2, 3, 8, 32}) {
+        setenv("HL_NUM_THREADS", std::to_string(threads).c_str(), 1);
+        p.invalidate_cache();
+        Internal::JITSharedRuntime::release_all();
+        if (!check_exactly_once(p, "work stealing", threads)) {
+            return -1;
+        }
+    }
+
+#ifdef __linux__
+    // NUMA-aware pools group the ranges by node, and workers prefer
+    // ranges of their own node, so a node may have fewer ranges than
+    // the workers that join from it.
+    setenv("HL_NUMA", "1", 1);
+    for (int nodes : {2, 3}) {
+        setenv("HL_SYSFS_ROOT", make_fake_sysfs(nodes).c_str(), 1);
+        for (int threads : {2, 3, 8, 32}) {
+            setenv("HL_NUM_THREADS", std::to_string(threads).c_str(), 1);
+            p.invalidate_cache();
+            Internal::JITSharedRuntime::release_all();
+            std::string mode = "NUMA with " + std::to_string(nodes) + " nodes";
+            if (!check_exactly_once(p, mode.c_str(), threads)) {
+                return -1;
+            }
+        }
+    }
+    unsetenv("HL_NUMA");
+    unsetenv("HL_SYSFS_ROOT");
+#endif
+
+    printf("Success!\n");
+#endif
+    return 0;
+}
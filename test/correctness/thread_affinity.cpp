@@ -0,0 +1,102 @@
+#include "Halide.h"
+#include "halide_test_dirs.h"
+
+#include <cctype>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+using namespace Halide;
+
+#ifdef __linux__
+// A fake sysfs tree with one online CPU, so that pinning works (or
+// fails the same way) on any machine.
+std::string make_fake_sysfs() {
+    std::string root = Internal::get_test_tmp_dir() + "thread_affinity_sysfs";
+    std::string dir = root;
+    for (const char *d : {"/devices", "/system", "/cpu", "/cpu0", "/topology"}) {
+        dir += d;
+        mkdir(dir.c_str(), 0755);
+    }
+    std::ofstream(root + "/devices/system/cpu/online") << "0\n";
+    std::ofstream(dir + "/core_id") << "0\n";
+    std::ofstream(dir + "/physical_package_id") << "0\n";
+    return root;
+}
+
+int placement_lines = 0;
+int pinned_workers = 0;
+bool bad_placement = false;
+
+void my_print(void *, const char *msg) {
+    std::string m(msg);
+    if (m.find("worker placement") != std::string::npos) {
+        placement_lines++;
+        return;
+    }
+    // Placement lines look like " 0: 0/0/0 1: unpinned ..."
+    if (placement_lines == 0 || m.size() < 2 || m[0] != ' ' || !isdigit(m[1])) {
+        return;
+    }
+    // Every worker must be on CPU 0, core 0, socket 0, or not pinned
+    // at all (if CPU 0 isn't available to this process).
+    size_t pos = 0;
+    while ((pos = m.find(": ", pos)) != std::string::npos) {
+        pos += 2;
+        if (m.compare(pos, 5, "0/0/0") == 0) {
+            pinned_workers++;
+        } else if (m.compare(pos, 8, "unpinned") != 0) {
+            bad_placement = true;
+        }
+    }
+}
+#endif
+
+int main(int argc, char **argv) {
+#ifndef __linux__
+    printf("[SKIP] Thread affinity is only implemented on Linux\n");
+#else
+    if (get_jit_target_from_environment().arch == Target::WebAssembly) {
+        printf("[SKIP] WebAssembly JIT does not yet support the profiler.\n");
+        return 0;
+    }
+
+    setenv("HL_SYSFS_ROOT", make_fake_sysfs().c_str(), 1);
+    setenv("HL_THREAD_AFFINITY", "core", 1);
+    setenv("HL_NUM_THREADS", "4", 1);
+    Internal::JITSharedRuntime::release_all();
+
+    Func f;
+    Var x, y;
+    f(x, y) = x + y;
+    f.parallel(y);
+    f.set_custom_print(my_print);
+
+    Target t = get_jit_target_from_environment().with_feature(Target::Profile);
+    Buffer<int> out = f.realize(64, 64, t);
+    for (int y = 0; y < out.height(); y++) {
+        for (int x = 0; x < out.width(); x++) {
+            if (out(x, y) != x + y) {
+                printf("out(%d, %d) = %d instead of %d\n", x, y, out(x, y), x + y);
+                return -1;
+            }
+        }
+    }
+
+    if (placement_lines == 0) {
+        printf("The profiler did not report where workers were placed\n");
+        return -1;
+    }
+    if (bad_placement) {
+        printf("A worker was placed somewhere other than CPU 0\n");
+        return -1;
+    }
+    printf("%d workers pinned to CPU 0\n", pinned_workers);
+
+    printf("Success!\n");
+#endif
+    return 0;
+}
@@ -0,0 +1,143 @@
+#include "Halide.h"
+#include "HalideTraceUtils.h"
+#include "halide_test_dirs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace Halide;
+using Halide::Internal::Packet;
+using Halide::Internal::TraceStream;
+
+// Write the trace of a realization of p to a file, with or without
+// compression. A fresh runtime is used each time, so that the trace
+// file is reopened, and is flushed and closed when the runtime is
+// released.
+void write_trace(Pipeline p, const std::string &trace_file, bool compress, int width, int height) {
+    Internal::ensure_no_file_exists(trace_file);
+    setenv("HL_TRACE_FILE", trace_file.c_str(), 1);
+    setenv("HL_TRACE_COMPRESS", compress ? "1" : "0", 1);
+    p.invalidate_cache();
+    Internal::JITSharedRuntime::release_all();
+    p.realize(width, height);
+    Internal::JITSharedRuntime::release_all();
+}
+
+// Check that a compressed trace is made of well-formed blocks, and
+// return the number of bytes of packets in them.
+bool check_blocks(const std::string &trace_file, uint64_t *raw_bytes) {
+    FILE *file = fopen(trace_file.c_str(), "rb");
+    if (!file) {
+        printf("No compressed trace file was written\n");
+        return false;
+    }
+    uint64_t compressed_bytes = 0;
+    *raw_bytes = 0;
+    halide_trace_block_header_t header;
+    while (fread(&header, sizeof(header), 1, file) == 1) {
+        if (header.magic != HALIDE_TRACE_BLOCK_MAGIC ||
+            header.raw_size % 4 != 0 ||
+            fseek(file, header.compressed_size, SEEK_CUR) != 0) {
+            printf("Bad block in compressed trace\n");
+            fclose(file);
+            return false;
+        }
+        *raw_bytes += header.raw_size;
+        compressed_bytes += sizeof(header) + header.compressed_size;
+    }
+    long file_size = ftell(file);
+    fclose(file);
+
+    printf("%d bytes of packets compressed to %d bytes\n", (int)*raw_bytes, (int)compressed_bytes);
+    if ((long)compressed_bytes != file_size) {
+        printf("The trace file has %d bytes that are not in a block\n", (int)(file_size - compressed_bytes));
+        return false;
+    }
+    if (compressed_bytes * 2 > *raw_bytes) {
+        printf("The trace did not compress\n");
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    if (get_jit_target_from_environment().arch == Target::WebAssembly) {
+        printf("[SKIP] WebAssembly JIT does not support writing trace files.\n");
+        return 0;
+    }
+
+#ifdef _WIN32
+    printf("[SKIP] Windows does not have a working setenv\n");
+#else
+    const int width = 256, height = 256;
+    Func f("f");
+    Var x("x"), y("y");
+    f(x, y) = x + y;
+    f.trace_stores();
+    Pipeline p(f);
+
+    std::string raw_file = Internal::get_test_tmp_dir() + "trace_file_uncompressed.bin";
+    std::string compressed_file = Internal::get_test_tmp_dir() + "trace_file_compressed.bin";
+    write_trace(p, raw_file, false, width, height);
+    write_trace(p, compressed_file, true, width, height);
+    unsetenv("HL_TRACE_FILE");
+    unsetenv("HL_TRACE_COMPRESS");
+
+    uint64_t raw_bytes = 0;
+    if (!check_blocks(compressed_file, &raw_bytes)) {
+        return -1;
+    }
+    // Each store is a packet of at least 40 bytes.
+    if (raw_bytes < (uint64_t)width * height * 40) {
+        printf("Some of the stores are missing from the trace\n");
+        return -1;
+    }
+
+    // Decompressing the trace should give exactly the packets that
+    // are written without compression.
+    FILE *raw = fopen(raw_file.c_str(), "rb");
+    FILE *compressed = fopen(compressed_file.c_str(), "rb");
+    if (!raw || !compressed) {
+        printf("Could not open the trace files\n");
+        return -1;
+    }
+    TraceStream raw_stream(raw), compressed_stream(compressed);
+    Packet a, b;
+    int packets = 0;
+    uint64_t packet_bytes = 0;
+    while (true) {
+        bool more_a = a.read_from_stream(raw_stream);
+        bool more_b = b.read_from_stream(compressed_stream);
+        if (more_a != more_b) {
+            printf("The compressed trace has %s packets than the uncompressed one\n",
+                   more_a ? "fewer" : "more");
+            return -1;
+        }
+        if (!more_a) {
+            break;
+        }
+        if (a.size != b.size || memcmp(&a, &b, a.size) != 0) {
+            printf("Packet %d differs between the compressed and uncompressed traces\n", packets);
+            return -1;
+        }
+        packets++;
+        packet_bytes += a.size;
+    }
+    fclose(raw);
+    fclose(compressed);
+
+    if (packet_bytes != raw_bytes) {
+        printf("The blocks hold %d bytes, but the packets in them add up to %d\n",
+               (int)raw_bytes, (int)packet_bytes);
+        return -1;
+    }
+    if (packets < width * height) {
+        printf("Only %d packets were decompressed\n", packets);
+        return -1;
+    }
+
+    printf("Success!\n");
+#endif
+    return 0;
+}
@@ -0,0 +1,195 @@
+#include "Halide.h"
+#include "HalideTraceUtils.h"
+#include "halide_test_dirs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace Halide;
+using Halide::Internal::Packet;
+using Halide::Internal::TraceIndex;
+using Halide::Internal::TraceQuery;
+using Halide::Internal::TraceStream;
+
+typedef std::vector<std::vector<uint8_t>> Packets;
+
+std::vector<uint8_t> packet_bytes(const Packet &p) {
+    const uint8_t *begin = (const uint8_t *)&p;
+    return std::vector<uint8_t>(begin, begin + p.size);
+}
+
+// The packets matching a query, found by reading the whole trace. The
+// pipeline is serial, so the packets of a realization of a Func are the
+// packets of that Func from its begin_realization to the next
+// end_realization.
+Packets linear_scan(FILE *file, const TraceQuery &query) {
+    Packets result;
+    TraceStream stream(file);
+    stream.rewind();
+    Packet p;
+    int realization = -1;
+    bool in_realization = false;
+    while (p.read_from_stream(stream)) {
+        if (!query.func.empty() && query.func != p.func()) {
+            continue;
+        }
+        if (query.realization >= 0) {
+            if (p.event == halide_trace_begin_realization) {
+                realization++;
+                in_realization = (realization == query.realization);
+            }
+            bool last = in_realization && p.event == halide_trace_end_realization;
+            if (!in_realization) {
+                continue;
+            }
+            in_realization = !last;
+        }
+        if (query.event >= 0 && query.event != p.event) {
+            continue;
+        }
+        result.push_back(packet_bytes(p));
+    }
+    return result;
+}
+
+Packets indexed_read(FILE *file, const TraceIndex &index, const TraceQuery &query) {
+    Packets result;
+    TraceStream stream(file);
+    index.read(stream, query, [&](const Packet &p) {
+        result.push_back(packet_bytes(p));
+    });
+    return result;
+}
+
+// Check that reading a query through the index gives exactly the
+// packets a linear scan does, and that it reads no more chunks than
+// expected.
+bool check_query(FILE *file, const TraceIndex &index, const TraceQuery &query,
+                 const char *name, size_t max_chunks) {
+    Packets expected = linear_scan(file, query);
+    Packets actual = indexed_read(file, index, query);
+    if (expected.empty()) {
+        printf("%s: the trace has no packets for the query\n", name);
+        return false;
+    }
+    if (actual != expected) {
+        printf("%s: the index read %d packets, but a linear scan found %d\n",
+               name, (int)actual.size(), (int)expected.size());
+        return false;
+    }
+    size_t chunks = index.num_chunks(query);
+    if (chunks > max_chunks) {
+        printf("%s: the index reads %d of %d chunks, expected at most %d\n",
+               name, (int)chunks, (int)index.num_chunks(), (int)max_chunks);
+        return false;
+    }
+    return true;
+}
+
+bool check_trace(const std::string &trace_file, const char *mode) {
+    FILE *file = fopen(trace_file.c_str(), "rb");
+    if (!file) {
+        printf("%s: no trace file was written\n", mode);
+        return false;
+    }
+
+    TraceIndex built;
+    {
+        TraceStream stream(file);
+        built.build(stream);
+    }
+    fseek(file, 0, SEEK_END);
+    if (built.trace_size() != (uint64_t)ftell(file)) {
+        printf("%s: the index covers %d bytes of a %d byte trace\n",
+               mode, (int)built.trace_size(), (int)ftell(file));
+        return false;
+    }
+    // The trace is several megabytes, so it should span a good number
+    // of chunks.
+    if (built.num_chunks() < 4) {
+        printf("%s: the trace was only divided into %d chunks\n", mode, (int)built.num_chunks());
+        return false;
+    }
+
+    // Queries should give the same answers through an index that has
+    // been saved and loaded again.
+    std::string index_file = trace_file + ".index";
+    Internal::ensure_no_file_exists(index_file);
+    TraceIndex index;
+    if (!built.save(index_file) || !index.load(index_file)) {
+        printf("%s: could not save and load the index\n", mode);
+        return false;
+    }
+    if (index.trace_size() != built.trace_size() || index.num_chunks() != built.num_chunks()) {
+        printf("%s: the loaded index does not match the one saved\n", mode);
+        return false;
+    }
+
+    const size_t all = index.num_chunks();
+    TraceQuery h_query, g_stores, f_query, g_realization;
+    h_query.func = "h";
+    g_stores.func = "g";
+    g_stores.event = halide_trace_store;
+    f_query.func = "f";
+    g_realization.func = "g";
+    g_realization.realization = 100;
+
+    // h is computed before anything else, so its packets are in the
+    // first few chunks, and the rest can be skipped. g is computed
+    // per row of f, so it is everywhere but the chunks of h, and one
+    // of its realizations spans at most two chunks.
+    bool ok = (check_query(file, index, h_query, "h", all - 1) &&
+               check_query(file, index, g_stores, "stores of g", all) &&
+               check_query(file, index, f_query, "f", all) &&
+               check_query(file, index, g_realization, "a realization of g", 2));
+    fclose(file);
+    if (!ok) {
+        printf("Query of the %s trace failed\n", mode);
+    }
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    if (get_jit_target_from_environment().arch == Target::WebAssembly) {
+        printf("[SKIP] WebAssembly JIT does not support writing trace files.\n");
+        return 0;
+    }
+
+#ifdef _WIN32
+    printf("[SKIP] Windows does not have a working setenv\n");
+#else
+    Func f("f"), g("g"), h("h");
+    Var x("x"), y("y");
+    h(x, y) = x * y;
+    g(x, y) = h(x, y) + 1;
+    f(x, y) = g(x, y) + g(x + 1, y);
+    h.compute_root().trace_stores();
+    g.compute_at(f, y).trace_stores().trace_realizations();
+    f.trace_stores();
+    Pipeline p(f);
+
+    for (bool compress : {false, true}) {
+        const char *mode = compress ? "compressed" : "uncompressed";
+        std::string trace_file = Internal::get_test_tmp_dir() + "trace_index_" + mode + ".bin";
+        Internal::ensure_no_file_exists(trace_file);
+        setenv("HL_TRACE_FILE", trace_file.c_str(), 1);
+        setenv("HL_TRACE_COMPRESS", compress ? "1" : "0", 1);
+        // Use a fresh runtime, so that the trace file is reopened, and
+        // is flushed and closed when the runtime is released.
+        p.invalidate_cache();
+        Internal::JITSharedRuntime::release_all();
+        p.realize(256, 256);
+        Internal::JITSharedRuntime::release_all();
+
+        if (!check_trace(trace_file, mode)) {
+            return -1;
+        }
+    }
+    unsetenv("HL_TRACE_FILE");
+    unsetenv("HL_TRACE_COMPRESS");
+
+    printf("Success!\n");
+#endif
+    return 0;
+}
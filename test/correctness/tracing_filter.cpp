@@ -0,0 +1,129 @@
+#include "Halide.h"
+#include <stdio.h>
+
+using namespace Halide;
+
+int stores = 0, loads = 0, outside = 0;
+int region_min[2], region_max[2];
+
+int my_trace(void *user_context, const halide_trace_event_t *e) {
+    if (e->event == halide_trace_store) {
+        stores++;
+    } else if (e->event == halide_trace_load) {
+        loads++;
+    } else {
+        return 0;
+    }
+    // At least one lane of each event must be inside the region. The
+    // coordinates of vector events are a vector per dimension.
+    bool inside = false;
+    for (int i = 0; i < e->type.lanes; i++) {
+        int x = e->coordinates[i];
+        int y = e->coordinates[e->type.lanes + i];
+        inside = inside || (x >= region_min[0] && x <= region_max[0] &&
+                            y >= region_min[1] && y <= region_max[1]);
+    }
+    if (!inside) {
+        outside++;
+    }
+    return 0;
+}
+
+void reset(int x_min, int x_max, int y_min, int y_max) {
+    stores = loads = outside = 0;
+    region_min[0] = x_min;
+    region_max[0] = x_max;
+    region_min[1] = y_min;
+    region_max[1] = y_max;
+}
+
+int main(int argc, char **argv) {
+    Var x("x"), y("y");
+
+    {
+        // Only the stores inside a box
+        Func f("f");
+        f(x, y) = x + y;
+        TraceFilter filter;
+        filter.region = {{10, 5}, {20, 3}};
+        f.trace_stores(filter);
+        f.set_custom_trace(&my_trace);
+        reset(10, 14, 20, 22);
+        f.realize(100, 100);
+        if (stores != 15 || outside != 0) {
+            printf("Traced %d stores, %d outside the region. Expected 15 and 0.\n", stores, outside);
+            return -1;
+        }
+    }
+
+    {
+        // The same, vectorized. A vector is traced if any lane is
+        // in the box.
+        Func f("f");
+        f(x, y) = x + y;
+        f.vectorize(x, 8);
+        TraceFilter filter;
+        filter.region = {{10, 1}, {20, 3}};
+        f.trace_stores(filter);
+        f.set_custom_trace(&my_trace);
+        reset(10, 10, 20, 22);
+        f.realize(64, 64);
+        if (stores != 3 || outside != 0) {
+            printf("Traced %d vector stores, %d outside the region. Expected 3 and 0.\n", stores, outside);
+            return -1;
+        }
+    }
+
+    {
+        // About one in ten stores, the same ones each time.
+        Func f("f");
+        f(x, y) = x + y;
+        TraceFilter filter;
+        filter.sample_rate = 10;
+        f.trace_stores(filter);
+        f.set_custom_trace(&my_trace);
+        reset(0, 99, 0, 99);
+        f.realize(100, 100);
+        int first_run = stores;
+        reset(0, 99, 0, 99);
+        f.realize(100, 100);
+        if (stores != first_run) {
+            printf("Sampling traced %d stores, then %d\n", first_run, stores);
+            return -1;
+        }
+        if (stores < 500 || stores > 2000) {
+            printf("Sampling one in ten of 10000 stores traced %d of them\n", stores);
+            return -1;
+        }
+    }
+
+    {
+        // Only the first three realizations of g, for both its loads
+        // and its stores.
+        Func g("g"), h("h");
+        g(x, y) = x * y;
+        h(x, y) = g(x, y) + g(x + 1, y);
+        g.compute_at(h, y);
+        TraceFilter filter;
+        filter.max_realizations = 3;
+        g.trace_stores(filter);
+        g.trace_loads(filter);
+        h.set_custom_trace(&my_trace);
+        reset(0, 10, 0, 9);
+        h.realize(10, 10);
+        if (stores != 3 * 11 || loads != 3 * 20) {
+            printf("Traced %d stores and %d loads. Expected %d and %d.\n", stores, loads, 3 * 11, 3 * 20);
+            return -1;
+        }
+        // The count starts again in each run.
+        reset(0, 10, 0, 9);
+        h.realize(10, 10);
+        if (stores != 3 * 11) {
+            printf("Traced %d stores in the second run. Expected %d.\n", stores, 3 * 11);
+            return -1;
+        }
+    }
+
+    printf("Success!\n");
+    return 0;
+}
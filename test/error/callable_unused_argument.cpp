@@ -0,0 +1,18 @@
+#include "Halide.h"
+#include <stdio.h>
+
+using namespace Halide;
+
+int main(int argc, char **argv) {
+    Func f;
+    Var x;
+    Param<int> used, unused;
+    f(x) = x + used;
+
+    // unused isn't an argument of the pipeline, so the Callable has
+    // nowhere to pass it.
+    Callable c = f.compile_to_callable({used, unused});
+
+    printf("Success!\n");
+    return 0;
+}
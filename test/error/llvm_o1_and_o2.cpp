@@ -0,0 +1,17 @@
+#include "Halide.h"
+#include <stdio.h>
+
+using namespace Halide;
+
+int main(int argc, char **argv) {
+    Func f;
+    Var x;
+    f(x) = x;
+
+    // llvm_o1 and llvm_o2 ask for different optimization levels.
+    Target t = get_jit_target_from_environment().with_feature(Target::LLVMO1).with_feature(Target::LLVMO2);
+    f.compile_jit(t);
+
+    printf("Success!\n");
+    return 0;
+}
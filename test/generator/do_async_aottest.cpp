@@ -0,0 +1,122 @@
+#include <condition_variable>
+#include <mutex>
+#include <stdio.h>
+
+#include "HalideBuffer.h"
+#include "HalideRuntime.h"
+
+#include "do_async.h"
+
+using namespace Halide::Runtime;
+
+const int num_calls = 16;
+
+struct call {
+    int offset;
+    Buffer<int> out;
+};
+
+std::mutex lock;
+std::condition_variable finished_cond;
+int finished = 0;
+bool failed = false;
+
+int run_pipeline(void *user_context, void *arg) {
+    call *c = (call *)arg;
+    return do_async(c->offset, c->out);
+}
+
+void on_done(void *user_context, void *arg, int result) {
+    std::lock_guard<std::mutex> l(lock);
+    if (result != 0) {
+        printf("Non zero exit code: %d\n", result);
+        failed = true;
+    }
+    finished++;
+    finished_cond.notify_all();
+}
+
+int main(int argc, char **argv) {
+    // Use fewer threads than concurrent calls, to check that the
+    // calls queue up rather than deadlock.
+    halide_set_num_threads(2);
+
+    call calls[num_calls];
+    for (int i = 0; i < num_calls; i++) {
+        calls[i].offset = i;
+        calls[i].out = Buffer<int>(64, 64);
+    }
+
+    halide_semaphore_t done;
+    halide_semaphore_init(&done, 0);
+
+    for (int rep = 0; rep < 10; rep++) {
+        finished = 0;
+        for (int i = 0; i < num_calls; i++) {
+            calls[i].out.fill(-1);
+            int ret = halide_do_async(nullptr, run_pipeline, &calls[i], on_done, &done);
+            if (ret) {
+                printf("halide_do_async failed: %d\n", ret);
+                return -1;
+            }
+        }
+
+        {
+            std::unique_lock<std::mutex> l(lock);
+            finished_cond.wait(l, [] { return finished == num_calls; });
+        }
+        if (failed) {
+            return -1;
+        }
+
+        // The semaphore was released once per call.
+        for (int i = 0; i < num_calls; i++) {
+            if (!halide_semaphore_try_acquire(&done, 1)) {
+                printf("Semaphore was released %d times instead of %d\n", i, num_calls);
+                return -1;
+            }
+        }
+        if (halide_semaphore_try_acquire(&done, 1)) {
+            printf("Semaphore was released too many times\n");
+            return -1;
+        }
+
+        for (int i = 0; i < num_calls; i++) {
+            Buffer<int> &out = calls[i].out;
+            for (int y = 0; y < out.height(); y++) {
+                for (int x = 0; x < out.width(); x++) {
+                    if (out(x, y) != x * y + i) {
+                        printf("out(%d, %d) = %d instead of %d\n", x, y, out(x, y), x * y + i);
+                        return -1;
+                    }
+                }
+            }
+        }
+    }
+
+    // Shutting down the thread pool runs the calls still queued, and
+    // their callbacks, before it returns.
+    finished = 0;
+    for (int i = 0; i < num_calls; i++) {
+        calls[i].out.fill(-1);
+        int ret = halide_do_async(nullptr, run_pipeline, &calls[i], on_done, nullptr);
+        if (ret) {
+            printf("halide_do_async failed: %d\n", ret);
+            return -1;
+        }
+    }
+    halide_shutdown_thread_pool();
+    if (finished != num_calls || failed) {
+        printf("%d of %d calls finished before shutdown returned\n", finished, num_calls);
+        return -1;
+    }
+    for (int i = 0; i < num_calls; i++) {
+        if (calls[i].out(3, 5) != 3 * 5 + i) {
+            printf("Call %d did not run before shutdown returned\n", i);
+            return -1;
+        }
+    }
+
+    printf("Success!\n");
+    return 0;
+}
@@ -0,0 +1,22 @@
+#include "Halide.h"
+
+namespace {
+
+class DoAsync : public Halide::Generator<DoAsync> {
+public:
+    Input<int> offset{"offset"};
+    Output<Buffer<int>> output{"output", 2};
+
+    void generate() {
+        // A job with nested parallelism, so that pipelines running
+        // asynchronously compete for workers with their own loops.
+        Var x, y;
+
+        output(x, y) = x * y + offset;
+        output.parallel(x, 8).parallel(y);
+    }
+};
+
+}  // namespace
+
+HALIDE_REGISTER_GENERATOR(DoAsync, do_async)
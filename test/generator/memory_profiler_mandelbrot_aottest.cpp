@@ -44,6 +44,7 @@ void validate(halide_profiler_state *s) {
         assert(mandelbrot_heap_per_iter <= p->memory_peak);
         assert(p->memory_peak <= mandelbrot_heap_total);
 
+        bool mandelbrot_has_histogram = false;
         for (int i = 0; i < p->num_funcs; i++) {
             halide_profiler_func_stats *fs = p->funcs + i;
             if (strncmp(fs->name, "argmin", 6) == 0) {
@@ -54,8 +55,43 @@ void validate(halide_profiler_state *s) {
 
                 assert(fs->num_allocs == mandelbrot_n_mallocs);
                 assert(fs->memory_total == mandelbrot_heap_total);
+                mandelbrot_has_histogram = fs->latency != nullptr;
             }
+
+            // A Func's histogram has an entry for each call in which
+            // the sampler billed it some time.
+            halide_profiler_latency_t func_latency;
+            int func_result = halide_profiler_get_latency(p->name, fs->name, &func_latency);
+            if (fs->latency == nullptr) {
+                assert(func_result != 0);
+                continue;
+            }
+            assert(func_result == 0);
+            assert(func_latency.count == fs->latency->count);
+            assert(func_latency.count > 0);
+            assert(func_latency.count <= (uint64_t)num_launcher_tasks);
+            assert(func_latency.p50 <= func_latency.p90);
+            assert(func_latency.p90 <= func_latency.p99);
+            assert(func_latency.p99 <= func_latency.max);
+            assert(func_latency.max > 0);
+            (void)func_result;
         }
+        // Nearly all the time goes to mandelbrot, so it must have been
+        // sampled in some call.
+        assert(mandelbrot_has_histogram);
+        (void)mandelbrot_has_histogram;
+
+        // Every call is in the latency histogram, whether or not it
+        // was sampled.
+        halide_profiler_latency_t latency;
+        int result = halide_profiler_get_latency(p->name, nullptr, &latency);
+        assert(result == 0);
+        (void)result;
+        assert(latency.count == (uint64_t)num_launcher_tasks);
+        assert(latency.p50 <= latency.p90);
+        assert(latency.p90 <= latency.p99);
+        assert(latency.p99 <= latency.max);
+        assert(latency.max > 0);
     }
 }
 
@@ -82,6 +118,13 @@ int main(int argc, char **argv) {
     printf("argmin expected value\n  stack peak: %d\n", argmin_stack_peak);
     printf("\n");
 
+    // Keep a latency histogram per Func, as well as per pipeline. Set
+    // before the profiler thread starts.
+    halide_profiler_get_state()->func_histograms = 1;
+
+    halide_runtime_metrics_t before;
+    halide_get_runtime_metrics(nullptr, &before);
+
     halide_do_par_for(nullptr, launcher_task, 0, num_launcher_tasks, nullptr);
 
     halide_profiler_state *state = halide_profiler_get_state();
@@ -89,6 +132,22 @@ int main(int argc, char **argv) {
 
     validate(state);
 
+    // Everything the pipelines allocated has been freed, and the
+    // thread pool has nothing left to do.
+    halide_runtime_metrics_t after;
+    halide_get_runtime_metrics(nullptr, &after);
+    assert(after.host_live_bytes == before.host_live_bytes);
+    assert(after.host_live_allocations == before.host_live_allocations);
+    assert(after.queued_jobs == 0);
+    assert(after.threads_reserved == 0);
+    assert(after.thread_pools >= 1);
+
+    char text[4096];
+    int length = halide_format_runtime_metrics(nullptr, &after, text, sizeof(text));
+    assert(length == (int)strlen(text));
+    assert(strstr(text, "\nhalide_host_live_bytes ") != nullptr);
+    (void)length;
+
     printf("Success!\n");
     return 0;
 }
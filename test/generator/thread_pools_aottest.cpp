@@ -0,0 +1,106 @@
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <stdio.h>
+#include <thread>
+
+#include "HalideBuffer.h"
+#include "HalideRuntime.h"
+
+#include "thread_pools.h"
+
+using namespace Halide::Runtime;
+
+std::mutex threads_lock;
+std::set<std::thread::id> threads_seen;
+
+extern "C" int record_thread(int y) {
+    std::lock_guard<std::mutex> lock(threads_lock);
+    threads_seen.insert(std::this_thread::get_id());
+    // Make the rows slow enough that every worker gets some.
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+    return y;
+}
+
+int batch_context, latency_context;
+
+std::set<std::thread::id> run_on(void *user_context, Buffer<int> &out) {
+    threads_seen.clear();
+    for (int i = 0; i < 20; i++) {
+        int ret = thread_pools(user_context, out);
+        if (ret) {
+            printf("Non zero exit code: %d\n", ret);
+            exit(-1);
+        }
+    }
+    for (int y = 0; y < out.height(); y++) {
+        for (int x = 0; x < out.width(); x++) {
+            if (out(x, y) != x + y) {
+                printf("out(%d, %d) = %d instead of %d\n", x, y, out(x, y), x + y);
+                exit(-1);
+            }
+        }
+    }
+    return threads_seen;
+}
+
+int main(int argc, char **argv) {
+    halide_set_num_threads(4);
+    int batch = halide_create_thread_pool("batch", 3, 0);
+    if (batch <= 0) {
+        printf("halide_create_thread_pool failed: %d\n", batch);
+        return -1;
+    }
+    if (halide_create_thread_pool("batch", 3, 0) != batch) {
+        printf("Creating a pool twice should return the same pool\n");
+        return -1;
+    }
+    if (halide_set_thread_pool(&batch_context, batch) != 0) {
+        printf("halide_set_thread_pool failed\n");
+        return -1;
+    }
+
+    Buffer<int> out(16, 64);
+    std::set<std::thread::id> batch_threads = run_on(&batch_context, out);
+    std::set<std::thread::id> latency_threads = run_on(&latency_context, out);
+
+    // The only thread the two pools may share is this one, which
+    // helps out with its own pipeline.
+    for (std::thread::id t : batch_threads) {
+        if (t != std::this_thread::get_id() && latency_threads.count(t)) {
+            printf("The pools share a worker thread\n");
+            return -1;
+        }
+    }
+    if (batch_threads.size() > 3 || latency_threads.size() > 4) {
+        printf("Too many threads: %d %d\n", (int)batch_threads.size(), (int)latency_threads.size());
+        return -1;
+    }
+
+    // Shutting down one pool leaves the other running, and the pool
+    // comes back when it is next used.
+    halide_shutdown_thread_pool_by_id(batch);
+    run_on(&batch_context, out);
+    halide_set_num_threads_in_pool(batch, 2);
+    if (run_on(&batch_context, out).size() > 3) {
+        printf("Shrinking the pool should not add threads\n");
+        return -1;
+    }
+
+    // Unbinding returns the context to the default pool.
+    if (halide_set_thread_pool(&batch_context, 0) != batch) {
+        printf("halide_set_thread_pool should return the old pool\n");
+        return -1;
+    }
+    for (std::thread::id t : run_on(&batch_context, out)) {
+        if (t != std::this_thread::get_id() && !latency_threads.count(t)) {
+            printf("An unbound context should use the default pool\n");
+            return -1;
+        }
+    }
+
+    halide_shutdown_thread_pool();
+
+    printf("Success!\n");
+    return 0;
+}
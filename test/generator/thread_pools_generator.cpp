@@ -0,0 +1,22 @@
+#include "Halide.h"
+
+namespace Ext {
+HalideExtern_1(int, record_thread, int)
+}
+
+using namespace Halide;
+
+class ThreadPools : public Generator<ThreadPools> {
+public:
+    Output<Buffer<int>> output{"output", 2};
+
+    void generate() {
+        // Note which threads compute each row, so the test can check
+        // which pool they came from.
+        Var x, y;
+        output(x, y) = Ext::record_thread(y) + x;
+        output.parallel(y);
+    }
+};
+
+HALIDE_REGISTER_GENERATOR(ThreadPools, thread_pools)
@@ -0,0 +1,94 @@
+#include "Halide.h"
+#include "halide_benchmark.h"
+#include <cstdio>
+
+using namespace Halide;
+using namespace Halide::Tools;
+
+#ifdef _WIN32
+#define DLLEXPORT __declspec(dllexport)
+#else
+#define DLLEXPORT
+#endif
+
+void *last_input_host = nullptr;
+
+// An extern stage that remembers where its input was allocated.
+extern "C" DLLEXPORT int record_input_host(halide_buffer_t *in, halide_buffer_t *out) {
+    if (in->is_bounds_query()) {
+        in->dim[0] = out->dim[0];
+    } else if (!out->is_bounds_query()) {
+        last_input_host = in->host;
+        Halide::Runtime::Buffer<int>(*out).fill(0);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (get_jit_target_from_environment().arch == Target::WebAssembly) {
+        printf("[SKIP] WebAssembly JIT does not support threads.\n");
+        return 0;
+    }
+
+    {
+        // A freed block is reused for the next allocation of the same
+        // size class, even if it is a different size.
+        Internal::JITSharedRuntime::reuse_host_allocations(true);
+        Var x;
+        Func producer, consumer;
+        producer(x) = x;
+        producer.compute_root();
+        consumer.define_extern("record_input_host", {producer}, Int(32), 1);
+
+        consumer.realize(150);
+        void *first = last_input_host;
+        consumer.realize(130);
+        if (first == nullptr || last_input_host != first) {
+            printf("A freed block of %d bytes was not reused for %d bytes: %p then %p\n",
+                   150 * 4, 130 * 4, first, last_input_host);
+            return -1;
+        }
+    }
+
+    // A chain of small intermediates, each computed per tile of the
+    // output and so allocated on the heap once per tile, from many
+    // threads at once.
+    Var x("x"), y("y"), xo("xo"), xi("xi");
+    Func in;
+    in(x, y) = x + y;
+    std::vector<Func> chain;
+    chain.push_back(in);
+    for (int i = 0; i < 20; i++) {
+        Func next;
+        Expr prev = chain.back()(x, y);
+        next(x, y) = select(prev % 2 == 0, prev / 2, 3 * prev + 1);
+        chain.push_back(next);
+    }
+    Func out = chain.back();
+    out.split(x, xo, xi, 256).parallel(y);
+    for (size_t i = 0; i < chain.size() - 1; i++) {
+        // The heap allocations are the point, so don't let them be
+        // lifted out of the loop or put on the stack.
+        chain[i].compute_at(out, xo).store_in(MemoryType::Heap);
+    }
+
+    Buffer<int> output(16 * 1024, 64);
+    out.compile_jit();
+
+    double t[2];
+    const char *names[2] = {"system allocator", "pooled"};
+    for (int i = 0; i < 2; i++) {
+        Internal::JITSharedRuntime::reuse_host_allocations(i == 1);
+        out.realize(output);
+        t[i] = benchmark([&]() { out.realize(output); });
+        printf("Time using %s: %f ms\n", names[i], t[i] * 1e3);
+    }
+
+    if (t[1] > t[0] * 1.5) {
+        printf("Pooling host allocations made the pipeline much slower!\n");
+        return -1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
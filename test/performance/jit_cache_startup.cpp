@@ -0,0 +1,136 @@
+#include "Halide.h"
+
+#include "halide_benchmark.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+using namespace Halide;
+using namespace Halide::Tools;
+
+// Measures how long a fresh process takes to JIT-compile a
+// pipeline, with and without a warm on-disk JIT cache. Lowering
+// assigns names from process-wide counters, so a cache entry can
+// only be reused by another run of the same program; the test
+// reruns itself in a child process to measure each startup.
+
+int run_child(const char *result_file) {
+    auto start = benchmark_now();
+
+    ImageParam input(Float(32), 2, "input");
+    Var x("x"), y("y"), xi("xi"), yi("yi");
+
+    Func clamped("clamped");
+    clamped = BoundaryConditions::repeat_edge(input);
+
+    Func blur_x("blur_x"), blur_y("blur_y"), sharpen("sharpen"), out("out");
+    blur_x(x, y) = (clamped(x - 2, y) + clamped(x - 1, y) * 4 + clamped(x, y) * 6 +
+                    clamped(x + 1, y) * 4 + clamped(x + 2, y)) /
+                   16;
+    blur_y(x, y) = (blur_x(x, y - 2) + blur_x(x, y - 1) * 4 + blur_x(x, y) * 6 +
+                    blur_x(x, y + 1) * 4 + blur_x(x, y + 2)) /
+                   16;
+    sharpen(x, y) = 2 * clamped(x, y) - blur_y(x, y);
+    out(x, y) = select(sharpen(x, y) > 0.5f, sqrt(sharpen(x, y)), sharpen(x, y) * sharpen(x, y));
+
+    out.tile(x, y, xi, yi, 64, 32).vectorize(xi, 8).parallel(y);
+    blur_y.compute_at(out, x).vectorize(x, 8);
+    blur_x.compute_at(out, x).vectorize(x, 8);
+
+    out.compile_jit();
+
+    double t = benchmark_duration_seconds(start, benchmark_now());
+
+    // Make sure whatever was loaded from the cache actually works.
+    Buffer<float> in(128, 128);
+    in.fill(0.25f);
+    input.set(in);
+    Buffer<float> result = out.realize({128, 128});
+    for (int y = 0; y < result.height(); y++) {
+        for (int x = 0; x < result.width(); x++) {
+            float correct = 0.25f * 0.25f;
+            if (std::abs(result(x, y) - correct) > 1e-5f) {
+                printf("result(%d, %d) = %f instead of %f\n", x, y, result(x, y), correct);
+                return -1;
+            }
+        }
+    }
+
+    FILE *f = fopen(result_file, "w");
+    if (!f) {
+        printf("Could not open %s\n", result_file);
+        return -1;
+    }
+    fprintf(f, "%f\n", t);
+    fclose(f);
+    return 0;
+}
+
+double run_startup(const std::string &program, const std::string &result_file) {
+    std::string command = "\"" + program + "\" -child \"" + result_file + "\"";
+    if (system(command.c_str()) != 0) {
+        return -1;
+    }
+    FILE *f = fopen(result_file.c_str(), "r");
+    double t = -1;
+    if (!f || fscanf(f, "%lf", &t) != 1) {
+        t = -1;
+    }
+    if (f) {
+        fclose(f);
+    }
+    return t;
+}
+
+int main(int argc, char **argv) {
+#ifdef _WIN32
+    printf("[SKIP] Windows does not have a working setenv\n");
+    return 0;
+#else
+    if (argc == 3 && std::string(argv[1]) == "-child") {
+        return run_child(argv[2]);
+    }
+
+    Target target = get_jit_target_from_environment();
+    if (target.arch == Target::WebAssembly) {
+        printf("[SKIP] The JIT cache does not apply to WebAssembly.\n");
+        return 0;
+    }
+
+    std::string cache_dir = Internal::dir_make_temp();
+    std::string result_file = Internal::file_make_temp("jit_cache_startup", ".txt");
+    setenv("HL_JIT_CACHE_DIR", cache_dir.c_str(), 1);
+
+    double cold = run_startup(argv[0], result_file);
+    double warm = 0;
+    for (int i = 0; i < 3 && warm >= 0; i++) {
+        double t = run_startup(argv[0], result_file);
+        warm = (i == 0 || t < 0) ? t : std::min(warm, t);
+    }
+
+    Internal::file_unlink(result_file);
+    std::string cleanup = "rm -rf \"" + cache_dir + "\"";
+    if (system(cleanup.c_str()) != 0) {
+        printf("Could not remove %s\n", cache_dir.c_str());
+    }
+
+    if (cold < 0 || warm < 0) {
+        printf("A child process failed\n");
+        return -1;
+    }
+
+    printf("Startup time with a cold JIT cache: %f ms\n"
+           "Startup time with a warm JIT cache: %f ms\n",
+           cold * 1e3, warm * 1e3);
+
+    if (warm > cold) {
+        printf("Loading from the JIT cache was slower than compiling\n");
+        return -1;
+    }
+
+    printf("Success!\n");
+    return 0;
+#endif
+}
@@ -0,0 +1,70 @@
+#include "Halide.h"
+#include "halide_benchmark.h"
+#include <cstdio>
+#include <cstring>
+
+using namespace Halide;
+using namespace Halide::Tools;
+
+#define W 16
+#define H 4096
+
+int main(int argc, char **argv) {
+    if (get_jit_target_from_environment().arch == Target::WebAssembly) {
+        printf("[SKIP] WebAssembly JIT does not support threads.\n");
+        return 0;
+    }
+
+    // Each row of g looks up its own row of f in the memoization
+    // cache. The rows are tiny, so with many threads running rows in
+    // parallel the time goes on the cache itself.
+    Var x, y;
+    Func f, g;
+    f(x, y) = cast<float>(x * y);
+    g(x, y) = f(x, y) + 1;
+    f.compute_at(g, y).memoize();
+    g.parallel(y);
+
+    Pipeline p(g);
+    Buffer<float> out(W, H);
+
+    // A cache that holds every row, so that all lookups hit, and one
+    // that holds a fraction of them, so that stores and evictions are
+    // mixed in.
+    const int64_t row_bytes = W * sizeof(float);
+    const int64_t cache_sizes[] = {H * row_bytes * 4, H * row_bytes / 4};
+
+    printf("Threads   all hits (ns/row)   evicting (ns/row)\n");
+    for (int t = 1; t <= 64; t *= 2) {
+        static char threads_buf[32];
+        snprintf(threads_buf, sizeof(threads_buf), "HL_NUM_THREADS=%d", t);
+        putenv(threads_buf);
+        p.invalidate_cache();
+        Internal::JITSharedRuntime::release_all();
+        p.compile_jit();
+
+        double ns[2];
+        for (int i = 0; i < 2; i++) {
+            Internal::JITSharedRuntime::memoization_cache_set_size(cache_sizes[i]);
+            p.realize(out);
+            ns[i] = benchmark([&]() { p.realize(out); }) * 1e9 / H;
+
+            for (int y = 0; y < H; y++) {
+                for (int x = 0; x < W; x++) {
+                    float correct = x * y + 1;
+                    if (out(x, y) != correct) {
+                        printf("out(%d, %d) = %f instead of %f with %d threads\n",
+                               x, y, out(x, y), correct, t);
+                        return -1;
+                    }
+                }
+            }
+        }
+        printf("%7d   %17.1f   %17.1f\n", t, ns[0], ns[1]);
+    }
+
+    Internal::JITSharedRuntime::memoization_cache_set_size(0);
+
+    printf("Success!\n");
+    return 0;
+}
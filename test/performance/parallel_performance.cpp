@@ -1,6 +1,8 @@
 #include "Halide.h"
 #include "halide_benchmark.h"
 #include <cstdio>
+#include <cstdlib>
+#include <string>
 
 using namespace Halide;
 using namespace Halide::Tools;
@@ -45,6 +47,43 @@ int main(int argc, char **argv) {
     double speedup = serialTime / parallelTime;
     printf("Speedup: %f\n", speedup);
 
+#ifdef _WIN32
+    printf("[SKIP] Windows does not have a working setenv, not reporting thread scaling\n");
+#else
+    // Report how a fine-grained parallel loop scales with the number
+    // of threads, with and without work stealing in the thread pool.
+    Func h;
+    h(x, y) = math;
+    h.parallel(y);
+    Pipeline p(h);
+    Buffer<float> imh(W, H * 16);
+    printf("Threads   locked (ms)   stealing (ms)\n");
+    for (int t = 1; t <= 256; t *= 2) {
+        double times[2];
+        for (int stealing = 0; stealing < 2; stealing++) {
+            setenv("HL_NUM_THREADS", std::to_string(t).c_str(), 1);
+            setenv("HL_WORK_STEALING", stealing ? "1" : "0", 1);
+            p.invalidate_cache();
+            Halide::Internal::JITSharedRuntime::release_all();
+            p.compile_jit();
+            p.realize(imh);
+            times[stealing] = benchmark([&]() { p.realize(imh); });
+
+            for (int y = 0; y < H; y++) {
+                for (int x = 0; x < W; x++) {
+                    if (imh(x, y) != img(x, y)) {
+                        printf("imh(%d, %d) = %f with %d threads\n", x, y, imh(x, y), t);
+                        return -1;
+                    }
+                }
+            }
+        }
+        printf("%7d   %11.4f   %13.4f\n", t, times[0] * 1e3, times[1] * 1e3);
+    }
+    unsetenv("HL_NUM_THREADS");
+    unsetenv("HL_WORK_STEALING");
+#endif
+
     if (speedup < 1.5) {
         fprintf(stderr, "WARNING: Parallel should be faster\n");
         return 0;
@@ -0,0 +1,128 @@
+#include "Halide.h"
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
+using namespace Halide;
+
+// The total times of the two pipelines, as reported at the end of
+// the short one.
+float fast_ms = -1, slow_ms = -1;
+
+void fast_print(void *, const char *msg) {
+    const char *total = strstr(msg, " total time: ");
+    if (!total) {
+        return;
+    }
+    float t = 0;
+    sscanf(total, " total time: %f", &t);
+    if (strstr(msg, "fast_output") && strstr(msg, "fast_output") < total) {
+        fast_ms = t;
+    } else if (strstr(msg, "slow_output") && strstr(msg, "slow_output") < total) {
+        slow_ms = t;
+    }
+}
+
+void slow_print(void *, const char *msg) {
+}
+
+// The share of the parallel pipeline's time billed to each of the
+// Funcs computed inside its parallel loop.
+int heavy_percent = -1, light_percent = -1;
+
+void parallel_print(void *, const char *msg) {
+    float ms;
+    const char *heavy = strstr(msg, "heavy_stage:");
+    if (heavy) {
+        sscanf(heavy, "heavy_stage: %fms (%d", &ms, &heavy_percent);
+    }
+    const char *light = strstr(msg, "light_stage:");
+    if (light) {
+        sscanf(light, "light_stage: %fms (%d", &ms, &light_percent);
+    }
+}
+
+Func make_pipeline(const std::string &name, int work) {
+    Var x("x"), y("y");
+    RDom r(0, work);
+    Func out(name);
+    out(x, y) = sum(sin(cast<float>(x * y + r)));
+    return out;
+}
+
+int main(int argc, char **argv) {
+#ifdef _WIN32
+    printf("[SKIP] Windows does not have a working setenv\n");
+#else
+    if (get_jit_target_from_environment().arch == Target::WebAssembly) {
+        printf("[SKIP] WebAssembly JIT does not yet support the profiler.\n");
+        return 0;
+    }
+
+    // Sample often enough to get a good picture of a short pipeline.
+    setenv("HL_PROFILER_SAMPLE_INTERVAL_US", "100", 1);
+
+    Target t = get_jit_target_from_environment().with_feature(Target::Profile);
+    Func fast = make_pipeline("fast_output", 400);
+    Func slow = make_pipeline("slow_output", 2000);
+    fast.set_custom_print(fast_print);
+    slow.set_custom_print(slow_print);
+    fast.compile_jit(t);
+    slow.compile_jit(t);
+
+    // Run the short pipeline entirely while the long one is running
+    // on another thread. Each should be billed for all of the time it
+    // was running, not a share of it.
+    std::atomic<bool> slow_started(false);
+    std::thread slow_thread([&]() {
+        slow_started = true;
+        slow.realize(256, 256, t);
+    });
+    while (!slow_started) {
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+    fast.realize(256, 256, t);
+    auto t2 = std::chrono::high_resolution_clock::now();
+    slow_thread.join();
+
+    float wall_ms = std::chrono::duration<float, std::milli>(t2 - t1).count();
+    printf("Short pipeline: %f ms, profiled as %f ms. Long pipeline profiled as %f ms over the same period.\n",
+           wall_ms, fast_ms, slow_ms);
+
+    if (fast_ms < 0.7f * wall_ms || slow_ms < 0.7f * wall_ms) {
+        printf("Concurrent pipelines were not each billed for the time they ran\n");
+        return -1;
+    }
+
+    // Inside a parallel loop, each worker's samples go to the Func
+    // that worker is computing, not to the Func that contains the
+    // loop. The heavy stage does nine times the work of the light one.
+    {
+        Var x("x"), y("y");
+        Func heavy = make_pipeline("heavy_stage", 1800);
+        Func light = make_pipeline("light_stage", 200);
+        Func par("parallel_output");
+        par(x, y) = heavy(x, y) + light(x, y);
+        par.parallel(y);
+        heavy.compute_at(par, y);
+        light.compute_at(par, y);
+        par.set_custom_print(parallel_print);
+        par.realize(256, 64, t);
+
+        printf("Inside a parallel loop, heavy stage billed %d%%, light stage %d%%\n",
+               heavy_percent, light_percent);
+        if (heavy_percent < 60 || light_percent < 0 || light_percent > 30) {
+            printf("Time inside the parallel loop was not billed to the Funcs each worker was running\n");
+            return -1;
+        }
+    }
+
+    printf("Success!\n");
+#endif
+    return 0;
+}
@@ -0,0 +1,66 @@
+#include "Halide.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace Halide;
+
+// The first event counted for each Func, from the line under it in
+// the report, e.g. "    cycles: 1234 instructions: 5678 ..."
+long long heavy_count = -1, light_count = -1;
+void my_print(void *, const char *msg) {
+    const char *counters = strstr(msg, "\n    ");
+    if (!counters) {
+        return;
+    }
+    long long count = -1;
+    if (sscanf(counters + 5, "%*[^:]: %lld", &count) != 1) {
+        return;
+    }
+    if (strstr(msg, "  heavy:") == msg) {
+        heavy_count = count;
+    } else if (strstr(msg, "  light:") == msg) {
+        light_count = count;
+    }
+}
+
+int main(int argc, char **argv) {
+#ifdef _WIN32
+    printf("[SKIP] Windows does not have a working setenv\n");
+#else
+    Target target = get_jit_target_from_environment();
+    if (target.os != Target::Linux) {
+        printf("[SKIP] Event counters are only supported on Linux.\n");
+        return 0;
+    }
+
+    // Read when the profiler thread starts.
+    setenv("HL_PROFILER_COUNTERS", "1", 1);
+
+    Func light("light"), heavy("heavy");
+    Var x("x"), y("y");
+    light(x, y) = x + y;
+    Expr e = cast<float>(light(x, y));
+    for (int i = 0; i < 50; i++) {
+        e = sin(e);
+    }
+    heavy(x, y) = e;
+    light.compute_root();
+
+    heavy.set_custom_print(&my_print);
+    heavy.realize(1000, 1000, target.with_feature(Target::Profile));
+
+    if (heavy_count < 0 && light_count < 0) {
+        printf("[SKIP] perf_event_open is not available here.\n");
+        return 0;
+    }
+    printf("First event counted in heavy: %lld, in light: %lld\n", heavy_count, light_count);
+    if (heavy_count <= light_count) {
+        printf("The Func doing more work should have counted more events\n");
+        return -1;
+    }
+
+    printf("Success!\n");
+#endif
+    return 0;
+}
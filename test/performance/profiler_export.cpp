@@ -0,0 +1,57 @@
+#include "Halide.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+using namespace Halide;
+
+std::string report;
+void my_print(void *, const char *msg) {
+    report += msg;
+}
+
+int main(int argc, char **argv) {
+#ifdef _WIN32
+    printf("[SKIP] Windows does not have a working setenv\n");
+#else
+    if (get_jit_target_from_environment().arch == Target::WebAssembly) {
+        printf("[SKIP] WebAssembly JIT does not yet support the profiler.\n");
+        return 0;
+    }
+
+    // Read when the first profiled pipeline starts.
+    setenv("HL_PROFILER_FORMAT", "json", 1);
+
+    Func producer("producer"), consumer("consumer");
+    Var x("x"), y("y");
+    RDom r(0, 100);
+    producer(x, y) = sum(sin(cast<float>(x + y + r)));
+    consumer(x, y) = producer(x, y) + producer(x + 1, y);
+    producer.compute_root();
+
+    consumer.set_custom_print(&my_print);
+    Target t = get_jit_target_from_environment().with_feature(Target::Profile);
+    consumer.realize(1000, 1000, t);
+
+    printf("%s", report.c_str());
+
+    if (report.compare(0, 14, "{\"pipelines\": ") != 0) {
+        printf("The report is not JSON\n");
+        return -1;
+    }
+    size_t producer_pos = report.find("\"name\": \"producer\"");
+    if (producer_pos == std::string::npos) {
+        printf("The report does not list the producer\n");
+        return -1;
+    }
+    size_t time_pos = report.find("\"time_ns\": ", producer_pos);
+    if (time_pos == std::string::npos ||
+        atoll(report.c_str() + time_pos + 11) <= 0) {
+        printf("The report does not give the time spent in the producer\n");
+        return -1;
+    }
+
+    printf("Success!\n");
+#endif
+    return 0;
+}
@@ -0,0 +1,64 @@
+#include "Halide.h"
+#include <stdio.h>
+#include <string.h>
+
+using namespace Halide;
+
+int update_percentage = -1;
+bool saw_specialization = false;
+void my_print(void *, const char *msg) {
+    // Loop lines look like "      for y (update 0): 1.23ms (45%)"
+    const char *update = strstr(msg, "for y (update 0): ");
+    if (update) {
+        float ms;
+        int percentage;
+        if (sscanf(update, "for y (update 0): %fms (%d", &ms, &percentage) == 2) {
+            update_percentage = percentage;
+        }
+    }
+    if (strstr(msg, "  if ") || strstr(msg, "  else (not ")) {
+        saw_specialization = true;
+    }
+}
+
+int main(int argc, char **argv) {
+    if (get_jit_target_from_environment().arch == Target::WebAssembly) {
+        printf("[SKIP] WebAssembly JIT does not yet support the profiler.\n");
+        return 0;
+    }
+
+    // A Func with a cheap pure definition and an expensive update.
+    Func f("f");
+    Var x("x"), y("y");
+    Param<bool> fast_path;
+    f(x, y) = cast<float>(x + y);
+    Expr e = f(x, y);
+    for (int i = 0; i < 100; i++) {
+        e = sin(e);
+    }
+    f(x, y) = e;
+    f.update().specialize(fast_path);
+
+    f.set_custom_print(&my_print);
+    fast_path.set(false);
+
+    Target t = get_jit_target_from_environment().with_feature(Target::ProfileLoops);
+    f.realize(1000, 1000, t);
+
+    if (update_percentage < 0) {
+        printf("The profiler did not report the loops of the update definition\n");
+        return -1;
+    }
+    printf("Percentage of runtime spent in the update: %d\n", update_percentage);
+    if (update_percentage < 50) {
+        printf("This is suspiciously low. It should be almost all of it.\n");
+        return -1;
+    }
+    if (!saw_specialization) {
+        printf("The profiler did not report the branches of the specialization\n");
+        return -1;
+    }
+
+    printf("Success!\n");
+    return 0;
+}
@@ -129,6 +129,19 @@ int main(int argc, char **argv) {
         std::cout << "One argument Pipeline realize reusing Realization/Target/ParamMap time " << t * 1e6 << "us.\n";
     }
 
+    {
+        Func f;
+        Param<int> in;
+
+        f() = in + 42;
+
+        Callable c = f.compile_to_callable({in});
+
+        auto buf = Buffer<int32_t>::make_scalar();
+        double t = benchmark([&]() { c(0, buf); });
+        std::cout << "One argument Callable call time " << t * 1e6 << "us.\n";
+    }
+
     for (int i = 10; i < 100; i += 10) {
         Func f;
         std::vector<Param<int>> params(i);
@@ -147,6 +160,31 @@ int main(int argc, char **argv) {
         std::cout << std::to_string(i) << "-argument Func realize to Buffer time " << t * 1e6 << "us.\n";
     }
 
+    for (int i = 10; i < 100; i += 10) {
+        Func f;
+        std::vector<Param<int>> params(i);
+        std::vector<Argument> args;
+
+        Expr e = 0;
+        for (auto &p : params) {
+            e += p;
+            args.push_back(p);
+        }
+
+        f() = e;
+        Callable c = f.compile_to_callable(args);
+
+        auto buf = Buffer<int32_t>::make_scalar();
+        std::vector<int> values(i, 1);
+        std::vector<const void *> argv;
+        for (const int &v : values) {
+            argv.push_back(&v);
+        }
+        argv.push_back(buf.raw_buffer());
+        double t = benchmark([&]() { c.call_argv(argv.data()); });
+        std::cout << std::to_string(i) << "-argument Callable call_argv time " << t * 1e6 << "us.\n";
+    }
+
     std::cout << "Success!\n";
 
     return 0;
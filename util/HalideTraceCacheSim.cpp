@@ -0,0 +1,671 @@
+#include "HalideRuntime.h"
+#include "HalideTraceUtils.h"
+#include "halide_trace_config.h"
+
+#include <algorithm>
+#include <map>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/** \file
+ *
+ * A tool which reads a binary Halide trace of loads and stores, and
+ * simulates how they would use a cache hierarchy. For each Func it
+ * reports the fraction of accesses served by each level of the cache,
+ * the distribution of reuse distances, and the working set of its
+ * realizations (the amount of memory touched at the loop level it is
+ * computed at).
+ *
+ * Traces record coordinates rather than addresses, so each
+ * realization of a Func is laid out densely, with the first dimension
+ * innermost, using the bounds from the begin_realization packet, or
+ * from the func_type_and_dim trace tag if realizations weren't traced.
+ */
+
+using namespace Halide;
+using namespace Halide::Internal;
+
+using std::map;
+using std::string;
+using std::vector;
+
+namespace {
+
+struct CacheConfig {
+    string name;
+    uint64_t size;
+    int ways;
+    int sets;
+};
+
+// A single load or store, reduced to the cache line it touches, or
+// the start or end of a realization.
+struct Access {
+    enum Kind : uint8_t {
+        Load,
+        Store,
+        BeginRealization,
+        EndRealization,
+    };
+    uint64_t line;
+    uint32_t func;
+    Kind kind;
+};
+
+struct FuncStats {
+    uint64_t loads = 0, stores = 0;
+    // The accesses served by each level of the cache. One more entry
+    // than there are levels, for the accesses that go to memory.
+    vector<uint64_t> served;
+    // Reuse distances in cache lines, in power-of-two buckets, and
+    // the number of first touches.
+    vector<uint64_t> reuse;
+    uint64_t cold = 0;
+    // The working sets of the realizations, in cache lines.
+    uint64_t realizations = 0, working_set_sum = 0, working_set_max = 0;
+};
+
+const int reuse_buckets = 48;
+
+int log2_bucket(uint64_t distance) {
+    int b = 0;
+    while (distance > 1 && b < reuse_buckets - 1) {
+        distance >>= 1;
+        b++;
+    }
+    return b;
+}
+
+// Simulates a hierarchy of set-associative LRU caches. A set of a
+// cache only ever sees lines with the same low bits, so the sets can
+// be split between simulators that run in parallel and see disjoint
+// sets of lines, and the result is the same as simulating them all in
+// one. This simulator takes the lines whose low bits are 'part', out
+// of 'parts'.
+class CacheSimulator {
+    vector<CacheConfig> levels;
+    uint64_t part, parts;
+    // The lines in each set of each level, most recently used first.
+    vector<vector<uint64_t>> contents;
+
+public:
+    vector<FuncStats> stats;
+
+    CacheSimulator(const vector<CacheConfig> &levels, int part, int parts)
+        : levels(levels), part(part), parts(parts) {
+        for (const CacheConfig &c : levels) {
+            contents.emplace_back((size_t)(c.sets / parts) * c.ways, UINT64_MAX);
+        }
+    }
+
+    // Look the line up in a level, and make it the most recently used
+    // line in its set. Returns true if it was already there.
+    bool access(size_t level, uint64_t line) {
+        const CacheConfig &c = levels[level];
+        uint64_t *set = &contents[level][((line % c.sets) / parts) * c.ways];
+        int way = 0;
+        while (way < c.ways - 1 && set[way] != line) {
+            way++;
+        }
+        bool hit = set[way] == line;
+        // Shifting the rest down evicts the least recently used line
+        // on a miss.
+        memmove(set + 1, set, way * sizeof(uint64_t));
+        set[0] = line;
+        return hit;
+    }
+
+    void run(const vector<Access> &accesses) {
+        for (const Access &a : accesses) {
+            if (a.kind > Access::Store || (a.line & (parts - 1)) != part) {
+                continue;
+            }
+            if (a.func >= stats.size()) {
+                stats.resize(a.func + 1);
+            }
+            FuncStats &s = stats[a.func];
+            s.served.resize(levels.size() + 1);
+            size_t level = 0;
+            while (level < levels.size() && !access(level, a.line)) {
+                level++;
+            }
+            // Lines missed in the inner levels were brought into them.
+            s.served[level]++;
+        }
+    }
+};
+
+// Measures reuse distances (the number of distinct cache lines
+// touched since the last touch of the same line), and the number of
+// distinct lines touched by each realization. Each line is marked at
+// the time of its last touch in a Fenwick tree, so both are counts of
+// the marks in a range of times.
+class ReuseAnalyzer {
+    vector<int64_t> tree;
+    std::unordered_map<uint64_t, uint64_t> last_touch;
+    uint64_t now = 0;
+    // The start times of the realizations in progress, per Func.
+    vector<vector<uint64_t>> open;
+
+    void add(uint64_t t, int64_t delta) {
+        for (uint64_t i = t + 1; i <= tree.size(); i += i & (~i + 1)) {
+            tree[i - 1] += delta;
+        }
+    }
+
+    // The number of marks at times before t.
+    int64_t count_before(uint64_t t) const {
+        int64_t c = 0;
+        for (uint64_t i = t; i > 0; i -= i & (~i + 1)) {
+            c += tree[i - 1];
+        }
+        return c;
+    }
+
+    // Renumber the marks from zero, in order, when time runs out.
+    void compact() {
+        vector<std::pair<uint64_t, uint64_t>> marks;
+        marks.reserve(last_touch.size());
+        for (const auto &l : last_touch) {
+            marks.emplace_back(l.second, l.first);
+        }
+        std::sort(marks.begin(), marks.end());
+        size_t size = tree.size();
+        while (marks.size() * 2 > size) {
+            size *= 2;
+        }
+        for (auto &starts : open) {
+            for (uint64_t &t : starts) {
+                t = std::lower_bound(marks.begin(), marks.end(), std::make_pair(t, (uint64_t)0)) - marks.begin();
+            }
+        }
+        tree.assign(size, 0);
+        for (size_t i = 0; i < marks.size(); i++) {
+            last_touch[marks[i].second] = i;
+            add(i, 1);
+        }
+        now = marks.size();
+    }
+
+    FuncStats &func_stats(uint32_t func) {
+        if (func >= stats.size()) {
+            stats.resize(func + 1);
+            open.resize(func + 1);
+        }
+        return stats[func];
+    }
+
+public:
+    vector<FuncStats> stats;
+
+    ReuseAnalyzer()
+        : tree(1 << 20, 0) {
+    }
+
+    void run(const vector<Access> &accesses) {
+        for (const Access &a : accesses) {
+            FuncStats &s = func_stats(a.func);
+            if (a.kind == Access::BeginRealization) {
+                open[a.func].push_back(now);
+                continue;
+            } else if (a.kind == Access::EndRealization) {
+                if (open[a.func].empty()) {
+                    continue;
+                }
+                uint64_t start = open[a.func].back();
+                open[a.func].pop_back();
+                uint64_t working_set = count_before(now) - count_before(start);
+                s.realizations++;
+                s.working_set_sum += working_set;
+                s.working_set_max = std::max(s.working_set_max, working_set);
+                continue;
+            }
+
+            if (a.kind == Access::Load) {
+                s.loads++;
+            } else {
+                s.stores++;
+            }
+            s.reuse.resize(reuse_buckets);
+
+            if (now == tree.size()) {
+                compact();
+            }
+            auto it = last_touch.find(a.line);
+            if (it == last_touch.end()) {
+                s.cold++;
+                last_touch[a.line] = now;
+            } else {
+                uint64_t distance = count_before(now) - count_before(it->second + 1);
+                s.reuse[log2_bucket(distance)]++;
+                add(it->second, -1);
+                it->second = now;
+            }
+            add(now, 1);
+            now++;
+        }
+    }
+};
+
+// The layout of a realization of a Func in the simulated memory. The
+// values of a Tuple-valued Func are in separate buffers, one after
+// the other.
+struct Layout {
+    uint64_t base = 0;
+    int64_t elements = 0;
+    vector<int> mins;
+    vector<int64_t> strides;
+
+    uint64_t address(const int *coords, int lanes, int lane, int elem_size, int value_index) const {
+        int64_t offset = value_index * elements;
+        for (size_t d = 0; d < mins.size(); d++) {
+            offset += (int64_t)(coords[d * lanes + lane] - mins[d]) * strides[d];
+        }
+        return base + offset * elem_size;
+    }
+};
+
+struct FuncInfo {
+    uint32_t id;
+    // The size of the largest value of the Func, and the number of
+    // values, from the func_type_and_dim trace tag if there is one.
+    int elem_size = 8, num_values = 1;
+    // From the func_type_and_dim trace tag, for accesses outside of
+    // any traced realization.
+    bool has_tag_layout = false;
+    Layout tag_layout;
+    // The realizations in progress, innermost last.
+    vector<Layout> realizations;
+    // Memory reserved for the realizations. Each realization reuses
+    // it if it fits, as a memory allocator would.
+    uint64_t reserved_base = 0, reserved_size = 0;
+    bool warned = false;
+};
+
+class TraceReader {
+    int line_size;
+    map<string, FuncInfo> funcs;
+    // The Func of each realization in progress, by id.
+    std::unordered_map<int32_t, FuncInfo *> realization_funcs;
+    uint64_t next_base = 1 << 20;
+
+    FuncInfo &func_info(const char *name) {
+        auto it = funcs.find(name);
+        if (it == funcs.end()) {
+            it = funcs.emplace(name, FuncInfo()).first;
+            it->second.id = (uint32_t)names.size();
+            names.emplace_back(name);
+        }
+        return it->second;
+    }
+
+    Layout make_layout(FuncInfo &f, const vector<std::pair<int, int>> &bounds) {
+        Layout l;
+        int64_t stride = 1;
+        for (const auto &b : bounds) {
+            l.mins.push_back(b.first);
+            l.strides.push_back(stride);
+            stride *= std::max(b.second, 1);
+        }
+        l.elements = stride;
+        uint64_t size = stride * f.elem_size * f.num_values;
+        if (size > f.reserved_size) {
+            // Leave a page between Funcs, so that they never share a line.
+            f.reserved_base = next_base;
+            f.reserved_size = size;
+            next_base += (size + 8191) & ~(uint64_t)4095;
+        }
+        l.base = f.reserved_base;
+        return l;
+    }
+
+public:
+    vector<string> names;
+    uint64_t unmapped = 0;
+
+    explicit TraceReader(int line_size)
+        : line_size(line_size) {
+    }
+
+    // Turn a packet into accesses.
+    void add(const Packet &p, vector<Access> &accesses) {
+        if (p.event == halide_trace_tag) {
+            if (Trace::FuncTypeAndDim::match(p.trace_tag())) {
+                Trace::FuncTypeAndDim t(p.trace_tag());
+                FuncInfo &f = func_info(p.func());
+                vector<std::pair<int, int>> bounds;
+                for (const auto &r : t.dims) {
+                    bounds.emplace_back(r.min, r.extent);
+                }
+                if (!t.types.empty()) {
+                    f.elem_size = 1;
+                    for (const halide_type_t &type : t.types) {
+                        f.elem_size = std::max(f.elem_size, (int)type.bytes());
+                    }
+                    f.num_values = (int)t.types.size();
+                }
+                f.tag_layout = make_layout(f, bounds);
+                f.has_tag_layout = true;
+            }
+        } else if (p.event == halide_trace_begin_realization) {
+            FuncInfo &f = func_info(p.func());
+            vector<std::pair<int, int>> bounds;
+            for (int d = 0; d + 1 < p.dimensions; d += 2) {
+                bounds.emplace_back(p.coordinates()[d], p.coordinates()[d + 1]);
+            }
+            f.realizations.push_back(make_layout(f, bounds));
+            realization_funcs[p.id] = &f;
+            accesses.push_back({0, f.id, Access::BeginRealization});
+        } else if (p.event == halide_trace_end_realization) {
+            auto it = realization_funcs.find(p.parent_id);
+            if (it != realization_funcs.end()) {
+                FuncInfo &f = *it->second;
+                f.realizations.pop_back();
+                realization_funcs.erase(it);
+                accesses.push_back({0, f.id, Access::EndRealization});
+            }
+        } else if (p.event == halide_trace_load || p.event == halide_trace_store) {
+            FuncInfo &f = func_info(p.func());
+            const Layout *layout = nullptr;
+            if (!f.realizations.empty()) {
+                layout = &f.realizations.back();
+            } else if (f.has_tag_layout) {
+                layout = &f.tag_layout;
+            }
+            int lanes = p.type.lanes;
+            if (!layout || (int)layout->mins.size() * lanes != p.dimensions) {
+                if (!f.warned) {
+                    fprintf(stderr, "Warning: no layout for the accesses to %s. "
+                                    "Trace its realizations, or enable trace tags.\n",
+                            p.func());
+                    f.warned = true;
+                }
+                unmapped++;
+                return;
+            }
+            // A vector access touches each line spanned by its lanes once.
+            Access::Kind kind = p.event == halide_trace_load ? Access::Load : Access::Store;
+            int elem_size = std::max(1, (int)p.type.bytes());
+            uint64_t last_line = UINT64_MAX;
+            for (int lane = 0; lane < lanes; lane++) {
+                uint64_t addr = layout->address(p.coordinates(), lanes, lane, elem_size, p.value_index);
+                uint64_t line = addr / line_size;
+                if (line != last_line) {
+                    accesses.push_back({line, f.id, kind});
+                    last_line = line;
+                }
+            }
+        }
+    }
+};
+
+uint64_t parse_size(const string &s) {
+    char *end;
+    uint64_t size = strtoull(s.c_str(), &end, 10);
+    switch (*end) {
+    case 'k':
+    case 'K':
+        return size << 10;
+    case 'm':
+    case 'M':
+        return size << 20;
+    case 'g':
+    case 'G':
+        return size << 30;
+    default:
+        return size;
+    }
+}
+
+string format_size(uint64_t bytes) {
+    char buf[64];
+    if (bytes >= (1 << 20)) {
+        snprintf(buf, sizeof(buf), "%.1fMB", bytes / (1024.0 * 1024.0));
+    } else if (bytes >= (1 << 10)) {
+        snprintf(buf, sizeof(buf), "%.1fKB", bytes / 1024.0);
+    } else {
+        snprintf(buf, sizeof(buf), "%dB", (int)bytes);
+    }
+    return buf;
+}
+
+void usage(char *const *argv) {
+    const string usage =
+        "Usage: " + string(argv[0]) +
+        " -i trace_file [-c caches] [-l line_size] [-j threads]\n"
+        "\n"
+        "This tool reads a binary trace produced by Halide, and simulates the\n"
+        "loads and stores in it on a hierarchy of caches. It reports, for each\n"
+        "Func, the fraction of its accesses served by each level of the cache,\n"
+        "the distribution of the reuse distances of its accesses, and the\n"
+        "working set of its realizations.\n"
+        "To generate a suitable binary trace, use Func::trace_loads() and\n"
+        "Func::trace_stores(), or the target feature trace_all, and run with\n"
+        "HL_TRACE_FILE=<filename>. Trace filters give misleading results here.\n"
+        "\n"
+        "  -c caches     The caches, innermost first, as name:size:ways, separated\n"
+        "                by commas. Sizes may end in K, M or G.\n"
+        "                The default is L1:32K:8,L2:1M:16,L3:32M:16\n"
+        "  -l line_size  The cache line size in bytes. The default is 64.\n"
+        "  -j threads    The number of threads simulating the caches. The default\n"
+        "                is the number of cores.\n";
+    fprintf(stderr, "%s\n", usage.c_str());
+    exit(1);
+}
+
+}  // namespace
+
+int main(int argc, char *const *argv) {
+    char *trace_filename = nullptr;
+    string cache_spec = "L1:32K:8,L2:1M:16,L3:32M:16";
+    int line_size = 64;
+    int threads = std::max(1, (int)std::thread::hardware_concurrency());
+    for (int i = 1; i < argc - 1; i++) {
+        string arg = argv[i];
+        if (arg == "-i") {
+            trace_filename = argv[++i];
+        } else if (arg == "-c") {
+            cache_spec = argv[++i];
+        } else if (arg == "-l") {
+            line_size = atoi(argv[++i]);
+        } else if (arg == "-j") {
+            threads = std::max(1, atoi(argv[++i]));
+        } else {
+            usage(argv);
+        }
+    }
+    if (trace_filename == nullptr || line_size <= 0 || (line_size & (line_size - 1))) {
+        usage(argv);
+    }
+
+    vector<CacheConfig> levels;
+    int min_sets = INT32_MAX;
+    size_t start = 0;
+    while (start < cache_spec.size()) {
+        size_t end = cache_spec.find(',', start);
+        if (end == string::npos) {
+            end = cache_spec.size();
+        }
+        string level = cache_spec.substr(start, end - start);
+        start = end + 1;
+        size_t c1 = level.find(':'), c2 = level.rfind(':');
+        if (c1 == string::npos || c1 == c2) {
+            usage(argv);
+        }
+        CacheConfig c;
+        c.name = level.substr(0, c1);
+        c.size = parse_size(level.substr(c1 + 1, c2 - c1 - 1));
+        c.ways = atoi(level.substr(c2 + 1).c_str());
+        if (c.ways <= 0 || c.size % ((uint64_t)c.ways * line_size) != 0) {
+            fprintf(stderr, "Error: cache %s isn't a whole number of sets of lines.\n", c.name.c_str());
+            exit(1);
+        }
+        c.sets = (int)(c.size / ((uint64_t)c.ways * line_size));
+        if (c.sets & (c.sets - 1)) {
+            fprintf(stderr, "Error: cache %s must have a power of two sets.\n", c.name.c_str());
+            exit(1);
+        }
+        min_sets = std::min(min_sets, c.sets);
+        levels.push_back(c);
+    }
+    if (levels.empty()) {
+        usage(argv);
+    }
+
+    // The caches are split between threads by the low bits of the
+    // lines, which must be the low bits of the sets of every level.
+    // One more thread measures reuse distances.
+    int parts = 1;
+    while (parts * 2 <= std::max(1, threads - 1) && parts * 2 <= min_sets) {
+        parts *= 2;
+    }
+
+    FILE *file = fopen(trace_filename, "rb");
+    if (file == nullptr) {
+        fprintf(stderr, "Error opening file: %s. Exiting.\n", trace_filename);
+        exit(1);
+    }
+    TraceStream stream(file);
+    TraceReader reader(line_size);
+
+    vector<CacheSimulator> simulators;
+    for (int i = 0; i < parts; i++) {
+        simulators.emplace_back(levels, i, parts);
+    }
+    ReuseAnalyzer reuse;
+
+    // Parse a batch of packets while the previous batch is simulated.
+    const size_t batch_size = 1 << 20;
+    vector<Access> batch, in_flight;
+    vector<std::thread> workers;
+    auto finish_batch = [&]() {
+        for (std::thread &t : workers) {
+            t.join();
+        }
+        workers.clear();
+    };
+    auto start_batch = [&]() {
+        finish_batch();
+        std::swap(batch, in_flight);
+        batch.clear();
+        for (CacheSimulator &s : simulators) {
+            workers.emplace_back([&s, &in_flight]() { s.run(in_flight); });
+        }
+        workers.emplace_back([&reuse, &in_flight]() { reuse.run(in_flight); });
+    };
+
+    uint64_t packets = 0;
+    Packet p;
+    while (p.read_from_stream(stream)) {
+        packets++;
+        reader.add(p, batch);
+        if (batch.size() >= batch_size) {
+            start_batch();
+        }
+    }
+    start_batch();
+    finish_batch();
+    fclose(file);
+
+    // Gather up the results.
+    vector<FuncStats> &stats = reuse.stats;
+    stats.resize(reader.names.size());
+    for (FuncStats &s : stats) {
+        s.served.resize(levels.size() + 1);
+        s.reuse.resize(reuse_buckets);
+    }
+    for (const CacheSimulator &sim : simulators) {
+        for (size_t f = 0; f < sim.stats.size(); f++) {
+            for (size_t l = 0; l < sim.stats[f].served.size(); l++) {
+                stats[f].served[l] += sim.stats[f].served[l];
+            }
+        }
+    }
+
+    printf("Read %llu packets, using %d threads.", (unsigned long long)packets, parts + 1);
+    if (reader.unmapped) {
+        printf(" %llu accesses had no layout and were skipped.", (unsigned long long)reader.unmapped);
+    }
+    printf("\n\nCaches:");
+    for (const CacheConfig &c : levels) {
+        printf(" %s %s %d-way,", c.name.c_str(), format_size(c.size).c_str(), c.ways);
+    }
+    printf(" %d-byte lines\n", line_size);
+
+    size_t name_width = 4;
+    for (const string &n : reader.names) {
+        name_width = std::max(name_width, n.size());
+    }
+
+    printf("\nThe fraction of the lines accessed served by each level:\n");
+    printf("  %-*s %12s %12s", (int)name_width, "Func", "Loads", "Stores");
+    for (const CacheConfig &c : levels) {
+        printf(" %7s", c.name.c_str());
+    }
+    printf(" %7s\n", "Memory");
+    for (size_t f = 0; f < stats.size(); f++) {
+        const FuncStats &s = stats[f];
+        uint64_t total = s.loads + s.stores;
+        if (total == 0) {
+            continue;
+        }
+        printf("  %-*s %12llu %12llu", (int)name_width, reader.names[f].c_str(),
+               (unsigned long long)s.loads, (unsigned long long)s.stores);
+        for (uint64_t served : s.served) {
+            printf(" %6.2f%%", 100.0 * served / total);
+        }
+        printf("\n");
+    }
+
+    // Report reuse distances against the sizes of the caches.
+    printf("\nThe fraction of accesses that reuse a line, within a reuse distance\n"
+           "of the number of lines in each cache, and the fraction that touch a\n"
+           "line for the first time:\n");
+    printf("  %-*s", (int)name_width, "Func");
+    for (const CacheConfig &c : levels) {
+        printf(" %7s", ("<=" + c.name).c_str());
+    }
+    printf(" %7s %7s\n", "Beyond", "Cold");
+    for (size_t f = 0; f < stats.size(); f++) {
+        const FuncStats &s = stats[f];
+        uint64_t total = s.loads + s.stores;
+        if (total == 0) {
+            continue;
+        }
+        printf("  %-*s", (int)name_width, reader.names[f].c_str());
+        uint64_t within = 0;
+        int bucket = 0;
+        for (const CacheConfig &c : levels) {
+            // Bucket b holds distances in [2^b, 2^(b+1)).
+            uint64_t lines = c.size / line_size;
+            while (bucket < reuse_buckets && ((uint64_t)2 << bucket) <= lines) {
+                within += s.reuse[bucket++];
+            }
+            printf(" %6.2f%%", 100.0 * within / total);
+        }
+        uint64_t reused = total - s.cold;
+        printf(" %6.2f%% %6.2f%%\n", 100.0 * (reused - within) / total, 100.0 * s.cold / total);
+    }
+
+    printf("\nThe memory touched during each realization of a Func, which is the\n"
+           "working set of the loop level it is computed at:\n");
+    printf("  %-*s %12s %10s %10s\n", (int)name_width, "Func", "Realizations", "Mean", "Max");
+    for (size_t f = 0; f < stats.size(); f++) {
+        const FuncStats &s = stats[f];
+        if (s.realizations == 0) {
+            continue;
+        }
+        printf("  %-*s %12llu %10s %10s\n", (int)name_width, reader.names[f].c_str(),
+               (unsigned long long)s.realizations,
+               format_size(s.working_set_sum / s.realizations * line_size).c_str(),
+               format_size(s.working_set_max * line_size).c_str());
+    }
+
+    return 0;
+}
@@ -4,6 +4,7 @@
 
 #include <fcntl.h>
 #include <map>
+#include <set>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -24,6 +25,7 @@ using namespace Internal;
 
 using Halide::Runtime::Buffer;
 using std::map;
+using std::set;
 using std::string;
 using std::vector;
 
@@ -48,7 +50,7 @@ struct FuncInfo {
 
     FuncInfo() {
     }
-    FuncInfo(Packet *p) {
+    FuncInfo(const Packet *p) {
         int real_dims = p->dimensions / p->type.lanes;
         if (real_dims > 16) {
             fprintf(stderr, "Error: found trace packet with dimensionality > 16. Aborting.\n");
@@ -63,7 +65,7 @@ struct FuncInfo {
         type.lanes = 1;
     }
 
-    void add_preprocess(Packet *p) {
+    void add_preprocess(const Packet *p) {
         int real_dims = p->dimensions / p->type.lanes;
         int lanes = p->type.lanes;
 
@@ -103,7 +105,7 @@ struct FuncInfo {
         }
     }
 
-    void add(Packet *p) {
+    void add(const Packet *p) {
         halide_type_t scalar_type = p->type;
         scalar_type.lanes = 1;
         if (scalar_type == halide_type_of<float>()) {
@@ -135,7 +137,7 @@ struct FuncInfo {
     }
 
     template<typename T>
-    void add_typed(Packet *p) {
+    void add_typed(const Packet *p) {
         Buffer<T> &buf = values.as<T>();
         int lanes = p->type.lanes;
 
@@ -272,13 +274,20 @@ void finish_dump(map<string, FuncInfo> &func_info, BufferOutputOpts output_opts)
 void usage(char *const *argv) {
     const string usage =
         "Usage: " + string(argv[0]) +
-        " -i trace_file -t {png,jpg,pgm,tmp,mat}\n"
+        " -i trace_file -t {png,jpg,pgm,tmp,mat} [-f func]... [-x index_file]\n"
         "\n"
         "This tool reads a binary trace produced by Halide, and dumps all\n"
         "Funcs into individual image files in the current directory.\n"
         "To generate a suitable binary trace, use Func::trace_stores(), or the\n"
         "target features trace_stores and trace_realizations, and run with\n"
-        "HL_TRACE_FILE=<filename>.\n";
+        "HL_TRACE_FILE=<filename>. Traces compressed with HL_TRACE_COMPRESS=1\n"
+        "are read too.\n"
+        "\n"
+        "  -f func        Only dump this Func. May be given more than once.\n"
+        "  -x index_file  Use an index of the trace to read only the parts of\n"
+        "                 it with the Funcs being dumped. The index is made by\n"
+        "                 reading the whole trace, if the file doesn't exist\n"
+        "                 or is for a different trace.\n";
     fprintf(stderr, "%s\n", usage.c_str());
     exit(1);
 }
@@ -286,6 +295,8 @@ void usage(char *const *argv) {
 int main(int argc, char *const *argv) {
     char *buf_filename = nullptr;
     char *buf_imagetype = nullptr;
+    char *index_filename = nullptr;
+    set<string> funcs;
     BufferOutputOpts outputopts;
     for (int i = 1; i < argc - 1; i++) {
         string arg = argv[i];
@@ -295,6 +306,12 @@ int main(int argc, char *const *argv) {
         } else if (arg == "-i") {
             i++;
             buf_filename = argv[i];
+        } else if (arg == "-f") {
+            i++;
+            funcs.insert(argv[i]);
+        } else if (arg == "-x") {
+            i++;
+            index_filename = argv[i];
         }
     }
 
@@ -326,71 +343,104 @@ int main(int argc, char *const *argv) {
         exit(1);
     }
 
-    printf("[INFO] Starting parse of binary trace...\n");
-    int packet_count = 0;
-
-    map<string, FuncInfo> func_info;
-
-    printf("[INFO] First pass...\n");
-
-    for (;;) {
-        Packet p;
-        if (!p.read_from_filedesc(file_desc)) {
-            printf("[INFO] Finished pass 1 after %d packets.\n", packet_count);
-            break;
-        }
+    TraceStream stream(file_desc);
 
-        // Packet read was successful.
-        packet_count++;
-        if ((packet_count % 100000) == 0) {
-            printf("[INFO] Pass 1: Read %d packets so far.\n", packet_count);
+    TraceIndex index;
+    bool indexed = false;
+    if (index_filename != nullptr) {
+        fseek(file_desc, 0, SEEK_END);
+        uint64_t trace_size = stream.tell();
+        stream.rewind();
+        if (index.load(index_filename) && index.trace_size() == trace_size) {
+            printf("[INFO] Using index %s\n", index_filename);
+        } else {
+            printf("[INFO] Indexing trace...\n");
+            index.build(stream);
+            if (!index.save(index_filename)) {
+                fprintf(stderr, "Error: couldn't write index file %s\n", index_filename);
+            }
         }
+        indexed = true;
+    }
 
-        // Check if this was a store packet.
-        if ((p.event == halide_trace_store) || (p.event == halide_trace_load)) {
-            if (func_info.find(string(p.func())) == func_info.end()) {
-                printf("[INFO] Found Func with tracked accesses: %s\n", p.func());
-                func_info[string(p.func())] = FuncInfo(&p);
+    // Call f on each load and store packet of the Funcs being dumped.
+    auto for_each_access = [&](int pass, const std::function<void(const Packet &)> &f) {
+        int packet_count = 0;
+        auto count = [&]() {
+            packet_count++;
+            if ((packet_count % 100000) == 0) {
+                printf("[INFO] Pass %d: Read %d packets so far.\n", pass, packet_count);
+            }
+        };
+        auto is_access = [](const Packet &p) {
+            return (p.event == halide_trace_store) || (p.event == halide_trace_load);
+        };
+        if (indexed) {
+            vector<TraceQuery> queries;
+            if (funcs.empty()) {
+                queries.emplace_back();
+            }
+            for (const string &func : funcs) {
+                TraceQuery query;
+                query.func = func;
+                queries.push_back(query);
+            }
+            for (const TraceQuery &query : queries) {
+                if (pass == 1) {
+                    printf("[INFO] Reading %d of %d chunks of the trace%s%s\n",
+                           (int)index.num_chunks(query), (int)index.num_chunks(),
+                           query.func.empty() ? "" : " for ", query.func.c_str());
+                }
+                index.read(stream, query, [&](const Packet &p) {
+                    count();
+                    if (is_access(p)) {
+                        f(p);
+                    }
+                });
+            }
+        } else {
+            stream.rewind();
+            if (ferror(file_desc)) {
+                fprintf(stderr, "Error: couldn't seek back to beginning of trace file. Aborting.\n");
+                exit(-1);
+            }
+            Packet p;
+            while (p.read_from_stream(stream)) {
+                count();
+                if (is_access(p) && (funcs.empty() || funcs.count(p.func()))) {
+                    f(p);
+                }
             }
-            func_info[string(p.func())].add_preprocess(&p);
         }
-    }
+        printf("[INFO] Finished pass %d after %d packets.\n", pass, packet_count);
+    };
 
-    packet_count = 0;
-    fseek(file_desc, 0, SEEK_SET);
-    if (ferror(file_desc)) {
-        fprintf(stderr, "Error: couldn't seek back to beginning of trace file. Aborting.\n");
-        exit(-1);
-    }
+    printf("[INFO] Starting parse of binary trace...\n");
+
+    map<string, FuncInfo> func_info;
+
+    printf("[INFO] First pass...\n");
+    for_each_access(1, [&](const Packet &p) {
+        if (func_info.find(string(p.func())) == func_info.end()) {
+            printf("[INFO] Found Func with tracked accesses: %s\n", p.func());
+            func_info[string(p.func())] = FuncInfo(&p);
+        }
+        func_info[string(p.func())].add_preprocess(&p);
+    });
 
     for (auto &pair : func_info) {
         pair.second.allocate();
     }
 
-    for (;;) {
-        Packet p;
-        if (!p.read_from_filedesc(file_desc)) {
-            printf("[INFO] Finished pass 2 after %d packets.\n", packet_count);
-            if (file_desc != nullptr) {
-                fclose(file_desc);
-            }
-            finish_dump(func_info, outputopts);
-            exit(0);
-        }
-
-        // Packet read was successful.
-        packet_count++;
-        if ((packet_count % 100000) == 0) {
-            printf("[INFO] Pass 2: Read %d packets so far.\n", packet_count);
+    for_each_access(2, [&](const Packet &p) {
+        if (func_info.find(string(p.func())) == func_info.end()) {
+            fprintf(stderr, "Unable to find Func on 2nd pass. Aborting.\n");
+            exit(-1);
         }
+        func_info[string(p.func())].add(&p);
+    });
 
-        // Check if this was a store packet.
-        if ((p.event == halide_trace_store) || (p.event == halide_trace_load)) {
-            if (func_info.find(string(p.func())) == func_info.end()) {
-                fprintf(stderr, "Unable to find Func on 2nd pass. Aborting.\n");
-                exit(-1);
-            }
-            func_info[string(p.func())].add(&p);
-        }
-    }
+    fclose(file_desc);
+    finish_dump(func_info, outputopts);
+    return 0;
 }
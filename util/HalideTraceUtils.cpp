@@ -1,5 +1,7 @@
 #include "HalideTraceUtils.h"
+#include <algorithm>
 #include <assert.h>
+#include <set>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -44,6 +46,451 @@ bool Packet::read(void *d, size_t size, FILE *fdesc) {
     return true;
 }
 
+bool Packet::read_from_stream(TraceStream &stream) {
+    return stream.read_packet(this, sizeof(Packet));
+}
+
+bool lz4_decompress(const uint8_t *src, size_t src_size, uint8_t *dst, size_t dst_size) {
+    const uint8_t *ip = src, *ip_end = src + src_size;
+    uint8_t *op = dst, *op_end = dst + dst_size;
+    while (ip < ip_end) {
+        uint8_t token = *ip++;
+
+        size_t literals = token >> 4;
+        if (literals == 15) {
+            uint8_t b;
+            do {
+                if (ip == ip_end) {
+                    return false;
+                }
+                b = *ip++;
+                literals += b;
+            } while (b == 255);
+        }
+        if (literals > (size_t)(ip_end - ip) || literals > (size_t)(op_end - op)) {
+            return false;
+        }
+        memcpy(op, ip, literals);
+        ip += literals;
+        op += literals;
+        if (ip == ip_end) {
+            // The last sequence has only literals.
+            break;
+        }
+
+        if (ip_end - ip < 2) {
+            return false;
+        }
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst)) {
+            return false;
+        }
+        size_t length = token & 15;
+        if (length == 15) {
+            uint8_t b;
+            do {
+                if (ip == ip_end) {
+                    return false;
+                }
+                b = *ip++;
+                length += b;
+            } while (b == 255);
+        }
+        length += 4;
+        if (length > (size_t)(op_end - op)) {
+            return false;
+        }
+        // The match may overlap the bytes it produces, so copy a byte
+        // at a time.
+        const uint8_t *match = op - offset;
+        for (size_t i = 0; i < length; i++) {
+            op[i] = match[i];
+        }
+        op += length;
+    }
+    return op == op_end;
+}
+
+bool TraceStream::read_packet(halide_trace_packet_t *p, size_t max_size) {
+    const size_t header_size = sizeof(halide_trace_packet_t);
+    if (block_pos == block.size()) {
+        // Between blocks, the next word is either the size of a packet
+        // or the start of a compressed block.
+        uint32_t word;
+        if (!read(&word, sizeof(word))) {
+            return false;
+        }
+        if (word == HALIDE_TRACE_BLOCK_MAGIC) {
+            if (!read_block()) {
+                return false;
+            }
+            if (!read(p, header_size)) {
+                fprintf(stderr, "Empty block in trace stream\n");
+                return false;
+            }
+        } else {
+            p->size = word;
+            if (!read((uint8_t *)p + sizeof(word), header_size - sizeof(word))) {
+                fprintf(stderr, "Unexpected EOF mid-packet\n");
+                return false;
+            }
+        }
+    } else if (!read(p, header_size)) {
+        return false;
+    }
+    if (p->size < header_size || p->size > max_size) {
+        fprintf(stderr, "Bad packet size in trace stream (%d)\n", (int)p->size);
+        abort();
+    }
+    if (!read((uint8_t *)p + header_size, p->size - header_size)) {
+        fprintf(stderr, "Unexpected EOF mid-packet\n");
+        return false;
+    }
+    return true;
+}
+
+void TraceStream::rewind() {
+    seek(0);
+}
+
+uint64_t TraceStream::tell() {
+#ifdef _MSC_VER
+    return (uint64_t)_ftelli64(file);
+#else
+    return (uint64_t)ftello(file);
+#endif
+}
+
+void TraceStream::seek(uint64_t offset) {
+#ifdef _MSC_VER
+    _fseeki64(file, (int64_t)offset, SEEK_SET);
+#else
+    fseeko(file, (off_t)offset, SEEK_SET);
+#endif
+    block.clear();
+    block_pos = 0;
+}
+
+bool TraceStream::read(void *d, size_t size) {
+    if (block_pos < block.size()) {
+        if (size > block.size() - block_pos) {
+            // Packets never straddle blocks.
+            fprintf(stderr, "Packet runs off the end of a compressed block\n");
+            abort();
+        }
+        memcpy(d, block.data() + block_pos, size);
+        block_pos += size;
+        return true;
+    }
+    if (!size) {
+        return true;
+    }
+    size_t s = fread(d, 1, size, file);
+    if (s != size) {
+        if (ferror(file) || !feof(file)) {
+            perror("Failed during read");
+            exit(-1);
+        }
+        return false;  // EOF
+    }
+    return true;
+}
+
+bool TraceStream::read_block() {
+    // The magic number has already been read.
+    halide_trace_block_header_t header;
+    const size_t rest = sizeof(header) - sizeof(header.magic);
+    if (!read((uint8_t *)&header + sizeof(header.magic), rest)) {
+        fprintf(stderr, "Unexpected EOF in block header\n");
+        return false;
+    }
+    compressed.resize(header.compressed_size);
+    if (!read(compressed.data(), compressed.size())) {
+        fprintf(stderr, "Unexpected EOF mid-block\n");
+        return false;
+    }
+    std::vector<uint8_t> raw(header.raw_size);
+    if (!lz4_decompress(compressed.data(), compressed.size(), raw.data(), raw.size())) {
+        fprintf(stderr, "Corrupt compressed block in trace stream\n");
+        exit(-1);
+    }
+    block.swap(raw);
+    block_pos = 0;
+    return true;
+}
+
+namespace {
+
+// Chunks of the index start at the first block boundary after this
+// many bytes of packets. The runtime writes compressed blocks of up
+// to a megabyte, so each full block is a chunk.
+const size_t trace_index_chunk_size = 512 * 1024;
+
+const uint32_t trace_index_magic = 0x58495448;  // "HTIX"
+const uint32_t trace_index_version = 1;
+
+void write_u32(FILE *f, uint32_t x) {
+    fwrite(&x, sizeof(x), 1, f);
+}
+
+void write_u64(FILE *f, uint64_t x) {
+    fwrite(&x, sizeof(x), 1, f);
+}
+
+bool read_u32(FILE *f, uint32_t *x) {
+    return fread(x, sizeof(*x), 1, f) == 1;
+}
+
+bool read_u64(FILE *f, uint64_t *x) {
+    return fread(x, sizeof(*x), 1, f) == 1;
+}
+
+}  // namespace
+
+uint32_t TraceIndex::key_id(const std::string &func, int event) {
+    auto key = std::make_pair(func, event);
+    auto it = key_ids.find(key);
+    if (it != key_ids.end()) {
+        return it->second;
+    }
+    uint32_t id = (uint32_t)keys.size();
+    keys.push_back(key);
+    key_ids[key] = id;
+    return id;
+}
+
+void TraceIndex::build(TraceStream &stream) {
+    keys.clear();
+    key_ids.clear();
+    chunks.clear();
+    realizations.clear();
+
+    // The realizations that have begun and not yet ended, by id.
+    std::map<int32_t, std::pair<std::string, size_t>> open;
+    std::set<uint32_t> chunk_keys;
+    size_t chunk_bytes = 0;
+
+    stream.rewind();
+    Packet p;
+    for (;;) {
+        if (stream.at_block_boundary() && (chunks.empty() || chunk_bytes >= trace_index_chunk_size)) {
+            if (!chunks.empty()) {
+                chunks.back().keys.assign(chunk_keys.begin(), chunk_keys.end());
+            }
+            chunks.push_back({stream.tell(), 0, {}});
+            chunk_keys.clear();
+            chunk_bytes = 0;
+        }
+        if (!p.read_from_stream(stream)) {
+            break;
+        }
+        uint32_t chunk = (uint32_t)(chunks.size() - 1);
+        chunks.back().packets++;
+        chunk_bytes += p.size;
+        chunk_keys.insert(key_id(p.func(), p.event));
+
+        if (p.event == halide_trace_begin_realization) {
+            std::vector<Realization> &r = realizations[p.func()];
+            open[p.id] = std::make_pair(std::string(p.func()), r.size());
+            r.push_back({p.id, chunk, chunk});
+        } else if (p.event == halide_trace_end_realization) {
+            auto it = open.find(p.parent_id);
+            if (it != open.end()) {
+                realizations[it->second.first][it->second.second].last_chunk = chunk;
+                open.erase(it);
+            }
+        }
+    }
+    if (chunks.back().packets == 0) {
+        chunks.pop_back();
+    } else {
+        chunks.back().keys.assign(chunk_keys.begin(), chunk_keys.end());
+    }
+    // Realizations that never ended run to the end of the trace.
+    for (const auto &o : open) {
+        realizations[o.second.first][o.second.second].last_chunk = (uint32_t)(chunks.size() - 1);
+    }
+    trace_bytes = stream.tell();
+}
+
+bool TraceIndex::save(const std::string &filename) const {
+    FILE *f = fopen(filename.c_str(), "wb");
+    if (!f) {
+        return false;
+    }
+    write_u32(f, trace_index_magic);
+    write_u32(f, trace_index_version);
+    write_u64(f, trace_bytes);
+    write_u32(f, (uint32_t)keys.size());
+    for (const auto &k : keys) {
+        write_u32(f, (uint32_t)k.first.size());
+        fwrite(k.first.data(), 1, k.first.size(), f);
+        write_u32(f, (uint32_t)k.second);
+    }
+    write_u32(f, (uint32_t)chunks.size());
+    for (const Chunk &c : chunks) {
+        write_u64(f, c.offset);
+        write_u32(f, c.packets);
+        write_u32(f, (uint32_t)c.keys.size());
+        for (uint32_t k : c.keys) {
+            write_u32(f, k);
+        }
+    }
+    write_u32(f, (uint32_t)realizations.size());
+    for (const auto &r : realizations) {
+        write_u32(f, (uint32_t)r.first.size());
+        fwrite(r.first.data(), 1, r.first.size(), f);
+        write_u32(f, (uint32_t)r.second.size());
+        for (const Realization &i : r.second) {
+            write_u32(f, (uint32_t)i.id);
+            write_u32(f, i.first_chunk);
+            write_u32(f, i.last_chunk);
+        }
+    }
+    bool ok = !ferror(f);
+    return (fclose(f) == 0) && ok;
+}
+
+bool TraceIndex::load(const std::string &filename) {
+    FILE *f = fopen(filename.c_str(), "rb");
+    if (!f) {
+        return false;
+    }
+    auto read_string = [&](std::string *str) {
+        uint32_t size;
+        if (!read_u32(f, &size)) {
+            return false;
+        }
+        str->resize(size);
+        return size == 0 || fread(&(*str)[0], 1, size, f) == size;
+    };
+
+    keys.clear();
+    key_ids.clear();
+    chunks.clear();
+    realizations.clear();
+    bool ok = true;
+    uint32_t magic, version, count;
+    ok = read_u32(f, &magic) && magic == trace_index_magic &&
+         read_u32(f, &version) && version == trace_index_version &&
+         read_u64(f, &trace_bytes) &&
+         read_u32(f, &count);
+    for (uint32_t i = 0; ok && i < count; i++) {
+        std::string func;
+        uint32_t event;
+        ok = read_string(&func) && read_u32(f, &event);
+        key_id(func, (int)event);
+    }
+    ok = ok && read_u32(f, &count);
+    for (uint32_t i = 0; ok && i < count; i++) {
+        Chunk c;
+        uint32_t num_keys;
+        ok = read_u64(f, &c.offset) && read_u32(f, &c.packets) && read_u32(f, &num_keys);
+        c.keys.resize(ok ? num_keys : 0);
+        for (uint32_t &k : c.keys) {
+            ok = ok && read_u32(f, &k) && k < keys.size();
+        }
+        chunks.push_back(c);
+    }
+    ok = ok && read_u32(f, &count);
+    for (uint32_t i = 0; ok && i < count; i++) {
+        std::string func;
+        uint32_t num;
+        ok = read_string(&func) && read_u32(f, &num);
+        std::vector<Realization> &r = realizations[func];
+        for (uint32_t j = 0; ok && j < num; j++) {
+            uint32_t id;
+            Realization real;
+            ok = read_u32(f, &id) && read_u32(f, &real.first_chunk) && read_u32(f, &real.last_chunk) &&
+                 real.last_chunk < chunks.size();
+            real.id = (int32_t)id;
+            r.push_back(real);
+        }
+    }
+    fclose(f);
+    return ok;
+}
+
+std::vector<size_t> TraceIndex::find_chunks(const TraceQuery &query) const {
+    std::vector<size_t> result;
+
+    size_t first = 0, last = chunks.size();
+    if (query.realization >= 0) {
+        auto it = realizations.find(query.func);
+        if (it == realizations.end() || query.realization >= (int)it->second.size()) {
+            return result;
+        }
+        first = it->second[query.realization].first_chunk;
+        last = it->second[query.realization].last_chunk + 1;
+    }
+
+    // The keys a chunk must have one of. A realization is found by
+    // following the parent ids from its begin_realization packet, so
+    // it needs every event of the Func.
+    std::vector<bool> wanted(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        wanted[i] = (query.func.empty() || keys[i].first == query.func) &&
+                    (query.event < 0 || query.realization >= 0 || keys[i].second == query.event);
+    }
+
+    for (size_t i = first; i < last; i++) {
+        for (uint32_t k : chunks[i].keys) {
+            if (wanted[k]) {
+                result.push_back(i);
+                break;
+            }
+        }
+    }
+    return result;
+}
+
+size_t TraceIndex::num_chunks(const TraceQuery &query) const {
+    return find_chunks(query).size();
+}
+
+void TraceIndex::read(TraceStream &stream, const TraceQuery &query,
+                      const std::function<void(const Packet &)> &f) const {
+    // The ids of the packets of the realization, to match the packets
+    // whose parents they are.
+    std::set<int32_t> ids;
+    if (query.realization >= 0) {
+        auto it = realizations.find(query.func);
+        if (it == realizations.end() || query.realization >= (int)it->second.size()) {
+            return;
+        }
+        ids.insert(it->second[query.realization].id);
+    }
+
+    Packet p;
+    size_t next = (size_t)-1;
+    for (size_t c : find_chunks(query)) {
+        if (c != next) {
+            stream.seek(chunks[c].offset);
+        }
+        next = c + 1;
+        for (uint32_t i = 0; i < chunks[c].packets; i++) {
+            if (!p.read_from_stream(stream)) {
+                fprintf(stderr, "Trace ended before the end of an indexed chunk. Is the index out of date?\n");
+                exit(-1);
+            }
+            if (!query.func.empty() && query.func != p.func()) {
+                continue;
+            }
+            if (query.realization >= 0) {
+                if (ids.count(p.id) == 0 && ids.count(p.parent_id) == 0) {
+                    continue;
+                }
+                ids.insert(p.id);
+            }
+            if (query.event >= 0 && query.event != p.event) {
+                continue;
+            }
+            f(p);
+        }
+    }
+}
+
 void bad_type_error(halide_type_t type) {
     fprintf(stderr, "Can't convert packet with type: %d bits: %d\n", type.code, type.bits);
     exit(-1);
@@ -3,7 +3,11 @@
 
 #include "HalideRuntime.h"
 #include <cstring>
+#include <functional>
+#include <map>
 #include <stdio.h>
+#include <string>
+#include <vector>
 
 namespace Halide {
 namespace Internal {
@@ -60,6 +64,52 @@ T value_as(halide_type_t type, const halide_scalar_value_t &value) {
     return (T)0;
 }
 
+// Decompress a block in the LZ4 block format. Returns false if the
+// block is corrupt, or doesn't decompress to exactly dst_size bytes.
+bool lz4_decompress(const uint8_t *src, size_t src_size, uint8_t *dst, size_t dst_size);
+
+// Reads the packets of a binary trace from a file. Traces written with
+// HL_TRACE_COMPRESS=1 are decompressed a block at a time as they are
+// read.
+class TraceStream {
+public:
+    explicit TraceStream(FILE *file)
+        : file(file) {
+    }
+
+    // Read the next packet into p, which has room for max_size bytes
+    // in all. Returns false at the end of the trace.
+    bool read_packet(halide_trace_packet_t *p, size_t max_size);
+
+    // Go back to the start of the trace. The file must be seekable.
+    void rewind();
+
+    // Whether the next packet is the first of a compressed block, or
+    // not in one. Only these packets can be seeked to.
+    bool at_block_boundary() const {
+        return block_pos == block.size();
+    }
+
+    // The offset in the file of the next packet, or of the block it
+    // starts. Only meaningful at a block boundary.
+    uint64_t tell();
+
+    // Go to a packet or block at an offset given by tell(). The file
+    // must be seekable.
+    void seek(uint64_t offset);
+
+private:
+    FILE *file;
+    // The decompressed block being read, and how far into it we are.
+    std::vector<uint8_t> block, compressed;
+    size_t block_pos = 0;
+
+    // Read size bytes, from the current block if there is one, and
+    // from the file if not. Returns false at the end of the file.
+    bool read(void *d, size_t size);
+    bool read_block();
+};
+
 // A struct representing a single Halide tracing packet.
 struct Packet : public halide_trace_packet_t {
     // Not all of this will be used, but this
@@ -89,11 +139,90 @@ struct Packet : public halide_trace_packet_t {
     // Grab a packet from a particular fctl file descriptor. Returns false when end is reached.
     bool read_from_filedesc(FILE *fdesc);
 
+    // Grab the next packet from a trace stream, which may be
+    // compressed. Returns false when the end is reached.
+    bool read_from_stream(TraceStream &stream);
+
 private:
     // Do a blocking read of some number of bytes from a unistd file descriptor.
     bool read(void *d, size_t size, FILE *fdesc);
 };
 
+// A subset of the packets of a trace to read.
+struct TraceQuery {
+    // Only packets of this Func, or of every Func if empty.
+    std::string func;
+
+    // Only packets with this event code, or with any if negative.
+    int event = -1;
+
+    // Only packets of this realization of the Func, numbered from
+    // zero in the order they began, or of all of them if negative.
+    // Needs the realizations to have been traced, and a Func.
+    int realization = -1;
+};
+
+// An index of a binary trace, recording which Funcs and events
+// appear where, so that a subset of a large trace can be read without
+// reading all of it. The trace is divided into chunks of half a
+// megabyte or more, aligned to compressed blocks. The index records the
+// (Func, event) pairs present in each chunk, and the chunks spanned by
+// each realization of each Func.
+class TraceIndex {
+public:
+    // Index a trace by reading it from start to end.
+    void build(TraceStream &stream);
+
+    // Save the index to a file, or load one. Return false on failure.
+    bool save(const std::string &filename) const;
+    bool load(const std::string &filename);
+
+    // The size of the trace file that was indexed, for checking that
+    // an index is up to date.
+    uint64_t trace_size() const {
+        return trace_bytes;
+    }
+
+    // The number of chunks in the trace, and how many of them might
+    // have packets matching a query.
+    size_t num_chunks() const {
+        return chunks.size();
+    }
+    size_t num_chunks(const TraceQuery &query) const;
+
+    // Call f on each packet that matches the query, in the order they
+    // appear in the trace, reading only the chunks that might contain
+    // them.
+    void read(TraceStream &stream, const TraceQuery &query,
+              const std::function<void(const Packet &)> &f) const;
+
+private:
+    struct Chunk {
+        uint64_t offset;
+        uint32_t packets;
+        // The (Func, event) pairs with packets in this chunk, sorted.
+        std::vector<uint32_t> keys;
+    };
+
+    struct Realization {
+        // The id of the begin_realization packet, and the range of
+        // chunks from that packet to the end_realization packet.
+        int32_t id;
+        uint32_t first_chunk, last_chunk;
+    };
+
+    std::vector<std::pair<std::string, int>> keys;
+    std::map<std::pair<std::string, int>, uint32_t> key_ids;
+    std::vector<Chunk> chunks;
+    std::map<std::string, std::vector<Realization>> realizations;
+    uint64_t trace_bytes = 0;
+
+    uint32_t key_id(const std::string &func, int event);
+
+    // Pick out the chunks that might have packets matching the query.
+    std::vector<size_t> find_chunks(const TraceQuery &query) const;
+};
+
 }  // namespace Internal
 }  // namespace Halide
 
@@ -24,6 +24,7 @@
 #endif
 
 #include "HalideRuntime.h"
+#include "HalideTraceUtils.h"
 #include "inconsolata.h"
 
 #include "halide_trace_config.h"
@@ -157,34 +158,10 @@ T get_value_as(const halide_trace_packet_t &p, int idx) {
 struct PacketAndPayload : public halide_trace_packet_t {
     uint8_t payload[4096];
 
-    static bool read_or_die(void *buf, size_t count) {
-        char *p = (char *)buf;
-        char *p_end = p + count;
-        while (p < p_end) {
-            int64_t bytes_read = ::read(STDIN_FILENO, p, p_end - p);
-            if (bytes_read == 0) {
-                return false;  // EOF
-            } else if (bytes_read < 0) {
-                fail() << "Unable to read packet";
-            }
-            p += bytes_read;
-        }
-        assert(p == p_end);
-        return true;
-    }
-
     bool read() {
-        constexpr size_t header_size = sizeof(halide_trace_packet_t);
-        if (!read_or_die(this, header_size)) {
-            return false;  // EOF
-        }
-
-        const size_t payload_size = this->size - header_size;
-        if (payload_size > sizeof(this->payload) || !read_or_die(this->payload, payload_size)) {
-            // Shouldn't ever get EOF here
-            fail() << "Unable to read packet payload of size " << payload_size;
-        }
-        return true;
+        // Traces come in on stdin, and may be compressed.
+        static Halide::Internal::TraceStream stream(stdin);
+        return stream.read_packet(this, sizeof(*this));
     }
 };
 